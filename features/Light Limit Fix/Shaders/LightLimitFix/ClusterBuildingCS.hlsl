@@ -5,6 +5,8 @@ cbuffer PerFrame : register(b0)
 	row_major float4x4 InvProjMatrix[2];
 	float LightsNear;
 	float LightsFar;
+	uint DepthSlicing;
+	float NearSliceEnd;
 }
 
 float3 GetPositionVS(float2 texcoord, float depth, int eyeIndex = 0)
@@ -61,8 +63,8 @@ float3 IntersectionZPlane(float3 B, float z_dist)
 	float3 minPointVS = min(GetPositionVS(texcoordMin, 1.0f, 0), GetPositionVS(texcoordMin, 1.0f, 1));
 #endif  // !VR
 
-	float clusterNear = LightsNear * pow(LightsFar / LightsNear, groupId.z / float(CLUSTER_BUILDING_DISPATCH_SIZE_Z));
-	float clusterFar = LightsNear * pow(LightsFar / LightsNear, (groupId.z + 1) / float(CLUSTER_BUILDING_DISPATCH_SIZE_Z));
+	float clusterNear = GetClusterSliceDepth(groupId.z, CLUSTER_BUILDING_DISPATCH_SIZE_Z, DepthSlicing, LightsNear, LightsFar, NearSliceEnd);
+	float clusterFar = GetClusterSliceDepth(groupId.z + 1, CLUSTER_BUILDING_DISPATCH_SIZE_Z, DepthSlicing, LightsNear, LightsFar, NearSliceEnd);
 
 	float3 minPointNear = IntersectionZPlane(minPointVS, clusterNear);
 	float3 minPointFar = IntersectionZPlane(minPointVS, clusterFar);
@@ -3,6 +3,7 @@
 cbuffer PerFrame : register(b0)
 {
 	uint LightCount;
+	uint LightListCapacity;  // light indices that fit into lightIndexList
 }
 
 //references
@@ -11,6 +12,11 @@ cbuffer PerFrame : register(b0)
 StructuredBuffer<ClusterAABB> clusters : register(t0);
 StructuredBuffer<StructuredLight> lights : register(t1);
 
+// [0] light indices requested by all clusters, which can exceed LightListCapacity
+// [1] clusters intersecting more than MAX_CLUSTER_LIGHTS lights
+// [2] intersections dropped by those clusters
+// [3] light indices dropped because lightIndexList was full
+// Cleared before every dispatch
 RWStructuredBuffer<uint> lightIndexCounter : register(u0);
 RWStructuredBuffer<uint> lightIndexList : register(u1);
 RWStructuredBuffer<LightGrid> lightGrid : register(u2);
@@ -34,11 +40,8 @@ bool LightIntersectsCluster(StructuredLight light, ClusterAABB cluster, int eyeI
 	if (any(dispatchThreadId >= uint3(CLUSTER_BUILDING_DISPATCH_SIZE_X, CLUSTER_BUILDING_DISPATCH_SIZE_Y, CLUSTER_BUILDING_DISPATCH_SIZE_Z)))
 		return;
 
-	if (all(dispatchThreadId == 0)) {
-		lightIndexCounter[0] = 0;
-	}
-
 	uint visibleLightCount = 0;
+	uint intersectingLightCount = 0;
 	uint visibleLightIndices[MAX_CLUSTER_LIGHTS];
 
 	uint clusterIndex = dispatchThreadId.x +
@@ -62,12 +65,13 @@ bool LightIntersectsCluster(StructuredLight light, ClusterAABB cluster, int eyeI
 		GroupMemoryBarrierWithGroupSync();
 
 		for (uint i = 0; i < batchSize; i++) {
-			StructuredLight light = lights[i];
+			StructuredLight light = lights[lightOffset + i];
 
 			bool updateCluster = LightIntersectsCluster(light, cluster);
 #ifdef VR
 			updateCluster = updateCluster || LightIntersectsCluster(light, cluster, 1);
 #endif  // VR
+			intersectingLightCount += updateCluster ? 1 : 0;
 			updateCluster = updateCluster && (visibleLightCount < MAX_CLUSTER_LIGHTS);
 
 			if (updateCluster) {
@@ -81,15 +85,38 @@ bool LightIntersectsCluster(StructuredLight light, ClusterAABB cluster, int eyeI
 
 	GroupMemoryBarrierWithGroupSync();
 
+	if (intersectingLightCount > MAX_CLUSTER_LIGHTS) {
+		InterlockedAdd(lightIndexCounter[1], 1);
+		InterlockedAdd(lightIndexCounter[2], intersectingLightCount - MAX_CLUSTER_LIGHTS);
+	}
+
+#ifdef PACKED_LIGHT_INDICES
+	// Ranges start on whole entries, so no two clusters write to the same entry
+	uint allocatedCount = (visibleLightCount + 1) & ~1;
+#else
+	uint allocatedCount = visibleLightCount;
+#endif
+
 	uint offset = 0;
-	InterlockedAdd(lightIndexCounter[0], visibleLightCount, offset);
+	InterlockedAdd(lightIndexCounter[0], allocatedCount, offset);
+
+	uint storedCount = offset < LightListCapacity ? min(visibleLightCount, LightListCapacity - offset) : 0;
+	if (storedCount < visibleLightCount)
+		InterlockedAdd(lightIndexCounter[3], visibleLightCount - storedCount);
 
-	for (uint i = 0; i < visibleLightCount; i++) {
+#ifdef PACKED_LIGHT_INDICES
+	for (uint i = 0; i < storedCount; i += 2) {
+		uint high = i + 1 < storedCount ? visibleLightIndices[i + 1] : 0;
+		lightIndexList[(offset + i) >> 1] = visibleLightIndices[i] | (high << 16);
+	}
+#else
+	for (uint i = 0; i < storedCount; i++) {
 		lightIndexList[offset + i] = visibleLightIndices[i];
 	}
+#endif
 
 	LightGrid output = {
-		offset, visibleLightCount, 0, 0
+		offset, storedCount, 0, 0
 	};
 
 	lightGrid[clusterIndex] = output;
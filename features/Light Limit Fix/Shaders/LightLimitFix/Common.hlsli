@@ -1,11 +1,25 @@
 #ifndef __LLF_COMMON_DEPENDENCY_HLSL__
 #define __LLF_COMMON_DEPENDENCY_HLSL__
 
-#define NUMTHREAD_X 16
-#define NUMTHREAD_Y 16
-#define NUMTHREAD_Z 4
+// Overridden by the defines LightLimitFix::SetupClusters compiles the compute shaders with
+#ifndef NUMTHREAD_X
+#	define NUMTHREAD_X 16
+#endif
+#ifndef NUMTHREAD_Y
+#	define NUMTHREAD_Y 16
+#endif
+#ifndef NUMTHREAD_Z
+#	define NUMTHREAD_Z 4
+#endif
 #define GROUP_SIZE (NUMTHREAD_X * NUMTHREAD_Y * NUMTHREAD_Z)
-#define MAX_CLUSTER_LIGHTS 128
+#ifndef MAX_CLUSTER_LIGHTS
+#	define MAX_CLUSTER_LIGHTS 128
+#endif
+
+// Distribution of the depth slices, see LightCulling::DepthSlicing
+#define CLUSTER_SLICING_EXPONENTIAL 0
+#define CLUSTER_SLICING_LINEAR 1
+#define CLUSTER_SLICING_HYBRID 2  // one slice up to nearSliceEnd, exponential after it
 
 #define Llf_PortalStrictLight (1 << 0)
 #define Llf_ShadowLight (1 << 1)
@@ -35,4 +49,27 @@ struct StructuredLight
 	float pad0[2];
 };
 
+// View depth at which a depth slice starts, slice sliceCount being the far plane
+float GetClusterSliceDepth(uint slice, uint sliceCount, uint slicing, float nearDepth, float farDepth, float nearSliceEnd)
+{
+	if (slicing == CLUSTER_SLICING_LINEAR)
+		return lerp(nearDepth, farDepth, slice / float(sliceCount));
+	if (slicing == CLUSTER_SLICING_HYBRID)
+		return slice == 0 ? nearDepth : nearSliceEnd * pow(farDepth / nearSliceEnd, (slice - 1) / float(sliceCount - 1));
+	return nearDepth * pow(farDepth / nearDepth, slice / float(sliceCount));
+}
+
+// Depth slice containing a view depth, the inverse of GetClusterSliceDepth
+uint GetClusterDepthSlice(float depth, uint sliceCount, uint slicing, float nearDepth, float farDepth, float nearSliceEnd)
+{
+	float slice;
+	if (slicing == CLUSTER_SLICING_LINEAR)
+		slice = (depth - nearDepth) * sliceCount / (farDepth - nearDepth);
+	else if (slicing == CLUSTER_SLICING_HYBRID)
+		slice = depth < nearSliceEnd ? 0.0 : 1.0 + log2(depth / nearSliceEnd) * (sliceCount - 1) / log2(farDepth / nearSliceEnd);
+	else
+		slice = log2(depth / nearDepth) * sliceCount / log2(farDepth / nearDepth);
+	return min(uint(max(slice, 0.0)), sliceCount - 1);
+}
+
 #endif  //__LLF_COMMON_DEPENDENCY_HLSL__
\ No newline at end of file
@@ -8,12 +8,19 @@ struct StrictLightData
 };
 
 StructuredBuffer<StructuredLight> lights : register(t50);
-StructuredBuffer<uint> lightList : register(t51);       //MAX_CLUSTER_LIGHTS * 16^3
-StructuredBuffer<LightGrid> lightGrid : register(t52);  //16^3
+StructuredBuffer<uint> lightList : register(t51);       // sized from the demand of previous frames, see LightLimitFix::ResizeLightList
+StructuredBuffer<LightGrid> lightGrid : register(t52);  //cluster count
 StructuredBuffer<StrictLightData> strictLights : register(t53);
 
 namespace LightLimitFix
 {
+	// Index into lights of entry i of the light list, cluster ranges start at lightGrid[clusterIndex].offset
+	uint GetLightIndex(uint i)
+	{
+		[branch] if (lightLimitFixSettings.PackedLightIndices) return (lightList[i >> 1] >> ((i & 1) << 4)) & 0xFFFF;
+		return lightList[i];
+	}
+
 	bool GetClusterIndex(in float2 uv, in float z, inout uint clusterIndex)
 	{
 		const uint3 clusterSize = lightLimitFixSettings.ClusterSize.xyz;
@@ -21,9 +28,8 @@ namespace LightLimitFix
 		if (z < CameraData.y || z > CameraData.x)
 			return false;
 
-		float clampedZ = clamp(z, CameraData.y, CameraData.x);
-		uint clusterZ = uint(max((log2(z) - log2(CameraData.y)) * clusterSize.z / log2(CameraData.x / CameraData.y), 0.0));
-		uint3 cluster = uint3(uint2(uv * clusterSize.xy), clusterZ);
+		uint clusterZ = GetClusterDepthSlice(z, clusterSize.z, lightLimitFixSettings.ClusterSize.w, CameraData.y, CameraData.x, lightLimitFixSettings.ClusterNearSliceEnd);
+		uint3 cluster = uint3(min(uint2(uv * clusterSize.xy), clusterSize.xy - 1), clusterZ);
 
 		clusterIndex = cluster.x + (clusterSize.x * cluster.y) + (clusterSize.x * clusterSize.y * cluster.z);
 		return true;
@@ -111,16 +117,16 @@ namespace LightLimitFix
 		bool lightIgnored = false;
 		if ((light.lightFlags & Llf_PortalStrictLight) && strictLights[0].RoomIndex >= 0) {
 			lightIgnored = true;
-			int roomIndex = strictLights[0].RoomIndex;
-			[unroll] for (int flagsIndex = 0; flagsIndex < 4; ++flagsIndex)
+			// roomFlags.xyz are words of 32 rooms, roomFlags.w holds the index of each word in 10 bits and the word count in the top 2 bits
+			uint roomIndex = strictLights[0].RoomIndex;
+			uint wordCount = light.roomFlags.w >> 30;
+			[unroll] for (uint flagsIndex = 0; flagsIndex < 3; ++flagsIndex)
 			{
-				if (roomIndex < 32) {
-					if (((light.roomFlags[flagsIndex] >> roomIndex) & 1) == 1) {
+				if (flagsIndex < wordCount && ((light.roomFlags.w >> (flagsIndex * 10)) & 0x3FF) == (roomIndex >> 5)) {
+					if (((light.roomFlags[flagsIndex] >> (roomIndex & 31)) & 1) == 1) {
 						lightIgnored = false;
 					}
-					break;
 				}
-				roomIndex -= 32;
 			}
 		}
 		return lightIgnored;
@@ -0,0 +1,30 @@
+#include "LightLimitFix/Common.hlsli"
+
+cbuffer PerFrame : register(b0)
+{
+	row_major float4x4 View[2];
+	float4 EyePosition[2];
+	uint LightCount;
+}
+
+// Lights as gathered, positionWS[0] being the world position, see LightLimitFix::UpdateLightSlots
+StructuredBuffer<StructuredLight> lightSources : register(t0);
+RWStructuredBuffer<StructuredLight> lights : register(u0);
+
+[numthreads(64, 1, 1)] void main(uint3 dispatchThreadId
+								 : SV_DispatchThreadID) {
+	if (dispatchThreadId.x >= LightCount)
+		return;
+
+	StructuredLight light = lightSources[dispatchThreadId.x];
+	float3 positionWorld = light.positionWS[0].xyz;
+
+	[unroll] for (int eyeIndex = 0; eyeIndex < 2; eyeIndex++)
+	{
+		light.positionWS[eyeIndex] = float4(positionWorld - EyePosition[eyeIndex].xyz, 0);
+		// empty slots are placed far behind the camera, so they never intersect a cluster
+		light.positionVS[eyeIndex] = light.radius > 0 ? float4(mul(float4(light.positionWS[eyeIndex].xyz, 1), View[eyeIndex]).xyz, 0) : float4(0, 0, -1e9, 0);
+	}
+
+	lights[dispatchThreadId.x] = light;
+}
@@ -7,18 +7,24 @@
 #if defined(PSHADER) || defined(COMPUTESHADER)
 cbuffer SharedData : register(b5)
 {
-	float4 WaterData[25];
+	float4 WaterData[25];  // w is the absolute water height, see GetWaterData
 	row_major float3x4 DirectionalAmbientShared;
-	float4 DirLightDirectionShared;
-	float4 DirLightColorShared;
 	float4 CameraData;
 	float4 BufferDim;
+	bool InInterior;  // If the area lacks a directional shadow light e.g. the sun or moon
+	bool InMapMenu;   // If the world/local map is open (note that the renderer is still deferred here)
+	float2 pad0;
+};
+
+// Changes every frame, so SharedData is only uploaded when anything else changed
+cbuffer SharedDataPerFrame : register(b7)
+{
+	float4 DirLightDirectionShared;
+	float4 DirLightColorShared;
 	float Timer;
 	uint FrameCount;
 	uint FrameCountAlwaysActive;
-	bool InInterior;  // If the area lacks a directional shadow light e.g. the sun or moon
-	bool InMapMenu;   // If the world/local map is open (note that the renderer is still deferred here)
-	float3 pad0;
+	uint pad1;
 };
 
 struct GrassLightingSettings
@@ -64,8 +70,10 @@ struct LightLimitFixSettings
 	uint EnableContactShadows;
 	uint EnableLightsVisualisation;
 	uint LightsVisualisationMode;
-	float LightsFar;
-	uint4 ClusterSize;
+	float ClusterNearSliceEnd;
+	uint4 ClusterSize;  // w is the depth slicing, CLUSTER_SLICING_*
+	uint PackedLightIndices;  // lightList holds two 16-bit light indices per entry
+	uint3 pad0;
 };
 
 struct WetnessEffectsSettings
@@ -135,6 +143,7 @@ struct PBRSettings
 	uint pad0[2];
 };
 
+// Mirrored by FeatureData in src/FeatureBuffer.cpp, which checks the size of each struct in registers
 cbuffer FeatureData : register(b6)
 {
 	GrassLightingSettings grassLightingSettings;
@@ -198,7 +207,10 @@ namespace SharedData
 		float4 waterData = float4(1.0, 1.0, 1.0, -2147483648);
 
 		[flatten] if (cellInt.x < 5 && cellInt.x >= 0 && cellInt.y < 5 && cellInt.y >= 0)
+		{
 			waterData = WaterData[waterTile];
+			waterData.w -= CameraPosAdjust[0].z;  // relative to the camera like worldPosition
+		}
 		return waterData;
 	}
 
@@ -627,7 +627,7 @@ PS_OUTPUT main(PS_INPUT input)
 			uint lightOffset = lightGrid[clusterIndex].offset;
 			[loop] for (uint i = 0; i < lightCount; i++)
 			{
-				uint light_index = lightList[lightOffset + i];
+				uint light_index = LightLimitFix::GetLightIndex(lightOffset + i);
 				StructuredLight light = lights[light_index];
 				if (LightLimitFix::IsLightIgnored(light)) {
 					continue;
@@ -2113,7 +2113,7 @@ PS_OUTPUT main(PS_INPUT input, bool frontFace
 		if (lightIndex < strictLights[0].NumStrictLights) {
 			light = strictLights[0].StrictLights[lightIndex];
 		} else {
-			uint clusteredLightIndex = lightList[lightOffset + (lightIndex - strictLights[0].NumStrictLights)];
+			uint clusteredLightIndex = LightLimitFix::GetLightIndex(lightOffset + (lightIndex - strictLights[0].NumStrictLights));
 			light = lights[clusteredLightIndex];
 
 			if (LightLimitFix::IsLightIgnored(light)) {
@@ -573,7 +573,7 @@ PS_OUTPUT main(PS_INPUT input, bool frontFace
 
 			[loop] for (uint i = 0; i < lightCount; i++)
 			{
-				uint light_index = lightList[lightOffset + i];
+				uint light_index = LightLimitFix::GetLightIndex(lightOffset + i);
 				StructuredLight light = lights[light_index];
 
 				float3 lightDirection = light.positionWS[eyeIndex].xyz - input.WorldPosition.xyz;
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <d3d11.h>
+
+/**
+ * Shadow copy of the pipeline slots Community Shaders binds on every draw, so binding what is already bound costs no D3D call.
+ *
+ * The copy is only right while nothing else binds the same slots. The game never uses the plugin's resource and constant buffer slots,
+ * but it binds its own shaders, and D3D unbinds a shader resource whose resource gets bound as an output. So the cache is invalidated
+ * every frame, by the hooks which bind the game's shaders, and by passes which write a cached resource.
+ * Views are compared by address only, they are owned by the features binding them.
+ */
+class BindCache
+{
+public:
+	struct Stats
+	{
+		uint32_t issued = 0;
+		uint32_t elided = 0;
+	};
+
+	void PSSetShaderResource(ID3D11DeviceContext* a_context, uint32_t a_slot, ID3D11ShaderResourceView* a_view)
+	{
+		if (psResources.Set(a_slot, a_view)) {
+			a_context->PSSetShaderResources(a_slot, 1, &a_view);
+			current.issued++;
+		} else
+			current.elided++;
+	}
+
+	void PSSetConstantBuffers(ID3D11DeviceContext* a_context, uint32_t a_startSlot, uint32_t a_count, ID3D11Buffer* const* a_buffers)
+	{
+		if (psConstantBuffers.SetRange(a_startSlot, a_count, a_buffers)) {
+			a_context->PSSetConstantBuffers(a_startSlot, a_count, a_buffers);
+			current.issued++;
+		} else
+			current.elided++;
+	}
+
+	void CSSetConstantBuffers(ID3D11DeviceContext* a_context, uint32_t a_startSlot, uint32_t a_count, ID3D11Buffer* const* a_buffers)
+	{
+		if (csConstantBuffers.SetRange(a_startSlot, a_count, a_buffers)) {
+			a_context->CSSetConstantBuffers(a_startSlot, a_count, a_buffers);
+			current.issued++;
+		} else
+			current.elided++;
+	}
+
+	void PSSetShader(ID3D11DeviceContext* a_context, ID3D11PixelShader* a_shader)
+	{
+		if (pixelShader.Set(0, a_shader)) {
+			a_context->PSSetShader(a_shader, nullptr, 0);
+			current.issued++;
+		} else
+			current.elided++;
+	}
+
+	void VSSetShader(ID3D11DeviceContext* a_context, ID3D11VertexShader* a_shader)
+	{
+		if (vertexShader.Set(0, a_shader)) {
+			a_context->VSSetShader(a_shader, nullptr, 0);
+			current.issued++;
+		} else
+			current.elided++;
+	}
+
+	/** @brief Forgets a shader resource slot, for when its resource was bound as an output. */
+	void InvalidatePSShaderResource(uint32_t a_slot) { psResources.known.reset(a_slot); }
+	void InvalidatePixelShader() { pixelShader.known.reset(); }
+	void InvalidateVertexShader() { vertexShader.known.reset(); }
+
+	void Invalidate()
+	{
+		psResources.known.reset();
+		psConstantBuffers.known.reset();
+		csConstantBuffers.known.reset();
+		InvalidatePixelShader();
+		InvalidateVertexShader();
+	}
+
+	/** @brief Invalidates everything and keeps the counters of the frame that ended. */
+	void NextFrame()
+	{
+		Invalidate();
+		lastFrame = current;
+		current = {};
+	}
+
+	const Stats& GetLastFrameStats() const { return lastFrame; }
+
+private:
+	template <class T, size_t a_slots>
+	struct Slots
+	{
+		std::array<T*, a_slots> bound{};
+		std::bitset<a_slots> known;
+
+		// Returns whether the slot changed and has to be bound
+		bool Set(uint32_t a_slot, T* a_value)
+		{
+			if (known.test(a_slot) && bound[a_slot] == a_value)
+				return false;
+			bound[a_slot] = a_value;
+			known.set(a_slot);
+			return true;
+		}
+
+		bool SetRange(uint32_t a_startSlot, uint32_t a_count, T* const* a_values)
+		{
+			bool changed = false;
+			for (uint32_t i = 0; i < a_count; i++)
+				changed |= Set(a_startSlot + i, a_values[i]);
+			return changed;
+		}
+	};
+
+	Slots<ID3D11ShaderResourceView, D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT> psResources;
+	Slots<ID3D11Buffer, D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT> psConstantBuffers;
+	Slots<ID3D11Buffer, D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT> csConstantBuffers;
+	Slots<ID3D11PixelShader, 1> pixelShader;
+	Slots<ID3D11VertexShader, 1> vertexShader;
+
+	Stats current;
+	Stats lastFrame;
+};
@@ -0,0 +1,320 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <stop_token>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace SIE
+{
+	/**
+	 * Why a shader was requested, used to order asynchronous compilation.
+	 */
+	enum class CompilationPriority : uint8_t
+	{
+		Speculative,  // permutations generated ahead of time that may never be drawn
+		Precompile,   // shaders loaded by the game, usually behind a loading screen
+		Draw,         // missing for a draw in the current frame
+		Total,
+	};
+
+	/** What CompilationQueue::Complete reports about a finished task. */
+	struct CompletedTask
+	{
+		CompilationPriority priority;  // highest priority the task was requested with, including while it compiled
+		bool queueEmpty;               // no task is queued or in progress anymore
+	};
+
+	/**
+	 * Work-stealing queue the compile workers take tasks from directly.
+	 *
+	 * Every worker owns one deque per priority. New tasks are pushed round robin to the workers below the worker limit.
+	 * A worker takes the newest task of its own deques, highest priority first, and once those are empty steals the oldest
+	 * task of the other workers, highest priority first. Each deque has its own mutex, so requests and workers only contend
+	 * when they meet on the same deque, and a request never waits for a worker searching the other deques.
+	 *
+	 * The state of each task is kept in sharded maps, which deduplicate requests. A request raising the priority of a queued
+	 * task pushes it again, the older entry is skipped once taken. A task waiting AgingInterval per priority below Draw is
+	 * taken before newer tasks of higher priorities, so speculative work is not starved.
+	 * Workers past the worker limit are parked until the limit is raised, the others steal what is left in their deques.
+	 *
+	 * Standalone of the game so tools/CompilationQueueBenchmark can build it on the host.
+	 */
+	template <typename Task>
+	class CompilationQueue
+	{
+	public:
+		static constexpr auto AgingInterval = std::chrono::seconds(2);  // time waiting before a task counts as one priority higher
+		static constexpr size_t ShardCount = 64;
+
+		/** @param a_workers Number of workers, and of deques. */
+		explicit CompilationQueue(uint32_t a_workers = std::max(std::thread::hardware_concurrency(), 1u)) :
+			workers(std::max(a_workers, 1u))
+		{}
+
+		/**
+		 * @brief Waits for a task and marks it in progress.
+		 *
+		 * @param stoken Stops the wait.
+		 * @param a_worker Index of the calling worker. Workers past the worker limit wait until the limit is raised again.
+		 * @return The task, or std::nullopt if the worker was told to stop.
+		 */
+		std::optional<Task> WaitTake(std::stop_token stoken, uint32_t a_worker)
+		{
+			while (true) {
+				if (a_worker >= workerLimit.load()) {
+					std::unique_lock lock(wakeMutex);
+					if (queuedEntries.load())
+						taskCondition.notify_one();  // the limit dropped while this worker was woken for a task, pass it on
+					if (!parkedCondition.wait(lock, stoken, [&]() { return a_worker < workerLimit.load(); }))
+						return std::nullopt;
+				}
+
+				if (auto task = TryTake(a_worker))
+					return task;
+
+				std::unique_lock lock(wakeMutex);
+				sleepingWorkers++;
+				const bool woken = taskCondition.wait(lock, stoken, [&]() { return queuedEntries.load() > 0 || a_worker >= workerLimit.load(); });
+				sleepingWorkers--;
+				if (!woken)
+					return std::nullopt;
+			}
+		}
+
+		/**
+		 * @brief Queues a task, or raises the priority of a task that is already queued or compiling.
+		 *
+		 * @param a_isDone Whether the task was finished outside of the queue, only called for new tasks.
+		 * @return Whether the task was newly queued.
+		 */
+		template <typename IsDone>
+		bool Add(const Task& task, CompilationPriority priority, IsDone&& a_isDone)
+		{
+			Entry entry{ task, 0, std::chrono::steady_clock::now() };
+			bool added = false;
+			{
+				auto& shard = GetShard(task);
+				std::scoped_lock lock(shard.mutex);
+				if (auto it = shard.tasks.find(task); it != shard.tasks.end()) {
+					auto& state = it->second;
+					if (state.status == Status::Processed || state.priority >= priority)
+						return false;
+					state.priority = priority;
+					if (state.status == Status::InProgress)
+						return false;  // only remembered for Complete
+					entry.generation = ++state.generation;
+				} else {
+					if (a_isDone())
+						return false;
+					shard.tasks.emplace(task, TaskState{ Status::Queued, priority, 0 });
+					queuedTasks++;
+					added = true;
+				}
+			}
+
+			const uint32_t limit = std::clamp(workerLimit.load(), 1u, static_cast<uint32_t>(workers.size()));
+			auto& worker = workers[nextWorker.fetch_add(1, std::memory_order_relaxed) % limit];
+			{
+				std::scoped_lock lock(worker.mutex);
+				worker.deques[static_cast<size_t>(priority)].push_back(std::move(entry));
+				queuedEntries++;
+			}
+			if (sleepingWorkers.load()) {
+				std::scoped_lock lock(wakeMutex);  // a worker between its last search and its wait sees queuedEntries
+			}
+			taskCondition.notify_one();  // only workers below the limit wait for tasks
+			return added;
+		}
+
+		/** @brief Marks a task taken with WaitTake finished. */
+		CompletedTask Complete(const Task& task)
+		{
+			auto priority = CompilationPriority::Speculative;
+			{
+				auto& shard = GetShard(task);
+				std::scoped_lock lock(shard.mutex);
+				// the task may have been cleared, and queued again, while it was compiling
+				if (auto it = shard.tasks.find(task); it != shard.tasks.end() && it->second.status == Status::InProgress) {
+					it->second.status = Status::Processed;
+					priority = it->second.priority;
+					tasksInProgress--;
+				}
+			}
+			return { priority, !queuedTasks.load() && !tasksInProgress.load() };
+		}
+
+		void Clear()
+		{
+			// deques first, so a task queued meanwhile keeps its state and at worst leaves an entry which is skipped
+			for (auto& worker : workers) {
+				std::scoped_lock lock(worker.mutex);
+				for (auto& deque : worker.deques) {
+					queuedEntries -= static_cast<uint32_t>(deque.size());
+					deque.clear();
+				}
+			}
+			for (auto& shard : shards) {
+				std::scoped_lock lock(shard.mutex);
+				for (const auto& [task, state] : shard.tasks) {
+					if (state.status == Status::Queued)
+						queuedTasks--;
+					else if (state.status == Status::InProgress)
+						tasksInProgress--;
+				}
+				shard.tasks.clear();
+			}
+		}
+
+		/** @brief Sets how many workers take tasks, waking the workers which are parked or have to park. */
+		void SetWorkerLimit(uint32_t a_limit)
+		{
+			if (workerLimit.exchange(a_limit) == a_limit)
+				return;
+			{
+				std::scoped_lock lock(wakeMutex);
+			}
+			parkedCondition.notify_all();
+			taskCondition.notify_all();
+		}
+
+		std::shared_mutex mutex;  // shared by workers taking a task, lock it to keep workers from taking tasks
+
+	private:
+		enum class Status : uint8_t
+		{
+			Queued,
+			InProgress,
+			Processed,  // completed or failed
+		};
+
+		struct TaskState
+		{
+			Status status;
+			CompilationPriority priority;
+			uint32_t generation;  // of the newest entry, older entries of the task are skipped
+		};
+
+		struct Entry
+		{
+			Task task;
+			uint32_t generation;
+			std::chrono::steady_clock::time_point queuedTime;
+		};
+
+		struct alignas(64) Worker
+		{
+			std::mutex mutex;
+			std::array<std::deque<Entry>, static_cast<size_t>(CompilationPriority::Total)> deques;  // by priority
+		};
+
+		struct alignas(64) Shard
+		{
+			std::mutex mutex;
+			std::unordered_map<Task, TaskState> tasks;
+		};
+
+		Shard& GetShard(const Task& task)
+		{
+			const auto hash = std::hash<Task>{}(task);
+			return shards[(hash ^ (hash >> 17)) % ShardCount];
+		}
+
+		std::optional<Task> TryTake(uint32_t a_worker)
+		{
+			std::shared_lock lock(mutex);
+			const auto now = std::chrono::steady_clock::now();
+
+			auto& own = workers[a_worker % workers.size()];
+			while (auto entry = PopOwn(own, now)) {
+				if (auto task = Claim(*entry))
+					return task;
+			}
+
+			for (size_t priority = static_cast<size_t>(CompilationPriority::Total); priority-- > 0;) {
+				for (size_t i = 1; i < workers.size(); i++) {
+					auto& victim = workers[(a_worker + i) % workers.size()];
+					while (auto entry = PopOldest(victim, priority)) {
+						if (auto task = Claim(*entry))
+							return task;
+					}
+				}
+			}
+			return std::nullopt;
+		}
+
+		// The oldest task below Draw which waited long enough, otherwise the newest task of the highest priority
+		std::optional<Entry> PopOwn(Worker& a_worker, std::chrono::steady_clock::time_point a_now)
+		{
+			std::scoped_lock lock(a_worker.mutex);
+			constexpr auto draw = static_cast<size_t>(CompilationPriority::Draw);
+			for (size_t priority = draw; priority-- > 0;) {
+				auto& deque = a_worker.deques[priority];
+				if (!deque.empty() && a_now - deque.front().queuedTime >= AgingInterval * (draw - priority)) {
+					auto entry = std::move(deque.front());
+					deque.pop_front();
+					queuedEntries--;
+					return entry;
+				}
+			}
+			for (size_t priority = a_worker.deques.size(); priority-- > 0;) {
+				auto& deque = a_worker.deques[priority];
+				if (!deque.empty()) {
+					auto entry = std::move(deque.back());
+					deque.pop_back();
+					queuedEntries--;
+					return entry;
+				}
+			}
+			return std::nullopt;
+		}
+
+		std::optional<Entry> PopOldest(Worker& a_worker, size_t a_priority)
+		{
+			std::scoped_lock lock(a_worker.mutex);
+			auto& deque = a_worker.deques[a_priority];
+			if (deque.empty())
+				return std::nullopt;
+			auto entry = std::move(deque.front());
+			deque.pop_front();
+			queuedEntries--;
+			return entry;
+		}
+
+		// Marks the task of an entry in progress, unless it was taken through a newer entry or cleared
+		std::optional<Task> Claim(const Entry& a_entry)
+		{
+			auto& shard = GetShard(a_entry.task);
+			std::scoped_lock lock(shard.mutex);
+			auto it = shard.tasks.find(a_entry.task);
+			if (it == shard.tasks.end() || it->second.status != Status::Queued || it->second.generation != a_entry.generation)
+				return std::nullopt;
+			it->second.status = Status::InProgress;
+			queuedTasks--;
+			tasksInProgress++;
+			return a_entry.task;
+		}
+
+		std::vector<Worker> workers;
+		std::array<Shard, ShardCount> shards;
+		std::atomic<uint32_t> nextWorker = 0;        // round robin of new entries
+		std::atomic<uint32_t> queuedEntries = 0;     // entries in all deques, including skipped ones
+		std::atomic<uint32_t> queuedTasks = 0;       // tasks with an entry waiting
+		std::atomic<uint32_t> tasksInProgress = 0;
+		std::atomic<uint32_t> workerLimit = 0;
+		std::atomic<uint32_t> sleepingWorkers = 0;
+		std::mutex wakeMutex;
+		std::condition_variable_any taskCondition;    // workers below the limit waiting for a task
+		std::condition_variable_any parkedCondition;  // workers past the limit waiting for it to be raised
+	};
+}
@@ -1,5 +1,6 @@
 #include "Deferred.h"
 
+#include "Profiler.h"
 #include "ShaderCache.h"
 #include "State.h"
 #include "TruePBR.h"
@@ -188,6 +189,7 @@ void Deferred::CopyShadowData()
 {
 	ZoneScoped;
 	TracyD3D11Zone(State::GetSingleton()->tracyCtx, "CopyShadowData");
+	Profiler::Scope profilerScope("Copy Shadow Data");
 
 	auto& context = State::GetSingleton()->context;
 
@@ -228,6 +230,7 @@ void Deferred::PrepassPasses()
 {
 	ZoneScoped;
 	TracyD3D11Zone(State::GetSingleton()->tracyCtx, "Prepass");
+	Profiler::Scope profilerScope("Prepass");
 
 	auto& shaderCache = SIE::ShaderCache::Instance();
 
@@ -242,9 +245,16 @@ void Deferred::PrepassPasses()
 
 	stateUpdateFlags.set(RE::BSGraphics::ShaderFlags::DIRTY_RENDERTARGET);  // Run OMSetRenderTargets again
 
-	TruePBR::GetSingleton()->PrePass();
+	{
+		Profiler::Scope featureScope("Prepass - TruePBR");
+		TruePBR::GetSingleton()->PrePass();
+	}
 	for (auto* feature : Feature::GetFeatureList()) {
 		if (feature->loaded) {
+			auto [zoneName, inserted] = prepassZoneNames.try_emplace(feature);
+			if (inserted)
+				zoneName->second = std::format("Prepass - {}", feature->GetShortName());
+			Profiler::Scope featureScope(zoneName->second);
 			feature->Prepass();
 		}
 	}
@@ -326,6 +336,7 @@ void Deferred::DeferredPasses()
 {
 	ZoneScoped;
 	TracyD3D11Zone(State::GetSingleton()->tracyCtx, "Deferred");
+	Profiler::Scope profilerScope("Deferred");
 
 	auto renderer = RE::BSGraphics::Renderer::GetSingleton();
 	auto& context = State::GetSingleton()->context;
@@ -360,11 +371,15 @@ void Deferred::DeferredPasses()
 	auto dispatchCount = Util::GetScreenDispatchCount();
 
 	if (ssgi->loaded) {
-		ssgi->DrawSSGI(prevDiffuseAmbientTexture);
+		{
+			Profiler::Scope passScope("Deferred - SSGI");
+			ssgi->DrawSSGI(prevDiffuseAmbientTexture);
+		}
 
 		// Ambient Composite
 		{
 			TracyD3D11Zone(State::GetSingleton()->tracyCtx, "Ambient Composite");
+			Profiler::Scope passScope("Deferred - Ambient Composite");
 
 			ID3D11ShaderResourceView* srvs[6]{
 				albedo.SRV,
@@ -399,18 +414,23 @@ void Deferred::DeferredPasses()
 	}
 
 	auto sss = SubsurfaceScattering::GetSingleton();
-	if (sss->loaded)
+	if (sss->loaded) {
+		Profiler::Scope passScope("Deferred - Subsurface Scattering");
 		sss->DrawSSS();
+	}
 
 	auto dynamicCubemaps = DynamicCubemaps::GetSingleton();
-	if (dynamicCubemaps->loaded)
+	if (dynamicCubemaps->loaded) {
+		Profiler::Scope passScope("Deferred - Cubemap Update");
 		dynamicCubemaps->UpdateCubemap();
+	}
 
 	auto terrainBlending = TerrainBlending::GetSingleton();
 
 	// Deferred Composite
 	{
 		TracyD3D11Zone(State::GetSingleton()->tracyCtx, "Deferred Composite");
+		Profiler::Scope passScope("Deferred - Composite");
 
 		bool doSSGISpecular = ssgi->loaded && ssgi->settings.Enabled && ssgi->settings.EnableGI && ssgi->settings.EnableSpecularGI;
 
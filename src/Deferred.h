@@ -11,6 +11,8 @@
 #define MASKS RE::RENDER_TARGETS::kRAWINDIRECT_PREVIOUS
 #define MASKS2 RE::RENDER_TARGETS::kRAWINDIRECT_PREVIOUS_DOWNSCALED
 
+struct Feature;
+
 class Deferred
 {
 public:
@@ -30,6 +32,9 @@ public:
 
 	void PrepassPasses();
 
+	// Profiler zone of the prepass of each feature, formatted on its first prepass
+	std::unordered_map<const Feature*, std::string> prepassZoneNames;
+
 	void ClearShaderCache();
 	ID3D11ComputeShader* GetComputeAmbientComposite();
 	ID3D11ComputeShader* GetComputeAmbientCompositeInterior();
@@ -10,31 +10,37 @@
 
 #include "TruePBR.h"
 
-template <class... Ts>
-std::pair<unsigned char*, size_t> _GetFeatureBufferData(Ts... feat_datas)
-{
-	size_t totalSize = (... + sizeof(Ts));
-	auto data = new unsigned char[totalSize];
-	size_t offset = 0;
+// In the order of the FeatureData cbuffer in SharedData.hlsli, with the size of each HLSL struct in registers
+using FeatureData = FeatureBufferLayout<
+	FeatureBufferSlot<GrassLighting::Settings, 2>,      // GrassLightingSettings
+	FeatureBufferSlot<ExtendedMaterials::Settings, 2>,  // CPMSettings
+	FeatureBufferSlot<DynamicCubemaps::Settings, 2>,    // CubemapCreatorSettings
+	FeatureBufferSlot<TerrainShadows::PerFrame, 2>,     // TerraOccSettings
+	FeatureBufferSlot<LightLimitFix::PerFrame, 3>,      // LightLimitFixSettings
+	FeatureBufferSlot<WetnessEffects::PerFrame, 9>,     // WetnessEffectsSettings
+	FeatureBufferSlot<Skylighting::SkylightingCB, 9>,   // SkylightingSettings
+	FeatureBufferSlot<TruePBR::Settings, 1>>;           // PBRSettings
 
-	([&] {
-		*((decltype(feat_datas)*)(data + offset)) = feat_datas;
-		offset += sizeof(decltype(feat_datas));
-	}(),
-		...);
+static FeatureData featureData;
 
-	return std::make_pair(data, totalSize);
+size_t GetFeatureBufferSize()
+{
+	return FeatureData::Size;
 }
 
-std::pair<unsigned char*, size_t> GetFeatureBufferData()
+const void* UpdateFeatureBufferData()
 {
-	return _GetFeatureBufferData(
-		GrassLighting::GetSingleton()->settings,
-		ExtendedMaterials::GetSingleton()->settings,
-		DynamicCubemaps::GetSingleton()->settings,
-		TerrainShadows::GetSingleton()->GetCommonBufferData(),
-		LightLimitFix::GetSingleton()->GetCommonBufferData(),
-		WetnessEffects::GetSingleton()->GetCommonBufferData(),
-		Skylighting::GetSingleton()->GetCommonBufferData(),
-		TruePBR::GetSingleton()->settings);
-}
\ No newline at end of file
+	featureData.Write<0>(GrassLighting::GetSingleton()->settings);
+	featureData.Write<1>(ExtendedMaterials::GetSingleton()->settings);
+	featureData.Write<2>(DynamicCubemaps::GetSingleton()->settings);
+	featureData.Write<3>(TerrainShadows::GetSingleton()->GetCommonBufferData());
+	featureData.Write<4>(LightLimitFix::GetSingleton()->GetCommonBufferData());
+	featureData.Write<5>(WetnessEffects::GetSingleton()->GetCommonBufferData());
+	featureData.Write<6>(Skylighting::GetSingleton()->GetCommonBufferData());
+	featureData.Write<7>(TruePBR::GetSingleton()->settings);
+
+	if (featureData.GetDirty().none())
+		return nullptr;
+	featureData.ClearDirty();
+	return featureData.GetData();
+}
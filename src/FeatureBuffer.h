@@ -1,3 +1,72 @@
 #pragma once
 
-std::pair<unsigned char*, size_t> GetFeatureBufferData();
\ No newline at end of file
+#include "Buffer.h"
+
+/**
+ * One struct of the FeatureData cbuffer in SharedData.hlsli.
+ *
+ * HLSL starts every struct of a cbuffer on a new 16 byte register, so the C++ struct has to fill a whole number of registers
+ * for the next slot to land where the shader reads it. a_registers is the size of the HLSL struct, which makes layout drift
+ * a build error instead of garbage in the shader.
+ */
+template <class T, size_t a_registers>
+struct FeatureBufferSlot
+{
+	static_assert(std::is_trivially_copyable_v<T>, "feature buffer data is copied as bytes");
+	static_assert(sizeof(T) == a_registers * 16, "feature buffer data does not match the size of its HLSL struct");
+
+	using Type = T;
+	static constexpr size_t Size = sizeof(T);
+};
+
+/**
+ * Compile-time layout of the FeatureData cbuffer, with a persistent copy the features write into.
+ *
+ * Each slot has a dirty flag which is only set if a write changed its bytes, so the buffer is only uploaded when a feature changed.
+ */
+template <class... Slots>
+class FeatureBufferLayout
+{
+public:
+	static constexpr size_t SlotCount = sizeof...(Slots);
+	static constexpr size_t Size = (Slots::Size + ...);
+
+	static constexpr std::array<size_t, SlotCount> Offsets = [] {
+		std::array<size_t, SlotCount> offsets{};
+		size_t offset = 0;
+		size_t index = 0;
+		((offsets[index++] = offset, offset += Slots::Size), ...);
+		return offsets;
+	}();
+
+	template <size_t I>
+	using SlotType = typename std::tuple_element_t<I, std::tuple<Slots...>>::Type;
+
+	template <size_t I>
+	void Write(const SlotType<I>& a_data)
+	{
+		auto* slot = data + Offsets[I];
+		if (std::memcmp(slot, &a_data, sizeof(a_data)) != 0) {
+			std::memcpy(slot, &a_data, sizeof(a_data));
+			dirty.set(I);
+		}
+	}
+
+	const void* GetData() const { return data; }
+	const std::bitset<SlotCount>& GetDirty() const { return dirty; }
+	void ClearDirty() { dirty.reset(); }
+
+private:
+	// UpdateSubresource reads the whole constant buffer, which is rounded up to 64 bytes
+	alignas(16) std::byte data[GetCBufferSize(static_cast<uint32_t>(Size))]{};
+	std::bitset<SlotCount> dirty = std::bitset<SlotCount>().set();  // everything is uploaded the first time
+};
+
+size_t GetFeatureBufferSize();
+
+/**
+ * @brief Writes the data of every feature into the persistent feature buffer.
+ *
+ * @return The buffer if any feature changed since the last call, otherwise nullptr and the upload can be skipped.
+ */
+const void* UpdateFeatureBufferData();
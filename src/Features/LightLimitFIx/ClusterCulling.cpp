@@ -0,0 +1,201 @@
+#include "ClusterCulling.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+#include <immintrin.h>
+
+namespace LightCulling
+{
+	namespace
+	{
+#if defined(__AVX__)
+		constexpr uint32_t SimdWidth = 8;
+#else
+		constexpr uint32_t SimdWidth = 4;
+#endif
+
+		struct Float3
+		{
+			float x, y, z;
+		};
+
+		Float3 GetPositionVS(const Matrix& a_invProj, float a_u, float a_v)
+		{
+			// texcoord to clip space at the far plane, y flipped
+			const float clip[4] = { a_u * 2.0f - 1.0f, -(a_v * 2.0f - 1.0f), 1.0f, 1.0f };
+			float h[4]{};
+			for (int column = 0; column < 4; column++)
+				for (int row = 0; row < 4; row++)
+					h[column] += clip[row] * a_invProj.m[row][column];
+			return { h[0] / h[3], h[1] / h[3], h[2] / h[3] };
+		}
+
+		Float3 IntersectionZPlane(const Float3& a_point, float a_zDistance)
+		{
+			const float t = a_zDistance / a_point.z;
+			return { a_point.x * t, a_point.y * t, a_point.z * t };
+		}
+
+		Float3 Min(const Float3& a, const Float3& b) { return { std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z) }; }
+		Float3 Max(const Float3& a, const Float3& b) { return { std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z) }; }
+
+		// returns a bit per light in [a_first, a_first + SimdWidth) whose sphere touches the box
+		uint32_t TestSimd(const ClusterAABB& a_cluster, const float* a_x, const float* a_y, const float* a_z, const float* a_radiiSquared, uint32_t a_first)
+		{
+#if defined(__AVX__)
+			const auto axis = [&](const float* a_positions, int a_axis) {
+				const __m256 position = _mm256_loadu_ps(a_positions + a_first);
+				const __m256 closest = _mm256_max_ps(_mm256_set1_ps(a_cluster.minPoint[a_axis]), _mm256_min_ps(position, _mm256_set1_ps(a_cluster.maxPoint[a_axis])));
+				const __m256 distance = _mm256_sub_ps(closest, position);
+				return _mm256_mul_ps(distance, distance);
+			};
+			const __m256 distanceSquared = _mm256_add_ps(_mm256_add_ps(axis(a_x, 0), axis(a_y, 1)), axis(a_z, 2));
+			return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(distanceSquared, _mm256_loadu_ps(a_radiiSquared + a_first), _CMP_LE_OQ)));
+#else
+			const auto axis = [&](const float* a_positions, int a_axis) {
+				const __m128 position = _mm_loadu_ps(a_positions + a_first);
+				const __m128 closest = _mm_max_ps(_mm_set1_ps(a_cluster.minPoint[a_axis]), _mm_min_ps(position, _mm_set1_ps(a_cluster.maxPoint[a_axis])));
+				const __m128 distance = _mm_sub_ps(closest, position);
+				return _mm_mul_ps(distance, distance);
+			};
+			const __m128 distanceSquared = _mm_add_ps(_mm_add_ps(axis(a_x, 0), axis(a_y, 1)), axis(a_z, 2));
+			return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(distanceSquared, _mm_loadu_ps(a_radiiSquared + a_first))));
+#endif
+		}
+	}
+
+	float GridDesc::GetSliceDepth(uint32_t a_slice) const
+	{
+		const float sliceCount = static_cast<float>(size[2]);
+		switch (slicing) {
+		case DepthSlicing::Linear:
+			return lightsNear + (lightsFar - lightsNear) * static_cast<float>(a_slice) / sliceCount;
+		case DepthSlicing::Hybrid:
+			return a_slice == 0 ? lightsNear : nearSliceEnd * std::pow(lightsFar / nearSliceEnd, static_cast<float>(a_slice - 1) / (sliceCount - 1.0f));
+		default:
+			return lightsNear * std::pow(lightsFar / lightsNear, static_cast<float>(a_slice) / sliceCount);
+		}
+	}
+
+	void ClusterCuller::BuildClusters(const GridDesc& a_desc, const Matrix (&a_invProj)[2])
+	{
+		desc = a_desc;
+		clusters.resize(desc.GetClusterCount());
+
+		for (uint32_t z = 0; z < desc.size[2]; z++) {
+			const float clusterNear = desc.GetSliceDepth(z);
+			const float clusterFar = desc.GetSliceDepth(z + 1);
+
+			for (uint32_t y = 0; y < desc.size[1]; y++) {
+				for (uint32_t x = 0; x < desc.size[0]; x++) {
+					const float uMin = static_cast<float>(x) / static_cast<float>(desc.size[0]);
+					const float vMin = static_cast<float>(y) / static_cast<float>(desc.size[1]);
+					const float uMax = static_cast<float>(x + 1) / static_cast<float>(desc.size[0]);
+					const float vMax = static_cast<float>(y + 1) / static_cast<float>(desc.size[1]);
+
+					Float3 maxPointVS = GetPositionVS(a_invProj[0], uMax, vMax);
+					Float3 minPointVS = GetPositionVS(a_invProj[0], uMin, vMin);
+					if (desc.eyeCount == 2) {
+						maxPointVS = Max(maxPointVS, GetPositionVS(a_invProj[1], uMax, vMax));
+						minPointVS = Min(minPointVS, GetPositionVS(a_invProj[1], uMin, vMin));
+					}
+
+					const Float3 minPointNear = IntersectionZPlane(minPointVS, clusterNear);
+					const Float3 minPointFar = IntersectionZPlane(minPointVS, clusterFar);
+					const Float3 maxPointNear = IntersectionZPlane(maxPointVS, clusterNear);
+					const Float3 maxPointFar = IntersectionZPlane(maxPointVS, clusterFar);
+
+					const Float3 minPoint = Min(Min(minPointNear, minPointFar), Min(maxPointNear, maxPointFar));
+					const Float3 maxPoint = Max(Max(minPointNear, minPointFar), Max(maxPointNear, maxPointFar));
+
+					auto& cluster = clusters[x + y * desc.size[0] + z * desc.size[0] * desc.size[1]];
+					cluster = { { minPoint.x, minPoint.y, minPoint.z, 0.0f }, { maxPoint.x, maxPoint.y, maxPoint.z, 0.0f } };
+				}
+			}
+		}
+	}
+
+	bool ClusterCuller::TestScalar(const ClusterAABB& a_cluster, const Light& a_light) const
+	{
+		bool intersects = false;
+		for (uint32_t eyeIndex = 0; eyeIndex < desc.eyeCount && !intersects; eyeIndex++) {
+			float distanceSquared = 0.0f;
+			for (int axis = 0; axis < 3; axis++) {
+				const float position = a_light.positionVS[eyeIndex][axis];
+				const float distance = std::max(a_cluster.minPoint[axis], std::min(position, a_cluster.maxPoint[axis])) - position;
+				distanceSquared += distance * distance;
+			}
+			intersects = distanceSquared <= a_light.radius * a_light.radius;
+		}
+		return intersects;
+	}
+
+	CullingStats ClusterCuller::Cull(std::span<const Light> a_lights, bool a_simd)
+	{
+		CullingStats stats;
+		stats.lightCount = static_cast<uint32_t>(a_lights.size());
+
+		const uint32_t paddedCount = (stats.lightCount + SimdWidth - 1) / SimdWidth * SimdWidth;
+		if (a_simd) {
+			// padding never intersects, a distance is never below a negative squared radius
+			radiiSquared.assign(paddedCount, -1.0f);
+			for (uint32_t eyeIndex = 0; eyeIndex < desc.eyeCount; eyeIndex++)
+				for (auto& axis : positions[eyeIndex])
+					axis.assign(paddedCount, 0.0f);
+
+			for (uint32_t i = 0; i < stats.lightCount; i++) {
+				const auto& light = a_lights[i];
+				radiiSquared[i] = light.radius * light.radius;
+				for (uint32_t eyeIndex = 0; eyeIndex < desc.eyeCount; eyeIndex++)
+					for (int axis = 0; axis < 3; axis++)
+						positions[eyeIndex][axis][i] = light.positionVS[eyeIndex][axis];
+			}
+		}
+
+		lightGrid.resize(clusters.size());
+		lightIndexList.clear();
+
+		for (size_t clusterIndex = 0; clusterIndex < clusters.size(); clusterIndex++) {
+			const auto& cluster = clusters[clusterIndex];
+			const auto offset = static_cast<uint32_t>(lightIndexList.size());
+			uint32_t visibleLightCount = 0;
+			uint32_t intersectingLightCount = 0;
+
+			const auto addLight = [&](uint32_t a_lightIndex) {
+				intersectingLightCount++;
+				if (visibleLightCount < desc.maxClusterLights) {
+					lightIndexList.push_back(a_lightIndex);
+					visibleLightCount++;
+				}
+			};
+
+			if (a_simd) {
+				for (uint32_t first = 0; first < paddedCount; first += SimdWidth) {
+					uint32_t mask = TestSimd(cluster, positions[0][0].data(), positions[0][1].data(), positions[0][2].data(), radiiSquared.data(), first);
+					if (desc.eyeCount == 2)
+						mask |= TestSimd(cluster, positions[1][0].data(), positions[1][1].data(), positions[1][2].data(), radiiSquared.data(), first);
+					for (; mask; mask &= mask - 1)
+						addLight(first + static_cast<uint32_t>(std::countr_zero(mask)));
+				}
+			} else {
+				for (uint32_t i = 0; i < stats.lightCount; i++)
+					if (TestScalar(cluster, a_lights[i]))
+						addLight(i);
+			}
+
+			lightGrid[clusterIndex] = { offset, visibleLightCount, { 0, 0 } };
+
+			stats.emptyClusters += intersectingLightCount == 0;
+			stats.peakClusterLights = std::max(stats.peakClusterLights, intersectingLightCount);
+			if (intersectingLightCount > desc.maxClusterLights) {
+				stats.saturatedClusters++;
+				stats.droppedLights += intersectingLightCount - desc.maxClusterLights;
+			}
+		}
+
+		stats.indexCount = static_cast<uint32_t>(lightIndexList.size());
+		return stats;
+	}
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+// CPU implementation of ClusterBuildingCS.hlsl and ClusterCullingCS.hlsl.
+// Only depends on the standard library and SSE/AVX intrinsics, so tools/LightCullingBenchmark can build it on any x86-64 host.
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace LightCulling
+{
+	// Layouts match StructuredLight, ClusterAABB and LightGrid in LightLimitFix/Common.hlsli and the LightLimitFix structs uploaded to them
+
+	struct alignas(16) Light
+	{
+		float color[3];
+		float radius;
+		float positionWS[2][4];
+		float positionVS[2][4];
+		uint32_t roomFlags[4];
+		uint32_t lightFlags;
+		uint32_t shadowLightIndex;
+		float pad0[2];
+	};
+	static_assert(sizeof(Light) == 112);
+
+	struct ClusterAABB
+	{
+		float minPoint[4];
+		float maxPoint[4];
+	};
+	static_assert(sizeof(ClusterAABB) == 32);
+
+	struct alignas(16) LightGrid
+	{
+		uint32_t offset;
+		uint32_t lightCount;
+		uint32_t pad0[2];
+	};
+	static_assert(sizeof(LightGrid) == 16);
+
+	struct Matrix
+	{
+		float m[4][4];  // row-major, applied to row vectors like the row_major matrices in HLSL
+	};
+
+	// Distribution of the depth slices between the near and far plane, CLUSTER_SLICING_* in Common.hlsli
+	enum class DepthSlicing : uint32_t
+	{
+		Exponential,
+		Linear,
+		Hybrid,  // one slice up to nearSliceEnd, exponential after it, so close clusters are not wasted on the first few units
+	};
+
+	struct GridDesc
+	{
+		uint32_t size[3] = { 16, 16, 32 };
+		float lightsNear = 1.0f;
+		float lightsFar = 16384.0f;
+		uint32_t maxClusterLights = 128;  // MAX_CLUSTER_LIGHTS in Common.hlsli
+		uint32_t eyeCount = 1;
+		DepthSlicing slicing = DepthSlicing::Exponential;
+		float nearSliceEnd = 0.0f;  // only used by DepthSlicing::Hybrid, between lightsNear and lightsFar
+
+		uint32_t GetClusterCount() const { return size[0] * size[1] * size[2]; }
+
+		/**
+		 * @brief Gets the view depth a depth slice starts at, see GetClusterSliceDepth in Common.hlsli.
+		 */
+		float GetSliceDepth(uint32_t a_slice) const;
+	};
+
+	struct CullingStats
+	{
+		uint32_t lightCount = 0;
+		uint32_t indexCount = 0;         // entries written to the light index list
+		uint32_t emptyClusters = 0;
+		uint32_t saturatedClusters = 0;  // clusters intersecting more than maxClusterLights lights
+		uint32_t droppedLights = 0;      // intersections lost to saturated clusters
+		uint32_t peakClusterLights = 0;  // most lights intersecting a single cluster, before clamping
+	};
+
+	/**
+	 * Builds the cluster grid and assigns lights to clusters like the compute shaders do.
+	 *
+	 * Results differ from the GPU only in the placement of each cluster's range in the index list,
+	 * which is in cluster order here instead of the order clusters were finished in. Buffers are
+	 * kept between calls, so repeated culling does not allocate once the grid is warm.
+	 */
+	class ClusterCuller
+	{
+	public:
+		/**
+		 * @brief Builds the view space bounds of every cluster, see ClusterBuildingCS.hlsl.
+		 *
+		 * @param a_invProj Inverse projection for each eye; the second one is ignored unless a_desc.eyeCount is 2.
+		 */
+		void BuildClusters(const GridDesc& a_desc, const Matrix (&a_invProj)[2]);
+
+		/**
+		 * @brief Assigns lights to the clusters from the last BuildClusters call, see ClusterCullingCS.hlsl.
+		 *
+		 * @param a_simd Uses the SSE/AVX intersection test; the scalar path is the reference it is checked against.
+		 */
+		CullingStats Cull(std::span<const Light> a_lights, bool a_simd = true);
+
+		const GridDesc& GetDesc() const { return desc; }
+		const std::vector<ClusterAABB>& GetClusters() const { return clusters; }
+		const std::vector<uint32_t>& GetLightIndexList() const { return lightIndexList; }
+		const std::vector<LightGrid>& GetLightGrid() const { return lightGrid; }
+
+	private:
+		bool TestScalar(const ClusterAABB& a_cluster, const Light& a_light) const;
+
+		GridDesc desc;
+		std::vector<ClusterAABB> clusters;
+		std::vector<uint32_t> lightIndexList;
+		std::vector<LightGrid> lightGrid;
+
+		// light positions and squared radii transposed for the SIMD test, padded to a whole vector
+		std::vector<float> positions[2][3];
+		std::vector<float> radiiSquared;
+	};
+}
@@ -0,0 +1,115 @@
+#include "LightCapture.h"
+
+#include <algorithm>
+
+namespace LightCulling
+{
+	namespace
+	{
+		struct FileHeader
+		{
+			uint32_t magic;
+			uint32_t version;
+			uint32_t lightSize;  // guards against captures of a different StructuredLight layout
+			uint32_t pad0;
+		};
+
+		// arrays this large only come from a corrupt file
+		constexpr uint32_t MaxArraySize = 1 << 24;
+
+		template <class T>
+		bool ReadArray(std::FILE* a_file, std::vector<T>& a_array, uint32_t a_count)
+		{
+			if (a_count > MaxArraySize)
+				return false;
+			a_array.resize(a_count);
+			return a_count == 0 || std::fread(a_array.data(), sizeof(T), a_count, a_file) == a_count;
+		}
+	}
+
+	GridDesc CaptureFrame::GetGridDesc() const
+	{
+		GridDesc desc;
+		std::copy(std::begin(info.gridSize), std::end(info.gridSize), desc.size);
+		desc.lightsNear = info.lightsNear;
+		desc.lightsFar = info.lightsFar;
+		desc.maxClusterLights = info.maxClusterLights;
+		desc.eyeCount = info.eyeCount;
+		desc.slicing = static_cast<DepthSlicing>(info.slicing);
+		desc.nearSliceEnd = info.nearSliceEnd;
+		return desc;
+	}
+
+	bool CaptureWriter::Open(const std::filesystem::path& a_path)
+	{
+		Close();
+#ifdef _WIN32
+		file = _wfopen(a_path.c_str(), L"wb");
+#else
+		file = std::fopen(a_path.c_str(), "wb");
+#endif
+		if (!file)
+			return false;
+		const FileHeader header{ Magic, Version, sizeof(Light), 0 };
+		std::fwrite(&header, sizeof(header), 1, file);
+		return true;
+	}
+
+	void CaptureWriter::Write(const CaptureFrame& a_frame)
+	{
+		if (!file)
+			return;
+		FrameInfo info = a_frame.info;
+		info.lightCount = static_cast<uint32_t>(a_frame.lights.size());
+		info.particleCount = static_cast<uint32_t>(a_frame.particles.size());
+		info.roomCount = static_cast<uint32_t>(a_frame.rooms.size());
+		std::fwrite(&info, sizeof(info), 1, file);
+		std::fwrite(a_frame.lights.data(), sizeof(Light), a_frame.lights.size(), file);
+		std::fwrite(a_frame.particles.data(), sizeof(ParticleInput), a_frame.particles.size(), file);
+		std::fwrite(a_frame.rooms.data(), sizeof(RoomNode), a_frame.rooms.size(), file);
+		frameCount++;
+	}
+
+	void CaptureWriter::Close()
+	{
+		if (file)
+			std::fclose(file);
+		file = nullptr;
+		frameCount = 0;
+	}
+
+	bool CaptureReader::Open(const std::filesystem::path& a_path)
+	{
+		Close();
+#ifdef _WIN32
+		file = _wfopen(a_path.c_str(), L"rb");
+#else
+		file = std::fopen(a_path.c_str(), "rb");
+#endif
+		if (!file)
+			return false;
+		FileHeader header{};
+		if (std::fread(&header, sizeof(header), 1, file) != 1 || header.magic != CaptureWriter::Magic || header.version != CaptureWriter::Version ||
+			header.lightSize != sizeof(Light)) {
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	bool CaptureReader::Read(CaptureFrame& a_frame)
+	{
+		if (!file || std::fread(&a_frame.info, sizeof(FrameInfo), 1, file) != 1)
+			return false;
+		return ReadArray(file, a_frame.lights, a_frame.info.lightCount) &&
+		       ReadArray(file, a_frame.particles, a_frame.info.particleCount) &&
+		       ReadArray(file, a_frame.rooms, a_frame.info.roomCount);
+	}
+
+	void CaptureReader::Close()
+	{
+		if (file)
+			std::fclose(file);
+		file = nullptr;
+	}
+}
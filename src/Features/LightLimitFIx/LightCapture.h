@@ -0,0 +1,107 @@
+#pragma once
+
+// Capture of the inputs Light Limit Fix gathers its lights from, written by the plugin and replayed by tools/LightCullingBenchmark.
+// Like ClusterCulling.h, only depends on the standard library.
+
+#include "ClusterCulling.h"
+
+#include <cstdio>
+#include <filesystem>
+
+namespace LightCulling
+{
+	// A particle before it is merged into a cell, see the particle loop of LightLimitFix::UpdateLights
+	struct ParticleInput
+	{
+		float position[3];  // world space, cells are keyed by it
+		float radius;
+		float color[3];  // after saturation, alpha and brightness
+		float pad0;
+	};
+	static_assert(sizeof(ParticleInput) == 32);
+
+	struct RoomNode
+	{
+		uint64_t node;  // address of the BSMultiBoundRoom or BSPortalSharedNode, only meaningful within one capture
+		uint32_t index;
+		uint32_t pad0;
+	};
+	static_assert(sizeof(RoomNode) == 16);
+
+	// Fixed size part of a captured frame
+	struct FrameInfo
+	{
+		uint32_t frameIndex;
+		uint32_t eyeCount;
+		uint32_t gridSize[3];
+		uint32_t maxClusterLights;
+		uint32_t slicing;  // DepthSlicing
+		float nearSliceEnd;
+		float lightsNear;
+		float lightsFar;
+		Matrix view[2];
+		Matrix projection[2];
+		Matrix invProjection[2];
+		float eyePosition[2][4];
+		uint32_t particleOptimization;  // particles were merged into cells of particleCellSize
+		float particleCellSize;
+		float lightFadeStart;
+		float lightFadeEnd;
+		uint32_t lightCount;     // gathered lights, before particle cells were turned into lights
+		uint32_t particleCount;  // particles merged into cells, only with particleOptimization
+		uint32_t roomCount;
+		uint32_t gatheredLightCount;  // gathered lights including particle cells, for checking a replay against
+	};
+
+	struct CaptureFrame
+	{
+		FrameInfo info{};
+		std::vector<Light> lights;
+		std::vector<ParticleInput> particles;
+		std::vector<RoomNode> rooms;
+
+		GridDesc GetGridDesc() const;
+	};
+
+	/**
+	 * Writes frames to a capture file, a header followed by one FrameInfo and its arrays per frame.
+	 */
+	class CaptureWriter
+	{
+	public:
+		static constexpr uint32_t Magic = 0x43464C4C;  // LLFC
+		static constexpr uint32_t Version = 1;
+
+		~CaptureWriter() { Close(); }
+
+		bool Open(const std::filesystem::path& a_path);
+		void Write(const CaptureFrame& a_frame);
+		void Close();
+
+		bool IsOpen() const { return file != nullptr; }
+		uint32_t GetFrameCount() const { return frameCount; }
+
+	private:
+		std::FILE* file = nullptr;
+		uint32_t frameCount = 0;
+	};
+
+	class CaptureReader
+	{
+	public:
+		~CaptureReader() { Close(); }
+
+		/**
+		 * @brief Opens a capture file and checks its header.
+		 */
+		bool Open(const std::filesystem::path& a_path);
+		/**
+		 * @brief Reads the next frame, reusing the arrays of a_frame. Returns false at the end of the file or on a truncated frame.
+		 */
+		bool Read(CaptureFrame& a_frame);
+		void Close();
+
+	private:
+		std::FILE* file = nullptr;
+	};
+}
@@ -0,0 +1,84 @@
+#include "ParticleLightGrid.h"
+
+void ParticleLightGrid::Clear()
+{
+	lights.clear();
+	largeLights.clear();
+	entries.clear();
+	cells.clear();
+}
+
+void ParticleLightGrid::Append(std::span<const Light> a_lights)
+{
+	lights.insert(lights.end(), a_lights.begin(), a_lights.end());
+}
+
+uint64_t ParticleLightGrid::GetCellKey(int64_t a_x, int64_t a_y, int64_t a_z)
+{
+	// 21 bits per axis, which wraps far outside of any worldspace
+	return (static_cast<uint64_t>(a_x) & 0x1FFFFF) | ((static_cast<uint64_t>(a_y) & 0x1FFFFF) << 21) | ((static_cast<uint64_t>(a_z) & 0x1FFFFF) << 42);
+}
+
+uint64_t ParticleLightGrid::GetCellKey(const RE::NiPoint3& a_point) const
+{
+	return GetCellKey(static_cast<int64_t>(std::floor(a_point.x / cellSize)), static_cast<int64_t>(std::floor(a_point.y / cellSize)),
+		static_cast<int64_t>(std::floor(a_point.z / cellSize)));
+}
+
+void ParticleLightGrid::Build()
+{
+	largeLights.clear();
+	entries.clear();
+	cells.clear();
+	if (lights.empty())
+		return;
+
+	// a cell as wide as an average light, so most lights overlap at most 8 cells
+	float radiusSum = 0.0f;
+	for (const auto& light : lights)
+		radiusSum += light.radius;
+	cellSize = std::max(2.0f * radiusSum / static_cast<float>(lights.size()), 1.0f);
+
+	for (uint32_t index = 0; index < lights.size(); index++) {
+		const auto& light = lights[index];
+		int64_t first[3], last[3];
+		const float position[3] = { light.position.x, light.position.y, light.position.z };
+		for (int axis = 0; axis < 3; axis++) {
+			first[axis] = static_cast<int64_t>(std::floor((position[axis] - light.radius) / cellSize));
+			last[axis] = static_cast<int64_t>(std::floor((position[axis] + light.radius) / cellSize));
+		}
+
+		if (last[0] - first[0] >= MaxCellsPerAxis || last[1] - first[1] >= MaxCellsPerAxis || last[2] - first[2] >= MaxCellsPerAxis) {
+			largeLights.push_back(index);
+			continue;
+		}
+
+		for (int64_t z = first[2]; z <= last[2]; z++)
+			for (int64_t y = first[1]; y <= last[1]; y++)
+				for (int64_t x = first[0]; x <= last[0]; x++)
+					entries.emplace_back(GetCellKey(x, y, z), index);
+	}
+
+	std::sort(entries.begin(), entries.end());
+
+	for (uint32_t i = 0; i < entries.size();) {
+		uint32_t end = i + 1;
+		while (end < entries.size() && entries[end].first == entries[i].first)
+			end++;
+		cells.emplace(entries[i].first, std::make_pair(i, end - i));
+		i = end;
+	}
+}
+
+ParticleLightGrid& ParticleLightSnapshots::BeginWrite()
+{
+	auto& snapshot = snapshots[1 - current.load()];
+	while (snapshot.readers.load())
+		std::this_thread::yield();
+	return snapshot.grid;
+}
+
+void ParticleLightSnapshots::Publish()
+{
+	current.store(1 - current.load());
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+/**
+ * Uniform grid over the particle lights of a frame, so light level queries only visit lights near the queried point.
+ *
+ * Lights are stored once per cell their bounds overlap. The cell size follows the average light radius,
+ * and lights much larger than a cell are kept in a separate list that every query visits.
+ */
+class ParticleLightGrid
+{
+public:
+	struct Light
+	{
+		float grey;
+		RE::NiPoint3 position;
+		float radius;
+	};
+
+	void Clear();
+	void Append(std::span<const Light> a_lights);
+	/**
+	 * @brief Sorts the appended lights into cells. Buffers are reused, so rebuilding does not allocate once warm.
+	 */
+	void Build();
+
+	std::span<const Light> GetLights() const { return lights; }
+
+	/**
+	 * @brief Calls a_func for every light whose bounds contain a_point, and possibly a few more.
+	 */
+	template <class F>
+	void ForEachLight(const RE::NiPoint3& a_point, F&& a_func) const
+	{
+		for (const auto index : largeLights)
+			a_func(lights[index]);
+		if (auto it = cells.find(GetCellKey(a_point)); it != cells.end()) {
+			for (uint32_t i = it->second.first; i < it->second.first + it->second.second; i++)
+				a_func(lights[entries[i].second]);
+		}
+	}
+
+private:
+	static constexpr int64_t MaxCellsPerAxis = 4;  // lights spanning more cells than this go to largeLights
+
+	uint64_t GetCellKey(const RE::NiPoint3& a_point) const;
+	static uint64_t GetCellKey(int64_t a_x, int64_t a_y, int64_t a_z);
+
+	float cellSize = 1.0f;
+	eastl::vector<Light> lights;
+	eastl::vector<uint32_t> largeLights;
+	eastl::vector<std::pair<uint64_t, uint32_t>> entries;          // (cell, light index) sorted by cell
+	ankerl::unordered_dense::map<uint64_t, std::pair<uint32_t, uint32_t>> cells;  // cell to (first entry, entry count)
+};
+
+/**
+ * Two ParticleLightGrids, one written by the render thread while the other is read by light level queries.
+ *
+ * Readers never block. The writer only waits if a reader still uses the grid it is about to overwrite, which
+ * requires a query to outlive a whole frame.
+ */
+class ParticleLightSnapshots
+{
+public:
+	/**
+	 * @brief Gets the grid that is not visible to readers, to be rebuilt and then published.
+	 */
+	ParticleLightGrid& BeginWrite();
+	void Publish();
+
+	template <class F>
+	void Read(F&& a_func)
+	{
+		for (;;) {
+			const auto index = current.load();
+			auto& snapshot = snapshots[index];
+			snapshot.readers.fetch_add(1);
+			// the writer may have taken this grid between loading the index and registering as a reader
+			if (current.load() == index) {
+				a_func(static_cast<const ParticleLightGrid&>(snapshot.grid));
+				snapshot.readers.fetch_sub(1);
+				return;
+			}
+			snapshot.readers.fetch_sub(1);
+		}
+	}
+
+private:
+	struct Snapshot
+	{
+		ParticleLightGrid grid;
+		std::atomic<uint32_t> readers = 0;
+	};
+
+	Snapshot snapshots[2];
+	std::atomic<uint32_t> current = 0;
+};
@@ -4,8 +4,19 @@
 #include "State.h"
 #include "Util.h"
 
-static constexpr uint CLUSTER_MAX_LIGHTS = 128;
+static constexpr uint CLUSTER_GROUP_SIZE[3] = { 16, 16, 4 };  // NUMTHREAD_X/Y/Z of ClusterCullingCS.hlsl
+static constexpr uint MAX_CLUSTER_LIGHT_INDICES = 1 << 24;     // light list budget if every cluster were full, 64 MB
+static constexpr uint MIN_LIGHT_LIST_CLUSTER_LIGHTS = 16;      // mean lights per cluster the light list starts with
+static constexpr uint LIGHT_LIST_SHRINK_FRAMES = 300;          // frames demand has to stay low before the light list shrinks
 static constexpr uint MAX_LIGHTS = 2048;
+static constexpr uint MIN_PARTICLES_PER_JOB = 1024;
+static constexpr uint LIGHT_UPLOAD_MERGE_GAP = 8;  // unchanged lights between two changed ranges are uploaded too, if there are at most this many
+
+// ClusterCulling.h mirrors the structured buffer layouts for the CPU culling path
+static_assert(sizeof(LightLimitFix::LightData) == sizeof(LightCulling::Light));
+static_assert(sizeof(LightLimitFix::ClusterAABB) == sizeof(LightCulling::ClusterAABB));
+static_assert(sizeof(LightLimitFix::LightGrid) == sizeof(LightCulling::LightGrid));
+static_assert(sizeof(LightLimitFix::LightBuildingCB::InvProjMatrix) == sizeof(LightCulling::Matrix[2]));
 
 NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(
 	LightLimitFix::Settings,
@@ -19,7 +30,13 @@ NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(
 	ParticleBrightness,
 	ParticleRadius,
 	BillboardBrightness,
-	BillboardRadius)
+	BillboardRadius,
+	ClusterTileSize,
+	ClusterDepthSlices,
+	ClusterDepthSlicing,
+	ClusterNearSliceEnd,
+	MaxClusterLights,
+	PackedLightIndices)
 
 void LightLimitFix::DrawSettings()
 {
@@ -41,11 +58,11 @@ void LightLimitFix::DrawSettings()
 
 		ImGui::Checkbox("Enable Optimization", &settings.EnableParticleLightsOptimization);
 		if (auto _tt = Util::HoverTooltipWrapper()) {
-			ImGui::Text("Merges vertices which are close enough to each other to significantly improve performance.");
+			ImGui::Text("Merges particles which are close enough to each other into a single light to significantly improve performance.");
 		}
 		ImGui::SliderInt("Optimisation Cluster Radius", (int*)&settings.ParticleLightsOptimisationClusterRadius, 1, 64);
 		if (auto _tt = Util::HoverTooltipWrapper()) {
-			ImGui::Text("Radius to use for clustering lights.");
+			ImGui::Text("Size of the grid cells particles are merged in. Each cell produces at most one light.");
 		}
 		ImGui::Spacing();
 		ImGui::Spacing();
@@ -107,9 +124,127 @@ void LightLimitFix::DrawSettings()
 		ImGui::TreePop();
 	}
 
+	if (ImGui::TreeNodeEx("Clustering")) {
+		// Rebuilding the grid recompiles the compute shaders, so changes are only applied once a slider is released
+		ImGui::SliderInt("Tile Size", (int*)&settings.ClusterTileSize, 32, 256);
+		clusterSettingsChanged |= ImGui::IsItemDeactivatedAfterEdit();
+		if (auto _tt = Util::HoverTooltipWrapper()) {
+			ImGui::Text("Width and height of a cluster in pixels. Higher resolutions and VR can use larger tiles.");
+		}
+
+		ImGui::SliderInt("Depth Slices", (int*)&settings.ClusterDepthSlices, 4, 128);
+		clusterSettingsChanged |= ImGui::IsItemDeactivatedAfterEdit();
+		if (auto _tt = Util::HoverTooltipWrapper()) {
+			ImGui::Text("Number of clusters between the near and far plane.");
+		}
+
+		const char* slicingModes[] = { "Exponential", "Linear", "Hybrid" };
+		settings.ClusterDepthSlicing = std::min(settings.ClusterDepthSlicing, 2u);
+		clusterSettingsChanged |= ImGui::Combo("Depth Slicing", (int*)&settings.ClusterDepthSlicing, slicingModes, IM_ARRAYSIZE(slicingModes));
+		if (auto _tt = Util::HoverTooltipWrapper()) {
+			ImGui::Text(
+				"How depth slices are distributed.\n"
+				" - Exponential: thin slices close to the camera, thick slices far away.\n"
+				" - Linear: slices of equal thickness.\n"
+				" - Hybrid: a single slice up to the near slice end, exponential after it.");
+		}
+
+		if (settings.ClusterDepthSlicing == static_cast<uint>(LightCulling::DepthSlicing::Hybrid)) {
+			ImGui::SliderFloat("Near Slice End", &settings.ClusterNearSliceEnd, 16.0f, 2048.0f, "%.0f");
+			if (auto _tt = Util::HoverTooltipWrapper()) {
+				ImGui::Text("View depth at which the first depth slice ends.");
+			}
+		}
+
+		ImGui::SliderInt("Max Lights Per Cluster", (int*)&settings.MaxClusterLights, 16, 512);
+		clusterSettingsChanged |= ImGui::IsItemDeactivatedAfterEdit();
+		if (auto _tt = Util::HoverTooltipWrapper()) {
+			ImGui::Text("Lights past this limit are dropped from a cluster. Higher limits use more memory.");
+		}
+
+		clusterSettingsChanged |= ImGui::Checkbox("16-bit Light Indices", &settings.PackedLightIndices);
+		if (auto _tt = Util::HoverTooltipWrapper()) {
+			ImGui::Text("Stores two light indices per entry of the light list, halving its memory.");
+		}
+
+		ImGui::TreePop();
+	}
+
 	if (ImGui::TreeNodeEx("Statistics", ImGuiTreeNodeFlags_DefaultOpen)) {
 		ImGui::Text(std::format("Clustered Light Count : {}", lightCount).c_str());
-		ImGui::Text(std::format("Particle Lights Detection Count : {}", particleLightsDetectionHits).c_str());
+		ImGui::Text(std::format("Particle Lights Detection Count : {}", particleLightsDetectionHits.load()).c_str());
+		ImGui::Text(std::format("Particle Light Checks : {} passes, {} cached, {} resolved, {} queued", lastParticleLightCheckStats.passes,
+			lastParticleLightCheckStats.cached, lastParticleLightCheckStats.resolved, lastParticleLightCheckStats.queued).c_str());
+		ImGui::Checkbox("Particle Light Cache", &particleLightCache);
+		if (auto _tt = Util::HoverTooltipWrapper()) {
+			ImGui::Text(
+				"Remembers the particle light config and vertex colours of each geometry, so render passes skip texture name lookups.\n"
+				"Disable to measure render passes without it.");
+		}
+		ImGui::SameLine();
+		ImGui::Checkbox("Time Particle Light Checks", &particleLightTiming);
+		if (particleLightTiming) {
+			const auto passes = std::max(lastParticleLightCheckStats.passes, 1u);
+			ImGui::Text(std::format("Particle Light Check Time : {:.3f} ms, {:.0f} ns per pass", lastParticleLightCheckStats.milliseconds,
+				lastParticleLightCheckStats.milliseconds * 1e6 / passes).c_str());
+		}
+		ImGui::Text(std::format("Lights Added / Removed / Updated : {} / {} / {}", lightUploadStats.added, lightUploadStats.removed, lightUploadStats.updated).c_str());
+		ImGui::Text(std::format("Lights Uploaded : {} in {} ranges", lightUploadStats.uploadedLights, lightUploadStats.uploadRanges).c_str());
+		ImGui::Text(std::format("Rooms : {}", roomNodes.size()).c_str());
+		ImGui::Text(std::format("Strict Light Rooms Cached / Resolved : {} / {}", lightRoomStats.cached, lightRoomStats.resolved).c_str());
+		if (lightRoomStats.overflowed) {
+			ImGui::Text(std::format("Strict Lights In Every Room : {}", lightRoomStats.overflowed).c_str());
+			if (auto _tt = Util::HoverTooltipWrapper()) {
+				ImGui::Text("Lights whose rooms were indexed too far apart to be stored, so they are not limited to their rooms.");
+			}
+		}
+
+		ImGui::Checkbox("CPU Cluster Culling", &cpuClusterCulling);
+		if (auto _tt = Util::HoverTooltipWrapper()) {
+			ImGui::Text(
+				"Assigns lights to clusters on the CPU instead of the GPU. Slower, intended for debugging.\n"
+				"Also reports clusters which hit the limit of lights per cluster.");
+		}
+		if (cpuClusterCulling || !clusterBuildingCS || !clusterCullingCS) {
+			ImGui::Text(std::format("Light Indices : {}", cpuCullingStats.indexCount).c_str());
+			ImGui::Text(std::format("Empty Clusters : {}", cpuCullingStats.emptyClusters).c_str());
+			ImGui::Text(std::format("Peak Cluster Lights : {} / {}", cpuCullingStats.peakClusterLights, maxClusterLights).c_str());
+		}
+
+		ImGui::Text(std::format("Light List : {} / {} indices ({:.1f} MB)", lightListStats.demand, lightListCapacity,
+			static_cast<double>(GetLightListEntries(lightListCapacity)) * sizeof(uint32_t) / (1024.0 * 1024.0)).c_str());
+		ImGui::Text(std::format("Overflowed Clusters : {}", lightListStats.overflowedClusters).c_str());
+		ImGui::Text(std::format("Dropped Cluster Lights : {}", lightListStats.droppedLights).c_str());
+		if (auto _tt = Util::HoverTooltipWrapper()) {
+			ImGui::Text("Intersections lost because clusters hit the limit of lights per cluster, or the light list was full.");
+		}
+
+		if (lightCaptureFramesLeft) {
+			ImGui::Text(std::format("Capturing Lights : {} frames left", lightCaptureFramesLeft).c_str());
+		} else {
+			if (ImGui::Button("Capture Lights"))
+				StartLightCapture();
+			if (auto _tt = Util::HoverTooltipWrapper()) {
+				ImGui::Text(
+					"Writes the gathered lights, camera and particles of the next frames to Data\\SKSE\\Plugins\\CommunityShadersLightCapture.bin,\n"
+					"which tools/LightCullingBenchmark can replay with --replay.");
+			}
+			ImGui::SameLine();
+			ImGui::SliderInt("Frames", &lightCaptureFrameCount, 1, 3600);
+		}
+
+		ImGui::Checkbox("Occupancy Histogram", &occupancyHistogram);
+		if (auto _tt = Util::HoverTooltipWrapper()) {
+			ImGui::Text(
+				"Reads back how many lights each cluster holds, to tune the cluster grid for a scene.\n"
+				"Clusters in the last bucket are likely to hit the limit of lights per cluster.");
+		}
+		if (occupancyHistogram) {
+			ImGui::PlotHistogram("Clusters per Light Count", occupancyBuckets.data(), static_cast<int>(occupancyBuckets.size()), 0,
+				std::format("0 - {} lights", maxClusterLights).c_str(), 0.0f, FLT_MAX, ImVec2(0, 80));
+			ImGui::PlotHistogram("Mean Lights per Depth Slice", clusterSliceOccupancy.data(), static_cast<int>(clusterSliceOccupancy.size()), 0,
+				"near to far", 0.0f, FLT_MAX, ImVec2(0, 80));
+		}
 
 		ImGui::TreePop();
 	}
@@ -121,36 +256,137 @@ LightLimitFix::PerFrame LightLimitFix::GetCommonBufferData()
 	perFrame.EnableContactShadows = settings.EnableContactShadows;
 	perFrame.EnableLightsVisualisation = settings.EnableLightsVisualisation;
 	perFrame.LightsVisualisationMode = settings.LightsVisualisationMode;
+	perFrame.ClusterNearSliceEnd = clusterNearSliceEnd;
 	std::copy(clusterSize, clusterSize + 3, perFrame.ClusterSize);
+	perFrame.ClusterSize[3] = static_cast<uint>(clusterDepthSlicing);
+	perFrame.PackedLightIndices = packedLightIndices;
 	return perFrame;
 }
 
 void LightLimitFix::SetupResources()
+{
+	lightBuildingCB = new ConstantBuffer(ConstantBufferDesc<LightBuildingCB>());
+	lightCullingCB = new ConstantBuffer(ConstantBufferDesc<LightCullingCB>());
+	lightTransformCB = new ConstantBuffer(ConstantBufferDesc<LightTransformCB>());
+
+	SetupClusters();
+
+	lightTransformCS = (ID3D11ComputeShader*)Util::CompileShader(L"Data\\Shaders\\LightLimitFix\\LightTransformCS.hlsl", {}, "cs_5_0");
+
+	{
+		// Written in ranges by copies from a ring of staging buffers, see UploadLights
+		D3D11_BUFFER_DESC sbDesc{};
+		sbDesc.Usage = D3D11_USAGE_DEFAULT;
+		sbDesc.CPUAccessFlags = 0;
+		sbDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+		sbDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+		sbDesc.StructureByteStride = sizeof(LightData);
+		sbDesc.ByteWidth = sizeof(LightData) * MAX_LIGHTS;
+		lightSources = eastl::make_unique<Buffer>(sbDesc);
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
+		srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+		srvDesc.Buffer.FirstElement = 0;
+		srvDesc.Buffer.NumElements = MAX_LIGHTS;
+		lightSources->CreateSRV(srvDesc);
+
+		// Written by LightTransformCS, see TransformLights
+		sbDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+		lights = eastl::make_unique<Buffer>(sbDesc);
+		lights->CreateSRV(srvDesc);
+
+		D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc{};
+		uavDesc.Format = DXGI_FORMAT_UNKNOWN;
+		uavDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+		uavDesc.Buffer.FirstElement = 0;
+		uavDesc.Buffer.NumElements = MAX_LIGHTS;
+		uavDesc.Buffer.Flags = 0;
+		lights->CreateUAV(uavDesc);
+
+		sbDesc.Usage = D3D11_USAGE_STAGING;
+		sbDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		sbDesc.BindFlags = 0;
+		for (auto& stagingBuffer : lightStagingBuffers)
+			stagingBuffer = eastl::make_unique<Buffer>(sbDesc);
+
+		lightsMirror.assign(MAX_LIGHTS, GetEmptyLight());
+		lightSlots.assign(MAX_LIGHTS, {});
+		dirtyLightSlots.assign((MAX_LIGHTS + 63) / 64, 0);
+		freeLightSlots.clear();
+		lightSlotMap.clear();
+		lightSlotCount = 0;
+		lightsNeedFullUpload = true;
+	}
+
+	{
+		D3D11_BUFFER_DESC sbDesc{};
+		sbDesc.Usage = D3D11_USAGE_DYNAMIC;
+		sbDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		sbDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+		sbDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+		sbDesc.StructureByteStride = sizeof(StrictLightData);
+		sbDesc.ByteWidth = sizeof(StrictLightData);
+		strictLightData = std::make_unique<Buffer>(sbDesc);
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
+		srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+		srvDesc.Buffer.FirstElement = 0;
+		srvDesc.Buffer.NumElements = 1;
+		strictLightData->CreateSRV(srvDesc);
+	}
+}
+
+void LightLimitFix::SetupClusters()
 {
 	auto screenSize = Util::ConvertToDynamic(State::GetSingleton()->screenSize);
 	if (REL::Module::IsVR())
 		screenSize.x *= .5;
-	clusterSize[0] = ((uint)screenSize.x + 63) / 64;
-	clusterSize[1] = ((uint)screenSize.y + 63) / 64;
-	clusterSize[2] = 32;
+	const uint tileSize = std::clamp(settings.ClusterTileSize, 32u, 256u);
+	clusterSize[0] = ((uint)screenSize.x + tileSize - 1) / tileSize;
+	clusterSize[1] = ((uint)screenSize.y + tileSize - 1) / tileSize;
+	clusterSize[2] = std::clamp(settings.ClusterDepthSlices, 4u, 128u);
+	clusterDepthSlicing = static_cast<LightCulling::DepthSlicing>(std::min(settings.ClusterDepthSlicing, static_cast<uint>(LightCulling::DepthSlicing::Hybrid)));
+	maxClusterLights = std::clamp(settings.MaxClusterLights, 16u, 512u);
+	packedLightIndices = settings.PackedLightIndices;
 	uint clusterCount = clusterSize[0] * clusterSize[1] * clusterSize[2];
 
+	if (clusterCount * maxClusterLights > MAX_CLUSTER_LIGHT_INDICES) {
+		maxClusterLights = std::max(MAX_CLUSTER_LIGHT_INDICES / clusterCount, 16u);
+		logger::warn("[LLF] Cluster grid too large for {} lights per cluster, limited to {}", settings.MaxClusterLights, maxClusterLights);
+	}
+
+	logger::info("[LLF] Cluster grid {}x{}x{} with {} depth slices, {} lights per cluster", clusterSize[0], clusterSize[1], clusterSize[2],
+		magic_enum::enum_name(clusterDepthSlicing), maxClusterLights);
+
 	{
 		std::string clusterSizeStrs[3];
-		for (int i = 0; i < 3; ++i)
+		std::string groupSizeStrs[3];
+		for (int i = 0; i < 3; ++i) {
 			clusterSizeStrs[i] = std::format("{}", clusterSize[i]);
+			groupSizeStrs[i] = std::format("{}", CLUSTER_GROUP_SIZE[i]);
+		}
+		const auto maxClusterLightsStr = std::format("{}", maxClusterLights);
 
 		std::vector<std::pair<const char*, const char*>> defines = {
 			{ "CLUSTER_BUILDING_DISPATCH_SIZE_X", clusterSizeStrs[0].c_str() },
 			{ "CLUSTER_BUILDING_DISPATCH_SIZE_Y", clusterSizeStrs[1].c_str() },
-			{ "CLUSTER_BUILDING_DISPATCH_SIZE_Z", clusterSizeStrs[2].c_str() }
+			{ "CLUSTER_BUILDING_DISPATCH_SIZE_Z", clusterSizeStrs[2].c_str() },
+			{ "NUMTHREAD_X", groupSizeStrs[0].c_str() },
+			{ "NUMTHREAD_Y", groupSizeStrs[1].c_str() },
+			{ "NUMTHREAD_Z", groupSizeStrs[2].c_str() },
+			{ "MAX_CLUSTER_LIGHTS", maxClusterLightsStr.c_str() }
 		};
+		if (packedLightIndices)
+			defines.push_back({ "PACKED_LIGHT_INDICES", "" });
 
+		if (clusterBuildingCS)
+			clusterBuildingCS->Release();
+		if (clusterCullingCS)
+			clusterCullingCS->Release();
 		clusterBuildingCS = (ID3D11ComputeShader*)Util::CompileShader(L"Data\\Shaders\\LightLimitFix\\ClusterBuildingCS.hlsl", defines, "cs_5_0");
 		clusterCullingCS = (ID3D11ComputeShader*)Util::CompileShader(L"Data\\Shaders\\LightLimitFix\\ClusterCullingCS.hlsl", defines, "cs_5_0");
-
-		lightBuildingCB = new ConstantBuffer(ConstantBufferDesc<LightBuildingCB>());
-		lightCullingCB = new ConstantBuffer(ConstantBufferDesc<LightCullingCB>());
 	}
 
 	{
@@ -181,7 +417,7 @@ void LightLimitFix::SetupResources()
 		uavDesc.Buffer.NumElements = numElements;
 		clusters->CreateUAV(uavDesc);
 
-		numElements = 1;
+		numElements = sizeof(LightListStats) / sizeof(uint32_t);
 		sbDesc.StructureByteStride = sizeof(uint32_t);
 		sbDesc.ByteWidth = sizeof(uint32_t) * numElements;
 		lightCounter = eastl::make_unique<Buffer>(sbDesc);
@@ -190,14 +426,16 @@ void LightLimitFix::SetupResources()
 		uavDesc.Buffer.NumElements = numElements;
 		lightCounter->CreateUAV(uavDesc);
 
-		numElements = clusterCount * CLUSTER_MAX_LIGHTS;
-		sbDesc.StructureByteStride = sizeof(uint32_t);
-		sbDesc.ByteWidth = sizeof(uint32_t) * numElements;
-		lightList = eastl::make_unique<Buffer>(sbDesc);
-		srvDesc.Buffer.NumElements = numElements;
-		lightList->CreateSRV(srvDesc);
-		uavDesc.Buffer.NumElements = numElements;
-		lightList->CreateUAV(uavDesc);
+		D3D11_BUFFER_DESC counterReadbackDesc = sbDesc;
+		counterReadbackDesc.Usage = D3D11_USAGE_STAGING;
+		counterReadbackDesc.BindFlags = 0;
+		counterReadbackDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		for (auto& readback : lightCounterReadback)
+			readback = eastl::make_unique<Buffer>(counterReadbackDesc);
+		lightCounterFrame = 0;
+		lightListStats = {};
+
+		CreateLightList(std::min(clusterCount * MIN_LIGHT_LIST_CLUSTER_LIGHTS, GetMaxLightListCapacity()));
 
 		numElements = clusterCount;
 		sbDesc.StructureByteStride = sizeof(LightGrid);
@@ -207,47 +445,109 @@ void LightLimitFix::SetupResources()
 		lightGrid->CreateSRV(srvDesc);
 		uavDesc.Buffer.NumElements = numElements;
 		lightGrid->CreateUAV(uavDesc);
+
+		D3D11_BUFFER_DESC readbackDesc = sbDesc;
+		readbackDesc.Usage = D3D11_USAGE_STAGING;
+		readbackDesc.BindFlags = 0;
+		readbackDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		for (auto& readback : lightGridReadback)
+			readback = eastl::make_unique<Buffer>(readbackDesc);
 	}
 
-	{
-		D3D11_BUFFER_DESC sbDesc{};
-		sbDesc.Usage = D3D11_USAGE_DYNAMIC;
-		sbDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-		sbDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-		sbDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
-		sbDesc.StructureByteStride = sizeof(LightData);
-		sbDesc.ByteWidth = sizeof(LightData) * MAX_LIGHTS;
-		lights = eastl::make_unique<Buffer>(sbDesc);
+	occupancyFrame = 0;
+	clustersNeedRebuild = true;
+	clusterSettingsChanged = false;
+}
 
-		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
-		srvDesc.Format = DXGI_FORMAT_UNKNOWN;
-		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
-		srvDesc.Buffer.FirstElement = 0;
-		srvDesc.Buffer.NumElements = MAX_LIGHTS;
-		lights->CreateSRV(srvDesc);
-	}
+uint LightLimitFix::GetLightListEntries(uint a_capacity) const
+{
+	return packedLightIndices ? (a_capacity + 1) / 2 : a_capacity;
+}
 
-	{
-		D3D11_BUFFER_DESC sbDesc{};
-		sbDesc.Usage = D3D11_USAGE_DYNAMIC;
-		sbDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-		sbDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-		sbDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
-		sbDesc.StructureByteStride = sizeof(StrictLightData);
-		sbDesc.ByteWidth = sizeof(StrictLightData);
-		strictLightData = std::make_unique<Buffer>(sbDesc);
+uint LightLimitFix::GetMaxLightListCapacity() const
+{
+	// every cluster full, plus the padding of packed ranges
+	const uint clusterCount = clusterSize[0] * clusterSize[1] * clusterSize[2];
+	return clusterCount * (maxClusterLights + (packedLightIndices ? 1 : 0));
+}
 
-		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
-		srvDesc.Format = DXGI_FORMAT_UNKNOWN;
-		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
-		srvDesc.Buffer.FirstElement = 0;
-		srvDesc.Buffer.NumElements = 1;
-		strictLightData->CreateSRV(srvDesc);
+void LightLimitFix::CreateLightList(uint a_capacity)
+{
+	lightListCapacity = (a_capacity + 1023) & ~1023u;
+	const uint numElements = GetLightListEntries(lightListCapacity);
+
+	D3D11_BUFFER_DESC sbDesc{};
+	sbDesc.Usage = D3D11_USAGE_DEFAULT;
+	sbDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+	sbDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	sbDesc.StructureByteStride = sizeof(uint32_t);
+	sbDesc.ByteWidth = sizeof(uint32_t) * numElements;
+	lightList = eastl::make_unique<Buffer>(sbDesc);
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc{};
+	srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+	srvDesc.Buffer.FirstElement = 0;
+	srvDesc.Buffer.NumElements = numElements;
+	lightList->CreateSRV(srvDesc);
+
+	D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc{};
+	uavDesc.Format = DXGI_FORMAT_UNKNOWN;
+	uavDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+	uavDesc.Buffer.FirstElement = 0;
+	uavDesc.Buffer.NumElements = numElements;
+	lightList->CreateUAV(uavDesc);
+
+	lightListShrinkFrames = 0;
+}
+
+void LightLimitFix::ResizeLightList(uint a_demand)
+{
+	// Grow with headroom as soon as the demand does not fit, shrink only once it stayed low for a while
+	const uint maxCapacity = GetMaxLightListCapacity();
+	uint capacity = lightListCapacity;
+	if (a_demand > lightListCapacity) {
+		capacity = std::min(a_demand + a_demand / 2, maxCapacity);
+	} else if (a_demand < lightListCapacity / 4) {
+		if (++lightListShrinkFrames > LIGHT_LIST_SHRINK_FRAMES)
+			capacity = std::max(a_demand * 2, std::min(clusterSize[0] * clusterSize[1] * clusterSize[2] * MIN_LIGHT_LIST_CLUSTER_LIGHTS, maxCapacity));
+	} else {
+		lightListShrinkFrames = 0;
 	}
+
+	if (capacity != lightListCapacity && ((capacity + 1023) & ~1023u) != lightListCapacity) {
+		logger::debug("[LLF] Light list resized from {} to {} indices", lightListCapacity, capacity);
+		CreateLightList(capacity);
+	}
+}
+
+void LightLimitFix::ReadLightListStats()
+{
+	static auto& context = State::GetSingleton()->context;
+
+	// Read the counters of a few frames ago so the GPU is never waited for, lightCounter still holds those of the last dispatch
+	context->CopyResource(lightCounterReadback[lightCounterFrame % LightCounterReadbackLatency]->resource.get(), lightCounter->resource.get());
+	lightCounterFrame++;
+	if (lightCounterFrame < LightCounterReadbackLatency)
+		return;
+
+	auto* readback = lightCounterReadback[lightCounterFrame % LightCounterReadbackLatency]->resource.get();
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if (FAILED(context->Map(readback, 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped)))
+		return;
+	std::memcpy(&lightListStats, mapped.pData, sizeof(LightListStats));
+	context->Unmap(readback, 0);
+
+	// intersections past the light list count as dropped as well
+	lightListStats.droppedLights += lightListStats.droppedIndices;
+
+	ResizeLightList(lightListStats.demand);
 }
 
 void LightLimitFix::Reset()
 {
+	QueueParticleLights();
+
 	for (auto& particleLight : particleLights) {
 		if (const auto particleSystem = netimmerse_cast<RE::NiParticleSystem*>(particleLight.first)) {
 			if (auto particleData = particleSystem->GetParticleRuntimeData().particleData.get()) {
@@ -263,6 +563,7 @@ void LightLimitFix::Reset()
 void LightLimitFix::LoadSettings(json& o_json)
 {
 	settings = o_json;
+	clusterSettingsChanged = true;
 }
 
 void LightLimitFix::SaveSettings(json& o_json)
@@ -273,6 +574,7 @@ void LightLimitFix::SaveSettings(json& o_json)
 void LightLimitFix::RestoreDefaultSettings()
 {
 	settings = {};
+	clusterSettingsChanged = true;
 }
 
 RE::NiNode* GetParentRoomNode(RE::NiAVObject* object)
@@ -364,8 +666,7 @@ void LightLimitFix::BSLightingShader_SetupGeometry_After(RE::BSRenderPass*)
 		previousRoomIndex = roomIndex;
 	}
 
-	ID3D11ShaderResourceView* view = strictLightData->srv.get();
-	context->PSSetShaderResources(53, 1, &view);
+	State::GetSingleton()->bindCache.PSSetShaderResource(context, 53, strictLightData->srv.get());
 }
 
 void LightLimitFix::SetLightPosition(LightLimitFix::LightData& a_light, RE::NiPoint3 a_initialPosition, bool a_cached)
@@ -390,7 +691,7 @@ void LightLimitFix::SetLightPosition(LightLimitFix::LightData& a_light, RE::NiPo
 	}
 }
 
-float LightLimitFix::CalculateLuminance(CachedParticleLight& light, RE::NiPoint3& point)
+float LightLimitFix::CalculateLuminance(const CachedParticleLight& light, const RE::NiPoint3& point)
 {
 	// See BSLight::CalculateLuminance_14131D3D0
 	// Performs lighting on the CPU which is identical to GPU code
@@ -405,17 +706,19 @@ float LightLimitFix::CalculateLuminance(CachedParticleLight& light, RE::NiPoint3
 
 void LightLimitFix::AddParticleLightLuminance(RE::NiPoint3& targetPosition, int& numHits, float& lightLevel)
 {
-	std::lock_guard<std::shared_mutex> lk{ cachedParticleLightsMutex };
-	particleLightsDetectionHits = 0;
+	uint32_t hits = 0;
 	if (settings.EnableParticleLightsDetection) {
-		for (auto& light : cachedParticleLights) {
-			auto luminance = CalculateLuminance(light, targetPosition);
-			lightLevel += luminance;
-			if (luminance > 0.0)
-				particleLightsDetectionHits++;
-		}
+		particleLightSnapshots.Read([&](const ParticleLightGrid& grid) {
+			grid.ForEachLight(targetPosition, [&](const CachedParticleLight& light) {
+				auto luminance = CalculateLuminance(light, targetPosition);
+				lightLevel += luminance;
+				if (luminance > 0.0)
+					hits++;
+			});
+		});
 	}
-	numHits += particleLightsDetectionHits;
+	particleLightsDetectionHits = hits;
+	numHits += hits;
 }
 
 void LightLimitFix::Prepass()
@@ -469,84 +772,39 @@ std::string ExtractTextureStem(std::string_view a_path)
 	return textureName;
 }
 
-std::optional<LightLimitFix::ConfigPair> LightLimitFix::GetParticleLightConfigs(RE::BSRenderPass* a_pass)
-{
-	// see https://www.nexusmods.com/skyrimspecialedition/articles/1391
-	if (settings.EnableParticleLights) {
-		if (auto shaderProperty = netimmerse_cast<RE::BSEffectShaderProperty*>(a_pass->shaderProperty)) {
-			if (!shaderProperty->lightData) {
-				if (auto material = shaderProperty->GetMaterial()) {
-					if (!material->sourceTexturePath.empty()) {
-						std::string textureName = ExtractTextureStem(material->sourceTexturePath.c_str());
-						if (textureName.size() < 1)
-							return std::nullopt;
-
-						auto& configs = ParticleLights::GetSingleton()->particleLightConfigs;
-						auto it = configs.find(textureName);
-						if (it == configs.end())
-							return std::nullopt;
-
-						ParticleLights::Config* config = &it->second;
-						ParticleLights::GradientConfig* gradientConfig = nullptr;
-						if (!material->greyscaleTexturePath.empty()) {
-							textureName = ExtractTextureStem(material->greyscaleTexturePath.c_str());
-							if (textureName.size() < 1)
-								return std::nullopt;
-
-							auto& gradientConfigs = ParticleLights::GetSingleton()->particleLightGradientConfigs;
-							auto itGradient = gradientConfigs.find(textureName);
-							if (itGradient == gradientConfigs.end())
-								return std::nullopt;
-							gradientConfig = &itGradient->second;
-						}
-						return std::make_pair(config, gradientConfig);
-					}
-				}
-			}
-		}
-	}
-	return std::nullopt;
-}
-
-bool LightLimitFix::CheckParticleLights(RE::BSRenderPass* a_pass, uint32_t)
+std::optional<LightLimitFix::ConfigPair> LightLimitFix::ResolveParticleLightConfigs(RE::BSEffectShaderMaterial* a_material)
 {
-	auto configs = GetParticleLightConfigs(a_pass);
-	if (configs.has_value()) {
-		if (AddParticleLight(a_pass, configs.value())) {
-			return !(settings.EnableParticleLightsCulling && configs->first->cull);
-		}
+	std::string textureName = ExtractTextureStem(a_material->sourceTexturePath.c_str());
+	if (textureName.size() < 1)
+		return std::nullopt;
+
+	auto& configs = ParticleLights::GetSingleton()->particleLightConfigs;
+	auto it = configs.find(textureName);
+	if (it == configs.end())
+		return std::nullopt;
+
+	ParticleLights::Config* config = &it->second;
+	ParticleLights::GradientConfig* gradientConfig = nullptr;
+	if (!a_material->greyscaleTexturePath.empty()) {
+		textureName = ExtractTextureStem(a_material->greyscaleTexturePath.c_str());
+		if (textureName.size() < 1)
+			return std::nullopt;
+
+		auto& gradientConfigs = ParticleLights::GetSingleton()->particleLightGradientConfigs;
+		auto itGradient = gradientConfigs.find(textureName);
+		if (itGradient == gradientConfigs.end())
+			return std::nullopt;
+		gradientConfig = &itGradient->second;
 	}
-	return true;
+	return std::make_pair(config, gradientConfig);
 }
 
-bool LightLimitFix::AddParticleLight(RE::BSRenderPass* a_pass, LightLimitFix::ConfigPair a_config)
+bool LightLimitFix::GetParticleVertexColor(RE::BSGeometry* a_geometry, RE::NiColorA& o_color)
 {
-	auto shaderProperty = netimmerse_cast<RE::BSEffectShaderProperty*>(a_pass->shaderProperty);
-	auto material = shaderProperty->GetMaterial();
-	auto config = a_config.first;
-	auto gradientConfig = a_config.second;
-
-	a_pass->geometry->IncRefCount();
-	if (const auto particleSystem = netimmerse_cast<RE::NiParticleSystem*>(a_pass->geometry)) {
-		if (auto particleData = particleSystem->GetParticleRuntimeData().particleData.get()) {
-			particleData->IncRefCount();
-		}
-	}
-
-	RE::NiColorA color;
-	color.red = material->baseColor.red * material->baseColorScale;
-	color.green = material->baseColor.green * material->baseColorScale;
-	color.blue = material->baseColor.blue * material->baseColorScale;
-	color.alpha = material->baseColor.alpha * shaderProperty->alpha;
-
-	if (auto emittance = shaderProperty->unk88) {
-		color.red *= emittance->red;
-		color.green *= emittance->green;
-		color.blue *= emittance->blue;
-	}
+	o_color = { 1.0f, 1.0f, 1.0f, 1.0f };
 
-	if (auto rendererData = a_pass->geometry->GetGeometryRuntimeData().rendererData) {
-		if (auto triShape = a_pass->geometry->AsTriShape()) {
+	if (auto rendererData = a_geometry->GetGeometryRuntimeData().rendererData) {
+		if (auto triShape = a_geometry->AsTriShape()) {
 			uint32_t vertexSize = rendererData->vertexDesc.GetSize();
 			if (rendererData->vertexDesc.HasFlag(RE::BSGraphics::Vertex::Flags::VF_COLORS)) {
 				uint32_t offset = rendererData->vertexDesc.GetAttributeOffset(RE::BSGraphics::Vertex::Attribute::VA_COLOR);
@@ -571,29 +829,141 @@ bool LightLimitFix::AddParticleLight(RE::BSRenderPass* a_pass, LightLimitFix::Co
 				if (!vertexColor || !alphaZero || !alphaOne)
 					return false;
 
-				color.red *= vertexColor->data[0] / 255.f;
-				color.green *= vertexColor->data[1] / 255.f;
-				color.blue *= vertexColor->data[2] / 255.f;
-				if (shaderProperty->flags.any(RE::BSShaderProperty::EShaderPropertyFlag::kVertexAlpha)) {
-					color.alpha *= vertexColor->data[3] / 255.f;
-				}
+				o_color.red = vertexColor->data[0] / 255.f;
+				o_color.green = vertexColor->data[1] / 255.f;
+				o_color.blue = vertexColor->data[2] / 255.f;
+				o_color.alpha = vertexColor->data[3] / 255.f;
 			}
 		}
 	}
+	return true;
+}
 
-	if (gradientConfig) {
-		auto grey = float3(config->colorMult.red, config->colorMult.green, config->colorMult.blue).Dot(float3(0.3f, 0.59f, 0.11f));
-		color.red *= grey * gradientConfig->color.red;
-		color.green *= grey * gradientConfig->color.green;
-		color.blue *= grey * gradientConfig->color.blue;
-	} else {
-		color.red *= config->colorMult.red;
-		color.green *= config->colorMult.green;
-		color.blue *= config->colorMult.blue;
+LightLimitFix::ParticleLightEntry* LightLimitFix::GetParticleLightEntry(RE::BSRenderPass* a_pass)
+{
+	// see https://www.nexusmods.com/skyrimspecialedition/articles/1391
+	auto shaderProperty = netimmerse_cast<RE::BSEffectShaderProperty*>(a_pass->shaderProperty);
+	if (!shaderProperty || shaderProperty->lightData)
+		return nullptr;
+	auto material = shaderProperty->GetMaterial();
+	if (!material || material->sourceTexturePath.empty())
+		return nullptr;
+
+	const void* rendererData = a_pass->geometry->GetGeometryRuntimeData().rendererData;
+	auto [it, inserted] = particleLightEntries.try_emplace(a_pass->geometry);
+	auto& entry = it->second;
+	entry.lastSeenFrame = particleLightFrame;
+
+	if (!inserted && particleLightCache && entry.shaderProperty == shaderProperty && entry.material == material && entry.rendererData == rendererData &&
+		entry.sourceTexture == material->sourceTexturePath.c_str() && entry.greyscaleTexture == material->greyscaleTexturePath.c_str()) {
+		particleLightCheckStats.cached++;
+		return &entry;
 	}
 
-	queuedParticleLights.insert({ a_pass->geometry, { color, *config } });
-	return true;
+	entry.shaderProperty = shaderProperty;
+	entry.material = material;
+	entry.rendererData = rendererData;
+	entry.sourceTexture = material->sourceTexturePath.c_str();
+	entry.greyscaleTexture = material->greyscaleTexturePath.c_str();
+	entry.configs = ResolveParticleLightConfigs(material);
+	if (entry.configs && !GetParticleVertexColor(a_pass->geometry, entry.vertexColor))
+		entry.configs.reset();
+	particleLightCheckStats.resolved++;
+	return &entry;
+}
+
+bool LightLimitFix::CheckParticleLight(RE::BSRenderPass* a_pass)
+{
+	auto* entry = GetParticleLightEntry(a_pass);
+	if (!entry || !entry->configs)
+		return true;
+
+	// Passes only queue the geometry, its light is worked out once per frame
+	if (entry->queuedFrame != particleLightFrame) {
+		entry->queuedFrame = particleLightFrame;
+
+		a_pass->geometry->IncRefCount();
+		if (const auto particleSystem = netimmerse_cast<RE::NiParticleSystem*>(a_pass->geometry)) {
+			if (auto particleData = particleSystem->GetParticleRuntimeData().particleData.get()) {
+				particleData->IncRefCount();
+			}
+		}
+		pendingParticleLights.push_back({ a_pass->geometry, entry->shaderProperty, *entry->configs, entry->vertexColor });
+	}
+
+	return !(settings.EnableParticleLightsCulling && entry->configs->first->cull);
+}
+
+bool LightLimitFix::CheckParticleLights(RE::BSRenderPass* a_pass, uint32_t)
+{
+	if (!settings.EnableParticleLights)
+		return true;
+
+	particleLightCheckStats.passes++;
+	if (!particleLightTiming)
+		return CheckParticleLight(a_pass);
+
+	const auto start = std::chrono::steady_clock::now();
+	const bool render = CheckParticleLight(a_pass);
+	particleLightCheckStats.milliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return render;
+}
+
+void LightLimitFix::QueueParticleLights()
+{
+	for (const auto& pending : pendingParticleLights) {
+		auto material = pending.shaderProperty->GetMaterial();
+		auto config = pending.configs.first;
+		auto gradientConfig = pending.configs.second;
+
+		RE::NiColorA color;
+		color.red = material->baseColor.red * material->baseColorScale;
+		color.green = material->baseColor.green * material->baseColorScale;
+		color.blue = material->baseColor.blue * material->baseColorScale;
+		color.alpha = material->baseColor.alpha * pending.shaderProperty->alpha;
+
+		if (auto emittance = pending.shaderProperty->unk88) {
+			color.red *= emittance->red;
+			color.green *= emittance->green;
+			color.blue *= emittance->blue;
+		}
+
+		color.red *= pending.vertexColor.red;
+		color.green *= pending.vertexColor.green;
+		color.blue *= pending.vertexColor.blue;
+		if (pending.shaderProperty->flags.any(RE::BSShaderProperty::EShaderPropertyFlag::kVertexAlpha)) {
+			color.alpha *= pending.vertexColor.alpha;
+		}
+
+		if (gradientConfig) {
+			auto grey = float3(config->colorMult.red, config->colorMult.green, config->colorMult.blue).Dot(float3(0.3f, 0.59f, 0.11f));
+			color.red *= grey * gradientConfig->color.red;
+			color.green *= grey * gradientConfig->color.green;
+			color.blue *= grey * gradientConfig->color.blue;
+		} else {
+			color.red *= config->colorMult.red;
+			color.green *= config->colorMult.green;
+			color.blue *= config->colorMult.blue;
+		}
+
+		queuedParticleLights.insert({ pending.geometry, { color, *config } });
+	}
+	particleLightCheckStats.queued = static_cast<uint32_t>(pendingParticleLights.size());
+	pendingParticleLights.clear();
+
+	lastParticleLightCheckStats = particleLightCheckStats;
+	particleLightCheckStats = {};
+
+	// Geometries which were not rendered for a while are most likely gone, and their address may be reused
+	if (particleLightFrame % ParticleLightEntryLifetime == 0) {
+		for (auto it = particleLightEntries.begin(); it != particleLightEntries.end();) {
+			if (particleLightFrame - it->second.lastSeenFrame > ParticleLightEntryLifetime)
+				it = particleLightEntries.erase(it);
+			else
+				++it;
+		}
+	}
+	particleLightFrame++;
 }
 
 void LightLimitFix::PostPostLoad()
@@ -614,7 +984,7 @@ float LightLimitFix::CalculateLightDistance(float3 a_lightPosition, float a_radi
 	return (a_lightPosition.x * a_lightPosition.x) + (a_lightPosition.y * a_lightPosition.y) + (a_lightPosition.z * a_lightPosition.z) - (a_radius * a_radius);
 }
 
-void LightLimitFix::AddCachedParticleLights(eastl::vector<LightData>& lightsData, LightLimitFix::LightData& light)
+void LightLimitFix::AddCachedParticleLights(GatherChunk& a_chunk, LightLimitFix::LightData& light)
 {
 	static float& lightFadeStart = *reinterpret_cast<float*>(REL::RelocationID(527668, 414582).address());
 	static float& lightFadeEnd = *reinterpret_cast<float*>(REL::RelocationID(527669, 414583).address());
@@ -634,20 +1004,28 @@ void LightLimitFix::AddCachedParticleLights(eastl::vector<LightData>& lightsData
 	light.color *= dimmer;
 
 	if ((light.color.x + light.color.y + light.color.z) > 1e-4 && light.radius > 1e-4) {
-		for (int eyeIndex = 0; eyeIndex < eyeCount; eyeIndex++)
-			light.positionVS[eyeIndex].data = DirectX::SimpleMath::Vector3::Transform(light.positionWS[eyeIndex].data, viewMatrixCached[eyeIndex]);
-
-		lightsData.push_back(light);
+		// stored at its world position like the slots, see TransformLights
+		light.positionWS[0].data += float3(eyePositionCached[0].x, eyePositionCached[0].y, eyePositionCached[0].z);
+		a_chunk.lights.push_back(light);
 
 		CachedParticleLight cachedParticleLight{};
 		cachedParticleLight.grey = float3(light.color.x, light.color.y, light.color.z).Dot(float3(0.3f, 0.59f, 0.11f));
 		cachedParticleLight.radius = light.radius;
-		cachedParticleLight.position = { light.positionWS[0].data.x + eyePositionCached[0].x, light.positionWS[0].data.y + eyePositionCached[0].y, light.positionWS[0].data.z + eyePositionCached[0].z };
+		cachedParticleLight.position = { light.positionWS[0].data.x, light.positionWS[0].data.y, light.positionWS[0].data.z };
 
-		cachedParticleLights.push_back(cachedParticleLight);
+		a_chunk.cachedParticleLights.push_back(cachedParticleLight);
 	}
 }
 
+uint64_t LightLimitFix::GetParticleCellKey(const RE::NiPoint3& a_position, float a_cellSize)
+{
+	// 21 bits per axis, which wraps far outside of any worldspace even with 1 unit cells
+	const auto axis = [a_cellSize](float a_value) {
+		return static_cast<uint64_t>(static_cast<int64_t>(std::floor(a_value / a_cellSize))) & 0x1FFFFF;
+	};
+	return axis(a_position.x) | (axis(a_position.y) << 21) | (axis(a_position.z) << 42);
+}
+
 float3 LightLimitFix::Saturation(float3 color, float saturation)
 {
 	float grey = color.Dot(float3(0.3f, 0.59f, 0.11f));
@@ -657,6 +1035,316 @@ float3 LightLimitFix::Saturation(float3 color, float saturation)
 	return color;
 }
 
+uint64_t LightLimitFix::GetRoomKey(RE::BSLight* a_light)
+{
+	// FNV-1a over the rooms and portals a light reaches, never 0 so it cannot be mistaken for a global light
+	uint64_t key = 0xcbf29ce484222325;
+	const auto mix = [&key](const void* a_node) {
+		key = (key ^ reinterpret_cast<uint64_t>(a_node)) * 0x100000001b3;
+	};
+	for (const auto& roomPtr : a_light->unk0D8)
+		mix(roomPtr);
+	mix(nullptr);
+	for (const auto& portalSharedNodePtr : a_light->unk108)
+		mix(portalSharedNodePtr);
+	return key | 1;
+}
+
+void LightLimitFix::ResolveLightRooms(LightData& a_light, RE::BSLight* a_bsLight)
+{
+	// Rooms first reached by the same light get consecutive indices, so the rooms of a light tend to share few words
+	std::fill_n(a_light.roomFlags, 4, 0u);
+	uint wordCount = 0;
+	bool overflowed = false;
+
+	const auto addRoom = [&](void* a_node) {
+		const auto [it, inserted] = roomNodes.try_emplace(static_cast<RE::NiNode*>(a_node), static_cast<uint32_t>(roomNodes.size()));
+		const uint word = it->second / 32;
+		uint wordSlot = 0;
+		while (wordSlot < wordCount && ((a_light.roomFlags[3] >> (wordSlot * ROOM_WORD_INDEX_BITS)) & ((1u << ROOM_WORD_INDEX_BITS) - 1)) != word)
+			wordSlot++;
+		if (wordSlot == wordCount) {
+			if (wordCount == ROOM_FLAG_WORDS || it->second >= MAX_ROOMS) {
+				overflowed = true;
+				return;
+			}
+			a_light.roomFlags[3] |= word << (wordSlot * ROOM_WORD_INDEX_BITS);
+			wordCount++;
+		}
+		a_light.roomFlags[wordSlot] |= 1u << (it->second % 32);
+	};
+
+	// List of BSMultiBoundRooms affected by a light
+	for (const auto& roomPtr : a_bsLight->unk0D8)
+		addRoom(roomPtr);
+	// List of BSPortalSharedNodes affected by a light
+	for (const auto& portalSharedNodePtr : a_bsLight->unk108)
+		addRoom(portalSharedNodePtr);
+
+	a_light.roomFlags[3] |= wordCount << (ROOM_FLAG_WORDS * ROOM_WORD_INDEX_BITS);
+
+	// Lighting every room is visibly wrong in fewer places than lighting none
+	if (overflowed) {
+		a_light.lightFlags.reset(LightFlags::PortalStrict);
+		lightRoomStats.overflowed++;
+	} else {
+		a_light.lightFlags.set(LightFlags::PortalStrict);
+	}
+}
+
+void LightLimitFix::ResolveGatheredLightRooms(uint32_t a_chunkCount)
+{
+	lightRoomStats = {};
+
+	// Room indices only stay meaningful while the same portal graphs are loaded
+	gatheredPortalGraphs.clear();
+	for (uint32_t i = 0; i < std::min(a_chunkCount, 2u); i++)
+		gatheredPortalGraphs.insert(gatheredPortalGraphs.end(), gatherChunks[i].portalGraphs.begin(), gatherChunks[i].portalGraphs.end());
+	std::sort(gatheredPortalGraphs.begin(), gatheredPortalGraphs.end());
+	gatheredPortalGraphs.erase(std::unique(gatheredPortalGraphs.begin(), gatheredPortalGraphs.end()), gatheredPortalGraphs.end());
+
+	const bool portalGraphsChanged = gatheredPortalGraphs != roomPortalGraphs;
+	if (portalGraphsChanged) {
+		roomPortalGraphs = gatheredPortalGraphs;
+		roomNodes.clear();
+		roomEpoch++;
+	}
+
+	for (uint32_t i = 0; i < std::min(a_chunkCount, 2u); i++) {
+		auto& chunk = gatherChunks[i];
+		if (portalGraphsChanged) {
+			for (uint32_t lightIndex = 0; lightIndex < chunk.lights.size(); lightIndex++) {
+				if (chunk.roomKeys[lightIndex]) {
+					ResolveLightRooms(chunk.lights[lightIndex], chunk.sources[lightIndex]);
+					lightRoomStats.resolved++;
+				}
+			}
+		} else {
+			for (const auto lightIndex : chunk.roomMisses)
+				ResolveLightRooms(chunk.lights[lightIndex], chunk.sources[lightIndex]);
+			lightRoomStats.resolved += static_cast<uint32_t>(chunk.roomMisses.size());
+			lightRoomStats.cached += chunk.roomCacheHits;
+		}
+	}
+}
+
+LightLimitFix::LightData LightLimitFix::GetEmptyLight()
+{
+	// no radius, so TransformLights places it far behind the camera where it never intersects a cluster
+	return LightData{};
+}
+
+void LightLimitFix::UpdateLightSlots(uint32_t a_chunkCount)
+{
+	lightSlotFrame++;
+	lightUploadStats = {};
+
+	const auto setDirty = [&](uint32_t a_slot) {
+		dirtyLightSlots[a_slot / 64] |= 1ull << (a_slot % 64);
+	};
+
+	// Lights which already have a slot, only uploaded again if anything about them changed
+
+	pendingLights.clear();
+	for (uint32_t chunkIndex = 0; chunkIndex < std::min(a_chunkCount, 2u); chunkIndex++) {
+		const auto& chunk = gatherChunks[chunkIndex];
+		for (uint32_t i = 0; i < chunk.lights.size(); i++) {
+			const auto it = lightSlotMap.find(chunk.sources[i]);
+			if (it == lightSlotMap.end()) {
+				pendingLights.emplace_back(chunkIndex, i);
+				continue;
+			}
+			auto& slot = lightSlots[it->second];
+			slot.lastSeenFrame = lightSlotFrame;
+			slot.roomKey = chunk.roomKeys[i];
+			slot.roomEpoch = roomEpoch;
+			if (std::memcmp(&lightsMirror[it->second], &chunk.lights[i], sizeof(LightData)) != 0) {
+				lightsMirror[it->second] = chunk.lights[i];
+				setDirty(it->second);
+				lightUploadStats.updated++;
+			}
+		}
+	}
+
+	// Lights which were not gathered this frame free their slot
+
+	for (auto it = lightSlotMap.begin(); it != lightSlotMap.end();) {
+		auto& slot = lightSlots[it->second];
+		if (slot.lastSeenFrame != lightSlotFrame) {
+			slot.light = nullptr;
+			lightsMirror[it->second] = GetEmptyLight();
+			setDirty(it->second);
+			freeLightSlots.push_back(it->second);
+			lightUploadStats.removed++;
+			it = lightSlotMap.erase(it);
+		} else {
+			++it;
+		}
+	}
+
+	while (lightSlotCount > 0 && !lightSlots[lightSlotCount - 1].light)
+		lightSlotCount--;
+	freeLightSlots.erase(std::remove_if(freeLightSlots.begin(), freeLightSlots.end(), [&](uint32_t a_slot) { return a_slot >= lightSlotCount; }), freeLightSlots.end());
+
+	// New lights take the lowest free slots first, to keep the slots compact
+
+	std::sort(freeLightSlots.begin(), freeLightSlots.end(), std::greater<uint32_t>());
+	for (const auto& [chunkIndex, i] : pendingLights) {
+		if (freeLightSlots.empty() && lightSlotCount == MAX_LIGHTS)
+			break;
+		auto* bsLight = gatherChunks[chunkIndex].sources[i];
+		const auto [it, inserted] = lightSlotMap.try_emplace(bsLight, 0);
+		if (!inserted)
+			continue;  // gathered twice this frame
+		uint32_t slotIndex;
+		if (!freeLightSlots.empty()) {
+			slotIndex = freeLightSlots.back();
+			freeLightSlots.pop_back();
+		} else {
+			slotIndex = lightSlotCount++;
+		}
+		it->second = slotIndex;
+		lightSlots[slotIndex] = { bsLight, lightSlotFrame, gatherChunks[chunkIndex].roomKeys[i], roomEpoch };
+		lightsMirror[slotIndex] = gatherChunks[chunkIndex].lights[i];
+		setDirty(slotIndex);
+		lightUploadStats.added++;
+	}
+
+	// Particle lights follow the last slot
+
+	lightCount = lightSlotCount;
+	for (uint32_t i = 2; i < a_chunkCount && lightCount < MAX_LIGHTS; i++) {
+		const auto count = std::min(static_cast<uint>(gatherChunks[i].lights.size()), MAX_LIGHTS - lightCount);
+		std::memcpy(lightsMirror.data() + lightCount, gatherChunks[i].lights.data(), sizeof(LightData) * count);
+		lightCount += count;
+	}
+}
+
+void LightLimitFix::UploadLights()
+{
+	static auto& context = State::GetSingleton()->context;
+
+	lightUploadRanges.clear();
+	if (lightsNeedFullUpload) {
+		if (lightCount)
+			lightUploadRanges.emplace_back(0, lightCount);
+		lightsNeedFullUpload = false;
+	} else {
+		// dirty slots past the last slot are either unused or overwritten by particle lights
+		for (uint32_t word = 0; word * 64 < lightSlotCount; word++) {
+			for (auto bits = dirtyLightSlots[word]; bits; bits &= bits - 1) {
+				const uint32_t slot = word * 64 + static_cast<uint32_t>(std::countr_zero(bits));
+				if (slot >= lightSlotCount)
+					break;
+				if (!lightUploadRanges.empty() && slot - lightUploadRanges.back().second <= LIGHT_UPLOAD_MERGE_GAP)
+					lightUploadRanges.back().second = slot + 1;
+				else
+					lightUploadRanges.emplace_back(slot, slot + 1);
+			}
+		}
+		if (lightCount > lightSlotCount) {
+			if (!lightUploadRanges.empty() && lightSlotCount - lightUploadRanges.back().second <= LIGHT_UPLOAD_MERGE_GAP)
+				lightUploadRanges.back().second = lightCount;
+			else
+				lightUploadRanges.emplace_back(lightSlotCount, lightCount);
+		}
+	}
+	std::fill(dirtyLightSlots.begin(), dirtyLightSlots.end(), 0);
+
+	if (lightUploadRanges.empty())
+		return;
+
+	// Ranges are packed one after another into the next staging buffer of the ring, then copied to their slots
+	auto* stagingBuffer = lightStagingBuffers[lightStagingIndex]->resource.get();
+	lightStagingIndex = (lightStagingIndex + 1) % LightStagingRingSize;
+
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	DX::ThrowIfFailed(context->Map(stagingBuffer, 0, D3D11_MAP_WRITE, 0, &mapped));
+	auto* stagingLights = static_cast<LightData*>(mapped.pData);
+	uint32_t stagingOffset = 0;
+	for (const auto& [first, last] : lightUploadRanges) {
+		std::memcpy(stagingLights + stagingOffset, lightsMirror.data() + first, sizeof(LightData) * (last - first));
+		stagingOffset += last - first;
+	}
+	context->Unmap(stagingBuffer, 0);
+
+	stagingOffset = 0;
+	for (const auto& [first, last] : lightUploadRanges) {
+		const D3D11_BOX box{ static_cast<UINT>(sizeof(LightData) * stagingOffset), 0, 0, static_cast<UINT>(sizeof(LightData) * (stagingOffset + last - first)), 1, 1 };
+		context->CopySubresourceRegion(lightSources->resource.get(), 0, static_cast<UINT>(sizeof(LightData) * first), 0, 0, stagingBuffer, 0, &box);
+		stagingOffset += last - first;
+	}
+
+	lightUploadStats.uploadedLights = stagingOffset;
+	lightUploadStats.uploadRanges = static_cast<uint32_t>(lightUploadRanges.size());
+}
+
+void LightLimitFix::TransformLight(const LightData& a_source, LightData& a_light) const
+{
+	// same as LightTransformCS.hlsl
+	a_light = a_source;
+	for (int eyeIndex = 0; eyeIndex < 2; eyeIndex++) {
+		const int cameraEye = std::min(eyeIndex, eyeCount - 1);
+		const auto& eyePosition = eyePositionCached[cameraEye];
+		a_light.positionWS[eyeIndex].data = a_source.positionWS[0].data - float3(eyePosition.x, eyePosition.y, eyePosition.z);
+		if (a_light.radius > 0)
+			a_light.positionVS[eyeIndex].data = DirectX::SimpleMath::Vector3::Transform(a_light.positionWS[eyeIndex].data, viewMatrixCached[cameraEye]);
+		else
+			a_light.positionVS[eyeIndex].data = { 0, 0, -1e9f };
+	}
+}
+
+void LightLimitFix::TransformLights(bool a_cullOnCpu)
+{
+	static auto& context = State::GetSingleton()->context;
+
+	// CPU cluster culling reads the lights relative to the camera, and without the compute shader they are uploaded from here
+	if (a_cullOnCpu || !lightTransformCS) {
+		cpuTransformedLights.resize(lightCount);
+		for (uint32_t i = 0; i < lightCount; i++)
+			TransformLight(lightsMirror[i], cpuTransformedLights[i]);
+	}
+
+	if (!lightTransformCS) {
+		if (lightCount) {
+			const D3D11_BOX box{ 0, 0, 0, static_cast<UINT>(sizeof(LightData) * lightCount), 1, 1 };
+			context->UpdateSubresource(lights->resource.get(), 0, &box, cpuTransformedLights.data(), 0, 0);
+		}
+		return;
+	}
+
+	if (!lightCount)
+		return;
+
+	LightTransformCB updateData{};
+	for (int eyeIndex = 0; eyeIndex < 2; eyeIndex++) {
+		const int cameraEye = std::min(eyeIndex, eyeCount - 1);
+		updateData.View[eyeIndex] = viewMatrixCached[cameraEye];
+		const auto& eyePosition = eyePositionCached[cameraEye];
+		updateData.EyePosition[eyeIndex] = float4(eyePosition.x, eyePosition.y, eyePosition.z, 0.0f);
+	}
+	updateData.LightCount = lightCount;
+	lightTransformCB->Update(updateData);
+
+	ID3D11Buffer* buffer = lightTransformCB->CB();
+	context->CSSetConstantBuffers(0, 1, &buffer);
+
+	ID3D11ShaderResourceView* srv = lightSources->srv.get();
+	context->CSSetShaderResources(0, 1, &srv);
+
+	ID3D11UnorderedAccessView* uav = lights->uav.get();
+	context->CSSetUnorderedAccessViews(0, 1, &uav, nullptr);
+
+	context->CSSetShader(lightTransformCS, nullptr, 0);
+	context->Dispatch((lightCount + 63) / 64, 1, 1);
+
+	ID3D11ShaderResourceView* null_srv = nullptr;
+	context->CSSetShaderResources(0, 1, &null_srv);
+
+	ID3D11UnorderedAccessView* null_uav = nullptr;
+	context->CSSetUnorderedAccessViews(0, 1, &null_uav, nullptr);
+}
+
 void LightLimitFix::UpdateLights()
 {
 	static float& cameraNear = (*(float*)(REL::RelocationID(517032, 403540).address() + 0x40));
@@ -665,6 +1353,9 @@ void LightLimitFix::UpdateLights()
 	lightsNear = cameraNear;
 	lightsFar = cameraFar;
 
+	if (clusterSettingsChanged)
+		SetupClusters();
+
 	auto shadowSceneNode = RE::BSShaderManager::State::GetSingleton().shadowSceneNode[0];
 
 	// Cache data since cameraData can become invalid in first-person
@@ -675,26 +1366,38 @@ void LightLimitFix::UpdateLights()
 		viewMatrixCached[eyeIndex].Invert(viewMatrixInverseCached[eyeIndex]);
 	}
 
-	eastl::vector<LightData> lightsData{};
-	lightsData.reserve(MAX_LIGHTS);
+	// Gather lights in parallel jobs, each writing into its own chunk. Chunks persist between frames so gathering does not allocate once warm.
 
-	// Process point lights
+	auto& shadowSceneNodeData = shadowSceneNode->GetRuntimeData();
 
-	roomNodes.empty();
+	particleLightList.clear();
+	uint32_t particleCount = 0;
+	for (auto& particleLight : particleLights) {
+		particleLightList.push_back(&particleLight);
+		const auto particleSystem = netimmerse_cast<RE::NiParticleSystem*>(particleLight.first);
+		const auto particleData = particleSystem ? particleSystem->GetParticleRuntimeData().particleData.get() : nullptr;
+		particleCount += particleData ? particleData->GetActiveVertexCount() : 1;
+	}
 
-	auto addRoom = [&](void* nodePtr, LightData& light) {
-		uint8_t roomIndex = 0;
-		auto* node = static_cast<RE::NiNode*>(nodePtr);
-		if (auto it = roomNodes.find(node); it == roomNodes.cend()) {
-			roomIndex = static_cast<uint8_t>(roomNodes.size());
-			roomNodes.insert_or_assign(node, roomIndex);
-		} else {
-			roomIndex = it->second;
-		}
-		light.roomFlags.SetBit(roomIndex, 1);
-	};
+	const uint32_t particleJobCount = std::clamp(particleCount / MIN_PARTICLES_PER_JOB, 1u, static_cast<uint32_t>(lightGatherPool.get_thread_count()));
+	const uint32_t chunkCount = 2 + particleJobCount;  // point lights, shadow lights, then particle system ranges
+	if (gatherChunks.size() < chunkCount)
+		gatherChunks.resize(chunkCount);
+	for (uint32_t i = 0; i < chunkCount; i++) {
+		gatherChunks[i].lights.clear();
+		gatherChunks[i].sources.clear();
+		gatherChunks[i].roomKeys.clear();
+		gatherChunks[i].roomMisses.clear();
+		gatherChunks[i].portalGraphs.clear();
+		gatherChunks[i].roomCacheHits = 0;
+		gatherChunks[i].cachedParticleLights.clear();
+		gatherChunks[i].particleCells.clear();
+		gatherChunks[i].particleInputs.clear();
+	}
+
+	// Process point lights
 
-	auto addLight = [&](const RE::NiPointer<RE::BSLight>& e) {
+	auto addLight = [&](const RE::NiPointer<RE::BSLight>& e, GatherChunk& chunk) {
 		if (auto bsLight = e.get()) {
 			if (auto niLight = bsLight->light.get()) {
 				if (IsValidLight(bsLight)) {
@@ -707,16 +1410,24 @@ void LightLimitFix::UpdateLights()
 
 					light.radius = runtimeData.radius.x;
 
+					// Rooms of strict lights are reused from their slot while they reach the same rooms of the same portal graphs,
+					// otherwise ResolveGatheredLightRooms indexes them once all jobs are done
+					uint64_t roomKey = 0;
+					bool roomsCached = false;
 					if (!IsGlobalLight(bsLight)) {
-						// List of BSMultiBoundRooms affected by a light
-						for (const auto& roomPtr : bsLight->unk0D8) {
-							addRoom(roomPtr, light);
-						}
-						// List of BSPortalSharedNodes affected by a light
-						for (const auto& portalSharedNodePtr : bsLight->unk108) {
-							addRoom(portalSharedNodePtr, light);
+						roomKey = GetRoomKey(bsLight);
+						if (chunk.portalGraphs.empty() || chunk.portalGraphs.back() != bsLight->portalGraph)
+							chunk.portalGraphs.push_back(bsLight->portalGraph);
+						if (const auto it = lightSlotMap.find(bsLight); it != lightSlotMap.end()) {
+							const auto& slot = lightSlots[it->second];
+							if (slot.roomKey == roomKey && slot.roomEpoch == roomEpoch) {
+								const auto& cachedLight = lightsMirror[it->second];
+								std::copy_n(cachedLight.roomFlags, 4, light.roomFlags);
+								if (cachedLight.lightFlags.any(LightFlags::PortalStrict))
+									light.lightFlags.set(LightFlags::PortalStrict);
+								roomsCached = true;
+							}
 						}
-						light.lightFlags.set(LightFlags::PortalStrict);
 					}
 
 					if (bsLight->IsShadowLight()) {
@@ -726,33 +1437,33 @@ void LightLimitFix::UpdateLights()
 						light.lightFlags.set(LightFlags::Shadow);
 					}
 
-					SetLightPosition(light, niLight->world.translate);
+					// the world position, so the light compares equal to its slot while it does not move, see TransformLights
+					const auto& position = niLight->world.translate;
+					light.positionWS[0].data = { position.x, position.y, position.z };
 
 					if ((light.color.x + light.color.y + light.color.z) > 1e-4 && light.radius > 1e-4) {
-						lightsData.push_back(light);
+						if (roomKey && !roomsCached)
+							chunk.roomMisses.push_back(static_cast<uint32_t>(chunk.lights.size()));
+						else if (roomKey)
+							chunk.roomCacheHits++;
+						chunk.lights.push_back(light);
+						chunk.sources.push_back(bsLight);
+						chunk.roomKeys.push_back(roomKey);
 					}
 				}
 			}
 		}
 	};
 
-	for (auto& e : shadowSceneNode->GetRuntimeData().activeLights) {
-		addLight(e);
-	}
-	for (auto& e : shadowSceneNode->GetRuntimeData().activeShadowLights) {
-		addLight(e);
-	}
-
-	{
-		std::lock_guard<std::shared_mutex> lk{ cachedParticleLightsMutex };
-		cachedParticleLights.clear();
+	// Process particle lights. With optimisation enabled, particles are binned into a world-space grid and each cell becomes a single light,
+	// which does not depend on the order particles are visited in.
 
-		LightData clusteredLight{};
-		uint32_t clusteredLights = 0;
+	const float particleCellSize = static_cast<float>(std::max(settings.ParticleLightsOptimisationClusterRadius, 1u));
+	const bool capturing = lightCaptureFramesLeft > 0;
 
-		auto eyePositionOffset = eyePositionCached[0] - eyePositionCached[1];
-
-		for (const auto& particleLight : particleLights) {
+	auto addParticleLights = [&](size_t first, size_t last, GatherChunk& chunk) {
+		for (size_t i = first; i < last; i++) {
+			const auto& particleLight = *particleLightList[i];
 			if (const auto particleSystem = netimmerse_cast<RE::NiParticleSystem*>(particleLight.first);
 				particleSystem && particleSystem->GetParticleRuntimeData().particleData.get()) {
 				// Process BSGeometry
@@ -761,6 +1472,7 @@ void LightLimitFix::UpdateLights()
 				auto numVertices = particleData->GetActiveVertexCount();
 				for (std::uint32_t p = 0; p < numVertices; p++) {
 					float radius = particleData->GetParticlesRuntimeData().sizes[p] * 70.0f;
+					radius *= settings.ParticleRadius * particleLight.second.config.radiusMult;
 
 					auto initialPosition = particleData->GetParticlesRuntimeData().positions[p];
 					if (!particleSystem->GetParticleSystemRuntimeData().isWorldspace) {
@@ -773,45 +1485,35 @@ void LightLimitFix::UpdateLights()
 
 					RE::NiPoint3 positionWS = initialPosition - eyePositionCached[0];
 
-					if (clusteredLights) {
-						auto averageRadius = clusteredLight.radius / (float)clusteredLights;
-						float radiusDiff = abs(averageRadius - radius);
-
-						auto averagePosition = clusteredLight.positionWS[0].data / (float)clusteredLights;
-						float positionDiff = positionWS.GetDistance({ averagePosition.x, averagePosition.y, averagePosition.z });
-
-						if ((radiusDiff + positionDiff) > settings.ParticleLightsOptimisationClusterRadius || !settings.EnableParticleLightsOptimization) {
-							clusteredLight.radius /= (float)clusteredLights;
-							clusteredLight.positionWS[0].data /= (float)clusteredLights;
-							clusteredLight.positionWS[1].data = clusteredLight.positionWS[0].data;
-							if (eyeCount == 2) {
-								clusteredLight.positionWS[1].data.x += eyePositionOffset.x / (float)clusteredLights;
-								clusteredLight.positionWS[1].data.y += eyePositionOffset.y / (float)clusteredLights;
-								clusteredLight.positionWS[1].data.z += eyePositionOffset.z / (float)clusteredLights;
-							}
-
-							AddCachedParticleLights(lightsData, clusteredLight);
-
-							clusteredLights = 0;
-							clusteredLight.color = { 0, 0, 0 };
-							clusteredLight.radius = 0;
-							clusteredLight.positionWS[0].data = { 0, 0, 0 };
-						}
-					}
-
 					float alpha = particleLight.second.color.alpha * particleData->GetParticlesRuntimeData().color[p].alpha;
 					float3 color;
 					color.x = particleLight.second.color.red * particleData->GetParticlesRuntimeData().color[p].red;
 					color.y = particleLight.second.color.green * particleData->GetParticlesRuntimeData().color[p].green;
 					color.z = particleLight.second.color.blue * particleData->GetParticlesRuntimeData().color[p].blue;
-					clusteredLight.color += Saturation(color, settings.ParticleLightsSaturation) * alpha * settings.ParticleBrightness;
+					color = Saturation(color, settings.ParticleLightsSaturation) * alpha * settings.ParticleBrightness;
+
+					if (!settings.EnableParticleLightsOptimization) {
+						LightData light{};
+						light.color = color;
+						light.radius = radius;
+						light.positionWS[0].data = { positionWS.x, positionWS.y, positionWS.z };
+						AddCachedParticleLights(chunk, light);
+						continue;
+					}
+
+					const float luminance = color.Dot(float3(0.3f, 0.59f, 0.11f));
+					if (luminance <= 0.0f)
+						continue;
 
-					clusteredLight.radius += radius * settings.ParticleRadius * particleLight.second.config.radiusMult;
-					clusteredLight.positionWS[0].data.x += positionWS.x;
-					clusteredLight.positionWS[0].data.y += positionWS.y;
-					clusteredLight.positionWS[0].data.z += positionWS.z;
+					if (capturing)
+						chunk.particleInputs.push_back({ { initialPosition.x, initialPosition.y, initialPosition.z }, radius, { color.x, color.y, color.z }, 0.0f });
 
-					clusteredLights++;
+					// cells are keyed by absolute position so they do not shift with the camera
+					auto& cell = chunk.particleCells[GetParticleCellKey(initialPosition, particleCellSize)];
+					cell.color += color;
+					cell.position += float3(positionWS.x, positionWS.y, positionWS.z) * luminance;
+					cell.radius += radius * luminance;
+					cell.weight += luminance;
 				}
 
 			} else {
@@ -827,35 +1529,96 @@ void LightLimitFix::UpdateLights()
 				light.color *= particleLight.second.color.alpha * settings.BillboardBrightness;
 				light.radius = particleLight.first->worldBound.radius * settings.BillboardRadius * particleLight.second.config.radiusMult;
 
-				auto position = particleLight.first->world.translate;
-
-				SetLightPosition(light, position);  // Light is complete for both eyes by now
+				auto positionWS = particleLight.first->world.translate - eyePositionCached[0];
+				light.positionWS[0].data = { positionWS.x, positionWS.y, positionWS.z };
 
-				AddCachedParticleLights(lightsData, light);
+				AddCachedParticleLights(chunk, light);
 			}
 		}
+	};
+
+	lightGatherPool.push_task([&]() {
+		for (auto& e : shadowSceneNodeData.activeShadowLights) {
+			addLight(e, gatherChunks[1]);
+		}
+	});
 
-		if (clusteredLights) {
-			clusteredLight.radius /= (float)clusteredLights;
-			clusteredLight.positionWS[0].data /= (float)clusteredLights;
-			clusteredLight.positionWS[1].data = clusteredLight.positionWS[0].data;
-			if (eyeCount == 2) {
-				clusteredLight.positionWS[1].data.x += eyePositionOffset.x / (float)clusteredLights;
-				clusteredLight.positionWS[1].data.y += eyePositionOffset.y / (float)clusteredLights;
-				clusteredLight.positionWS[1].data.z += eyePositionOffset.z / (float)clusteredLights;
+	// split particle systems into ranges of roughly equal particle count
+	{
+		size_t first = 0;
+		uint32_t rangeParticles = 0;
+		uint32_t job = 0;
+		for (size_t i = 0; i < particleLightList.size(); i++) {
+			const auto particleSystem = netimmerse_cast<RE::NiParticleSystem*>(particleLightList[i]->first);
+			const auto particleData = particleSystem ? particleSystem->GetParticleRuntimeData().particleData.get() : nullptr;
+			rangeParticles += particleData ? particleData->GetActiveVertexCount() : 1;
+			if (job + 1 < particleJobCount && rangeParticles * particleJobCount >= particleCount) {
+				lightGatherPool.push_task(addParticleLights, first, i + 1, std::ref(gatherChunks[2 + job]));
+				first = i + 1;
+				rangeParticles = 0;
+				job++;
 			}
-			AddCachedParticleLights(lightsData, clusteredLight);
 		}
+		lightGatherPool.push_task(addParticleLights, first, particleLightList.size(), std::ref(gatherChunks[2 + job]));
+	}
+
+	for (auto& e : shadowSceneNodeData.activeLights) {
+		addLight(e, gatherChunks[0]);
+	}
+
+	lightGatherPool.wait_for_tasks();
+
+	ResolveGatheredLightRooms(chunkCount);
+
+	if (capturing)
+		CaptureGatheredLights(chunkCount, particleCellSize);
+
+	// Merge the cells of all particle jobs, then emit one light per cell at its luminance-weighted centroid
+	if (settings.EnableParticleLightsOptimization) {
+		auto& particleCells = gatherChunks[2].particleCells;
+		for (uint32_t i = 3; i < chunkCount; i++) {
+			for (const auto& [key, cell] : gatherChunks[i].particleCells)
+				particleCells[key] += cell;
+		}
+
+		for (const auto& [key, cell] : particleCells) {
+			LightData light{};
+			light.color = cell.color;
+			light.radius = cell.radius / cell.weight;
+			light.positionWS[0].data = cell.position / cell.weight;
+			AddCachedParticleLights(gatherChunks[2], light);
+		}
+	}
+
+	{
+		auto& particleLightGrid = particleLightSnapshots.BeginWrite();
+		particleLightGrid.Clear();
+		for (uint32_t i = 2; i < chunkCount; i++)
+			particleLightGrid.Append({ gatherChunks[i].cachedParticleLights.data(), gatherChunks[i].cachedParticleLights.size() });
+		particleLightGrid.Build();
+		particleLightSnapshots.Publish();
 	}
 
+	UpdateLightSlots(chunkCount);
+
 	static auto& context = State::GetSingleton()->context;
 
+	const bool cullOnCpu = cpuClusterCulling || !clusterBuildingCS || !clusterCullingCS;
+
 	{
 		auto projMatrixUnjittered = Util::GetCameraData(0).projMatrixUnjittered;
 		float fov = atan(1.0f / static_cast<float4x4>(projMatrixUnjittered).m[0][0]) * 2.0f * (180.0f / 3.14159265359f);
 
-		static float _lightsNear = 0.0f, _lightsFar = 0.0f, _fov = 0.0f;
-		if (fabs(_fov - fov) > 1e-4 || fabs(_lightsNear - lightsNear) > 1e-4 || fabs(_lightsFar - lightsFar) > 1e-4) {
+		// the hybrid near slice has to end between the planes, which move with the camera
+		clusterNearSliceEnd = std::clamp(settings.ClusterNearSliceEnd, lightsNear * 2.0f, lightsFar * 0.5f);
+
+		static float _lightsNear = 0.0f, _lightsFar = 0.0f, _fov = 0.0f, _nearSliceEnd = 0.0f;
+		const bool gridChanged = clustersNeedRebuild || fabs(_fov - fov) > 1e-4 || fabs(_lightsNear - lightsNear) > 1e-4 || fabs(_lightsFar - lightsFar) > 1e-4 ||
+		                         fabs(_nearSliceEnd - clusterNearSliceEnd) > 1e-4;
+		if (gridChanged)
+			cpuClustersValid = false;
+
+		if (gridChanged || (cullOnCpu && !cpuClustersValid)) {
 			LightBuildingCB updateData{};
 			updateData.InvProjMatrix[0] = DirectX::XMMatrixInverse(nullptr, projMatrixUnjittered);
 			if (eyeCount == 1)
@@ -864,51 +1627,105 @@ void LightLimitFix::UpdateLights()
 				updateData.InvProjMatrix[1] = DirectX::XMMatrixInverse(nullptr, Util::GetCameraData(1).projMatrixUnjittered);
 			updateData.LightsNear = lightsNear;
 			updateData.LightsFar = lightsFar;
+			updateData.DepthSlicing = static_cast<uint>(clusterDepthSlicing);
+			updateData.NearSliceEnd = clusterNearSliceEnd;
 
-			lightBuildingCB->Update(updateData);
+			if (gridChanged && clusterBuildingCS) {
+				lightBuildingCB->Update(updateData);
 
-			ID3D11Buffer* buffer = lightBuildingCB->CB();
-			context->CSSetConstantBuffers(0, 1, &buffer);
+				ID3D11Buffer* buffer = lightBuildingCB->CB();
+				context->CSSetConstantBuffers(0, 1, &buffer);
 
-			ID3D11UnorderedAccessView* clusters_uav = clusters->uav.get();
-			context->CSSetUnorderedAccessViews(0, 1, &clusters_uav, nullptr);
+				ID3D11UnorderedAccessView* clusters_uav = clusters->uav.get();
+				context->CSSetUnorderedAccessViews(0, 1, &clusters_uav, nullptr);
 
-			context->CSSetShader(clusterBuildingCS, nullptr, 0);
-			context->Dispatch(clusterSize[0], clusterSize[1], clusterSize[2]);
+				context->CSSetShader(clusterBuildingCS, nullptr, 0);
+				context->Dispatch(clusterSize[0], clusterSize[1], clusterSize[2]);
 
-			ID3D11UnorderedAccessView* null_uav = nullptr;
-			context->CSSetUnorderedAccessViews(0, 1, &null_uav, nullptr);
+				ID3D11UnorderedAccessView* null_uav = nullptr;
+				context->CSSetUnorderedAccessViews(0, 1, &null_uav, nullptr);
+			}
+
+			if (cullOnCpu) {
+				LightCulling::GridDesc desc{ { clusterSize[0], clusterSize[1], clusterSize[2] }, lightsNear, lightsFar, maxClusterLights, static_cast<uint>(eyeCount),
+					clusterDepthSlicing, clusterNearSliceEnd };
+				LightCulling::Matrix invProj[2];
+				std::memcpy(invProj, updateData.InvProjMatrix, sizeof(invProj));
+				cpuClusterCuller.BuildClusters(desc, invProj);
+				cpuClustersValid = true;
+			}
 
 			_fov = fov;
 			_lightsNear = lightsNear;
 			_lightsFar = lightsFar;
+			_nearSliceEnd = clusterNearSliceEnd;
+			clustersNeedRebuild = false;
 		}
 	}
 
 	{
-		lightCount = std::min((uint)lightsData.size(), MAX_LIGHTS);
+		UploadLights();
+		TransformLights(cullOnCpu);
+
+		if (cullOnCpu) {
+			cpuCullingStats = cpuClusterCuller.Cull({ reinterpret_cast<const LightCulling::Light*>(cpuTransformedLights.data()), lightCount });
+
+			const LightGrid* grid = reinterpret_cast<const LightGrid*>(cpuClusterCuller.GetLightGrid().data());
+			const auto* indices = cpuClusterCuller.GetLightIndexList().data();
+			auto indexCount = static_cast<uint>(cpuClusterCuller.GetLightIndexList().size());
+
+			if (packedLightIndices) {
+				// ranges start on whole entries, like ClusterCullingCS.hlsl allocates them
+				const auto& cpuGrid = cpuClusterCuller.GetLightGrid();
+				cpuPackedLightGrid.resize(cpuGrid.size());
+				cpuPackedLightIndices.clear();
+				uint offset = 0;
+				for (size_t i = 0; i < cpuGrid.size(); i++) {
+					cpuPackedLightGrid[i] = { offset, cpuGrid[i].lightCount, { 0, 0 } };
+					for (uint j = 0; j < cpuGrid[i].lightCount; j += 2) {
+						const uint high = j + 1 < cpuGrid[i].lightCount ? indices[cpuGrid[i].offset + j + 1] : 0;
+						cpuPackedLightIndices.push_back(indices[cpuGrid[i].offset + j] | (high << 16));
+					}
+					offset += (cpuGrid[i].lightCount + 1) & ~1u;
+				}
+				grid = cpuPackedLightGrid.data();
+				indices = cpuPackedLightIndices.data();
+				indexCount = offset;
+			}
 
-		D3D11_MAPPED_SUBRESOURCE mapped;
-		DX::ThrowIfFailed(context->Map(lights->resource.get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped));
-		size_t bytes = sizeof(LightData) * lightCount;
-		memcpy_s(mapped.pData, bytes, lightsData.data(), bytes);
-		context->Unmap(lights->resource.get(), 0);
+			lightListStats = { indexCount, cpuCullingStats.saturatedClusters, cpuCullingStats.droppedLights, 0 };
+			ResizeLightList(indexCount);
+
+			context->UpdateSubresource(lightGrid->resource.get(), 0, nullptr, grid, 0, 0);
+			if (indexCount) {
+				const D3D11_BOX box{ 0, 0, 0, static_cast<UINT>(GetLightListEntries(indexCount) * sizeof(uint32_t)), 1, 1 };
+				context->UpdateSubresource(lightList->resource.get(), 0, &box, indices, 0, 0);
+			}
+		} else {
+			// before the dispatch, since resizing the light list discards its contents
+			ReadLightListStats();
 
-		LightCullingCB updateData{};
-		updateData.LightCount = lightCount;
-		lightCullingCB->Update(updateData);
+			LightCullingCB updateData{};
+			updateData.LightCount = lightCount;
+			updateData.LightListCapacity = lightListCapacity;
+			lightCullingCB->Update(updateData);
 
-		ID3D11Buffer* buffer = lightCullingCB->CB();
-		context->CSSetConstantBuffers(0, 1, &buffer);
+			const UINT clearCounters[4] = { 0, 0, 0, 0 };
+			context->ClearUnorderedAccessViewUint(lightCounter->uav.get(), clearCounters);
 
-		ID3D11ShaderResourceView* srvs[] = { clusters->srv.get(), lights->srv.get() };
-		context->CSSetShaderResources(0, 2, srvs);
+			ID3D11Buffer* buffer = lightCullingCB->CB();
+			context->CSSetConstantBuffers(0, 1, &buffer);
+
+			ID3D11ShaderResourceView* srvs[] = { clusters->srv.get(), lights->srv.get() };
+			context->CSSetShaderResources(0, 2, srvs);
 
-		ID3D11UnorderedAccessView* uavs[] = { lightCounter->uav.get(), lightList->uav.get(), lightGrid->uav.get() };
-		context->CSSetUnorderedAccessViews(0, 3, uavs, nullptr);
+			ID3D11UnorderedAccessView* uavs[] = { lightCounter->uav.get(), lightList->uav.get(), lightGrid->uav.get() };
+			context->CSSetUnorderedAccessViews(0, 3, uavs, nullptr);
 
-		context->CSSetShader(clusterCullingCS, nullptr, 0);
-		context->Dispatch((clusterSize[0] + 15) / 16, (clusterSize[1] + 15) / 16, (clusterSize[2] + 3) / 4);
+			context->CSSetShader(clusterCullingCS, nullptr, 0);
+			context->Dispatch((clusterSize[0] + CLUSTER_GROUP_SIZE[0] - 1) / CLUSTER_GROUP_SIZE[0], (clusterSize[1] + CLUSTER_GROUP_SIZE[1] - 1) / CLUSTER_GROUP_SIZE[1],
+				(clusterSize[2] + CLUSTER_GROUP_SIZE[2] - 1) / CLUSTER_GROUP_SIZE[2]);
+		}
 	}
 
 	context->CSSetShader(nullptr, nullptr, 0);
@@ -921,4 +1738,121 @@ void LightLimitFix::UpdateLights()
 
 	ID3D11UnorderedAccessView* null_uavs[3] = { nullptr };
 	context->CSSetUnorderedAccessViews(0, 3, null_uavs, nullptr);
+
+	if (occupancyHistogram)
+		UpdateOccupancy(cullOnCpu);
+
+	if (capturing)
+		WriteLightCapture(chunkCount);
+}
+
+void LightLimitFix::StartLightCapture()
+{
+	if (!lightCaptureWriter.Open(LightCapturePath)) {
+		logger::warn("[LLF] Failed to open {} for light capture", stl::utf16_to_utf8(LightCapturePath).value_or("<path>"));
+		return;
+	}
+	lightCaptureFramesLeft = static_cast<uint>(std::max(lightCaptureFrameCount, 1));
+	logger::info("[LLF] Capturing {} frames of lights", lightCaptureFramesLeft);
+}
+
+void LightLimitFix::CaptureGatheredLights(uint32_t a_chunkCount, float a_particleCellSize)
+{
+	static float& lightFadeStart = *reinterpret_cast<float*>(REL::RelocationID(527668, 414582).address());
+	static float& lightFadeEnd = *reinterpret_cast<float*>(REL::RelocationID(527669, 414583).address());
+
+	auto& frame = lightCaptureFrame;
+	frame.lights.clear();
+	frame.particles.clear();
+	for (uint32_t i = 0; i < a_chunkCount; i++) {
+		const auto& chunk = gatherChunks[i];
+		// captures hold lights relative to the camera, like the lights buffer
+		for (const auto& light : chunk.lights) {
+			LightData transformed;
+			TransformLight(light, transformed);
+			frame.lights.push_back(*reinterpret_cast<const LightCulling::Light*>(&transformed));
+		}
+		frame.particles.insert(frame.particles.end(), chunk.particleInputs.begin(), chunk.particleInputs.end());
+	}
+
+	frame.rooms.clear();
+	for (const auto& [node, index] : roomNodes)
+		frame.rooms.push_back({ reinterpret_cast<uint64_t>(node), index, 0 });
+
+	frame.info.particleOptimization = settings.EnableParticleLightsOptimization;
+	frame.info.particleCellSize = a_particleCellSize;
+	frame.info.lightFadeStart = lightFadeStart;
+	frame.info.lightFadeEnd = lightFadeEnd;
+}
+
+void LightLimitFix::WriteLightCapture(uint32_t a_chunkCount)
+{
+	auto& info = lightCaptureFrame.info;
+	info.frameIndex = RE::BSGraphics::State::GetSingleton()->frameCount;
+	info.eyeCount = static_cast<uint32_t>(eyeCount);
+	std::copy(clusterSize, clusterSize + 3, info.gridSize);
+	info.maxClusterLights = maxClusterLights;
+	info.slicing = static_cast<uint32_t>(clusterDepthSlicing);
+	info.nearSliceEnd = clusterNearSliceEnd;
+	info.lightsNear = lightsNear;
+	info.lightsFar = lightsFar;
+
+	for (int eyeIndex = 0; eyeIndex < 2; eyeIndex++) {
+		const int cameraEye = std::min(eyeIndex, eyeCount - 1);
+		const Matrix projection = Util::GetCameraData(cameraEye).projMatrixUnjittered;
+		const Matrix invProjection = DirectX::XMMatrixInverse(nullptr, Util::GetCameraData(cameraEye).projMatrixUnjittered);
+		std::memcpy(&info.view[eyeIndex], &viewMatrixCached[cameraEye], sizeof(LightCulling::Matrix));
+		std::memcpy(&info.projection[eyeIndex], &projection, sizeof(LightCulling::Matrix));
+		std::memcpy(&info.invProjection[eyeIndex], &invProjection, sizeof(LightCulling::Matrix));
+		const auto& eyePosition = eyePositionCached[cameraEye];
+		std::copy_n(&eyePosition.x, 3, info.eyePosition[eyeIndex]);
+	}
+
+	// the gathered light count after particle cells were turned into lights, slot holes are not part of the capture
+	info.gatheredLightCount = 0;
+	for (uint32_t i = 0; i < a_chunkCount; i++)
+		info.gatheredLightCount += static_cast<uint32_t>(gatherChunks[i].lights.size());
+
+	lightCaptureWriter.Write(lightCaptureFrame);
+
+	if (--lightCaptureFramesLeft == 0) {
+		logger::info("[LLF] Captured {} frames of lights to {}", lightCaptureWriter.GetFrameCount(), stl::utf16_to_utf8(LightCapturePath).value_or("<path>"));
+		lightCaptureWriter.Close();
+	}
+}
+
+void LightLimitFix::UpdateOccupancy(bool a_culledOnCpu)
+{
+	static auto& context = State::GetSingleton()->context;
+
+	std::span<const LightGrid> grid;
+	D3D11_MAPPED_SUBRESOURCE mapped{};
+	ID3D11Buffer* mappedBuffer = nullptr;
+
+	if (a_culledOnCpu) {
+		const auto& cpuGrid = cpuClusterCuller.GetLightGrid();
+		grid = { reinterpret_cast<const LightGrid*>(cpuGrid.data()), cpuGrid.size() };
+	} else {
+		// Read the grid culled a few frames ago so the GPU is never waited for
+		context->CopyResource(lightGridReadback[occupancyFrame % OccupancyReadbackLatency]->resource.get(), lightGrid->resource.get());
+		occupancyFrame++;
+		if (occupancyFrame < OccupancyReadbackLatency)
+			return;
+		mappedBuffer = lightGridReadback[occupancyFrame % OccupancyReadbackLatency]->resource.get();
+		if (FAILED(context->Map(mappedBuffer, 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped)))
+			return;
+		grid = { static_cast<const LightGrid*>(mapped.pData), static_cast<size_t>(clusterSize[0]) * clusterSize[1] * clusterSize[2] };
+	}
+
+	occupancyBuckets.fill(0.0f);
+	clusterSliceOccupancy.assign(clusterSize[2], 0.0f);
+	const uint sliceClusters = clusterSize[0] * clusterSize[1];
+	for (size_t i = 0; i < grid.size(); i++) {
+		const auto count = std::min(grid[i].lightCount, maxClusterLights);
+		occupancyBuckets[std::min(count * OccupancyBucketCount / maxClusterLights, OccupancyBucketCount - 1)]++;
+		clusterSliceOccupancy[i / sliceClusters] += static_cast<float>(count) / static_cast<float>(sliceClusters);
+	}
+
+	if (mappedBuffer)
+		context->Unmap(mappedBuffer, 0);
 }
\ No newline at end of file
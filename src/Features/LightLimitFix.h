@@ -2,12 +2,16 @@
 #include <DirectXMath.h>
 #include <d3d11.h>
 
+#include "BS_thread_pool.hpp"
 #include "Buffer.h"
 #include "Util.h"
 #include <shared_mutex>
 
 #include "Feature.h"
 #include "ShaderCache.h"
+#include <Features/LightLimitFix/ClusterCulling.h>
+#include <Features/LightLimitFix/LightCapture.h>
+#include <Features/LightLimitFix/ParticleLightGrid.h>
 #include <Features/LightLimitFix/ParticleLights.h>
 
 struct LightLimitFix : Feature
@@ -43,12 +47,18 @@ public:
 		float radius;
 		PositionOpt positionWS[2];
 		PositionOpt positionVS[2];
-		uint128_t roomFlags = uint32_t(0);
+		uint roomFlags[4]{};  // see ROOM_FLAG_WORDS
 		stl::enumeration<LightFlags> lightFlags;
 		uint32_t shadowMaskIndex = 0;
 		float pad0[2];
 	};
 
+	// A strict light stores the rooms it reaches as up to ROOM_FLAG_WORDS words of 32 rooms in roomFlags[0..2]. roomFlags[3] packs the
+	// index of each word in ROOM_WORD_INDEX_BITS bits, and the word count in its top bits, so room indices are not limited to 128.
+	static constexpr uint ROOM_FLAG_WORDS = 3;
+	static constexpr uint ROOM_WORD_INDEX_BITS = 10;
+	static constexpr uint MAX_ROOMS = 32 << ROOM_WORD_INDEX_BITS;
+
 	struct ClusterAABB
 	{
 		float4 minPoint;
@@ -67,11 +77,21 @@ public:
 		float4x4 InvProjMatrix[2];
 		float LightsNear;
 		float LightsFar;
-		uint pad0[2];
+		uint DepthSlicing;
+		float NearSliceEnd;
 	};
 
 	struct alignas(16) LightCullingCB
 	{
+		uint LightCount;
+		uint LightListCapacity;
+		uint pad[2];
+	};
+
+	struct alignas(16) LightTransformCB
+	{
+		float4x4 View[2];
+		float4 EyePosition[2];
 		uint LightCount;
 		uint pad[3];
 	};
@@ -81,8 +101,10 @@ public:
 		uint EnableContactShadows;
 		uint EnableLightsVisualisation;
 		uint LightsVisualisationMode;
-		float pad0;
-		uint ClusterSize[4];
+		float ClusterNearSliceEnd;
+		uint ClusterSize[4];  // the depth slicing in w
+		uint PackedLightIndices;
+		uint pad1[3];
 	};
 
 	PerFrame GetCommonBufferData();
@@ -97,12 +119,7 @@ public:
 
 	StrictLightData strictLightDataTemp;
 
-	struct CachedParticleLight
-	{
-		float grey;
-		RE::NiPoint3 position;
-		float radius;
-	};
+	using CachedParticleLight = ParticleLightGrid::Light;
 
 	std::unique_ptr<Buffer> strictLightData = nullptr;
 
@@ -112,17 +129,25 @@ public:
 
 	ID3D11ComputeShader* clusterBuildingCS = nullptr;
 	ID3D11ComputeShader* clusterCullingCS = nullptr;
+	ID3D11ComputeShader* lightTransformCS = nullptr;
 
 	ConstantBuffer* lightBuildingCB = nullptr;
 	ConstantBuffer* lightCullingCB = nullptr;
+	ConstantBuffer* lightTransformCB = nullptr;
 
-	eastl::unique_ptr<Buffer> lights = nullptr;
+	eastl::unique_ptr<Buffer> lightSources = nullptr;  // lights at their world position, written in ranges from lightsMirror
+	eastl::unique_ptr<Buffer> lights = nullptr;        // lights relative to the camera, written by LightTransformCS every frame
 	eastl::unique_ptr<Buffer> clusters = nullptr;
 	eastl::unique_ptr<Buffer> lightCounter = nullptr;
 	eastl::unique_ptr<Buffer> lightList = nullptr;
 	eastl::unique_ptr<Buffer> lightGrid = nullptr;
 
 	std::uint32_t lightCount = 0;
+
+	LightCulling::ClusterCuller cpuClusterCuller;
+	LightCulling::CullingStats cpuCullingStats;
+	bool cpuClusterCulling = false;  // cull on the CPU instead of ClusterCullingCS, always done if the compute shaders failed to compile
+	bool cpuClustersValid = false;
 	float lightsNear = 1;
 	float lightsFar = 16384;
 
@@ -135,11 +160,97 @@ public:
 	eastl::hash_map<RE::BSGeometry*, ParticleLightInfo> queuedParticleLights;
 	eastl::hash_map<RE::BSGeometry*, ParticleLightInfo> particleLights;
 
+	// Particles merged into one grid cell, positions and radii are weighted by luminance
+	struct ParticleCell
+	{
+		float3 color;
+		float3 position;
+		float radius = 0;
+		float weight = 0;
+
+		ParticleCell& operator+=(const ParticleCell& a_other)
+		{
+			color += a_other.color;
+			position += a_other.position;
+			radius += a_other.radius;
+			weight += a_other.weight;
+			return *this;
+		}
+	};
+
+	// Lights gathered by one job of UpdateLights
+	struct GatherChunk
+	{
+		eastl::vector<LightData> lights;
+		eastl::vector<RE::BSLight*> sources;  // BSLight of each entry in lights, only filled for point and shadow lights
+		eastl::vector<uint64_t> roomKeys;     // GetRoomKey of each entry in lights, only filled for point and shadow lights
+		eastl::vector<uint32_t> roomMisses;   // entries in lights whose rooms were not cached
+		eastl::vector<RE::BSPortalGraph*> portalGraphs;
+		uint32_t roomCacheHits = 0;
+		eastl::vector<CachedParticleLight> cachedParticleLights;
+		ankerl::unordered_dense::map<uint64_t, ParticleCell> particleCells;
+		eastl::vector<LightCulling::ParticleInput> particleInputs;  // only filled while capturing
+	};
+
+	BS::thread_pool lightGatherPool{ std::clamp(std::thread::hardware_concurrency() / 4, 1u, 4u) };
+	eastl::vector<GatherChunk> gatherChunks;
+	eastl::vector<eastl::hash_map<RE::BSGeometry*, ParticleLightInfo>::value_type*> particleLightList;
+
+	// Point and shadow lights keep their slot in the lights buffer for as long as they exist, so only lights which changed
+	// since the last frame are uploaded. Slots hold world positions, which do not change with the camera, and LightTransformCS
+	// moves them relative to the camera on the GPU. Particle lights change every frame and are appended after the last slot.
+	struct LightSlot
+	{
+		RE::BSLight* light = nullptr;  // nullptr if the slot is free
+		uint32_t lastSeenFrame = 0;
+		uint64_t roomKey = 0;    // rooms the roomFlags of the slot were resolved from
+		uint32_t roomEpoch = 0;  // roomNodes the roomFlags of the slot index into
+	};
+
+	struct LightUploadStats
+	{
+		uint32_t added = 0;
+		uint32_t removed = 0;
+		uint32_t updated = 0;
+		uint32_t uploadedLights = 0;  // including particle lights and unchanged lights between merged ranges
+		uint32_t uploadRanges = 0;
+	};
+
+	static constexpr uint32_t LightStagingRingSize = 3;  // frames a staging buffer can stay in flight before it is written again
+
+	eastl::vector<LightData> lightsMirror;          // CPU copy of the lightSources buffer
+	eastl::vector<LightData> cpuTransformedLights;  // lightsMirror relative to the camera, only filled for CPU cluster culling or without LightTransformCS
+	eastl::vector<LightSlot> lightSlots;
+	eastl::vector<uint64_t> dirtyLightSlots;  // one bit per slot
+	eastl::vector<uint32_t> freeLightSlots;
+	eastl::vector<std::pair<uint32_t, uint32_t>> pendingLights;  // (chunk, index) of gathered lights without a slot yet
+	eastl::vector<std::pair<uint32_t, uint32_t>> lightUploadRanges;
+	ankerl::unordered_dense::map<RE::BSLight*, uint32_t> lightSlotMap;
+	eastl::unique_ptr<Buffer> lightStagingBuffers[LightStagingRingSize];
+	uint32_t lightStagingIndex = 0;
+	uint32_t lightSlotCount = 0;  // slots in use by point and shadow lights, including free ones below the last used slot
+	uint32_t lightSlotFrame = 0;
+	bool lightsNeedFullUpload = true;
+	LightUploadStats lightUploadStats;
+
+	// Writes what UpdateLights gathered to a file for tools/LightCullingBenchmark to replay
+	static constexpr auto LightCapturePath = L"Data\\SKSE\\Plugins\\CommunityShadersLightCapture.bin";
+	LightCulling::CaptureWriter lightCaptureWriter;
+	LightCulling::CaptureFrame lightCaptureFrame;
+	uint lightCaptureFramesLeft = 0;
+	int lightCaptureFrameCount = 300;
+
 	RE::NiPoint3 eyePositionCached[2]{};
 	Matrix viewMatrixCached[2]{};
 	Matrix viewMatrixInverseCached[2]{};
 
 	virtual void SetupResources() override;
+	void SetupClusters();
+	uint GetLightListEntries(uint a_capacity) const;
+	uint GetMaxLightListCapacity() const;
+	void CreateLightList(uint a_capacity);
+	void ResizeLightList(uint a_demand);
+	void ReadLightListStats();
 	virtual void Reset() override;
 
 	virtual void LoadSettings(json& o_json) override;
@@ -153,9 +264,19 @@ public:
 	virtual void DataLoaded() override;
 
 	float CalculateLightDistance(float3 a_lightPosition, float a_radius);
-	void AddCachedParticleLights(eastl::vector<LightData>& lightsData, LightLimitFix::LightData& light);
+	void AddCachedParticleLights(GatherChunk& a_chunk, LightLimitFix::LightData& light);
 	void SetLightPosition(LightLimitFix::LightData& a_light, RE::NiPoint3 a_initialPosition, bool a_cached = true);
+	static uint64_t GetParticleCellKey(const RE::NiPoint3& a_position, float a_cellSize);
 	void UpdateLights();
+	static LightData GetEmptyLight();
+	void UpdateLightSlots(uint32_t a_chunkCount);
+	void UploadLights();
+	void TransformLight(const LightData& a_source, LightData& a_light) const;
+	void TransformLights(bool a_cullOnCpu);
+	void UpdateOccupancy(bool a_culledOnCpu);
+	void StartLightCapture();
+	void CaptureGatheredLights(uint32_t a_chunkCount, float a_particleCellSize);
+	void WriteLightCapture(uint32_t a_chunkCount);
 	virtual void Prepass() override;
 
 	static inline float3 Saturation(float3 color, float saturation);
@@ -177,16 +298,102 @@ public:
 		float BillboardRadius = 1.0f;
 		bool EnableParticleLightsOptimization = true;
 		uint ParticleLightsOptimisationClusterRadius = 32;
+		uint ClusterTileSize = 64;
+		uint ClusterDepthSlices = 32;
+		uint ClusterDepthSlicing = 0;  // LightCulling::DepthSlicing
+		float ClusterNearSliceEnd = 256.0f;
+		uint MaxClusterLights = 128;
+		bool PackedLightIndices = false;
 	};
 
+	// Cluster grid SetupClusters last built, settings are applied to it when clusterSettingsChanged is set
 	uint clusterSize[3] = { 16 };
+	LightCulling::DepthSlicing clusterDepthSlicing = LightCulling::DepthSlicing::Exponential;
+	float clusterNearSliceEnd = 256.0f;
+	uint maxClusterLights = 128;
+	bool packedLightIndices = false;
+	bool clusterSettingsChanged = false;
+	bool clustersNeedRebuild = true;
+
+	// Counters written by ClusterCullingCS.hlsl, in the order of lightCounter
+	struct LightListStats
+	{
+		uint demand = 0;              // light indices requested by all clusters, used to size the light list
+		uint overflowedClusters = 0;  // clusters intersecting more than maxClusterLights lights
+		uint droppedLights = 0;       // intersections dropped by those clusters, and by a full light list once read back
+		uint droppedIndices = 0;      // light indices dropped because the light list was full
+	};
+
+	static constexpr uint LightCounterReadbackLatency = 3;
+	uint lightListCapacity = 0;  // in light indices, two per entry if packed
+	uint lightListShrinkFrames = 0;
+	LightListStats lightListStats;
+	eastl::unique_ptr<Buffer> lightCounterReadback[LightCounterReadbackLatency];
+	uint lightCounterFrame = 0;
+	eastl::vector<LightGrid> cpuPackedLightGrid;
+	eastl::vector<uint32_t> cpuPackedLightIndices;
+
+	static constexpr uint OccupancyReadbackLatency = 3;
+	static constexpr uint OccupancyBucketCount = 16;
+	bool occupancyHistogram = false;
+	eastl::unique_ptr<Buffer> lightGridReadback[OccupancyReadbackLatency];
+	uint occupancyFrame = 0;
+	std::array<float, OccupancyBucketCount> occupancyBuckets{};  // clusters per range of light counts
+	eastl::vector<float> clusterSliceOccupancy;                  // mean lights per cluster of each depth slice
 
 	Settings settings;
 
 	using ConfigPair = std::pair<ParticleLights::Config*, ParticleLights::GradientConfig*>;
-	std::optional<ConfigPair> GetParticleLightConfigs(RE::BSRenderPass* a_pass);
-	bool AddParticleLight(RE::BSRenderPass* a_pass, ConfigPair a_config);
+
+	// What a render pass of a geometry needs to know about its particle light, resolved on first sight and again whenever the
+	// shader property, material, textures or vertex data of the geometry change
+	struct ParticleLightEntry
+	{
+		RE::BSEffectShaderProperty* shaderProperty = nullptr;
+		RE::BSEffectShaderMaterial* material = nullptr;
+		const char* sourceTexture = nullptr;  // BSFixedStrings are interned, so a texture changed if its pointer did
+		const char* greyscaleTexture = nullptr;
+		const void* rendererData = nullptr;
+		std::optional<ConfigPair> configs;  // nullopt if the textures have no config or the vertex colours rule the geometry out
+		RE::NiColorA vertexColor{ 1.0f, 1.0f, 1.0f, 1.0f };
+		uint32_t lastSeenFrame = 0;
+		uint32_t queuedFrame = 0;
+	};
+
+	// Particle lights found by render passes, turned into ParticleLightInfo once per frame by Reset
+	struct PendingParticleLight
+	{
+		RE::BSGeometry* geometry;
+		RE::BSEffectShaderProperty* shaderProperty;
+		ConfigPair configs;
+		RE::NiColorA vertexColor;
+	};
+
+	struct ParticleLightCheckStats
+	{
+		uint32_t passes = 0;
+		uint32_t cached = 0;
+		uint32_t resolved = 0;
+		uint32_t queued = 0;
+		double milliseconds = 0.0;  // only measured with particleLightTiming
+	};
+
+	static constexpr uint32_t ParticleLightEntryLifetime = 300;  // frames an entry is kept without being rendered
+
+	ankerl::unordered_dense::map<RE::BSGeometry*, ParticleLightEntry> particleLightEntries;
+	eastl::vector<PendingParticleLight> pendingParticleLights;
+	uint32_t particleLightFrame = 1;
+	bool particleLightCache = true;    // off resolves every pass, to compare the cost of render pass checks with and without it
+	bool particleLightTiming = false;  // times CheckParticleLights, which costs about as much as a cached check
+	ParticleLightCheckStats particleLightCheckStats;
+	ParticleLightCheckStats lastParticleLightCheckStats;
+
+	static std::optional<ConfigPair> ResolveParticleLightConfigs(RE::BSEffectShaderMaterial* a_material);
+	static bool GetParticleVertexColor(RE::BSGeometry* a_geometry, RE::NiColorA& o_color);
+	ParticleLightEntry* GetParticleLightEntry(RE::BSRenderPass* a_pass);
+	bool CheckParticleLight(RE::BSRenderPass* a_pass);
 	bool CheckParticleLights(RE::BSRenderPass* a_pass, uint32_t a_technique);
+	void QueueParticleLights();
 
 	void BSLightingShader_SetupGeometry_Before(RE::BSRenderPass* a_pass);
 
@@ -200,13 +407,29 @@ public:
 
 	void BSLightingShader_SetupGeometry_After(RE::BSRenderPass* a_pass);
 
-	std::shared_mutex cachedParticleLightsMutex;
-	eastl::vector<CachedParticleLight> cachedParticleLights;
-	std::uint32_t particleLightsDetectionHits = 0;
+	ParticleLightSnapshots particleLightSnapshots;  // rebuilt by UpdateLights, read by AI light level queries on other threads
+	std::atomic<std::uint32_t> particleLightsDetectionHits = 0;
+
+	// Rooms and portals reached by strict lights, indexed in the order they were first reached. Only rebuilt when the portal graphs of the
+	// gathered lights change, which also invalidates the rooms cached in lightSlots.
+	ankerl::unordered_dense::map<RE::NiNode*, uint32_t> roomNodes;
+	eastl::vector<RE::BSPortalGraph*> roomPortalGraphs;
+	eastl::vector<RE::BSPortalGraph*> gatheredPortalGraphs;
+	uint32_t roomEpoch = 1;
+
+	struct LightRoomStats
+	{
+		uint32_t cached = 0;
+		uint32_t resolved = 0;
+		uint32_t overflowed = 0;  // lights whose rooms did not fit into ROOM_FLAG_WORDS words, lit in every room instead
+	};
+	LightRoomStats lightRoomStats;
 
-	eastl::hash_map<RE::NiNode*, uint8_t> roomNodes;
+	static uint64_t GetRoomKey(RE::BSLight* a_light);
+	void ResolveLightRooms(LightData& a_light, RE::BSLight* a_bsLight);
+	void ResolveGatheredLightRooms(uint32_t a_chunkCount);
 
-	float CalculateLuminance(CachedParticleLight& light, RE::NiPoint3& point);
+	float CalculateLuminance(const CachedParticleLight& light, const RE::NiPoint3& point);
 	void AddParticleLightLuminance(RE::NiPoint3& targetPosition, int& numHits, float& lightLevel);
 
 	struct Hooks
@@ -60,12 +60,12 @@ ID3D11PixelShader* Skylighting::GetFoliagePS()
 void Skylighting::SkylightingShaderHacks()
 {
 	if (inOcclusion) {
-		auto& context = State::GetSingleton()->context;
+		auto state = State::GetSingleton();
 
 		if (foliage) {
-			context->PSSetShader(GetFoliagePS(), NULL, NULL);
+			state->bindCache.PSSetShader(state->context, GetFoliagePS());
 		} else {
-			context->PSSetShader(nullptr, NULL, NULL);
+			state->bindCache.PSSetShader(state->context, nullptr);
 		}
 	}
 }
@@ -149,17 +149,18 @@ void TerrainBlending::TerrainShaderHacks()
 {
 	if (renderTerrainDepth) {
 		auto renderer = RE::BSGraphics::Renderer::GetSingleton();
-		auto& context = State::GetSingleton()->context;
+		auto state = State::GetSingleton();
+		auto& context = state->context;
 		if (renderAltTerrain) {
 			auto dsv = renderer->GetDepthStencilData().depthStencils[RE::RENDER_TARGETS_DEPTHSTENCIL::kMAIN].views[0];
 			context->OMSetRenderTargets(0, nullptr, dsv);
-			context->VSSetShader(GetTerrainOffsetVertexShader(), NULL, NULL);
+			state->bindCache.VSSetShader(context, GetTerrainOffsetVertexShader());
 		} else {
 			auto dsv = terrainDepth.views[0];
 			context->OMSetRenderTargets(0, nullptr, dsv);
 			auto shadowState = RE::BSGraphics::RendererShadowState::GetSingleton();
 			GET_INSTANCE_MEMBER(currentVertexShader, shadowState)
-			context->VSSetShader((ID3D11VertexShader*)currentVertexShader->shader, NULL, NULL);
+			state->bindCache.VSSetShader(context, (ID3D11VertexShader*)currentVertexShader->shader);
 		}
 		renderAltTerrain = !renderAltTerrain;
 	}
@@ -187,8 +188,7 @@ void TerrainBlending::OverrideTerrainWorld()
 	context->OMSetDepthStencilState(terrainDepthStencilState, 0xFF);
 
 	// Used to get the distance of the surface to the lowest depth
-	auto view = terrainOffsetTexture->srv.get();
-	context->PSSetShaderResources(35, 1, &view);
+	State::GetSingleton()->bindCache.PSSetShaderResource(context, 35, terrainOffsetTexture->srv.get());
 }
 
 void TerrainBlending::OverrideTerrainDepth()
@@ -227,7 +227,7 @@ void TerrainBlending::ResetTerrainDepth()
 	stateUpdateFlags.set(RE::BSGraphics::ShaderFlags::DIRTY_RENDERTARGET);
 
 	GET_INSTANCE_MEMBER(currentVertexShader, shadowState)
-	context->VSSetShader((ID3D11VertexShader*)currentVertexShader->shader, NULL, NULL);
+	State::GetSingleton()->bindCache.VSSetShader(context, (ID3D11VertexShader*)currentVertexShader->shader);
 
 	context->CopyResource(terrainDepthTexture->resource.get(), mainDepth.texture);
 }
@@ -269,6 +269,9 @@ void TerrainBlending::BlendPrepassDepths()
 	ID3D11UnorderedAccessView* uavs[2] = { nullptr, nullptr };
 	context->CSSetUnorderedAccessViews(0, ARRAYSIZE(uavs), uavs, nullptr);
 
+	// Binding the offset texture as a UAV unbound it from the pixel shader
+	State::GetSingleton()->bindCache.InvalidatePSShaderResource(35);
+
 	ID3D11ComputeShader* shader = nullptr;
 	context->CSSetShader(shader, nullptr, 0);
 
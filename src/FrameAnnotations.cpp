@@ -1,6 +1,7 @@
 #include "FrameAnnotations.h"
 
 #include "State.h"
+#include "Util.h"
 
 #pragma comment(lib, "dxguid.lib")
 
@@ -43,7 +44,8 @@ namespace FrameAnnotations
 	{
 		static void thunk(void* imageSpaceShader, RE::BSTriShape* shape, RE::ImageSpaceEffectParam* param)
 		{
-			State::GetSingleton()->BeginPerfEvent(std::format("{} Draw", magic_enum::enum_name(EffectType)));
+			static const std::wstring title = Util::StringToWString(std::format("{} Draw", magic_enum::enum_name(EffectType)));
+			State::GetSingleton()->BeginPerfEvent(title.c_str());
 
 			func(imageSpaceShader, shape, param);
 
@@ -58,7 +60,8 @@ namespace FrameAnnotations
 	{
 		static void thunk(void* imageSpaceShader, uint32_t a1, uint32_t a2, uint32_t a3)
 		{
-			State::GetSingleton()->BeginPerfEvent(std::format("{} Dispatch", magic_enum::enum_name(EffectType)));
+			static const std::wstring title = Util::StringToWString(std::format("{} Dispatch", magic_enum::enum_name(EffectType)));
+			State::GetSingleton()->BeginPerfEvent(title.c_str());
 
 			func(imageSpaceShader, a1, a2, a3);
 
@@ -106,7 +109,7 @@ namespace FrameAnnotations
 	{
 		static void thunk(RE::BSShadowLight* light, void* a2)
 		{
-			State::GetSingleton()->BeginPerfEvent("Directional Light Shadowmaps");
+			State::GetSingleton()->BeginPerfEvent(L"Directional Light Shadowmaps");
 
 			func(light, a2);
 
@@ -120,7 +123,7 @@ namespace FrameAnnotations
 	{
 		static void thunk(RE::BSShadowLight* light, void* a2)
 		{
-			State::GetSingleton()->BeginPerfEvent("Spot Light Shadowmaps");
+			State::GetSingleton()->BeginPerfEvent(L"Spot Light Shadowmaps");
 
 			func(light, a2);
 
@@ -134,7 +137,7 @@ namespace FrameAnnotations
 	{
 		static void thunk(RE::BSShadowLight* light, void* a2)
 		{
-			State::GetSingleton()->BeginPerfEvent("Omnidirectional Light Shadowmaps");
+			State::GetSingleton()->BeginPerfEvent(L"Omnidirectional Light Shadowmaps");
 
 			func(light, a2);
 
@@ -171,7 +174,7 @@ namespace FrameAnnotations
 	{
 		static void thunk(bool a1, bool a2)
 		{
-			State::GetSingleton()->BeginPerfEvent("Depth");
+			State::GetSingleton()->BeginPerfEvent(L"Depth");
 
 			func(a1, a2);
 
@@ -184,7 +187,7 @@ namespace FrameAnnotations
 	{
 		static void thunk(bool a1)
 		{
-			State::GetSingleton()->BeginPerfEvent("Shadowmasks");
+			State::GetSingleton()->BeginPerfEvent(L"Shadowmasks");
 
 			func(a1);
 
@@ -197,7 +200,7 @@ namespace FrameAnnotations
 	{
 		static void thunk(bool a1)
 		{
-			State::GetSingleton()->BeginPerfEvent("World");
+			State::GetSingleton()->BeginPerfEvent(L"World");
 
 			func(a1);
 
@@ -210,7 +213,7 @@ namespace FrameAnnotations
 	{
 		static void thunk(bool a1, bool a2)
 		{
-			State::GetSingleton()->BeginPerfEvent("First Person View");
+			State::GetSingleton()->BeginPerfEvent(L"First Person View");
 
 			func(a1, a2);
 
@@ -223,7 +226,7 @@ namespace FrameAnnotations
 	{
 		static void thunk()
 		{
-			State::GetSingleton()->BeginPerfEvent("Water Effects");
+			State::GetSingleton()->BeginPerfEvent(L"Water Effects");
 
 			func();
 
@@ -236,7 +239,7 @@ namespace FrameAnnotations
 	{
 		static void thunk(void* a1, bool a2, bool a3)
 		{
-			State::GetSingleton()->BeginPerfEvent("Player View");
+			State::GetSingleton()->BeginPerfEvent(L"Player View");
 
 			func(a1, a2, a3);
 
@@ -249,7 +252,7 @@ namespace FrameAnnotations
 	{
 		static void thunk(void* accumulator, uint32_t renderFlags)
 		{
-			State::GetSingleton()->BeginPerfEvent("Effects");
+			State::GetSingleton()->BeginPerfEvent(L"Effects");
 
 			func(accumulator, renderFlags);
 
@@ -299,7 +302,7 @@ namespace FrameAnnotations
 	{
 		static void thunk(void* a1, void* a2, bool a3)
 		{
-			State::GetSingleton()->BeginPerfEvent("Volumetric Lighting");
+			State::GetSingleton()->BeginPerfEvent(L"Volumetric Lighting");
 
 			func(a1, a2, a3);
 
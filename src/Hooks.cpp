@@ -1,6 +1,7 @@
 #include "Hooks.h"
 
 #include "Menu.h"
+#include "Profiler.h"
 #include "ShaderCache.h"
 #include "State.h"
 #include "TruePBR.h"
@@ -61,6 +62,14 @@ void DumpShader(const REX::BSShader* thisClass, const ShaderType* shader, const
 
 struct BSShader_LoadShaders
 {
+	// permutations a previous session never drew are compiled after everything else
+	static SIE::CompilationPriority GetPrecompilePriority(const RE::BSShader& shader, SIE::ShaderClass shaderClass, uint32_t descriptor)
+	{
+		return SIE::ShaderCache::Instance().usageRecorder.IsKnownUnused(shader.shaderType.get(), shaderClass, descriptor) ?
+		           SIE::CompilationPriority::Speculative :
+		           SIE::CompilationPriority::Precompile;
+	}
+
 	static void thunk(RE::BSShader* shader, std::uintptr_t stream)
 	{
 		func(shader, stream);
@@ -79,7 +88,7 @@ struct BSShader_LoadShaders
 				auto vertexShaderDesriptor = entry->id;
 				auto pixelShaderDescriptor = entry->id;
 				State::GetSingleton()->ModifyShaderLookup(*shader, vertexShaderDesriptor, pixelShaderDescriptor);
-				shaderCache.GetVertexShader(*shader, vertexShaderDesriptor);
+				shaderCache.GetVertexShader(*shader, vertexShaderDesriptor, GetPrecompilePriority(*shader, SIE::ShaderClass::Vertex, vertexShaderDesriptor));
 			}
 			for (const auto& entry : shader->pixelShaders) {
 				if (entry->shader && shaderCache.IsDump()) {
@@ -89,9 +98,9 @@ struct BSShader_LoadShaders
 				auto vertexShaderDesriptor = entry->id;
 				auto pixelShaderDescriptor = entry->id;
 				State::GetSingleton()->ModifyShaderLookup(*shader, vertexShaderDesriptor, pixelShaderDescriptor);
-				shaderCache.GetPixelShader(*shader, pixelShaderDescriptor);
+				shaderCache.GetPixelShader(*shader, pixelShaderDescriptor, GetPrecompilePriority(*shader, SIE::ShaderClass::Pixel, pixelShaderDescriptor));
 				State::GetSingleton()->ModifyShaderLookup(*shader, vertexShaderDesriptor, pixelShaderDescriptor, true);
-				shaderCache.GetPixelShader(*shader, pixelShaderDescriptor);
+				shaderCache.GetPixelShader(*shader, pixelShaderDescriptor, GetPrecompilePriority(*shader, SIE::ShaderClass::Pixel, pixelShaderDescriptor));
 			}
 		}
 		BSShaderHooks::hk_LoadShaders((REX::BSShader*)shader, stream);
@@ -114,6 +123,12 @@ bool Hooks::BSShader_BeginTechnique::thunk(RE::BSShader* shader, uint32_t vertex
 
 	state->ModifyShaderLookup(*shader, state->modifiedVertexDescriptor, state->modifiedPixelDescriptor);
 
+	if (auto& usageRecorder = SIE::ShaderCache::Instance().usageRecorder; usageRecorder.IsEnabled()) {
+		usageRecorder.Record(shader->shaderType.get(), SIE::ShaderClass::Vertex, state->modifiedVertexDescriptor);
+		if (!skipPixelShader)
+			usageRecorder.Record(shader->shaderType.get(), SIE::ShaderClass::Pixel, state->modifiedPixelDescriptor);
+	}
+
 	bool shaderFound = func(shader, vertexDescriptor, pixelDescriptor, skipPixelShader);
 
 	if (!shaderFound) {
@@ -194,6 +209,7 @@ struct IDXGISwapChain_Present
 {
 	static HRESULT WINAPI thunk(IDXGISwapChain* This, UINT SyncInterval, UINT Flags)
 	{
+		Profiler::GetSingleton()->EndFrame();
 		State::GetSingleton()->Reset();
 		Menu::GetSingleton()->DrawOverlay();
 		Streamline::GetSingleton()->Present();
@@ -483,6 +499,7 @@ namespace Hooks
 		static void thunk(RE::BSGraphics::Renderer* This, RE::BSGraphics::VertexShader* a_vertexShader)
 		{
 			auto state = State::GetSingleton();
+			state->bindCache.InvalidateVertexShader();
 			if (!state->settingCustomShader) {
 				auto& shaderCache = SIE::ShaderCache::Instance();
 				if (shaderCache.IsEnabled()) {
@@ -515,6 +532,7 @@ namespace Hooks
 		static void thunk(RE::BSGraphics::Renderer* This, RE::BSGraphics::PixelShader* a_pixelShader)
 		{
 			auto state = State::GetSingleton();
+			state->bindCache.InvalidatePixelShader();
 			if (!state->settingCustomShader) {
 				auto& shaderCache = SIE::ShaderCache::Instance();
 				if (shaderCache.IsEnabled()) {
@@ -16,6 +16,7 @@
 #include "Features/LightLimitFix/ParticleLights.h"
 
 #include "Deferred.h"
+#include "Profiler.h"
 #include "TruePBR.h"
 
 #include "Streamline.h"
@@ -302,6 +303,32 @@ void Menu::DrawSettings()
 					"Only delete the Disk Cache manually if you are encountering issues. ");
 			}
 
+			ImGui::TableNextColumn();
+			if (ImGui::Button("Save Permutation Manifest", { -1, 0 })) {
+				shaderCache.WritePermutationManifest();
+			}
+			if (auto _tt = Util::HoverTooltipWrapper()) {
+				ImGui::Text(
+					"Saves every shader seen this session to Data\\ShaderCache\\Permutations.json. "
+					"The manifest can be used to build the Disk Cache without launching the game. ");
+			}
+
+			ImGui::TableNextColumn();
+			ImGui::BeginDisabled(!shaderCache.usageRecorder.IsEnabled());
+			if (ImGui::Button("Save Shader Usage", { -1, 0 })) {
+				if (shaderCache.usageRecorder.Write())
+					logger::info("Saved usage of {} shader permutations", shaderCache.usageRecorder.GetSessionCount());
+				else
+					logger::warn("Failed to save shader usage");
+			}
+			ImGui::EndDisabled();
+			if (auto _tt = Util::HoverTooltipWrapper()) {
+				ImGui::Text(
+					"Saves the shaders drawn so far, together with earlier saved sessions, to Data\\SKSE\\Plugins\\CommunityShadersUsage.bin and .json. "
+					"On the next start those shaders are compiled before the ones never drawn. "
+					"Requires \"Record Shader Usage\" in Advanced. ");
+			}
+
 			if (shaderCache.GetFailedTasks()) {
 				ImGui::TableNextRow();
 				ImGui::TableNextColumn();
@@ -783,19 +810,40 @@ void Menu::DrawAdvancedSettings()
 			ImGui::Text("Defines for Shader Compiler. Semicolon \";\" separated. Clear with space. Rebuild shaders after making change. Compute Shaders require a restart to recompile.");
 		}
 		ImGui::Spacing();
-		ImGui::SliderInt("Compiler Threads", &shaderCache.compilationThreadCount, 1, static_cast<int32_t>(std::thread::hardware_concurrency()));
+		if (ImGui::SliderInt("Compiler Threads", &shaderCache.compilationThreadCount, 1, static_cast<int32_t>(std::thread::hardware_concurrency())))
+			shaderCache.UpdateCompilationThreadCount();
 		if (auto _tt = Util::HoverTooltipWrapper()) {
 			ImGui::Text(
 				"Number of threads to use to compile shaders. "
 				"The more threads the faster compilation will finish but may make the system unresponsive. ");
 		}
-		ImGui::SliderInt("Background Compiler Threads", &shaderCache.backgroundCompilationThreadCount, 1, static_cast<int32_t>(std::thread::hardware_concurrency()));
+		if (ImGui::SliderInt("Background Compiler Threads", &shaderCache.backgroundCompilationThreadCount, 1, static_cast<int32_t>(std::thread::hardware_concurrency())))
+			shaderCache.UpdateCompilationThreadCount();
 		if (auto _tt = Util::HoverTooltipWrapper()) {
 			ImGui::Text(
 				"Number of threads to use to compile shaders while playing game. "
 				"This is activated if the startup compilation is skipped. "
 				"The more threads the faster compilation will finish but may make the system unresponsive. ");
 		}
+		bool useCompilerProcesses = shaderCache.UseCompilerProcesses();
+		if (ImGui::Checkbox("Compile in Separate Processes", &useCompilerProcesses)) {
+			shaderCache.SetCompilerProcesses(useCompilerProcesses);
+		}
+		if (auto _tt = Util::HoverTooltipWrapper()) {
+			ImGui::Text(
+				"Compile shaders in helper processes instead of the game. "
+				"A shader compiler crash then only fails that shader instead of crashing the game. "
+				"Falls back to compiling in the game if CommunityShadersCompiler.exe is missing. ");
+		}
+		bool recordShaderUsage = shaderCache.usageRecorder.IsEnabled();
+		if (ImGui::Checkbox("Record Shader Usage", &recordShaderUsage)) {
+			shaderCache.usageRecorder.SetEnabled(recordShaderUsage);
+		}
+		if (auto _tt = Util::HoverTooltipWrapper()) {
+			ImGui::Text(
+				"Records which shaders are actually drawn, so they can be saved with \"Save Shader Usage\" "
+				"and compiled first when building the Disk Cache. ");
+		}
 
 		if (ImGui::SliderInt("Test Interval", reinterpret_cast<int*>(&testInterval), 0, 10)) {
 			if (testInterval == 0) {
@@ -831,7 +879,7 @@ void Menu::DrawAdvancedSettings()
 		if (ImGui::Button("Dump Ini Settings", { -1, 0 })) {
 			Util::DumpSettingsOptions();
 		}
-		if (!shaderCache.blockedKey.empty()) {
+		if (shaderCache.blockedKeyIndex != (uint)-1) {
 			auto blockingButtonString = std::format("Stop Blocking {} Shaders", shaderCache.blockedIDs.size());
 			if (ImGui::Button(blockingButtonString.c_str(), { -1, 0 })) {
 				shaderCache.DisableShaderBlocking();
@@ -855,6 +903,13 @@ void Menu::DrawAdvancedSettings()
 		}
 		if (ImGui::TreeNodeEx("Statistics", ImGuiTreeNodeFlags_DefaultOpen)) {
 			ImGui::Text(std::format("Shader Compiler : {}", shaderCache.GetShaderStatsString()).c_str());
+			const auto& bindStats = State::GetSingleton()->bindCache.GetLastFrameStats();
+			ImGui::Text(std::format("Draw Binds : {} issued, {} elided", bindStats.issued, bindStats.elided).c_str());
+			if (auto _tt = Util::HoverTooltipWrapper()) {
+				ImGui::Text(
+					"Shader resources, constant buffers and shaders Community Shaders bound on draws last frame. "
+					"Elided binds were already bound and skipped the D3D call. ");
+			}
 			ImGui::TreePop();
 		}
 		ImGui::Checkbox("Extended Frame Annotations", &State::GetSingleton()->extendedFrameAnnotations);
@@ -901,6 +956,7 @@ void Menu::DrawAdvancedSettings()
 		}
 	}
 
+	Profiler::GetSingleton()->DrawSettings();
 	TruePBR::GetSingleton()->DrawSettings();
 	Menu::DrawDisableAtBootSettings();
 }
@@ -1009,7 +1065,9 @@ void Menu::DrawOverlay()
 	auto failed = shaderCache.GetFailedTasks();
 	auto hide = shaderCache.IsHideErrors();
 
-	if (!(shaderCache.IsCompiling() || IsEnabled || inTestMode || (failed && !hide))) {
+	auto profiler = Profiler::GetSingleton();
+
+	if (!(shaderCache.IsCompiling() || IsEnabled || inTestMode || (failed && !hide) || profiler->IsOverlayVisible())) {
 		auto& io = ImGui::GetIO();
 		io.ClearInputKeys();
 		io.ClearEventsQueue();
@@ -1096,6 +1154,8 @@ void Menu::DrawOverlay()
 		ImGui::End();
 	}
 
+	profiler->DrawOverlay();
+
 	ImGuiStyle& style = ImGui::GetStyle();
 	style = oldStyle;
 
@@ -1423,6 +1483,7 @@ void Menu::ProcessInputEventQueue()
 				} else if (key == settings.SkipCompilationKey) {
 					auto& shaderCache = SIE::ShaderCache::Instance();
 					shaderCache.backgroundCompilation = true;
+					shaderCache.UpdateCompilationThreadCount();
 				} else if (key == settings.EffectToggleKey) {
 					auto& shaderCache = SIE::ShaderCache::Instance();
 					shaderCache.SetEnabled(!shaderCache.IsEnabled());
@@ -0,0 +1,290 @@
+#include "Profiler.h"
+
+#include "State.h"
+#include "Util.h"
+
+namespace
+{
+	constexpr uint32_t MaxZonesPerFrame = 256;  // scopes are placed around passes, far fewer run in a frame
+
+	using Clock = std::chrono::high_resolution_clock;
+}
+
+Profiler::Scope::Scope(std::string_view a_name)
+{
+	auto profiler = GetSingleton();
+	if (profiler->frames[profiler->currentFrame].recording)
+		zone = profiler->BeginZone(a_name);
+}
+
+Profiler::Scope::~Scope()
+{
+	GetSingleton()->EndZone(zone);
+}
+
+void Profiler::Samples::Add(float a_value)
+{
+	values[next] = a_value;
+	next = (next + 1) % SampleCount;
+	count = std::min(count + 1, SampleCount);
+}
+
+Profiler::Percentiles Profiler::Samples::Get() const
+{
+	if (!count)
+		return {};
+
+	// Until the ring is full the samples are the first count values
+	auto sorted = values;
+	std::sort(sorted.begin(), sorted.begin() + count);
+	const auto at = [&](float a_percentile) { return sorted[std::min(count - 1, static_cast<uint32_t>(a_percentile * count))]; };
+	return { at(0.50f), at(0.95f), at(0.99f) };
+}
+
+int32_t Profiler::BeginZone(std::string_view a_name)
+{
+	auto& frame = frames[currentFrame];
+	if (!frame.recording || frame.zoneCount == MaxZonesPerFrame)
+		return -1;
+
+	auto it = timingIndices.find(a_name);
+	if (it == timingIndices.end()) {
+		it = timingIndices.emplace(std::string(a_name), static_cast<uint32_t>(timings.size())).first;
+		timings.push_back({ std::string(a_name) });
+	}
+
+	if (frame.zoneCount == frame.zones.size()) {
+		auto device = State::GetSingleton()->device;
+		D3D11_QUERY_DESC desc{ D3D11_QUERY_TIMESTAMP, 0 };
+		Zone newZone;
+		DX::ThrowIfFailed(device->CreateQuery(&desc, newZone.begin.put()));
+		DX::ThrowIfFailed(device->CreateQuery(&desc, newZone.end.put()));
+		frame.zones.push_back(std::move(newZone));
+	}
+
+	auto& zone = frame.zones[frame.zoneCount];
+	zone.timing = it->second;
+	zone.ended = false;
+	zone.cpuBegin = Clock::now();
+	State::GetSingleton()->context->End(zone.begin.get());
+	return static_cast<int32_t>(frame.zoneCount++);
+}
+
+void Profiler::EndZone(int32_t a_zone)
+{
+	auto& frame = frames[currentFrame];
+	if (a_zone < 0 || !frame.recording || static_cast<uint32_t>(a_zone) >= frame.zoneCount)
+		return;
+
+	auto& zone = frame.zones[a_zone];
+	State::GetSingleton()->context->End(zone.end.get());
+	zone.cpuMs = std::chrono::duration<float, std::milli>(Clock::now() - zone.cpuBegin).count();
+	zone.ended = true;
+}
+
+void Profiler::EndFrame()
+{
+	auto context = State::GetSingleton()->context;
+
+	if (frames[currentFrame].recording) {
+		EndZone(frameZone);
+		context->End(frames[currentFrame].disjoint.get());
+	}
+	frameZone = -1;
+
+	// The next frame reuses the queries of the oldest one, which the GPU had FrameLatency - 1 frames to finish
+	currentFrame = (currentFrame + 1) % FrameLatency;
+	auto& frame = frames[currentFrame];
+	if (frame.recording)
+		Resolve(frame);
+
+	frame.zoneCount = 0;
+	frame.recording = enabled;
+	if (frame.recording) {
+		if (!frame.disjoint) {
+			D3D11_QUERY_DESC desc{ D3D11_QUERY_TIMESTAMP_DISJOINT, 0 };
+			DX::ThrowIfFailed(State::GetSingleton()->device->CreateQuery(&desc, frame.disjoint.put()));
+		}
+		context->Begin(frame.disjoint.get());
+		frameZone = BeginZone("Frame");
+	}
+}
+
+void Profiler::Resolve(Frame& a_frame)
+{
+	auto context = State::GetSingleton()->context;
+
+	D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint{};
+	const bool gpuValid = context->GetData(a_frame.disjoint.get(), &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK && !disjoint.Disjoint;
+	if (!gpuValid)
+		droppedFrames++;
+
+	// Zones with the same name are summed, timings which did not run this frame get no sample
+	cpuFrameMs.assign(timings.size(), -1.0f);
+	gpuFrameMs.assign(timings.size(), -1.0f);
+	for (uint32_t i = 0; i < a_frame.zoneCount; i++) {
+		const auto& zone = a_frame.zones[i];
+		if (!zone.ended)
+			continue;
+
+		cpuFrameMs[zone.timing] = std::max(cpuFrameMs[zone.timing], 0.0f) + zone.cpuMs;
+
+		uint64_t begin = 0;
+		uint64_t end = 0;
+		if (gpuValid &&
+			context->GetData(zone.begin.get(), &begin, sizeof(begin), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK &&
+			context->GetData(zone.end.get(), &end, sizeof(end), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK) {
+			const auto gpuMs = static_cast<float>(static_cast<double>(end - begin) * 1000.0 / static_cast<double>(disjoint.Frequency));
+			gpuFrameMs[zone.timing] = std::max(gpuFrameMs[zone.timing], 0.0f) + gpuMs;
+		}
+	}
+
+	for (size_t i = 0; i < timings.size(); i++) {
+		if (cpuFrameMs[i] >= 0.0f)
+			timings[i].cpu.Add(cpuFrameMs[i]);
+		if (gpuFrameMs[i] >= 0.0f)
+			timings[i].gpu.Add(gpuFrameMs[i]);
+	}
+	resolvedFrames++;
+}
+
+void Profiler::Clear()
+{
+	// Timings stay, zones of frames still in flight refer to them
+	for (auto& timing : timings) {
+		timing.cpu = {};
+		timing.gpu = {};
+	}
+	resolvedFrames = 0;
+	droppedFrames = 0;
+}
+
+void Profiler::DrawSettings()
+{
+	if (ImGui::CollapsingHeader("Frame Timings", ImGuiTreeNodeFlags_OpenOnArrow | ImGuiTreeNodeFlags_OpenOnDoubleClick)) {
+		ImGui::Checkbox("Enable Frame Timings", &enabled);
+		if (auto _tt = Util::HoverTooltipWrapper()) {
+			ImGui::Text(
+				"Times the passes Community Shaders adds on the CPU and the GPU. "
+				"GPU timestamps cost a little GPU time, so only enable this while measuring. ");
+		}
+		ImGui::Checkbox("Show Overlay", &showOverlay);
+		if (auto _tt = Util::HoverTooltipWrapper()) {
+			ImGui::Text(
+				"Shows the 50th, 95th and 99th percentile of every pass over the last frames, in milliseconds. "
+				"The overlay stays visible when the menu is closed. ");
+		}
+
+		ImGui::Text(std::format("Frames : {} timed, {} without GPU times", resolvedFrames, droppedFrames).c_str());
+		if (auto _tt = Util::HoverTooltipWrapper()) {
+			ImGui::Text(
+				"Frames are timed a few frames after they were rendered. "
+				"A frame has no GPU times if the GPU was not done with it yet or its clock changed frequency. ");
+		}
+
+		if (ImGui::Button("Export CSV"))
+			exportStatus = ExportCSV() ? std::format("Saved {}", Util::WStringToString(CsvPath)) : "Failed to save timings";
+		ImGui::SameLine();
+		if (ImGui::Button("Export JSON"))
+			exportStatus = ExportJSON() ? std::format("Saved {}", Util::WStringToString(JsonPath)) : "Failed to save timings";
+		ImGui::SameLine();
+		if (ImGui::Button("Clear"))
+			Clear();
+		if (!exportStatus.empty())
+			ImGui::Text(exportStatus.c_str());
+	}
+}
+
+void Profiler::DrawOverlay()
+{
+	if (!IsOverlayVisible())
+		return;
+
+	ImGui::SetNextWindowBgAlpha(0.6f);
+	ImGui::SetNextWindowPos(ImVec2(ImGui::GetIO().DisplaySize.x - 10, 10), ImGuiCond_Always, ImVec2(1, 0));
+	if (!ImGui::Begin("FrameTimings", nullptr, ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoSavedSettings | ImGuiWindowFlags_NoInputs)) {
+		ImGui::End();
+		return;
+	}
+
+	ImGui::Text(std::format("Frame Timings (ms), last {} frames", std::min(resolvedFrames, SampleCount)).c_str());
+	if (ImGui::BeginTable("##FrameTimings", 7, ImGuiTableFlags_SizingFixedFit | ImGuiTableFlags_RowBg)) {
+		for (const auto* column : { "Pass", "CPU p50", "CPU p95", "CPU p99", "GPU p50", "GPU p95", "GPU p99" })
+			ImGui::TableSetupColumn(column);
+		ImGui::TableHeadersRow();
+
+		for (const auto& timing : timings) {
+			const auto cpu = timing.cpu.Get();
+			const auto gpu = timing.gpu.Get();
+			ImGui::TableNextColumn();
+			ImGui::TextUnformatted(timing.name.c_str());
+			for (const float value : { cpu.p50, cpu.p95, cpu.p99 }) {
+				ImGui::TableNextColumn();
+				ImGui::Text(std::format("{:.2f}", value).c_str());
+			}
+			for (const float value : { gpu.p50, gpu.p95, gpu.p99 }) {
+				ImGui::TableNextColumn();
+				ImGui::Text(timing.gpu.count ? std::format("{:.2f}", value).c_str() : "-");
+			}
+		}
+		ImGui::EndTable();
+	}
+	ImGui::End();
+}
+
+bool Profiler::ExportCSV() const
+{
+	std::ofstream file(CsvPath, std::ios::trunc);
+	if (!file.is_open())
+		return false;
+
+	file << "Pass,CPU Samples,CPU p50 (ms),CPU p95 (ms),CPU p99 (ms),GPU Samples,GPU p50 (ms),GPU p95 (ms),GPU p99 (ms)\n";
+	for (const auto& timing : timings) {
+		const auto cpu = timing.cpu.Get();
+		const auto gpu = timing.gpu.Get();
+		file << std::format("\"{}\",{},{:.4f},{:.4f},{:.4f},{},{:.4f},{:.4f},{:.4f}\n", timing.name,
+			timing.cpu.count, cpu.p50, cpu.p95, cpu.p99, timing.gpu.count, gpu.p50, gpu.p95, gpu.p99);
+	}
+	return file.good();
+}
+
+bool Profiler::ExportJSON() const
+{
+	// Samples from oldest to newest
+	const auto toList = [](const Samples& a_samples) {
+		json list = json::array();
+		const uint32_t first = a_samples.count == SampleCount ? a_samples.next : 0;
+		for (uint32_t i = 0; i < a_samples.count; i++)
+			list.push_back(a_samples.values[(first + i) % SampleCount]);
+		return list;
+	};
+	const auto toPercentiles = [](const Percentiles& a_percentiles) {
+		return json{ { "p50", a_percentiles.p50 }, { "p95", a_percentiles.p95 }, { "p99", a_percentiles.p99 } };
+	};
+
+	json passes = json::array();
+	for (const auto& timing : timings) {
+		passes.push_back({
+			{ "Name", timing.name },
+			{ "CPU", toPercentiles(timing.cpu.Get()) },
+			{ "GPU", toPercentiles(timing.gpu.Get()) },
+			{ "CPU Samples", toList(timing.cpu) },
+			{ "GPU Samples", toList(timing.gpu) },
+		});
+	}
+
+	auto state = State::GetSingleton();
+	json timingsJson;
+	timingsJson["Version"] = Plugin::VERSION.string();
+	timingsJson["Adapter"] = state->adapterDescription;
+	timingsJson["VR"] = state->isVR;
+	timingsJson["Frames"] = resolvedFrames;
+	timingsJson["Frames Without GPU Times"] = droppedFrames;
+	timingsJson["Passes"] = std::move(passes);
+
+	std::ofstream file(JsonPath, std::ios::trunc);
+	if (!file.is_open())
+		return false;
+	file << timingsJson.dump(1, '\t');
+	return file.good();
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <d3d11.h>
+#include <winrt/base.h>
+
+/**
+ * CPU and GPU timings of the passes Community Shaders adds, for users who cannot run Tracy.
+ *
+ * GPU times come from timestamp queries which are only read back FrameLatency frames later, so profiling never waits on the GPU.
+ * Every zone keeps its times of the last SampleCount frames, which the overlay shows as percentiles and the export writes out.
+ */
+class Profiler
+{
+public:
+	static Profiler* GetSingleton()
+	{
+		static Profiler singleton;
+		return &singleton;
+	}
+
+	static constexpr uint32_t FrameLatency = 4;
+	static constexpr uint32_t SampleCount = 512;
+	static constexpr auto CsvPath = L"Data\\SKSE\\Plugins\\CommunityShadersTimings.csv";
+	static constexpr auto JsonPath = L"Data\\SKSE\\Plugins\\CommunityShadersTimings.json";
+
+	/**
+	 * Times the enclosing block on the CPU and the GPU, if the profiler is enabled.
+	 * Zones with the same name are summed per frame.
+	 */
+	class Scope
+	{
+	public:
+		explicit Scope(std::string_view a_name);
+		~Scope();
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+	private:
+		int32_t zone = -1;  // zone of the recording frame, -1 if nothing is recorded
+	};
+
+	struct Percentiles
+	{
+		float p50 = 0.0f;
+		float p95 = 0.0f;
+		float p99 = 0.0f;
+	};
+
+	bool enabled = false;
+	bool showOverlay = true;
+
+	/** @brief Ends the frame being recorded and reads back the oldest one. Called on present. */
+	void EndFrame();
+	void Clear();
+
+	void DrawSettings();
+	void DrawOverlay();
+	bool IsOverlayVisible() const { return enabled && showOverlay; }
+
+	bool ExportCSV() const;
+	bool ExportJSON() const;
+
+private:
+	struct Samples
+	{
+		std::array<float, SampleCount> values{};
+		uint32_t next = 0;
+		uint32_t count = 0;
+
+		void Add(float a_value);
+		Percentiles Get() const;
+	};
+
+	struct Timing
+	{
+		std::string name;
+		Samples cpu;  // milliseconds
+		Samples gpu;  // milliseconds, only frames without a disjoint GPU clock
+	};
+
+	struct Zone
+	{
+		uint32_t timing = 0;
+		winrt::com_ptr<ID3D11Query> begin;
+		winrt::com_ptr<ID3D11Query> end;
+		std::chrono::high_resolution_clock::time_point cpuBegin;
+		float cpuMs = 0.0f;
+		bool ended = false;
+	};
+
+	struct Frame
+	{
+		winrt::com_ptr<ID3D11Query> disjoint;
+		std::vector<Zone> zones;  // kept between frames so the queries are only created once
+		uint32_t zoneCount = 0;
+		bool recording = false;
+	};
+
+	struct StringHash
+	{
+		using is_transparent = void;
+		size_t operator()(std::string_view a_string) const { return std::hash<std::string_view>{}(a_string); }
+	};
+
+	int32_t BeginZone(std::string_view a_name);
+	void EndZone(int32_t a_zone);
+	void Resolve(Frame& a_frame);
+
+	std::array<Frame, FrameLatency> frames;
+	uint32_t currentFrame = 0;
+	int32_t frameZone = -1;
+
+	std::vector<Timing> timings;  // in the order zones were first seen
+	std::unordered_map<std::string, uint32_t, StringHash, std::equal_to<>> timingIndices;
+	std::vector<float> cpuFrameMs;  // per timing, reused by Resolve
+	std::vector<float> gpuFrameMs;
+	uint32_t resolvedFrames = 0;
+	uint32_t droppedFrames = 0;  // queries not done FrameLatency frames later, or a disjoint GPU clock
+	std::string exportStatus;
+};
@@ -9,6 +9,8 @@
 
 #include "Deferred.h"
 #include "Feature.h"
+#include "ShaderCompilerProcess.h"
+#include "ShaderIncludeHandler.h"
 #include "State.h"
 
 #include "Features/DynamicCubemaps.h"
@@ -19,12 +21,6 @@ namespace SIE
 	{
 		static void GetShaderDefines(const RE::BSShader&, uint32_t, D3D_SHADER_MACRO*);
 		static std::string GetShaderString(ShaderClass, const RE::BSShader&, uint32_t, bool = false);
-		/**
-		@brief Get the BSShader::Type from the ShaderString
-		@param a_key The key generated from GetShaderString
-		@return A string with a valid BSShader::Type
-		*/
-		static std::string GetTypeFromShaderString(const std::string&);
 		constexpr const char* VertexShaderProfile = "vs_5_0";
 		constexpr const char* PixelShaderProfile = "ps_5_0";
 		constexpr const char* ComputeShaderProfile = "cs_5_0";
@@ -1054,6 +1050,20 @@ namespace SIE
 			return result;
 		}
 
+		template <class ShaderType>
+		static void ReleaseShader(const std::unique_ptr<ShaderType>& shader)
+		{
+			if (shader && shader->shader)
+				shader->shader->Release();
+		}
+
+		template <class ShaderType>
+		static void ReleaseShaders(const std::vector<std::unique_ptr<ShaderType>>& shaders)
+		{
+			for (const auto& shader : shaders)
+				ReleaseShader(shader);
+		}
+
 		static void AddAttribute(uint64_t& desc, RE::BSGraphics::Vertex::Attribute attribute)
 		{
 			desc |= ((1ull << (44 + attribute)) | (1ull << (54 + attribute)) |
@@ -1221,17 +1231,44 @@ namespace SIE
 			mapBufferConsts("PerGeometry", bufferSizes[2]);
 		}
 
-		std::wstring GetDiskPath(const std::string_view& name, uint32_t descriptor, ShaderClass shaderClass)
+		static uint64_t GetDiskCacheKey(const std::string_view& name, uint32_t descriptor, ShaderClass shaderClass)
 		{
-			switch (shaderClass) {
-			case ShaderClass::Pixel:
-				return std::format(L"Data/ShaderCache/{}/{:X}.pso", std::wstring(name.begin(), name.end()), descriptor);
-			case ShaderClass::Vertex:
-				return std::format(L"Data/ShaderCache/{}/{:X}.vso", std::wstring(name.begin(), name.end()), descriptor);
-			case ShaderClass::Compute:
-				return std::format(L"Data/ShaderCache/{}/{:X}.cso", std::wstring(name.begin(), name.end()), descriptor);
+			return ShaderCacheArchive::Hash(std::format("{}:{}:{:X}", name, magic_enum::enum_name(shaderClass), descriptor));
+		}
+
+		/**
+		@brief Runs the preprocessor, for compiler processes which get the source with all includes and defines applied
+		*/
+		static winrt::com_ptr<ID3DBlob> PreprocessShader(const std::string& source, const std::string& sourceName, std::array<D3D_SHADER_MACRO, 64>& defines,
+			ShaderIncludeHandler& includeHandler)
+		{
+			winrt::com_ptr<ID3DBlob> preprocessed;
+			winrt::com_ptr<ID3DBlob> errors;
+			if (FAILED(D3DPreprocess(source.data(), source.size(), sourceName.c_str(), defines.data(), &includeHandler, preprocessed.put(), errors.put())))
+				return nullptr;
+			return preprocessed;
+		}
+
+		/**
+		@brief Hash every input of a compile: the source and every file it may include, the defines, the profile and the flags
+		*/
+		static uint64_t GetDiskCacheSourceHash(const ShaderIncludeHandler::SourceTree& sourceTree, std::array<D3D_SHADER_MACRO, 64>& defines, const char* profile, uint32_t flags)
+		{
+			return ShaderCacheArchive::HashCompileInputs(sourceTree.hash, defines, profile, flags);
+		}
+
+		static ShaderPermutation GetShaderPermutation(ShaderClass shaderClass, const RE::BSShader& shader, uint32_t descriptor, uint64_t diskCacheKey,
+			const std::string& path, std::array<D3D_SHADER_MACRO, 64>& defines, uint32_t flags)
+		{
+			ShaderPermutation permutation{ diskCacheKey, path, std::string(magic_enum::enum_name(shader.shaderType.get())),
+				std::string(magic_enum::enum_name(shaderClass)), descriptor, GetShaderProfile(shaderClass), flags,
+				!State::GetSingleton()->IsDeveloperMode() };
+			for (const auto& define : defines) {
+				if (define.Name == nullptr)
+					break;
+				permutation.defines.emplace_back(define.Name, define.Definition ? define.Definition : "");
 			}
-			return {};
+			return permutation;
 		}
 
 		static std::string GetShaderString(ShaderClass shaderClass, const RE::BSShader& shader, uint32_t descriptor, bool hashkey)
@@ -1247,15 +1284,10 @@ namespace SIE
 			return result;
 		}
 
-		std::string GetTypeFromShaderString(const std::string& a_key)
+		static size_t GetShaderId(ShaderClass shaderClass, const RE::BSShader& shader, uint32_t descriptor)
 		{
-			std::string type = "";
-			std::string::size_type pos = a_key.find(':');
-			if (pos != std::string::npos)
-				type = a_key.substr(0, pos);
-			if (type.starts_with("IS") || type == "ReflectionsRayTracing")
-				type = "ImageSpace";  // fix type for image space shaders
-			return type;
+			return descriptor + (static_cast<size_t>(shader.shaderType.underlying()) << 32) +
+			       (static_cast<size_t>(shaderClass) << 60);
 		}
 
 		static ID3DBlob* CompileShader(ShaderClass shaderClass, const RE::BSShader& shader, uint32_t descriptor, bool useDiskCache)
@@ -1272,27 +1304,6 @@ namespace SIE
 			}
 			const auto type = shader.shaderType.get();
 
-			// check diskcache
-			auto diskPath = GetDiskPath(shader.fxpFilename, descriptor, shaderClass);
-
-			if (useDiskCache && std::filesystem::exists(diskPath)) {
-				// check build time of cache
-				auto diskCacheTime = cache.UseFileWatcher() ? std::chrono::clock_cast<std::chrono::system_clock>(std::filesystem::last_write_time(diskPath)) : system_clock::now();
-				if (cache.ShaderModifiedSince(shader.fxpFilename, diskCacheTime)) {
-					logger::debug("Diskcached shader {} older than {}", SIE::SShaderCache::GetShaderString(shaderClass, shader, descriptor, true), std::format("{:%Y%m%d%H%M}", diskCacheTime));
-				} else if (FAILED(D3DReadFileToBlob(diskPath.c_str(), &shaderBlob))) {
-					logger::error("Failed to load {} shader {}::{:X}", magic_enum::enum_name(shaderClass), magic_enum::enum_name(type), descriptor);
-
-					if (shaderBlob != nullptr) {
-						shaderBlob->Release();
-					}
-				} else {
-					logger::debug("Loaded shader from {}", Util::WStringToString(diskPath));
-					cache.AddCompletedShader(shaderClass, shader, descriptor, shaderBlob);
-					return shaderBlob;
-				}
-			}
-
 			// prepare preprocessor defines
 			std::array<D3D_SHADER_MACRO, 64> defines{};
 			auto lastIndex = 0;
@@ -1322,17 +1333,63 @@ namespace SIE
 					static_cast<const RE::BSImagespaceShader&>(shader).originalShaderName :
 					shader.fxpFilename);
 			auto pathString = Util::WStringToString(path);
-			if (!std::filesystem::exists(path)) {
+			const auto source = ShaderIncludeHandler::ReadFile(path);
+			if (!source) {
 				logger::error("Failed to compile {} shader {}::{:X}: {} does not exist", magic_enum::enum_name(shaderClass), magic_enum::enum_name(type), descriptor, pathString);
 				return nullptr;
 			}
+			const uint32_t flags = !State::GetSingleton()->IsDeveloperMode() ? D3DCOMPILE_OPTIMIZATION_LEVEL3 : D3DCOMPILE_DEBUG;
+			ShaderIncludeHandler includeHandler(path);
+
+			// check diskcache
+			const auto diskCacheKey = GetDiskCacheKey(shader.fxpFilename, descriptor, shaderClass);
+			const auto sourceTree = useDiskCache ? ShaderIncludeHandler::ScanSourceTree(path) : std::nullopt;
+			const auto diskCacheSourceHash = sourceTree ? GetDiskCacheSourceHash(*sourceTree, defines, GetShaderProfile(shaderClass), flags) : 0;
+			if (diskCacheSourceHash)
+				cache.permutationManifest.Add(GetShaderPermutation(shaderClass, shader, descriptor, diskCacheKey, pathString, defines, flags));
+
+			if (diskCacheSourceHash) {
+				if (auto [diskBlob, diskCacheTime] = cache.diskCacheArchive.Find(diskCacheKey, diskCacheSourceHash); diskBlob) {
+					// check build time of cache
+					if (cache.ShaderModifiedSince(shader.fxpFilename, diskCacheTime)) {
+						logger::debug("Diskcached shader {} older than {}", SIE::SShaderCache::GetShaderString(shaderClass, shader, descriptor, true), std::format("{:%Y%m%d%H%M}", diskCacheTime));
+						diskBlob->Release();
+					} else {
+						logger::debug("Loaded {} shader {}::{:X} from disk cache", magic_enum::enum_name(shaderClass), magic_enum::enum_name(type), descriptor);
+						cache.AddCompletedShader(shaderClass, shader, descriptor, diskBlob, sourceTree->files);
+						return diskBlob;
+					}
+				}
+			}
+
 			logger::debug("Compiling {} {}:{}:{:X} to {}", pathString, magic_enum::enum_name(type), magic_enum::enum_name(shaderClass), descriptor, MergeDefinesString(defines));
 
 			// compile shaders
 			ID3DBlob* errorBlob = nullptr;
-			const uint32_t flags = !State::GetSingleton()->IsDeveloperMode() ? D3DCOMPILE_OPTIMIZATION_LEVEL3 : D3DCOMPILE_DEBUG;
-			const HRESULT compileResult = D3DCompileFromFile(path.c_str(), defines.data(), D3D_COMPILE_STANDARD_FILE_INCLUDE, "main",
-				GetShaderProfile(shaderClass), flags, 0, &shaderBlob, &errorBlob);
+			HRESULT compileResult = E_FAIL;
+			std::optional<ShaderCompilerProcesses::Result> processResult;
+			winrt::com_ptr<ID3DBlob> preprocessed;
+			if (cache.UseCompilerProcesses())
+				preprocessed = PreprocessShader(*source, pathString, defines, includeHandler);
+			if (preprocessed) {
+				ShaderCompilerProtocol::Request request;
+				request.flags = flags;
+				request.sourceName = pathString;
+				request.profile = GetShaderProfile(shaderClass);
+				// defines and includes were already applied by preprocessing
+				request.source.assign(static_cast<const char*>(preprocessed->GetBufferPointer()), preprocessed->GetBufferSize());
+				processResult = cache.compilerProcesses.Compile(std::move(request));
+			}
+			if (processResult) {
+				shaderBlob = processResult->blob;
+				compileResult = shaderBlob ? S_OK : E_FAIL;
+				if (!processResult->errors.empty() && SUCCEEDED(D3DCreateBlob(processResult->errors.size() + 1, &errorBlob))) {
+					std::memcpy(errorBlob->GetBufferPointer(), processResult->errors.c_str(), processResult->errors.size() + 1);
+				}
+			} else {
+				compileResult = D3DCompile(source->data(), source->size(), pathString.c_str(), defines.data(), &includeHandler, "main",
+					GetShaderProfile(shaderClass), flags, 0, &shaderBlob, &errorBlob);
+			}
 
 			if (FAILED(compileResult)) {
 				if (errorBlob != nullptr) {
@@ -1369,24 +1426,11 @@ namespace SIE
 			}
 
 			// save shader to disk
-			if (useDiskCache) {
-				auto directoryPath = std::format("Data/ShaderCache/{}", shader.fxpFilename);
-				if (!std::filesystem::is_directory(directoryPath)) {
-					try {
-						std::filesystem::create_directories(directoryPath);
-					} catch (std::filesystem::filesystem_error const& ex) {
-						logger::error("Failed to create folder: {}", ex.what());
-					}
-				}
-
-				const HRESULT saveResult = D3DWriteBlobToFile(shaderBlob, diskPath.c_str(), true);
-				if (FAILED(saveResult)) {
-					logger::error("Failed to save shader to {}", Util::WStringToString(diskPath));
-				} else {
-					logger::debug("Saved shader to {}", Util::WStringToString(diskPath));
-				}
+			if (diskCacheSourceHash) {
+				cache.diskCacheArchive.Add(diskCacheKey, diskCacheSourceHash, shaderBlob);
+				logger::debug("Saved {} shader {}::{:X} to disk cache", magic_enum::enum_name(shaderClass), magic_enum::enum_name(type), descriptor);
 			}
-			cache.AddCompletedShader(shaderClass, shader, descriptor, shaderBlob);
+			cache.AddCompletedShader(shaderClass, shader, descriptor, shaderBlob, includeHandler.GetIncludes());
 			return shaderBlob;
 		}
 
@@ -1671,7 +1715,7 @@ namespace SIE
 	}
 
 	RE::BSGraphics::VertexShader* ShaderCache::GetVertexShader(const RE::BSShader& shader,
-		uint32_t descriptor)
+		uint32_t descriptor, CompilationPriority priority)
 	{
 		if (shader.shaderType == RE::BSShader::Type::ImageSpace) {
 			const auto& isShader = static_cast<const RE::BSImagespaceShader&>(shader);
@@ -1689,35 +1733,31 @@ namespace SIE
 			return nullptr;
 		}
 
-		auto key = SIE::SShaderCache::GetShaderString(ShaderClass::Vertex, shader, descriptor, true);
-		if (blockedKeyIndex != -1 && !blockedKey.empty() && key == blockedKey) {
+		if (blockedKeyIndex != -1 && GetShaderKey(ShaderClass::Vertex, shader, descriptor) == blockedKey) {
 			if (std::find(blockedIDs.begin(), blockedIDs.end(), descriptor) == blockedIDs.end()) {
 				blockedIDs.push_back(descriptor);
-				logger::debug("Skipping blocked shader {:X}:{} total: {}", descriptor, blockedKey, blockedIDs.size());
+				logger::debug("Skipping blocked shader {:X}:{} total: {}", descriptor, blockedKeyString, blockedIDs.size());
 			}
 			return nullptr;
 		}
 
-		{
-			std::lock_guard lockGuard(vertexShadersMutex);
-			auto& typeCache = vertexShaders[static_cast<size_t>(shader.shaderType.underlying())];
-			auto it = typeCache.find(descriptor);
-			if (it != typeCache.end()) {
-				return it->second.get();
-			}
+		if (auto found = vertexShaders[static_cast<size_t>(shader.shaderType.underlying())].Find(descriptor)) {
+			return found;
 		}
 
 		if (IsAsync()) {
-			compilationSet.Add({ ShaderClass::Vertex, shader, descriptor });
+			compilationSet.Add({ ShaderClass::Vertex, shader, descriptor }, priority);
 		} else {
-			return MakeAndAddVertexShader(shader, descriptor);
+			auto newShader = MakeAndAddVertexShader(shader, descriptor);
+			vertexShaders[static_cast<size_t>(shader.shaderType.underlying())].Flush();
+			return newShader;
 		}
 
 		return nullptr;
 	}
 
 	RE::BSGraphics::PixelShader* ShaderCache::GetPixelShader(const RE::BSShader& shader,
-		uint32_t descriptor)
+		uint32_t descriptor, CompilationPriority priority)
 	{
 		auto state = State::GetSingleton();
 		if (state->isVR && strcmp(shader.fxpFilename, "OBBOcclusionTesting") == 0)
@@ -1735,35 +1775,31 @@ namespace SIE
 			}
 		}
 
-		auto key = SIE::SShaderCache::GetShaderString(ShaderClass::Pixel, shader, descriptor, true);
-		if (blockedKeyIndex != -1 && !blockedKey.empty() && key == blockedKey) {
+		if (blockedKeyIndex != -1 && GetShaderKey(ShaderClass::Pixel, shader, descriptor) == blockedKey) {
 			if (std::find(blockedIDs.begin(), blockedIDs.end(), descriptor) == blockedIDs.end()) {
 				blockedIDs.push_back(descriptor);
-				logger::debug("Skipping blocked shader {:X}:{} total: {}", descriptor, blockedKey, blockedIDs.size());
+				logger::debug("Skipping blocked shader {:X}:{} total: {}", descriptor, blockedKeyString, blockedIDs.size());
 			}
 			return nullptr;
 		}
 
-		{
-			std::lock_guard lockGuard(pixelShadersMutex);
-			auto& typeCache = pixelShaders[static_cast<size_t>(shader.shaderType.underlying())];
-			auto it = typeCache.find(descriptor);
-			if (it != typeCache.end()) {
-				return it->second.get();
-			}
+		if (auto found = pixelShaders[static_cast<size_t>(shader.shaderType.underlying())].Find(descriptor)) {
+			return found;
 		}
 
 		if (IsAsync()) {
-			compilationSet.Add({ ShaderClass::Pixel, shader, descriptor });
+			compilationSet.Add({ ShaderClass::Pixel, shader, descriptor }, priority);
 		} else {
-			return MakeAndAddPixelShader(shader, descriptor);
+			auto newShader = MakeAndAddPixelShader(shader, descriptor);
+			pixelShaders[static_cast<size_t>(shader.shaderType.underlying())].Flush();
+			return newShader;
 		}
 
 		return nullptr;
 	}
 
 	RE::BSGraphics::ComputeShader* ShaderCache::GetComputeShader(const RE::BSShader& shader,
-		uint32_t descriptor)
+		uint32_t descriptor, CompilationPriority priority)
 	{
 		auto state = State::GetSingleton();
 		if (!((ShaderCache::IsSupportedShader(shader) || state->IsDeveloperMode() && state->IsShaderEnabled(shader)) && state->enableCShaders)) {
@@ -1777,28 +1813,24 @@ namespace SIE
 			}
 		}
 
-		auto key = SIE::SShaderCache::GetShaderString(ShaderClass::Compute, shader, descriptor, true);
-		if (blockedKeyIndex != -1 && !blockedKey.empty() && key == blockedKey) {
+		if (blockedKeyIndex != -1 && GetShaderKey(ShaderClass::Compute, shader, descriptor) == blockedKey) {
 			if (std::find(blockedIDs.begin(), blockedIDs.end(), descriptor) == blockedIDs.end()) {
 				blockedIDs.push_back(descriptor);
-				logger::debug("Skipping blocked shader {:X}:{} total: {}", descriptor, blockedKey, blockedIDs.size());
+				logger::debug("Skipping blocked shader {:X}:{} total: {}", descriptor, blockedKeyString, blockedIDs.size());
 			}
 			return nullptr;
 		}
 
-		{
-			std::lock_guard lockGuard(computeShadersMutex);
-			auto& typeCache = computeShaders[static_cast<size_t>(shader.shaderType.underlying())];
-			auto it = typeCache.find(descriptor);
-			if (it != typeCache.end()) {
-				return it->second.get();
-			}
+		if (auto found = computeShaders[static_cast<size_t>(shader.shaderType.underlying())].Find(descriptor)) {
+			return found;
 		}
 
 		if (IsAsync()) {
-			compilationSet.Add({ ShaderClass::Compute, shader, descriptor });
+			compilationSet.Add({ ShaderClass::Compute, shader, descriptor }, priority);
 		} else {
-			return MakeAndAddComputeShader(shader, descriptor);
+			auto newShader = MakeAndAddComputeShader(shader, descriptor);
+			computeShaders[static_cast<size_t>(shader.shaderType.underlying())].Flush();
+			return newShader;
 		}
 
 		return nullptr;
@@ -1808,42 +1840,30 @@ namespace SIE
 	{
 		Clear();
 		StopFileWatcher();
-		if (!compilationPool.wait_for_tasks_duration(std::chrono::milliseconds(1000))) {
-			logger::info("Tasks still running despite request to stop; killing thread {}!", GetThreadId(managementThread));
-			WaitForSingleObject(managementThread, 1000);
-			TerminateThread(managementThread, 0);
-			CloseHandle(managementThread);
+		for (auto& worker : compilationWorkers)
+			worker.request_stop();
+		for (int i = 0; i < 100 && busyWorkers; i++)
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		if (busyWorkers) {
+			logger::info("Tasks still running despite request to stop; abandoning {} compiler threads!", busyWorkers.load());
+			for (auto& worker : compilationWorkers)
+				worker.detach();
 		}
+		compilationWorkers.clear();
+		compilationPool.wait_for_tasks_duration(std::chrono::milliseconds(1000));
 	}
 
 	void ShaderCache::Clear()
 	{
-		{
-			std::lock_guard lockGuardV(vertexShadersMutex);
-			for (auto& shaders : vertexShaders) {
-				for (auto& [id, shader] : shaders) {
-					shader->shader->Release();
-				}
-				shaders.clear();
-			}
+		ShaderIncludeHandler::InvalidateFileCache();  // pick up edits to shaders when recompiling without the file watcher
+		for (auto& shaders : vertexShaders) {
+			SShaderCache::ReleaseShaders(shaders.Clear());
 		}
-		{
-			std::lock_guard lockGuardP(pixelShadersMutex);
-			for (auto& shaders : pixelShaders) {
-				for (auto& [id, shader] : shaders) {
-					shader->shader->Release();
-				}
-				shaders.clear();
-			}
+		for (auto& shaders : pixelShaders) {
+			SShaderCache::ReleaseShaders(shaders.Clear());
 		}
-		{
-			std::lock_guard lockGuardC(computeShadersMutex);
-			for (auto& shaders : computeShaders) {
-				for (auto& [id, shader] : shaders) {
-					shader->shader->Release();
-				}
-				shaders.clear();
-			}
+		for (auto& shaders : computeShaders) {
+			SShaderCache::ReleaseShaders(shaders.Clear());
 		}
 		{
 			std::unique_lock lockM{ mapMutex };
@@ -1852,28 +1872,18 @@ namespace SIE
 		{
 			std::unique_lock lockH{ hlslMapMutex };
 			hlslToShaderMap.clear();
+			shaderFileMap.clear();
+		}
+		{
+			std::unique_lock lockK{ keyMutex };
+			descriptorKeyMap.clear();
+			defineSetIds.clear();
+			defineSetStrings.clear();
+			defineSetGeneration++;
 		}
 		compilationSet.Clear();
 	}
 
-	template <typename ShaderType, typename MutexType>
-	void ReleaseShader(ShaderType& shaders,
-		MutexType& mutex, RE::BSShader::Type type, uint32_t descriptor)
-	{
-		std::lock_guard<MutexType> lockGuard(mutex);
-
-		if (static_cast<size_t>(type) < shaders.size()) {
-			auto& shaderMap = shaders[static_cast<size_t>(type)];
-			auto shaderIt = shaderMap.find(descriptor);
-			if (shaderIt != shaderMap.end()) {
-				auto& shaderPtr = shaderIt->second;
-				if (shaderPtr && shaderPtr->shader) {
-					shaderPtr->shader->Release();
-				}
-				shaderMap.erase(shaderIt);
-			}
-		}
-	}
 	bool ShaderCache::Clear(const std::string& a_path)
 	{
 		std::string lowerFilePath = Util::FixFilePath(a_path);
@@ -1889,51 +1899,38 @@ namespace SIE
 			}
 
 			entries = it->second;  // Copy the entries
-			hlslToShaderMap.erase(it);
+			// unlink the entries from every other file they were built from too
+			for (auto& entry : entries)
+				UnlinkShaderFiles(entry);
 		}
 
 		// Step 2: Process the copied entries without holding hlslMapMutex
-		for (auto& entry : entries) {
-			// Remove shader key from shaderMap
-			{
-				std::unique_lock lockM{ mapMutex };
+		{
+			std::unique_lock lockM{ mapMutex };
+			for (auto& entry : entries)
 				shaderMap.erase(entry.key);
-			}
+		}
 
-			// Handle vertex, pixel, and compute shaders (each will lock)
-			switch (entry.shaderClass) {
-			case SIE::ShaderClass::Vertex:
-				ReleaseShader(vertexShaders, vertexShadersMutex, entry.type, entry.descriptor);
-				break;
-			case SIE::ShaderClass::Pixel:
-				ReleaseShader(pixelShaders, pixelShadersMutex, entry.type, entry.descriptor);
-				break;
-			case SIE::ShaderClass::Compute:
-				ReleaseShader(computeShaders, computeShadersMutex, entry.type, entry.descriptor);
-				break;
-			default:
+		// descriptors by class and type, so each shader table is erased and published once
+		std::array<std::array<std::vector<uint32_t>, static_cast<size_t>(RE::BSShader::Type::Total)>, static_cast<size_t>(SIE::ShaderClass::Total)> descriptors;
+		for (auto& entry : entries) {
+			if (entry.shaderClass < SIE::ShaderClass::Total)
+				descriptors[static_cast<size_t>(entry.shaderClass)][static_cast<size_t>(entry.type)].push_back(entry.descriptor);
+			else
 				logger::warn("Unexpected shader class: {}", static_cast<int>(entry.shaderClass));
-				break;
-			}
 
-			// Delete the associated file
-			const auto& filePath = entry.diskPath;
-			const auto& filePathString = Util::WStringToString(filePath);
-			{
-				std::scoped_lock lockD{ compilationSet.compilationMutex };
-				try {
-					if (std::filesystem::exists(filePath)) {
-						std::filesystem::remove(filePath);
-						logger::debug("Deleted {}", filePathString);
-					}
-				} catch (const std::exception& e) {
-					logger::warn("Failed to delete file {}: {}", filePathString, e.what());
-				} catch (...) {
-					logger::warn("An unknown error occurred while trying to delete file '{}'", filePathString);
-				}
-			}
+			// Drop the associated disk cache entry
+			diskCacheArchive.Remove(entry.diskCacheKey);
 
-			logger::debug("Marking recompile for shader: {}", entry.key);
+			logger::debug("Marking recompile for shader: {}", GetShaderKeyString(entry.key));
+		}
+		for (size_t type = 0; type < static_cast<size_t>(RE::BSShader::Type::Total); type++) {
+			if (const auto& vertex = descriptors[static_cast<size_t>(SIE::ShaderClass::Vertex)][type]; !vertex.empty())
+				SShaderCache::ReleaseShaders(vertexShaders[type].Erase(vertex));
+			if (const auto& pixel = descriptors[static_cast<size_t>(SIE::ShaderClass::Pixel)][type]; !pixel.empty())
+				SShaderCache::ReleaseShaders(pixelShaders[type].Erase(pixel));
+			if (const auto& compute = descriptors[static_cast<size_t>(SIE::ShaderClass::Compute)][type]; !compute.empty())
+				SShaderCache::ReleaseShaders(computeShaders[type].Erase(compute));
 		}
 
 		if (!entries.empty()) {
@@ -1944,40 +1941,44 @@ namespace SIE
 		return true;
 	}
 
-	void ShaderCache::Clear(RE::BSShader::Type a_type)
+	void ShaderCache::UnlinkShaderFiles(const hlslRecord& a_record)
 	{
-		logger::debug("Clearing cache for {}", magic_enum::enum_name(a_type));
-		std::lock_guard lockGuardV(vertexShadersMutex);
-		{
-			for (auto& [id, shader] : vertexShaders[static_cast<size_t>(a_type)]) {
-				shader->shader->Release();
-			}
-			vertexShaders[static_cast<size_t>(a_type)].clear();
-		}
-		std::lock_guard lockGuardP(pixelShadersMutex);
-		{
-			for (auto& [id, shader] : pixelShaders[static_cast<size_t>(a_type)]) {
-				shader->shader->Release();
+		auto it = shaderFileMap.find(a_record);
+		if (it == shaderFileMap.end())
+			return;
+
+		for (const auto& file : it->second) {
+			if (auto fileIt = hlslToShaderMap.find(file); fileIt != hlslToShaderMap.end()) {
+				fileIt->second.erase(a_record);
+				if (fileIt->second.empty())
+					hlslToShaderMap.erase(fileIt);
 			}
-			pixelShaders[static_cast<size_t>(a_type)].clear();
 		}
-		std::lock_guard lockGuardC(computeShadersMutex);
+		shaderFileMap.erase(it);
+	}
+
+	void ShaderCache::Clear(RE::BSShader::Type a_type)
+	{
+		logger::debug("Clearing cache for {}", magic_enum::enum_name(a_type));
+		ShaderIncludeHandler::InvalidateFileCache();
+		SShaderCache::ReleaseShaders(vertexShaders[static_cast<size_t>(a_type)].Clear());
+		SShaderCache::ReleaseShaders(pixelShaders[static_cast<size_t>(a_type)].Clear());
+		SShaderCache::ReleaseShaders(computeShaders[static_cast<size_t>(a_type)].Clear());
+		ClearShaderMap(a_type);
 		{
-			for (auto& [id, shader] : computeShaders[static_cast<size_t>(a_type)]) {
-				shader->shader->Release();
-			}
-			computeShaders[static_cast<size_t>(a_type)].clear();
+			// defines for this type may have changed, so force the keys to be rebuilt
+			std::unique_lock lockK{ keyMutex };
+			std::erase_if(descriptorKeyMap, [a_type](const auto& item) { return item.second.type == static_cast<uint8_t>(a_type); });
 		}
-		ClearShaderMap(a_type);
 		compilationSet.Clear();
 	}
 
-	bool ShaderCache::AddCompletedShader(ShaderClass shaderClass, const RE::BSShader& shader, uint32_t descriptor, ID3DBlob* a_blob)
+	bool ShaderCache::AddCompletedShader(ShaderClass shaderClass, const RE::BSShader& shader, uint32_t descriptor, ID3DBlob* a_blob,
+		std::span<const std::filesystem::path> a_includes)
 	{
-		auto key = SIE::SShaderCache::GetShaderString(shaderClass, shader, descriptor, true);
-		auto keyWithDescriptor = SIE::SShaderCache::GetShaderString(shaderClass, shader, descriptor, false);
+		auto key = GetShaderKey(shaderClass, shader, descriptor);
 		auto status = a_blob ? ShaderCompilationTask::Status::Completed : ShaderCompilationTask::Status::Failed;
-		logger::debug("Adding {} shader to map: {}", magic_enum ::enum_name(status), keyWithDescriptor);
+		logger::debug("Adding {} shader to map: {:X}:{}", magic_enum ::enum_name(status), descriptor, GetShaderKeyString(key));
 		{
 			std::unique_lock lockM{ mapMutex };
 			shaderMap.insert_or_assign(key, ShaderCacheResult{ a_blob, status, system_clock::now() });
@@ -1988,51 +1989,45 @@ namespace SIE
 				shader.fxpFilename);
 		auto pathString = Util::WStringToString(path);
 		if (a_blob) {  // only create hlsl record if successful
-			std::string lowerFilePath = Util::FixFilePath(pathString);
-			{
-				std::unique_lock lockH{ hlslMapMutex };
-				auto it = hlslToShaderMap.find(lowerFilePath);
-				hlslRecord newRecord{ key, shader.shaderType.get(), descriptor, shaderClass, SIE::SShaderCache::GetDiskPath(shader.fxpFilename, descriptor, shaderClass) };
-
-				if (it != hlslToShaderMap.end()) {
-					auto& entries = it->second;
+			hlslRecord newRecord{ key, shader.shaderType.get(), descriptor, shaderClass, SIE::SShaderCache::GetDiskCacheKey(shader.fxpFilename, descriptor, shaderClass) };
 
-					// Find and remove existing record with the same key
-					auto existingRecord = std::find_if(entries.begin(), entries.end(),
-						[&](const hlslRecord& r) { return r.key == key; });
+			std::vector<std::string> files{ Util::FixFilePath(pathString) };
+			for (const auto& include : a_includes) {
+				auto lowerInclude = Util::FixFilePath(include.string());
+				if (std::ranges::find(files, lowerInclude) == files.end())
+					files.push_back(std::move(lowerInclude));
+			}
 
-					if (existingRecord != entries.end()) {
-						entries.erase(existingRecord);  // Remove the old record
-					}
+			{
+				std::unique_lock lockH{ hlslMapMutex };
+				// Remove the links of an existing record with the same key, its includes may have changed
+				UnlinkShaderFiles(newRecord);
 
-					// Insert the new or updated record
-					entries.insert(newRecord);
-				} else {
-					// Create a new entry in hlslToShaderMap for this file path
-					hlslToShaderMap.emplace(lowerFilePath, std::set<hlslRecord>{ newRecord });
-				}
+				for (const auto& file : files)
+					hlslToShaderMap[file].insert(newRecord);
+				shaderFileMap.emplace(newRecord, std::move(files));
 			}
 		}
 
 		return a_blob != nullptr;
 	}
 
-	ID3DBlob* ShaderCache::GetCompletedShader(const std::string& a_key)
+	ID3DBlob* ShaderCache::GetCompletedShader(const ShaderKey& a_key)
 	{
-		std::string type = SIE::SShaderCache::GetTypeFromShaderString(a_key);
+		std::string type{ magic_enum::enum_name(static_cast<RE::BSShader::Type>(a_key.type)) };
 		UpdateShaderModifiedTime(type);
 		std::scoped_lock lockM{ mapMutex };
-		if (!shaderMap.empty() && shaderMap.contains(a_key)) {
-			if (ShaderModifiedSince(type, shaderMap.at(a_key).compileTime)) {
+		auto it = shaderMap.find(a_key);
+		if (it != shaderMap.end()) {
+			if (ShaderModifiedSince(type, it->second.compileTime)) {
 				logger::debug("Shader {} compiled {} before changes at {}",
-					a_key,
-					std::format("{:%H:%M:%S}", shaderMap.at(a_key).compileTime),
+					GetShaderKeyString(a_key),
+					std::format("{:%H:%M:%S}", it->second.compileTime),
 					std::format("{:%H:%M:%S}", GetModifiedShaderMapTime(type)));
 				return nullptr;
 			}
-			auto status = shaderMap.at(a_key).status;
-			if (status != ShaderCompilationTask::Status::Pending)
-				return shaderMap.at(a_key).blob;
+			if (it->second.status != ShaderCompilationTask::Status::Pending)
+				return it->second.blob;
 		}
 		return nullptr;
 	}
@@ -2040,25 +2035,60 @@ namespace SIE
 	ID3DBlob* ShaderCache::GetCompletedShader(ShaderClass shaderClass, const RE::BSShader& shader,
 		uint32_t descriptor)
 	{
-		auto key = SIE::SShaderCache::GetShaderString(shaderClass, shader, descriptor, true);
-		return GetCompletedShader(key);
+		return GetCompletedShader(GetShaderKey(shaderClass, shader, descriptor));
 	}
 
 	ID3DBlob* ShaderCache::GetCompletedShader(const ShaderCompilationTask& a_task)
 	{
-		auto key = a_task.GetString();
-		return GetCompletedShader(key);
+		return GetCompletedShader(a_task.GetKey());
 	}
 
-	ShaderCompilationTask::Status ShaderCache::GetShaderStatus(const std::string& a_key)
+	ShaderCompilationTask::Status ShaderCache::GetShaderStatus(const ShaderKey& a_key)
 	{
 		std::scoped_lock lockM{ mapMutex };
-		if (!shaderMap.empty() && shaderMap.contains(a_key)) {
-			return shaderMap.at(a_key).status;
+		auto it = shaderMap.find(a_key);
+		if (it != shaderMap.end()) {
+			return it->second.status;
 		}
 		return ShaderCompilationTask::Status::Pending;
 	}
 
+	ShaderKey ShaderCache::GetShaderKey(ShaderClass shaderClass, const RE::BSShader& shader, uint32_t descriptor)
+	{
+		const auto id = SIE::SShaderCache::GetShaderId(shaderClass, shader, descriptor);
+		{
+			std::shared_lock lockK{ keyMutex };
+			auto it = descriptorKeyMap.find(id);
+			if (it != descriptorKeyMap.end())
+				return it->second;
+		}
+
+		// first time this descriptor is seen; build the defines string once and intern it
+		auto keyString = SIE::SShaderCache::GetShaderString(shaderClass, shader, descriptor, true);
+
+		std::unique_lock lockK{ keyMutex };
+		auto [setIt, inserted] = defineSetIds.try_emplace(std::move(keyString), static_cast<uint32_t>(defineSetStrings.size()));
+		if (inserted)
+			defineSetStrings.push_back(setIt->first);
+
+		ShaderKey key{
+			.defineSet = setIt->second,
+			.generation = defineSetGeneration,
+			.type = static_cast<uint8_t>(shader.shaderType.underlying()),
+			.shaderClass = static_cast<uint8_t>(shaderClass),
+		};
+		descriptorKeyMap.insert_or_assign(id, key);
+		return key;
+	}
+
+	std::string ShaderCache::GetShaderKeyString(const ShaderKey& a_key)
+	{
+		std::shared_lock lockK{ keyMutex };
+		if (a_key.generation == defineSetGeneration && a_key.defineSet < defineSetStrings.size())
+			return defineSetStrings[a_key.defineSet];
+		return std::format("{}:{}:{:X}", magic_enum::enum_name(static_cast<RE::BSShader::Type>(a_key.type)), magic_enum::enum_name(static_cast<ShaderClass>(a_key.shaderClass)), a_key.Pack());
+	}
+
 	std::string ShaderCache::GetShaderStatsString(bool a_timeOnly)
 	{
 		return compilationSet.GetStatsString(a_timeOnly);
@@ -2127,7 +2157,8 @@ namespace SIE
 
 	void ShaderCache::DeleteDiskCache()
 	{
-		std::scoped_lock lock{ compilationSet.compilationMutex };
+		std::scoped_lock lock{ compilationSet.GetMutex() };
+		diskCacheArchive.Close();
 		try {
 			std::filesystem::remove_all(L"Data/ShaderCache");
 			logger::info("Deleted disk cache");
@@ -2141,23 +2172,18 @@ namespace SIE
 		CSimpleIniA ini;
 		ini.SetUnicode();
 		ini.LoadFile(L"Data\\ShaderCache\\Info.ini");
-		bool valid = true;
 
-		if (auto version = ini.GetValue("Cache", "Version")) {
-			if (strcmp(SHADER_CACHE_VERSION.string().c_str(), version) != 0 || !(State::GetSingleton()->ValidateCache(ini))) {
-				logger::info("Disk cache outdated or invalid");
-				valid = false;
-			}
+		// entries are keyed by a hash of their compile inputs and the archive rejects other formats itself,
+		// so neither a plugin update nor changed features invalidate the whole cache
+		auto version = ini.GetValue("Cache", "Version");
+		if (!version || strcmp(SHADER_CACHE_VERSION.string().c_str(), version) != 0) {
+			logger::info("Disk cache written by another version; recompiling shaders whose inputs changed");
+		} else if (!State::GetSingleton()->ValidateCache(ini)) {
+			logger::info("Features changed since the disk cache was written; recompiling affected shaders");
 		} else {
-			logger::info("Disk cache outdated or invalid");
-			valid = false;
-		}
-
-		if (valid) {
 			logger::info("Using disk cache");
-		} else {
-			DeleteDiskCache();
 		}
+		diskCacheArchive.Load(L"Data/ShaderCache");
 	}
 
 	void ShaderCache::WriteDiskCacheInfo()
@@ -2168,12 +2194,33 @@ namespace SIE
 		State::GetSingleton()->WriteDiskCacheInfo(ini);
 		ini.SaveFile(L"Data\\ShaderCache\\Info.ini");
 		logger::info("Saved disk cache info");
+		WritePermutationManifest();
+	}
+
+	void ShaderCache::WritePermutationManifest()
+	{
+		CSimpleIniA ini;
+		ini.SetUnicode();
+		ini.SetValue("Cache", "Version", SHADER_CACHE_VERSION.string().c_str());
+		State::GetSingleton()->WriteDiskCacheInfo(ini);
+		permutationManifest.cacheVersion = SHADER_CACHE_VERSION.string();
+		ini.Save(permutationManifest.diskCacheInfo);
+
+		if (permutationManifest.Write(L"Data\\ShaderCache\\Permutations.json"))
+			logger::info("Saved {} shader permutations to manifest", permutationManifest.GetPermutations().size());
+		else
+			logger::warn("Failed to save shader permutation manifest");
 	}
 
 	ShaderCache::ShaderCache()
 	{
 		logger::debug("ShaderCache initialized with {} compiler threads", (int)compilationThreadCount);
-		compilationPool.push_task(&ShaderCache::ManageCompilationSet, this, ssource.get_token());
+		// start enough workers for the largest thread count the settings allow, the extra ones stay idle
+		const auto workerCount = std::max(static_cast<int32_t>(std::thread::hardware_concurrency()), 1);
+		compilationWorkers.reserve(workerCount);
+		for (int32_t i = 0; i < workerCount; i++)
+			compilationWorkers.emplace_back([this, i](std::stop_token stoken) { CompilationWorker(stoken, i); });
+		UpdateCompilationThreadCount();
 	}
 
 	bool ShaderCache::UseFileWatcher() const
@@ -2181,6 +2228,18 @@ namespace SIE
 		return useFileWatcher;
 	}
 
+	bool ShaderCache::UseCompilerProcesses() const
+	{
+		return useCompilerProcesses;
+	}
+
+	void ShaderCache::SetCompilerProcesses(bool value)
+	{
+		useCompilerProcesses = value;
+		if (!useCompilerProcesses)
+			compilerProcesses.Shutdown();
+	}
+
 	void ShaderCache::SetFileWatcher(bool value)
 	{
 		auto oldValue = useFileWatcher;
@@ -2283,7 +2342,6 @@ namespace SIE
 			auto newShader = SShaderCache::CreateVertexShader(*shaderBlob, shader,
 				descriptor);
 
-			std::lock_guard lockGuard(vertexShadersMutex);
 
 			const auto result = (*device)->CreateVertexShader(shaderBlob->GetBufferPointer(),
 				newShader->byteCodeSize, nullptr, reinterpret_cast<ID3D11VertexShader**>(&newShader->shader));
@@ -2294,9 +2352,7 @@ namespace SIE
 					newShader->shader->Release();
 				}
 			} else {
-				return vertexShaders[static_cast<size_t>(shader.shaderType.get())]
-				    .insert_or_assign(descriptor, std::move(newShader))
-				    .first->second.get();
+				return vertexShaders[static_cast<size_t>(shader.shaderType.get())].Insert(descriptor, std::move(newShader));
 			}
 		}
 		return nullptr;
@@ -2312,7 +2368,6 @@ namespace SIE
 			auto newShader = SShaderCache::CreatePixelShader(*shaderBlob, shader,
 				descriptor);
 
-			std::lock_guard lockGuard(pixelShadersMutex);
 			const auto result = (*device)->CreatePixelShader(shaderBlob->GetBufferPointer(),
 				shaderBlob->GetBufferSize(), nullptr, reinterpret_cast<ID3D11PixelShader**>(&newShader->shader));
 			if (FAILED(result)) {
@@ -2323,9 +2378,7 @@ namespace SIE
 					newShader->shader->Release();
 				}
 			} else {
-				return pixelShaders[static_cast<size_t>(shader.shaderType.get())]
-				    .insert_or_assign(descriptor, std::move(newShader))
-				    .first->second.get();
+				return pixelShaders[static_cast<size_t>(shader.shaderType.get())].Insert(descriptor, std::move(newShader));
 			}
 		}
 		return nullptr;
@@ -2341,7 +2394,6 @@ namespace SIE
 			auto newShader = SShaderCache::CreateComputeShader(*shaderBlob, shader,
 				descriptor);
 
-			std::lock_guard lockGuard(computeShadersMutex);
 			const auto result = (*device)->CreateComputeShader(shaderBlob->GetBufferPointer(),
 				shaderBlob->GetBufferSize(), nullptr, reinterpret_cast<ID3D11ComputeShader**>(&newShader->shader));
 			if (FAILED(result)) {
@@ -2352,9 +2404,7 @@ namespace SIE
 					newShader->shader->Release();
 				}
 			} else {
-				return computeShaders[static_cast<size_t>(shader.shaderType.get())]
-				    .insert_or_assign(descriptor, std::move(newShader))
-				    .first->second.get();
+				return computeShaders[static_cast<size_t>(shader.shaderType.get())].Insert(descriptor, std::move(newShader));
 			}
 		}
 		return nullptr;
@@ -2402,8 +2452,7 @@ namespace SIE
 		std::unique_lock lockM{ SIE::ShaderCache::mapMutex };
 		logger::debug("Clearing shaderMap of {}", shaderTypeStr);
 		for (auto it = shaderMap.begin(); it != shaderMap.end();) {
-			auto typeInKey = SIE::SShaderCache::GetTypeFromShaderString(it->first);
-			if (typeInKey == shaderTypeStr) {
+			if (it->first.type == static_cast<uint8_t>(a_type)) {
 				it = shaderMap.erase(it);
 			} else {
 				++it;
@@ -2439,9 +2488,10 @@ namespace SIE
 		for (auto& [key, value] : shaderMap) {
 			if (index++ == targetIndex) {
 				blockedKey = key;
+				blockedKeyString = GetShaderKeyString(key);
 				blockedKeyIndex = (uint)targetIndex;
 				blockedIDs.clear();
-				logger::debug("Blocking shader ({}/{}) {}", blockedKeyIndex + 1, shaderMap.size(), blockedKey);
+				logger::debug("Blocking shader ({}/{}) {}", blockedKeyIndex + 1, shaderMap.size(), blockedKeyString);
 				return;
 			}
 		}
@@ -2449,29 +2499,66 @@ namespace SIE
 
 	void ShaderCache::DisableShaderBlocking()
 	{
-		blockedKey = "";
+		blockedKey = {};
+		blockedKeyString = "";
 		blockedKeyIndex = (uint)-1;
 		blockedIDs.clear();
 		logger::debug("Stopped blocking shaders");
 	}
 
-	void ShaderCache::ManageCompilationSet(std::stop_token stoken)
+	void ShaderCache::CompilationWorker(std::stop_token stoken, int32_t a_worker)
 	{
-		managementThread = GetCurrentThread();
-		SetThreadPriority(managementThread, THREAD_PRIORITY_BELOW_NORMAL);
+		SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
 		while (!stoken.stop_requested()) {
-			const auto& task = compilationSet.WaitTake(stoken);
+			const auto& task = compilationSet.WaitTake(stoken, a_worker);
 			if (!task.has_value())
 				break;  // exit because thread told to end
-			compilationPool.push_task(&ShaderCache::ProcessCompilationSet, this, stoken, task.value());
+			busyWorkers++;
+			task->Perform();
+			// publish the tail of the batch once the queue ran dry, and at once when a draw waits for the shader
+			const auto completed = compilationSet.Complete(task.value());
+			if (completed.queueEmpty || completed.priority == CompilationPriority::Draw)
+				FlushShaderTables();
+			else
+				FlushStaleShaderTables();  // long compiles still running do not hold back what finished before them
+			busyWorkers--;
 		}
 	}
 
-	void ShaderCache::ProcessCompilationSet(std::stop_token stoken, SIE::ShaderCompilationTask task)
+	void ShaderCache::FlushShaderTables()
 	{
-		SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
-		task.Perform();
-		compilationSet.Complete(task);
+		for (auto& shaders : vertexShaders) {
+			shaders.Flush();
+		}
+		for (auto& shaders : pixelShaders) {
+			shaders.Flush();
+		}
+		for (auto& shaders : computeShaders) {
+			shaders.Flush();
+		}
+	}
+
+	void ShaderCache::FlushStaleShaderTables()
+	{
+		for (auto& shaders : vertexShaders) {
+			shaders.FlushStale();
+		}
+		for (auto& shaders : pixelShaders) {
+			shaders.FlushStale();
+		}
+		for (auto& shaders : computeShaders) {
+			shaders.FlushStale();
+		}
+	}
+
+	int32_t ShaderCache::GetCompilationThreadCount() const
+	{
+		return !backgroundCompilation ? compilationThreadCount : backgroundCompilationThreadCount;
+	}
+
+	void ShaderCache::UpdateCompilationThreadCount()
+	{
+		compilationSet.SetWorkerLimit(GetCompilationThreadCount());
 	}
 
 	ShaderCompilationTask::ShaderCompilationTask(ShaderClass aShaderClass,
@@ -2494,8 +2581,12 @@ namespace SIE
 
 	size_t ShaderCompilationTask::GetId() const
 	{
-		return descriptor + (static_cast<size_t>(shader.shaderType.underlying()) << 32) +
-		       (static_cast<size_t>(shaderClass) << 60);
+		return SIE::SShaderCache::GetShaderId(shaderClass, shader, descriptor);
+	}
+
+	ShaderKey ShaderCompilationTask::GetKey() const
+	{
+		return ShaderCache::Instance().GetShaderKey(shaderClass, shader, descriptor);
 	}
 
 	std::string ShaderCompilationTask::GetString() const
@@ -2508,44 +2599,23 @@ namespace SIE
 		return GetId() == other.GetId();
 	}
 
-	std::optional<ShaderCompilationTask> CompilationSet::WaitTake(std::stop_token stoken)
+	std::optional<ShaderCompilationTask> CompilationSet::WaitTake(std::stop_token stoken, int32_t a_worker)
 	{
-		std::unique_lock lock(compilationMutex);
-		auto& shaderCache = ShaderCache::Instance();
-		if (!conditionVariable.wait(
-				lock, stoken,
-				[this, &shaderCache]() { return !availableTasks.empty() &&
-			                                    // check against all tasks in queue to trickle the work. It cannot be the active tasks count because the thread pool itself is maximum.
-			                                    (int)shaderCache.compilationPool.get_tasks_total() <=
-			                                        (!shaderCache.backgroundCompilation ? shaderCache.compilationThreadCount : shaderCache.backgroundCompilationThreadCount); })) {
-			/*Woke up because of a stop request. */
-			return std::nullopt;
-		}
-		if (!ShaderCache::Instance().IsCompiling()) {  // we just got woken up because there's a task, start clock
-			lastCalculation = lastReset = high_resolution_clock::now();
-		}
-		auto node = availableTasks.extract(availableTasks.begin());
-		auto& task = node.value();
-		tasksInProgress.insert(std::move(node));
-		return task;
+		return queue.WaitTake(stoken, static_cast<uint32_t>(a_worker));
 	}
 
-	void CompilationSet::Add(const ShaderCompilationTask& task)
+	void CompilationSet::Add(const ShaderCompilationTask& task, CompilationPriority priority)
 	{
-		std::unique_lock lock(compilationMutex);
-		auto inProgressIt = tasksInProgress.find(task);
-		auto processedIt = processedTasks.find(task);
-		if (inProgressIt == tasksInProgress.end() && processedIt == processedTasks.end() && !ShaderCache::Instance().GetCompletedShader(task)) {
-			auto [availableIt, wasAdded] = availableTasks.insert(task);
-			lock.unlock();
-			if (wasAdded) {
-				conditionVariable.notify_one();
-				totalTasks++;
-			}
+		if (!queue.Add(task, priority, [&task]() { return ShaderCache::Instance().GetCompletedShader(task) != nullptr; }))
+			return;
+		if (!ShaderCache::Instance().IsCompiling()) {  // first task after being idle, start clock
+			std::scoped_lock lock(timeMutex);
+			lastCalculation = lastReset = high_resolution_clock::now();
 		}
+		totalTasks++;
 	}
 
-	void CompilationSet::Complete(const ShaderCompilationTask& task)
+	CompletedTask CompilationSet::Complete(const ShaderCompilationTask& task)
 	{
 		auto& cache = ShaderCache::Instance();
 		auto key = task.GetString();
@@ -2557,31 +2627,34 @@ namespace SIE
 			logger::debug("Compiling Task failed: {}", key);
 			failedTasks++;
 		}
-		auto now = high_resolution_clock::now();
-		totalMs += duration_cast<milliseconds>(now - lastCalculation).count();
-		lastCalculation = now;
-		std::scoped_lock lock(compilationMutex);
-		processedTasks.insert(task);
-		tasksInProgress.erase(task);
-		conditionVariable.notify_one();
+		{
+			std::scoped_lock lock(timeMutex);
+			auto now = high_resolution_clock::now();
+			totalMs += duration_cast<milliseconds>(now - lastCalculation).count();
+			lastCalculation = now;
+		}
 		DynamicCubemaps::GetSingleton()->resetCapture = true;
+		return queue.Complete(task);
 	}
 
 	void CompilationSet::Clear()
 	{
-		std::scoped_lock lock(compilationMutex);
-		availableTasks.clear();
-		tasksInProgress.clear();
-		processedTasks.clear();
+		queue.Clear();
 		totalTasks = 0;
 		completedTasks = 0;
 		failedTasks = 0;
 		cacheHitTasks = 0;
+		std::scoped_lock lock(timeMutex);
 		lastReset = high_resolution_clock::now();
 		lastCalculation = high_resolution_clock::now();
 		totalMs = (double)duration_cast<std::chrono::milliseconds>(lastReset - lastReset).count();
 	}
 
+	void CompilationSet::SetWorkerLimit(int32_t a_limit)
+	{
+		queue.SetWorkerLimit(static_cast<uint32_t>(std::max(a_limit, 0)));
+	}
+
 	std::string CompilationSet::GetHumanTime(double a_totalms)
 	{
 		int milliseconds = (int)a_totalms;
@@ -2632,15 +2705,19 @@ namespace SIE
 			return;
 		}
 
-		// Ensure the file is not a directory and is a valid shader file (.hlsl)
+		// Ensure the file is not a directory and is a valid shader file (.hlsl) or include (.hlsli)
 		std::string lowerExtension = extension;
 		std::transform(lowerExtension.begin(), lowerExtension.end(), lowerExtension.begin(),
 			[](unsigned char c) { return static_cast<char>(std::tolower(c)); });
-		if (!std::filesystem::is_directory(filePath) && lowerExtension == ".hlsl") {
+		if (!std::filesystem::is_directory(filePath) && lowerExtension == ".hlsli") {
+			// Attempt to mark every shader including the file for recompilation
+			if (!cache.Clear(filePath.string()))
+				logger::debug("No compiled shaders include {}", filePath.string());
+		} else if (!std::filesystem::is_directory(filePath) && lowerExtension == ".hlsl") {
 			// Update cache with the modified shader
 			cache.InsertModifiedShaderMap(shaderTypeString, modifiedTime);
 
-			// Attempt to mark the shader for recompilation
+			// Attempt to mark the shader and any shader including it for recompilation
 			bool foundPath = cache.Clear(filePath.string());
 
 			if (!foundPath) {
@@ -2670,6 +2747,7 @@ namespace SIE
 		while (cache.UseFileWatcher()) {
 			lock.lock();
 			if (!queue.empty() && queue.size() == lastQueueSize) {
+				ShaderIncludeHandler::InvalidateFileCache();  // before recompiling, so the changed files are read again
 				bool clearCache = false;
 				for (fileAction fAction : queue) {
 					const std::filesystem::path filePath = std::filesystem::path(std::format("{}\\{}", fAction.dir, fAction.filename));
@@ -3,13 +3,22 @@
 #include <RE/B/BSShader.h>
 
 #include "BS_thread_pool.hpp"
+#include "CompilationQueue.h"
+#include "ShaderCacheArchive.h"
+#include "ShaderCompilerProcess.h"
+#include "ShaderPermutationManifest.h"
+#include "ShaderTable.h"
+#include "ShaderUsageRecorder.h"
 #include "efsw/efsw.hpp"
 #include <chrono>
 #include <condition_variable>
+#include <map>
+#include <set>
+#include <shared_mutex>
 #include <unordered_map>
 #include <unordered_set>
 
-static constexpr REL::Version SHADER_CACHE_VERSION = { 0, 0, 0, 20 };
+static constexpr REL::Version SHADER_CACHE_VERSION = { 0, 0, 0, 21 };
 
 using namespace std::chrono;
 
@@ -209,6 +218,29 @@ namespace SIE
 		Total,
 	};
 
+	/**
+	 * Compact key identifying a compiled shader permutation.
+	 *
+	 * Descriptors whose defines resolve to the same string share a key. The define set is interned
+	 * once per descriptor so draw-time lookups never need to rebuild the defines string.
+	 */
+	struct ShaderKey
+	{
+		uint32_t defineSet = 0;   // index into the interned define-set table
+		uint16_t generation = 0;  // bumped whenever the interned table is reset
+		uint8_t type = 0;         // RE::BSShader::Type
+		uint8_t shaderClass = 0;  // ShaderClass
+
+		uint64_t Pack() const
+		{
+			return static_cast<uint64_t>(defineSet) | (static_cast<uint64_t>(generation) << 32) |
+			       (static_cast<uint64_t>(type) << 48) | (static_cast<uint64_t>(shaderClass) << 56);
+		}
+
+		bool operator==(const ShaderKey& other) const { return Pack() == other.Pack(); }
+		bool operator<(const ShaderKey& other) const { return Pack() < other.Pack(); }
+	};
+
 	class ShaderCompilationTask
 	{
 	public:
@@ -223,6 +255,7 @@ namespace SIE
 		void Perform() const;
 
 		size_t GetId() const;
+		ShaderKey GetKey() const;
 		std::string GetString() const;
 
 		bool operator==(const ShaderCompilationTask& other) const;
@@ -234,6 +267,15 @@ namespace SIE
 	};
 }
 
+template <>
+struct std::hash<SIE::ShaderKey>
+{
+	std::size_t operator()(const SIE::ShaderKey& key) const noexcept
+	{
+		return std::hash<uint64_t>{}(key.Pack());
+	}
+};
+
 template <>
 struct std::hash<SIE::ShaderCompilationTask>
 {
@@ -248,10 +290,27 @@ namespace SIE
 	class CompilationSet
 	{
 	public:
-		std::optional<ShaderCompilationTask> WaitTake(std::stop_token stoken);
-		void Add(const ShaderCompilationTask& task);
-		void Complete(const ShaderCompilationTask& task);
+		/**
+		 * @brief Waits for a task and marks it in progress, see CompilationQueue for the order.
+		 *
+		 * @param stoken Stops the wait.
+		 * @param a_worker Index of the calling worker. Workers past the active compiler thread
+		 * count wait until the count is raised again.
+		 * @return The task, or std::nullopt if the worker was told to stop.
+		 */
+		std::optional<ShaderCompilationTask> WaitTake(std::stop_token stoken, int32_t a_worker);
+		/**
+		 * @brief Queues a task, or raises the priority of a task that is already queued or compiling.
+		 *
+		 * @param task The task to compile.
+		 * @param priority Why the shader was requested.
+		 */
+		void Add(const ShaderCompilationTask& task, CompilationPriority priority = CompilationPriority::Draw);
+		CompletedTask Complete(const ShaderCompilationTask& task);
 		void Clear();
+		/** @brief Sets how many workers take tasks. */
+		void SetWorkerLimit(int32_t a_limit);
+		std::shared_mutex& GetMutex() { return queue.mutex; }
 		std::string GetHumanTime(double a_totalms);
 		double GetEta();
 		std::string GetStatsString(bool a_timeOnly = false);
@@ -259,18 +318,19 @@ namespace SIE
 		std::atomic<uint64_t> totalTasks = 0;
 		std::atomic<uint64_t> failedTasks = 0;
 		std::atomic<uint64_t> cacheHitTasks = 0;  // number of compiles of a previously seen shader combo
-		std::mutex compilationMutex;
 
 	private:
-		std::unordered_set<ShaderCompilationTask> availableTasks;
-		std::unordered_set<ShaderCompilationTask> tasksInProgress;
-		std::unordered_set<ShaderCompilationTask> processedTasks;  // completed or failed
-		std::condition_variable_any conditionVariable;
+		CompilationQueue<ShaderCompilationTask> queue;
+		std::mutex timeMutex;  // guards the times below, which every worker updates
 		std::chrono::steady_clock::time_point lastReset = high_resolution_clock::now();
 		std::chrono::steady_clock::time_point lastCalculation = high_resolution_clock::now();
 		double totalMs = (double)duration_cast<std::chrono::milliseconds>(lastReset - lastReset).count();
 	};
 
+	// Shader tables of the cache, on the game's containers
+	template <typename ShaderType>
+	using GameShaderTable = ShaderTable<ShaderType, eastl::unordered_map<uint32_t, ShaderType*>, eastl::unordered_map<uint32_t, std::unique_ptr<ShaderType>>>;
+
 	struct ShaderCacheResult
 	{
 		ID3DBlob* blob;
@@ -322,6 +382,14 @@ namespace SIE
 		inline static bool IsShaderSourceAvailable(const RE::BSShader& shader);
 
 		bool IsCompiling();
+		/**
+		 * @brief Gets the number of workers allowed to compile, which depends on whether compilation runs in the background.
+		 */
+		int32_t GetCompilationThreadCount() const;
+		/**
+		 * @brief Applies a change of the compiler thread counts or of background compilation to the workers.
+		 */
+		void UpdateCompilationThreadCount();
 		bool IsEnabled() const;
 		void SetEnabled(bool value);
 		bool IsAsync() const;
@@ -334,8 +402,19 @@ namespace SIE
 		void DeleteDiskCache();
 		void ValidateDiskCache();
 		void WriteDiskCacheInfo();
+		/**
+		 * @brief Saves every permutation seen this session to Data/ShaderCache/Permutations.json.
+		 *
+		 * The manifest can be compiled into a disk cache outside of the game with tools/ShaderCachePrebuilder.
+		 */
+		void WritePermutationManifest();
 		bool UseFileWatcher() const;
 		void SetFileWatcher(bool value);
+		/**
+		 * @brief Whether shaders are compiled in helper processes (see ShaderCompilerProcesses), so a compiler crash cannot take down the game.
+		 */
+		bool UseCompilerProcesses() const;
+		void SetCompilerProcesses(bool value);
 
 		void StartFileWatcher();
 		void StopFileWatcher();
@@ -370,36 +449,60 @@ namespace SIE
    		* @brief Clears and marks shaders for recompilation based on the given path.
  		*
  		* This function looks up the provided `a_path` in the `hlslToShaderMap`. 
-		* If the path exists in the map, it iterates through all the shader entries associated 
-		* with that path, clears the shaders, and marks them for recompilation by updating their 
+		* If the path exists in the map, it iterates through all the shader entries compiled from
+		* or including that path, clears the shaders, and marks them for recompilation by updating their 
 		* modified times, and logs the operation.
 		*
-		* @param a_path The file path associated with the shaders to be marked for recompilation.
+		* @param a_path The .hlsl or .hlsli file path associated with the shaders to be marked for recompilation.
 		* 
 		* @returns bool whether a shader was found in the `hlslToShaderMap`
 		* 
 		* @note The function assumes that `a_path` corresponds to shaders stored in `hlslToShaderMap`.
-		* If the path is not found in the map, the function does nothing. Also, only files compiled
-		* during session will be identified. Disk cached shaders will not be cleared and a further 
-		* cache clear may be necessary.
+		* If the path is not found in the map, the function does nothing. Only shaders compiled or
+		* loaded from the disk cache during the session are linked to their files.
 		* 
 		* @threadsafe The function locks the internal map (`mapMutex`) to ensure thread safety when 
 		* accessing or modifying shared shader map data.
 		*/
 		bool Clear(const std::string& a_path);
 
-		bool AddCompletedShader(ShaderClass shaderClass, const RE::BSShader& shader, uint32_t descriptor, ID3DBlob* a_blob);
-		ID3DBlob* GetCompletedShader(const std::string& a_key);
+		/**
+		 * @brief Stores the result of a compile and links it to the files it was built from.
+		 *
+		 * @param a_includes Every file included while compiling, used to find the permutations
+		 * affected when one of them changes.
+		 */
+		bool AddCompletedShader(ShaderClass shaderClass, const RE::BSShader& shader, uint32_t descriptor, ID3DBlob* a_blob,
+			std::span<const std::filesystem::path> a_includes = {});
+		ID3DBlob* GetCompletedShader(const ShaderKey& a_key);
 		ID3DBlob* GetCompletedShader(const SIE::ShaderCompilationTask& a_task);
 		ID3DBlob* GetCompletedShader(ShaderClass shaderClass, const RE::BSShader& shader, uint32_t descriptor);
-		ShaderCompilationTask::Status GetShaderStatus(const std::string& a_key);
+		ShaderCompilationTask::Status GetShaderStatus(const ShaderKey& a_key);
+
+		/**
+		 * @brief Gets the compact key for a shader permutation.
+		 *
+		 * The defines string is only built the first time a descriptor is seen; afterwards the key
+		 * is served from a descriptor lookup table.
+		 *
+		 * @param shaderClass The shader class (vertex, pixel or compute).
+		 * @param shader The shader the descriptor belongs to.
+		 * @param descriptor The (modified) shader descriptor.
+		 * @return The key shared by all descriptors resolving to the same defines.
+		 */
+		ShaderKey GetShaderKey(ShaderClass shaderClass, const RE::BSShader& shader, uint32_t descriptor);
+		/**
+		 * @brief Gets the human readable string a key was interned from. Intended for logging only.
+		 */
+		std::string GetShaderKeyString(const ShaderKey& a_key);
 		std::string GetShaderStatsString(bool a_timeOnly = false);
 
-		RE::BSGraphics::VertexShader* GetVertexShader(const RE::BSShader& shader, uint32_t descriptor);
+		RE::BSGraphics::VertexShader* GetVertexShader(const RE::BSShader& shader, uint32_t descriptor,
+			CompilationPriority priority = CompilationPriority::Draw);
 		RE::BSGraphics::PixelShader* GetPixelShader(const RE::BSShader& shader,
-			uint32_t descriptor);
+			uint32_t descriptor, CompilationPriority priority = CompilationPriority::Draw);
 		RE::BSGraphics::ComputeShader* GetComputeShader(const RE::BSShader& shader,
-			uint32_t descriptor);
+			uint32_t descriptor, CompilationPriority priority = CompilationPriority::Draw);
 
 		RE::BSGraphics::VertexShader* MakeAndAddVertexShader(const RE::BSShader& shader,
 			uint32_t descriptor);
@@ -433,7 +536,11 @@ namespace SIE
 
 		int32_t compilationThreadCount = std::max({ static_cast<int32_t>(std::thread::hardware_concurrency()) - 4, static_cast<int32_t>(std::thread::hardware_concurrency()) * 3 / 4, 1 });
 		int32_t backgroundCompilationThreadCount = std::max(static_cast<int32_t>(std::thread::hardware_concurrency()) / 2, 1);
-		BS::thread_pool compilationPool{};
+		BS::thread_pool compilationPool{ 1 };  // auxiliary tasks such as the file watcher queue; shaders are compiled by compilationWorkers
+		ShaderCacheArchive diskCacheArchive;
+		ShaderCompilerProcesses compilerProcesses;
+		ShaderPermutationManifest permutationManifest;  // every permutation looked up in the disk cache this session
+		ShaderUsageRecorder usageRecorder;              // permutations actually drawn, used to precompile those first
 		bool backgroundCompilation = false;
 		bool menuLoaded = false;
 
@@ -629,39 +736,36 @@ namespace SIE
 		};
 
 		uint blockedKeyIndex = (uint)-1;  // index in shaderMap; negative value indicates disabled
-		std::string blockedKey = "";
+		ShaderKey blockedKey{};
+		std::string blockedKeyString = "";  // blockedKey for display and logging
 		std::vector<uint32_t> blockedIDs;  // more than one descriptor could be blocked based on shader hash
-		HANDLE managementThread = nullptr;
 
 	private:
 		struct hlslRecord
 		{
-			std::string key;
+			ShaderKey key;
 			RE::BSShader::Type type;
 			std::uint32_t descriptor;
 			SIE::ShaderClass shaderClass;
-			std::wstring diskPath;
+			uint64_t diskCacheKey;
 
 			bool operator<(const hlslRecord& other) const
 			{
-				return key < other.key;
+				return std::tie(key, descriptor) < std::tie(other.key, other.descriptor);
 			}
 		};
+		void UnlinkShaderFiles(const hlslRecord& a_record);
 		ShaderCache();
-		void ManageCompilationSet(std::stop_token stoken);
-		void ProcessCompilationSet(std::stop_token stoken, SIE::ShaderCompilationTask task);
+		void CompilationWorker(std::stop_token stoken, int32_t a_worker);
+		/** @brief Publishes the shaders inserted since the last batch, so the render thread finds them. */
+		void FlushShaderTables();
+		void FlushStaleShaderTables();
 
 		~ShaderCache();
 
-		std::array<eastl::unordered_map<uint32_t, std::unique_ptr<RE::BSGraphics::VertexShader>>,
-			static_cast<size_t>(RE::BSShader::Type::Total)>
-			vertexShaders;
-		std::array<eastl::unordered_map<uint32_t, std::unique_ptr<RE::BSGraphics::PixelShader>>,
-			static_cast<size_t>(RE::BSShader::Type::Total)>
-			pixelShaders;
-		std::array<eastl::unordered_map<uint32_t, std::unique_ptr<RE::BSGraphics::ComputeShader>>,
-			static_cast<size_t>(RE::BSShader::Type::Total)>
-			computeShaders;
+		std::array<GameShaderTable<RE::BSGraphics::VertexShader>, static_cast<size_t>(RE::BSShader::Type::Total)> vertexShaders;
+		std::array<GameShaderTable<RE::BSGraphics::PixelShader>, static_cast<size_t>(RE::BSShader::Type::Total)> pixelShaders;
+		std::array<GameShaderTable<RE::BSGraphics::ComputeShader>, static_cast<size_t>(RE::BSShader::Type::Total)> computeShaders;
 
 		bool isEnabled = true;
 		bool isDiskCache = true;
@@ -669,18 +773,23 @@ namespace SIE
 		bool isDump = false;
 		bool hideError = false;
 		bool useFileWatcher = false;
+		bool useCompilerProcesses = false;
 
-		std::stop_source ssource;
-		std::mutex vertexShadersMutex;
-		std::mutex pixelShadersMutex;
-		std::mutex computeShadersMutex;
 		CompilationSet compilationSet;
-		std::unordered_map<std::string, ShaderCacheResult> shaderMap{};
+		std::vector<std::jthread> compilationWorkers;  // one per hardware thread, only GetCompilationThreadCount() take tasks
+		std::atomic<int32_t> busyWorkers = 0;          // workers currently compiling
+		std::unordered_map<ShaderKey, ShaderCacheResult> shaderMap{};
 		std::mutex mapMutex;                                                            // guard for shaderMap
 		std::unordered_map<std::string, system_clock::time_point> modifiedShaderMap{};  // hashmap when a shader source file last modified
 		std::mutex modifiedMapMutex;                                                    // guard for modifiedShaderMap
-		std::unordered_map<std::string, std::set<hlslRecord>> hlslToShaderMap{};        // hashmap linking specific hlsl files to shader keys in shaderMap
-		std::mutex hlslMapMutex;                                                        // guard for hlslToShaderMap
+		std::unordered_map<std::string, std::set<hlslRecord>> hlslToShaderMap{};        // hashmap linking hlsl files and everything they include to shader keys in shaderMap
+		std::map<hlslRecord, std::vector<std::string>> shaderFileMap{};                 // files each shader was built from, the reverse of hlslToShaderMap
+		std::mutex hlslMapMutex;                                                        // guard for hlslToShaderMap and shaderFileMap
+		std::unordered_map<size_t, ShaderKey> descriptorKeyMap{};                       // hashmap from ShaderCompilationTask id to its key
+		std::unordered_map<std::string, uint32_t> defineSetIds{};                       // interned define-set strings
+		std::vector<std::string> defineSetStrings{};                                    // define-set id to string; for logging
+		uint16_t defineSetGeneration = 0;                                               // incremented when the interned define sets are reset
+		std::shared_mutex keyMutex;                                                     // guard for descriptorKeyMap and define sets
 
 		// efsw file watcher
 		efsw::FileWatcher* fileWatcher = nullptr;
@@ -695,16 +804,16 @@ namespace SIE
 		/**
 		 * @brief Updates the shader cache for a specific file path and determines whether to clear the cache.
 		 *
-		 * This function checks if the given file exists and is a shader file (with the ".hlsl" extension).
-		 * It then updates the cache with the modified time for the shader file and marks shaders for recompilation 
-		 * based on the given path. If a specific shader is not found in the cache, it may trigger a cache clear.
+		 * This function checks if the given file exists and is a shader file (with the ".hlsl" or ".hlsli" extension).
+		 * It then updates the cache with the modified time for the shader file and marks every shader compiled from
+		 * or including it for recompilation. If a top level shader is not found in the cache, it may trigger a cache clear.
 		 *
 		 * @param filePath The path of the shader file to update.
 		 * @param cache Reference to the shader cache to update.
 		 * @param clearCache A boolean flag indicating whether the entire cache should be cleared.
 		 * @param fileDone A boolean flag that signals whether the update process is done for the current file.
 		 * 
-		 * @note The function only processes files with an ".hlsl" extension and ignores directories.
+		 * @note The function only processes files with an ".hlsl" or ".hlsli" extension and ignores directories.
 		 * It assumes case-insensitive handling for shader types and extensions.
 		 * 
 		 * @return Void. Updates internal state and modifies `clearCache` and `fileDone` by reference.
@@ -0,0 +1,434 @@
+#include "ShaderCacheArchive.h"
+
+#include <d3dcompiler.h>
+
+namespace SIE
+{
+	namespace SShaderCacheArchive
+	{
+		constexpr const wchar_t* ArchiveName = L"ShaderCache.bin";
+		constexpr const wchar_t* JournalName = L"ShaderCache.journal";
+
+		// ID3DBlob over memory owned by someone else, e.g. a view of the mapped archive
+		class ArchiveBlob final : public ID3DBlob
+		{
+		public:
+			ArchiveBlob(std::shared_ptr<const void> a_owner, const void* a_data, size_t a_size) :
+				owner(std::move(a_owner)), data(a_data), size(a_size)
+			{}
+
+			HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppvObject) override
+			{
+				if (ppvObject == nullptr)
+					return E_POINTER;
+				if (riid == __uuidof(IUnknown) || riid == __uuidof(ID3D10Blob)) {
+					*ppvObject = static_cast<ID3DBlob*>(this);
+					AddRef();
+					return S_OK;
+				}
+				*ppvObject = nullptr;
+				return E_NOINTERFACE;
+			}
+
+			ULONG STDMETHODCALLTYPE AddRef() override
+			{
+				return ++refCount;
+			}
+
+			ULONG STDMETHODCALLTYPE Release() override
+			{
+				auto count = --refCount;
+				if (count == 0)
+					delete this;
+				return count;
+			}
+
+			LPVOID STDMETHODCALLTYPE GetBufferPointer() override
+			{
+				return const_cast<void*>(data);
+			}
+
+			SIZE_T STDMETHODCALLTYPE GetBufferSize() override
+			{
+				return size;
+			}
+
+		private:
+			std::shared_ptr<const void> owner;
+			const void* data;
+			size_t size;
+			std::atomic<ULONG> refCount = 1;
+		};
+
+		// Entry of the next packed archive, copied from the current archive or the journal
+		struct PendingEntry
+		{
+			ShaderCacheArchive::JournalRecord record;  // a size of 0 removes the key
+			bool inJournal = false;
+			uint64_t offset = 0;  // of the blob in its file
+		};
+
+		static bool ReadJournal(const std::filesystem::path& a_path, std::unordered_map<uint64_t, PendingEntry>& a_entries)
+		{
+			std::ifstream file(a_path, std::ios::binary);
+			std::error_code ec;
+			const auto fileSize = std::filesystem::file_size(a_path, ec);
+			if (!file.is_open() || ec)
+				return false;
+
+			// only the records are read, blobs are copied straight from the journal when needed
+			ShaderCacheArchive::JournalRecord record{};
+			uint64_t offset = 0;
+			while (file.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+				offset += sizeof(record);
+				if (offset + record.size > fileSize) {
+					logger::warn("Shader cache journal truncated; ignoring last entry");
+					break;
+				}
+				a_entries.insert_or_assign(record.keyHash, PendingEntry{ record, true, offset });
+				offset += record.size;
+				file.seekg(offset);
+			}
+			return true;
+		}
+
+		static bool CopyBlob(std::ifstream& a_from, uint64_t a_offset, uint32_t a_size, std::ofstream& a_to, std::vector<char>& a_buffer)
+		{
+			a_from.seekg(a_offset);
+			for (uint32_t left = a_size; left;) {
+				const auto chunk = std::min(left, static_cast<uint32_t>(a_buffer.size()));
+				if (!a_from.read(a_buffer.data(), chunk))
+					return false;
+				a_to.write(a_buffer.data(), chunk);
+				left -= chunk;
+			}
+			return true;
+		}
+	}
+
+	struct ShaderCacheArchive::Mapping
+	{
+		HANDLE file = INVALID_HANDLE_VALUE;
+		HANDLE mapping = nullptr;
+		const uint8_t* view = nullptr;
+		size_t size = 0;
+
+		~Mapping()
+		{
+			if (view)
+				UnmapViewOfFile(view);
+			if (mapping)
+				CloseHandle(mapping);
+			if (file != INVALID_HANDLE_VALUE)
+				CloseHandle(file);
+		}
+	};
+
+	ShaderCacheArchive::~ShaderCacheArchive()
+	{
+		Close();
+	}
+
+	bool ShaderCacheArchive::Load(const std::filesystem::path& a_directory)
+	{
+		Close();
+
+		std::unique_lock lock{ mutex };
+		directory = a_directory;
+
+		// blobs of the last load keep the archive mapped, and Windows refuses to replace a mapped file,
+		// so the journal is then read over the current archive and folded in on a later load
+		if (!Compact())
+			ReplayJournal();
+		return Map() || !journalEntries.empty();
+	}
+
+	bool ShaderCacheArchive::Map()
+	{
+		const auto archivePath = directory / SShaderCacheArchive::ArchiveName;
+		auto newMapping = std::make_shared<Mapping>();
+		// allow deletion while mapped so the disk cache can still be cleared from the menu
+		newMapping->file = CreateFileW(archivePath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (newMapping->file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER fileSize{};
+		if (!GetFileSizeEx(newMapping->file, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(Header))
+			return false;
+		newMapping->size = static_cast<size_t>(fileSize.QuadPart);
+
+		newMapping->mapping = CreateFileMappingW(newMapping->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!newMapping->mapping) {
+			logger::error("Failed to map shader cache archive: {}", GetLastError());
+			return false;
+		}
+		newMapping->view = static_cast<const uint8_t*>(MapViewOfFile(newMapping->mapping, FILE_MAP_READ, 0, 0, 0));
+		if (!newMapping->view) {
+			logger::error("Failed to map shader cache archive: {}", GetLastError());
+			return false;
+		}
+
+		const auto header = reinterpret_cast<const Header*>(newMapping->view);
+		const size_t indexEnd = sizeof(Header) + static_cast<size_t>(header->entryCount) * sizeof(IndexEntry);
+		if (header->magic != Magic || header->version != Version || indexEnd > newMapping->size) {
+			logger::info("Shader cache archive outdated or invalid");
+			return false;
+		}
+
+		std::span<const IndexEntry> newIndex{ reinterpret_cast<const IndexEntry*>(newMapping->view + sizeof(Header)), header->entryCount };
+		for (const auto& entry : newIndex) {
+			if (entry.offset < indexEnd || entry.offset + entry.size > newMapping->size) {
+				logger::info("Shader cache archive outdated or invalid");
+				return false;
+			}
+		}
+
+		mapping = std::move(newMapping);
+		index = newIndex;
+		logger::info("Mapped shader cache archive with {} shaders", index.size());
+		return true;
+	}
+
+	void ShaderCacheArchive::ReplayJournal()
+	{
+		const auto journalPath = directory / SShaderCacheArchive::JournalName;
+		std::unordered_map<uint64_t, SShaderCacheArchive::PendingEntry> entries;
+		if (!SShaderCacheArchive::ReadJournal(journalPath, entries))
+			return;
+
+		std::ifstream file(journalPath, std::ios::binary);
+		for (const auto& [keyHash, entry] : entries) {
+			winrt::com_ptr<ID3DBlob> blob;  // stays null for removed keys
+			if (entry.record.size) {
+				if (FAILED(D3DCreateBlob(entry.record.size, blob.put())))
+					continue;
+				file.seekg(entry.offset);
+				if (!file.read(static_cast<char*>(blob->GetBufferPointer()), entry.record.size))
+					continue;
+			}
+			journalEntries.insert_or_assign(keyHash, JournalEntry{ entry.record.sourceHash, entry.record.timestamp, std::move(blob) });
+		}
+		logger::info("Read {} shaders from the shader cache journal", entries.size());
+	}
+
+	void ShaderCacheArchive::Close()
+	{
+		std::unique_lock lock{ mutex };
+		index = {};
+		mapping.reset();
+		journalEntries.clear();
+		if (journal.is_open())
+			journal.close();
+	}
+
+	ShaderCacheArchive::FindResult ShaderCacheArchive::Find(uint64_t a_keyHash, uint64_t a_sourceHash)
+	{
+		std::shared_lock lock{ mutex };
+
+		if (auto it = journalEntries.find(a_keyHash); it != journalEntries.end()) {
+			const auto& entry = it->second;
+			if (!entry.blob || entry.sourceHash != a_sourceHash)
+				return {};
+			entry.blob->AddRef();
+			return { entry.blob.get(), std::chrono::system_clock::time_point(std::chrono::system_clock::duration(entry.timestamp)) };
+		}
+
+		const auto entry = FindPacked(a_keyHash);
+		if (!entry || entry->sourceHash != a_sourceHash)
+			return {};
+
+		auto blob = new SShaderCacheArchive::ArchiveBlob(mapping, mapping->view + entry->offset, entry->size);
+		return { blob, std::chrono::system_clock::time_point(std::chrono::system_clock::duration(entry->timestamp)) };
+	}
+
+	void ShaderCacheArchive::Add(uint64_t a_keyHash, uint64_t a_sourceHash, ID3DBlob* a_blob)
+	{
+		if (!a_blob)
+			return;
+
+		std::unique_lock lock{ mutex };
+		if (!OpenJournal())
+			return;
+
+		JournalRecord record{
+			.keyHash = a_keyHash,
+			.sourceHash = a_sourceHash,
+			.timestamp = std::chrono::system_clock::now().time_since_epoch().count(),
+			.size = static_cast<uint32_t>(a_blob->GetBufferSize()),
+		};
+		journal.write(reinterpret_cast<const char*>(&record), sizeof(record));
+		journal.write(static_cast<const char*>(a_blob->GetBufferPointer()), record.size);
+		journal.flush();
+
+		winrt::com_ptr<ID3DBlob> blob;
+		blob.copy_from(a_blob);
+		journalEntries.insert_or_assign(a_keyHash, JournalEntry{ record.sourceHash, record.timestamp, std::move(blob) });
+	}
+
+	void ShaderCacheArchive::Remove(uint64_t a_keyHash)
+	{
+		std::unique_lock lock{ mutex };
+		if (!FindPacked(a_keyHash) && !journalEntries.contains(a_keyHash))
+			return;
+		if (!OpenJournal())
+			return;
+
+		JournalRecord record{ .keyHash = a_keyHash };
+		journal.write(reinterpret_cast<const char*>(&record), sizeof(record));
+		journal.flush();
+
+		journalEntries.insert_or_assign(a_keyHash, JournalEntry{ 0, 0, nullptr });
+	}
+
+	bool ShaderCacheArchive::Compact()
+	{
+		const auto archivePath = directory / SShaderCacheArchive::ArchiveName;
+		const auto journalPath = directory / SShaderCacheArchive::JournalName;
+		if (!std::filesystem::exists(journalPath))
+			return true;
+
+		const auto tempPath = directory / L"ShaderCache.bin.tmp";
+		size_t entryCount = 0;
+		{
+			std::unordered_map<uint64_t, SShaderCacheArchive::PendingEntry> entries;
+
+			// existing packed entries first so the journal can override them
+			std::ifstream archive(archivePath, std::ios::binary);
+			if (archive.is_open()) {
+				std::error_code ec;
+				const auto archiveSize = std::filesystem::file_size(archivePath, ec);
+				Header header{};
+				std::vector<IndexEntry> oldIndex;
+				if (!ec && archive.read(reinterpret_cast<char*>(&header), sizeof(header)) && header.magic == Magic && header.version == Version &&
+					sizeof(Header) + static_cast<uint64_t>(header.entryCount) * sizeof(IndexEntry) <= archiveSize) {
+					oldIndex.resize(header.entryCount);
+					archive.read(reinterpret_cast<char*>(oldIndex.data()), oldIndex.size() * sizeof(IndexEntry));
+				}
+				for (const auto& entry : oldIndex) {
+					if (entry.offset + entry.size <= archiveSize)
+						entries.insert_or_assign(entry.keyHash, SShaderCacheArchive::PendingEntry{ { entry.keyHash, entry.sourceHash, entry.timestamp, entry.size, 0 }, false, entry.offset });
+				}
+			}
+			SShaderCacheArchive::ReadJournal(journalPath, entries);
+			std::ifstream journal(journalPath, std::ios::binary);
+
+			std::vector<IndexEntry> newIndex;
+			newIndex.reserve(entries.size());
+			for (const auto& [keyHash, entry] : entries) {
+				if (entry.record.size)
+					newIndex.push_back({ keyHash, entry.record.sourceHash, entry.record.timestamp, 0, entry.record.size, 0 });
+			}
+			std::ranges::sort(newIndex, {}, &IndexEntry::keyHash);
+			uint64_t offset = sizeof(Header) + newIndex.size() * sizeof(IndexEntry);
+			for (auto& entry : newIndex) {
+				entry.offset = offset;
+				offset += entry.size;
+			}
+
+			// blobs are streamed from the old archive and the journal, never held in memory all at once
+			std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+			bool written = file.is_open() && journal.is_open();
+			if (written) {
+				Header header{ .entryCount = static_cast<uint32_t>(newIndex.size()) };
+				file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+				file.write(reinterpret_cast<const char*>(newIndex.data()), newIndex.size() * sizeof(IndexEntry));
+				std::vector<char> buffer(1 << 16);
+				for (const auto& entry : newIndex) {
+					const auto& pending = entries.at(entry.keyHash);
+					if (!(written = SShaderCacheArchive::CopyBlob(pending.inJournal ? journal : archive, pending.offset, entry.size, file, buffer)))
+						break;
+				}
+				written = written && file;
+			}
+			if (!written) {
+				logger::error("Failed to write {}", tempPath.string());
+				file.close();
+				std::error_code ec;
+				std::filesystem::remove(tempPath, ec);
+				return false;
+			}
+			entryCount = newIndex.size();
+		}
+
+		try {
+			std::filesystem::rename(tempPath, archivePath);
+			std::filesystem::remove(journalPath);
+		} catch (const std::filesystem::filesystem_error& e) {
+			logger::warn("Failed to compact shader cache archive, keeping the journal: {}", e.what());
+			std::error_code ec;
+			std::filesystem::remove(tempPath, ec);
+			return false;
+		}
+		logger::info("Compacted shader cache archive to {} shaders", entryCount);
+		return true;
+	}
+
+	size_t ShaderCacheArchive::GetEntryCount()
+	{
+		std::shared_lock lock{ mutex };
+		size_t count = journalEntries.size();
+		for (const auto& entry : index) {
+			if (!journalEntries.contains(entry.keyHash))
+				count++;
+		}
+		return count;
+	}
+
+	uint64_t ShaderCacheArchive::Hash(std::string_view a_data, uint64_t a_seed)
+	{
+		// FNV-1a
+		uint64_t hash = a_seed;
+		for (auto c : a_data) {
+			hash ^= static_cast<uint8_t>(c);
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	uint64_t ShaderCacheArchive::HashCompileInputs(uint64_t a_sourceTreeHash, std::span<const D3D_SHADER_MACRO> a_defines, std::string_view a_profile, uint32_t a_flags)
+	{
+		std::string defines;
+		for (const auto& define : a_defines) {
+			if (define.Name == nullptr)
+				break;
+			defines += define.Name;
+			if (define.Definition != nullptr && *define.Definition != '\0') {
+				defines += '=';
+				defines += define.Definition;
+			}
+			defines += ' ';
+		}
+
+		auto hash = Hash(defines, a_sourceTreeHash);
+		hash = Hash(a_profile, hash);
+		return Hash({ reinterpret_cast<const char*>(&a_flags), sizeof(a_flags) }, hash);
+	}
+
+	const ShaderCacheArchive::IndexEntry* ShaderCacheArchive::FindPacked(uint64_t a_keyHash) const
+	{
+		auto it = std::ranges::lower_bound(index, a_keyHash, {}, &IndexEntry::keyHash);
+		if (it == index.end() || it->keyHash != a_keyHash)
+			return nullptr;
+		return &*it;
+	}
+
+	bool ShaderCacheArchive::OpenJournal()
+	{
+		if (journal.is_open())
+			return true;
+		if (directory.empty())
+			return false;
+		try {
+			std::filesystem::create_directories(directory);
+		} catch (const std::filesystem::filesystem_error& e) {
+			logger::error("Failed to create folder: {}", e.what());
+			return false;
+		}
+		journal.open(directory / SShaderCacheArchive::JournalName, std::ios::binary | std::ios::app);
+		if (!journal.is_open()) {
+			logger::error("Failed to open shader cache journal");
+			return false;
+		}
+		return true;
+	}
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <d3dcommon.h>
+#include <filesystem>
+#include <fstream>
+#include <shared_mutex>
+#include <span>
+#include <unordered_map>
+#include <winrt/base.h>
+
+namespace SIE
+{
+	/**
+	 * Single-file disk cache for compiled shaders.
+	 *
+	 * The packed archive holds a header, an index sorted by key hash and the concatenated shader
+	 * blobs. It is memory mapped once on load and blobs are served straight out of the mapping.
+	 * Shaders compiled during the session are appended to a journal, which is folded into the
+	 * packed archive by Compact() on the next load.
+	 */
+	class ShaderCacheArchive
+	{
+	public:
+		static constexpr uint32_t Magic = 0x43535343;  // "CSSC"
+		static constexpr uint32_t Version = 2;  // 2: source hashes cover the include tree instead of the preprocessed source
+
+		struct Header
+		{
+			uint32_t magic = Magic;
+			uint32_t version = Version;
+			uint32_t entryCount = 0;
+			uint32_t pad0 = 0;
+		};
+
+		struct IndexEntry
+		{
+			uint64_t keyHash;
+			uint64_t sourceHash;
+			int64_t timestamp;  // compile time, system_clock ticks
+			uint64_t offset;    // from the start of the archive
+			uint32_t size;
+			uint32_t pad0;
+		};
+
+		// Journal record, followed by size bytes of shader blob. A size of 0 removes the key.
+		struct JournalRecord
+		{
+			uint64_t keyHash;
+			uint64_t sourceHash;
+			int64_t timestamp;
+			uint32_t size;
+			uint32_t pad0;
+		};
+
+		struct FindResult
+		{
+			ID3DBlob* blob = nullptr;  // new reference, owned by the caller
+			std::chrono::system_clock::time_point timestamp{};
+		};
+
+		~ShaderCacheArchive();
+
+		/**
+		 * @brief Compacts any pending journal into the packed archive and maps it.
+		 *
+		 * If the archive cannot be replaced, e.g. because blobs of the last load still map it,
+		 * the current archive is mapped and the journal is read on top of it instead.
+		 * @param a_directory The disk cache directory, e.g. Data/ShaderCache.
+		 * @return true if any shaders were loaded, false if the cache starts empty.
+		 */
+		bool Load(const std::filesystem::path& a_directory);
+		/**
+		 * @brief Unmaps the archive and closes the journal.
+		 *
+		 * Blobs already handed out keep the mapping alive until they are released.
+		 */
+		void Close();
+
+		/**
+		 * @brief Looks up a shader blob.
+		 *
+		 * @param a_keyHash Identifies the permutation (shader, class and descriptor).
+		 * @param a_sourceHash Identifies the inputs the permutation was compiled from; entries
+		 * compiled from different inputs are treated as missing.
+		 */
+		FindResult Find(uint64_t a_keyHash, uint64_t a_sourceHash);
+		void Add(uint64_t a_keyHash, uint64_t a_sourceHash, ID3DBlob* a_blob);
+		void Remove(uint64_t a_keyHash);
+
+		/**
+		 * @brief Merges the journal into a new packed archive and deletes the journal.
+		 *
+		 * Must be called while the archive is not mapped.
+		 * @return false if the journal is still pending because the archive could not be written or replaced.
+		 */
+		bool Compact();
+
+		size_t GetEntryCount();
+
+		static uint64_t Hash(std::string_view a_data, uint64_t a_seed = 14695981039346656037ull);
+		/**
+		 * @brief Hashes everything a compiled shader depends on, used as the source hash of an entry.
+		 *
+		 * @param a_sourceTreeHash Hash of the source and every file it may include, see ShaderIncludeHandler::ScanSourceTree.
+		 * @param a_defines Defines up to the first null entry.
+		 * @param a_profile The shader profile, e.g. ps_5_0.
+		 * @param a_flags D3DCOMPILE_* flags.
+		 */
+		static uint64_t HashCompileInputs(uint64_t a_sourceTreeHash, std::span<const D3D_SHADER_MACRO> a_defines, std::string_view a_profile, uint32_t a_flags);
+
+	private:
+		struct Mapping;
+
+		struct JournalEntry
+		{
+			uint64_t sourceHash;
+			int64_t timestamp;
+			winrt::com_ptr<ID3DBlob> blob;  // null for removed keys
+		};
+
+		const IndexEntry* FindPacked(uint64_t a_keyHash) const;
+		bool OpenJournal();
+		bool Map();
+		/** @brief Reads the journal into journalEntries, for when it could not be compacted. */
+		void ReplayJournal();
+
+		std::filesystem::path directory;
+		std::shared_ptr<Mapping> mapping;
+		std::span<const IndexEntry> index;
+		std::unordered_map<uint64_t, JournalEntry> journalEntries;
+		std::ofstream journal;
+		std::shared_mutex mutex;
+	};
+}
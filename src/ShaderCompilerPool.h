@@ -0,0 +1,152 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ShaderCompilerProtocol.h"
+
+namespace SIE
+{
+	/**
+	 * Schedules compile requests over a pool of helper processes, one request per process at a time.
+	 *
+	 * Processes are started on demand and reused once they answered. A process which closes its pipe, answers with
+	 * something else than the response, or does not answer before the deadline is handed back to the caller and ended
+	 * with it, and the next request starts a fresh one.
+	 *
+	 * Process provides bool Write(std::string_view) and
+	 * ReadStatus Read(char* data, size_t size, std::chrono::steady_clock::time_point deadline), and ends the helper when
+	 * destroyed. Standalone of the game so tools/ShaderCompilerTest can run it against the stand-in compiler on the host.
+	 */
+	template <typename Process>
+	class ShaderCompilerPool
+	{
+	public:
+		enum class Status
+		{
+			Completed,    // the response belongs to the request
+			Unavailable,  // no process could be started
+			SendFailed,   // the request could not be written, even to a fresh process
+			Stopped,      // the process closed its pipe or sent garbage, likely a compiler crash
+			TimedOut,     // the process did not answer before the deadline
+		};
+
+		struct Result
+		{
+			Status status = Status::Unavailable;
+			ShaderCompilerProtocol::Response response;
+			std::unique_ptr<Process> process;  // the process which failed the request, ended once released
+		};
+
+		/** @param a_start Starts a process, or returns null if the executable cannot be started. */
+		explicit ShaderCompilerPool(std::function<std::unique_ptr<Process>()> a_start) :
+			start(std::move(a_start)) {}
+
+		/**
+		 * @brief Sends a request to an idle or new process and waits for the response.
+		 *
+		 * @param a_request The shader to compile. The id is assigned here.
+		 * @param a_timeout How long the process may take to answer.
+		 */
+		Result Compile(ShaderCompilerProtocol::Request a_request, std::chrono::milliseconds a_timeout)
+		{
+			{
+				std::scoped_lock lock(mutex);
+				a_request.id = nextId++;
+			}
+			const auto message = ShaderCompilerProtocol::Serialize(a_request);
+
+			// an idle process may have exited since its last request, so retry once with a fresh one
+			for (int attempt = 0; attempt < 2; attempt++) {
+				auto slot = Acquire();
+				if (!slot.process)
+					return { Status::Unavailable };
+				if (!slot.process->Write(message))
+					continue;
+
+				Result result{ Status::Completed };
+				const auto deadline = std::chrono::steady_clock::now() + a_timeout;
+				std::string payload;
+				const auto status = ShaderCompilerProtocol::ReadMessage(
+					[&](char* a_data, size_t a_size) { return slot.process->Read(a_data, a_size, deadline); }, payload);
+				if (status == ShaderCompilerProtocol::ReadStatus::Ok && ShaderCompilerProtocol::Deserialize(payload, result.response) &&
+					result.response.id == a_request.id) {
+					Release(std::move(slot));
+					return result;
+				}
+				result.status = status == ShaderCompilerProtocol::ReadStatus::TimedOut ? Status::TimedOut : Status::Stopped;
+				result.process = std::move(slot.process);
+				return result;
+			}
+			return { Status::SendFailed };
+		}
+
+		/**
+		 * @brief Ends all idle processes. Busy ones end when their request completes.
+		 *
+		 * Starting processes is retried afterwards, even if it failed before.
+		 */
+		void Shutdown()
+		{
+			std::scoped_lock lock(mutex);
+			idleProcesses.clear();
+			generation++;
+			unavailable = false;
+		}
+
+		/** @return How many processes were started, for tests. */
+		uint32_t GetStartCount() const { return startCount.load(); }
+
+	private:
+		struct Slot
+		{
+			std::unique_ptr<Process> process;
+			uint32_t generation = 0;  // Shutdown() count when started
+		};
+
+		Slot Acquire()
+		{
+			uint32_t processGeneration = 0;
+			{
+				std::scoped_lock lock(mutex);
+				if (!idleProcesses.empty()) {
+					auto slot = std::move(idleProcesses.back());
+					idleProcesses.pop_back();
+					return slot;
+				}
+				if (unavailable)
+					return {};
+				processGeneration = generation;
+			}
+			auto process = start();
+			if (!process) {
+				std::scoped_lock lock(mutex);
+				unavailable = true;
+				return {};
+			}
+			startCount++;
+			return { std::move(process), processGeneration };
+		}
+
+		void Release(Slot a_slot)
+		{
+			std::scoped_lock lock(mutex);
+			if (a_slot.generation == generation)
+				idleProcesses.push_back(std::move(a_slot));
+		}
+
+		std::function<std::unique_ptr<Process>()> start;
+		std::mutex mutex;
+		std::vector<Slot> idleProcesses;
+		bool unavailable = false;  // the executable could not be started, stop trying
+		uint32_t generation = 0;
+		uint32_t nextId = 0;
+		std::atomic<uint32_t> startCount = 0;
+	};
+}
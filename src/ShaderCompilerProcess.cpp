@@ -0,0 +1,184 @@
+#include "ShaderCompilerProcess.h"
+
+#include <d3dcompiler.h>
+
+#include "Util.h"
+
+namespace SIE
+{
+	ShaderCompilerProcesses::Process::~Process()
+	{
+		if (input)
+			CloseHandle(input);
+		if (output)
+			CloseHandle(output);
+		if (readEvent)
+			CloseHandle(readEvent);
+		if (process) {
+			TerminateProcess(process, 0);
+			CloseHandle(process);
+		}
+	}
+
+	bool ShaderCompilerProcesses::Process::Write(std::string_view a_data)
+	{
+		size_t offset = 0;
+		while (offset < a_data.size()) {
+			DWORD written = 0;
+			if (!WriteFile(input, a_data.data() + offset, static_cast<DWORD>(a_data.size() - offset), &written, nullptr))
+				return false;
+			offset += written;
+		}
+		return true;
+	}
+
+	ShaderCompilerProtocol::ReadStatus ShaderCompilerProcesses::Process::Read(char* a_data, size_t a_size, std::chrono::steady_clock::time_point a_deadline)
+	{
+		size_t offset = 0;
+		while (offset < a_size) {
+			OVERLAPPED overlapped{};
+			overlapped.hEvent = readEvent;
+			if (!ReadFile(output, a_data + offset, static_cast<DWORD>(a_size - offset), nullptr, &overlapped) && GetLastError() != ERROR_IO_PENDING)
+				return ShaderCompilerProtocol::ReadStatus::Closed;
+
+			const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(a_deadline - std::chrono::steady_clock::now()).count();
+			DWORD read = 0;
+			if (WaitForSingleObject(readEvent, static_cast<DWORD>(std::clamp<int64_t>(remaining, 0, INFINITE - 1))) != WAIT_OBJECT_0) {
+				// the buffer has to outlive the read, so wait for the cancellation to land
+				CancelIoEx(output, &overlapped);
+				GetOverlappedResult(output, &overlapped, &read, TRUE);
+				return ShaderCompilerProtocol::ReadStatus::TimedOut;
+			}
+			if (!GetOverlappedResult(output, &overlapped, &read, FALSE) || !read)
+				return ShaderCompilerProtocol::ReadStatus::Closed;
+			offset += read;
+		}
+		return ShaderCompilerProtocol::ReadStatus::Ok;
+	}
+
+	ShaderCompilerProcesses::ShaderCompilerProcesses() :
+		pool([this]() { return Start(); })
+	{}
+
+	ShaderCompilerProcesses::~ShaderCompilerProcesses()
+	{
+		Shutdown();
+		if (job)
+			CloseHandle(job);
+	}
+
+	std::optional<ShaderCompilerProcesses::Result> ShaderCompilerProcesses::Compile(ShaderCompilerProtocol::Request a_request)
+	{
+		const auto sourceName = a_request.sourceName;
+		auto result = pool.Compile(std::move(a_request), ResponseTimeout);
+		switch (result.status) {
+		case ShaderCompilerPool<Process>::Status::Completed:
+			{
+				Result compiled{ nullptr, std::move(result.response.errors) };
+				if (result.response.succeeded && SUCCEEDED(D3DCreateBlob(result.response.blob.size(), &compiled.blob)))
+					std::memcpy(compiled.blob->GetBufferPointer(), result.response.blob.data(), result.response.blob.size());
+				return compiled;
+			}
+		case ShaderCompilerPool<Process>::Status::Unavailable:
+			return std::nullopt;
+		case ShaderCompilerPool<Process>::Status::SendFailed:
+			return Result{ nullptr, "failed to send the shader to a compiler process" };
+		case ShaderCompilerPool<Process>::Status::TimedOut:
+			// ending the process with the result frees its slot, the next request starts a fresh one
+			logger::error("Shader compiler process {} did not answer within {}s while compiling {}; restarting it", GetProcessId(result.process->process), ResponseTimeout.count(), sourceName);
+			return Result{ nullptr, "shader compiler process timed out" };
+		case ShaderCompilerPool<Process>::Status::Stopped:
+		default:
+			{
+				DWORD exitCode = 0;
+				GetExitCodeProcess(result.process->process, &exitCode);
+				logger::error("Shader compiler process {} stopped while compiling {} (exit code {:X})", GetProcessId(result.process->process), sourceName, exitCode);
+				return Result{ nullptr, "shader compiler process stopped" };
+			}
+		}
+	}
+
+	void ShaderCompilerProcesses::Shutdown()
+	{
+		pool.Shutdown();
+	}
+
+	std::unique_ptr<ShaderCompilerProcesses::Process> ShaderCompilerProcesses::Start()
+	{
+		std::unique_lock lock(mutex);
+		if (!job) {
+			// end helpers together with the game, even if it crashes
+			job = CreateJobObjectW(nullptr, nullptr);
+			JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits{};
+			limits.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+			if (job)
+				SetInformationJobObject(job, JobObjectExtendedLimitInformation, &limits, sizeof(limits));
+		}
+		// anonymous pipes cannot be read overlapped, so the helper's stdout is a named pipe, which allows reads with a deadline
+		const auto pipeName = std::format(L"\\\\.\\pipe\\CommunityShadersCompiler-{}-{}", GetCurrentProcessId(), pipeCount++);
+		lock.unlock();
+
+		auto process = std::make_unique<Process>();
+		process->readEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+		if (!process->readEvent)
+			return nullptr;
+
+		SECURITY_ATTRIBUTES security{ sizeof(security), nullptr, TRUE };
+		HANDLE childInput = nullptr;
+		if (!CreatePipe(&childInput, &process->input, &security, 0))
+			return nullptr;
+		SetHandleInformation(process->input, HANDLE_FLAG_INHERIT, 0);
+		process->output = CreateNamedPipeW(pipeName.c_str(), PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+			PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, 1, 0, 1 << 16, 0, nullptr);
+		if (process->output == INVALID_HANDLE_VALUE) {
+			process->output = nullptr;
+			CloseHandle(childInput);
+			return nullptr;
+		}
+		HANDLE childOutput = CreateFileW(pipeName.c_str(), GENERIC_WRITE, 0, &security, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (childOutput == INVALID_HANDLE_VALUE) {
+			CloseHandle(childInput);
+			return nullptr;
+		}
+
+		// only hand the helper its own pipe ends, not every inheritable handle in the game
+		HANDLE inheritedHandles[] = { childInput, childOutput };
+		SIZE_T attributeSize = 0;
+		InitializeProcThreadAttributeList(nullptr, 1, 0, &attributeSize);
+		std::vector<std::byte> attributeBuffer(attributeSize);
+		auto attributes = reinterpret_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(attributeBuffer.data());
+		InitializeProcThreadAttributeList(attributes, 1, 0, &attributeSize);
+		UpdateProcThreadAttribute(attributes, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST, inheritedHandles, sizeof(inheritedHandles), nullptr, nullptr);
+
+		STARTUPINFOEXW startupInfo{};
+		startupInfo.StartupInfo.cb = sizeof(startupInfo);
+		startupInfo.StartupInfo.dwFlags = STARTF_USESTDHANDLES;
+		startupInfo.StartupInfo.hStdInput = childInput;
+		startupInfo.StartupInfo.hStdOutput = childOutput;
+		startupInfo.lpAttributeList = attributes;
+
+		std::wstring commandLine = std::format(L"\"{}\"", ExecutablePath);
+		PROCESS_INFORMATION processInfo{};
+		const bool started = CreateProcessW(ExecutablePath, commandLine.data(), nullptr, nullptr, TRUE,
+			CREATE_NO_WINDOW | CREATE_SUSPENDED | BELOW_NORMAL_PRIORITY_CLASS | EXTENDED_STARTUPINFO_PRESENT,
+			nullptr, nullptr, &startupInfo.StartupInfo, &processInfo) != FALSE;
+		const auto error = GetLastError();
+
+		DeleteProcThreadAttributeList(attributes);
+		CloseHandle(childInput);
+		CloseHandle(childOutput);
+
+		if (!started) {
+			logger::warn("Failed to start shader compiler process {} ({:X}); compiling in process instead", Util::WStringToString(ExecutablePath), error);
+			return nullptr;
+		}
+
+		process->process = processInfo.hProcess;
+		if (job)
+			AssignProcessToJobObject(job, processInfo.hProcess);
+		ResumeThread(processInfo.hThread);
+		CloseHandle(processInfo.hThread);
+		logger::debug("Started shader compiler process {}", processInfo.dwProcessId);
+		return process;
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <d3dcommon.h>
+#include <mutex>
+#include <optional>
+
+#include "ShaderCompilerPool.h"
+#include "ShaderCompilerProtocol.h"
+
+namespace SIE
+{
+	/**
+	 * Pool of out-of-process shader compilers (tools/ShaderCompiler).
+	 *
+	 * Each helper process serves one request at a time over its stdin and stdout pipes, so a
+	 * compiler crash only fails the shader that was being compiled. Processes are started on
+	 * demand, one per compiling thread, and belong to a job object that ends them with the game.
+	 * A helper which does not answer within ResponseTimeout is ended and replaced.
+	 */
+	class ShaderCompilerProcesses
+	{
+	public:
+		static constexpr auto ExecutablePath = L"Data\\SKSE\\Plugins\\CommunityShadersCompiler.exe";
+		static constexpr auto ResponseTimeout = std::chrono::seconds(60);  // far beyond the slowest shader, so only a hung compiler hits it
+
+		struct Result
+		{
+			ID3DBlob* blob = nullptr;  // new reference, owned by the caller; null if compilation failed
+			std::string errors;
+		};
+
+		ShaderCompilerProcesses();
+		~ShaderCompilerProcesses();
+
+		/**
+		 * @brief Compiles a shader in a helper process.
+		 *
+		 * @param a_request The shader to compile. The id is assigned here.
+		 * @return The compile result, or std::nullopt if no helper process could be started and
+		 * the shader should be compiled in process instead.
+		 */
+		std::optional<Result> Compile(ShaderCompilerProtocol::Request a_request);
+
+		/**
+		 * @brief Ends all idle helper processes. Busy ones end when their request completes.
+		 *
+		 * Starting processes is retried afterwards, even if it failed before.
+		 */
+		void Shutdown();
+
+	private:
+		struct Process
+		{
+			HANDLE process = nullptr;
+			HANDLE input = nullptr;      // write end of the helper's stdin
+			HANDLE output = nullptr;     // overlapped read end of the helper's stdout
+			HANDLE readEvent = nullptr;  // signaled when a read of output completes
+
+			~Process();
+
+			bool Write(std::string_view a_data);
+			ShaderCompilerProtocol::ReadStatus Read(char* a_data, size_t a_size, std::chrono::steady_clock::time_point a_deadline);
+		};
+
+		std::unique_ptr<Process> Start();
+
+		std::mutex mutex;  // guards job and pipeCount
+		HANDLE job = nullptr;
+		uint32_t pipeCount = 0;
+		ShaderCompilerPool<Process> pool;
+	};
+}
@@ -0,0 +1,207 @@
+#pragma once
+
+// Shared with the out-of-process compiler in tools/ShaderCompiler, so only the standard library is used here.
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace SIE::ShaderCompilerProtocol
+{
+	/**
+	 * Messages are framed as a 32-bit little endian payload length followed by the payload.
+	 * Integers in the payload are 32-bit little endian and strings are a length followed by
+	 * their bytes. Every request is answered by exactly one response with the same id.
+	 */
+	constexpr uint32_t Magic = 0x50435343;  // "CSCP"
+	constexpr uint32_t Version = 1;
+	constexpr uint32_t MaxMessageSize = 64 << 20;
+
+	struct Request
+	{
+		uint32_t id = 0;
+		uint32_t flags = 0;                                         // D3DCOMPILE_* flags
+		std::string sourceName;                                     // path, used for error messages
+		std::string entryPoint = "main";
+		std::string profile;                                        // e.g. ps_5_0
+		std::vector<std::pair<std::string, std::string>> defines;  // an empty value defines the name without a value
+		std::string source;
+	};
+
+	struct Response
+	{
+		uint32_t id = 0;
+		bool succeeded = false;
+		std::string blob;    // compiled bytecode
+		std::string errors;  // compiler output, also set for warnings on success
+	};
+
+	class Writer
+	{
+	public:
+		void U32(uint32_t a_value)
+		{
+			for (int i = 0; i < 4; i++)
+				buffer.push_back(static_cast<char>((a_value >> (i * 8)) & 0xFF));
+		}
+
+		void String(std::string_view a_value)
+		{
+			U32(static_cast<uint32_t>(a_value.size()));
+			buffer.append(a_value);
+		}
+
+		/** @brief Returns the framed message. */
+		std::string Finish()
+		{
+			std::string message;
+			message.reserve(buffer.size() + 4);
+			Writer length;
+			length.U32(static_cast<uint32_t>(buffer.size()));
+			message.append(length.buffer);
+			message.append(buffer);
+			return message;
+		}
+
+	private:
+		std::string buffer;
+	};
+
+	class Reader
+	{
+	public:
+		explicit Reader(std::string_view a_payload) :
+			payload(a_payload) {}
+
+		uint32_t U32()
+		{
+			if (payload.size() - offset < 4) {
+				valid = false;
+				return 0;
+			}
+			uint32_t value = 0;
+			for (int i = 0; i < 4; i++)
+				value |= static_cast<uint32_t>(static_cast<uint8_t>(payload[offset + i])) << (i * 8);
+			offset += 4;
+			return value;
+		}
+
+		std::string String()
+		{
+			const auto size = U32();
+			if (!valid || payload.size() - offset < size) {
+				valid = false;
+				return {};
+			}
+			std::string value{ payload.substr(offset, size) };
+			offset += size;
+			return value;
+		}
+
+		bool IsValid() const { return valid; }
+		bool AtEnd() const { return offset == payload.size(); }
+
+	private:
+		std::string_view payload;
+		size_t offset = 0;
+		bool valid = true;
+	};
+
+	/** @brief Decodes the payload length from the first four bytes of a message. */
+	inline uint32_t ReadLength(const char (&a_header)[4])
+	{
+		return Reader({ a_header, 4 }).U32();
+	}
+
+	enum class ReadStatus
+	{
+		Ok,
+		Closed,    // the pipe was closed or broke, or the message is too large
+		TimedOut,  // the deadline passed first
+	};
+
+	/**
+	 * @brief Reads the payload of one message.
+	 *
+	 * @param a_read Reads exactly the given number of bytes, as ReadStatus(char* data, size_t size).
+	 */
+	template <typename Read>
+	ReadStatus ReadMessage(Read&& a_read, std::string& a_payload)
+	{
+		char header[4];
+		if (const auto status = a_read(header, sizeof(header)); status != ReadStatus::Ok)
+			return status;
+		const auto size = ReadLength(header);
+		if (size > MaxMessageSize)
+			return ReadStatus::Closed;
+		a_payload.resize(size);
+		return a_read(a_payload.data(), size);
+	}
+
+	inline std::string Serialize(const Request& a_request)
+	{
+		Writer writer;
+		writer.U32(Magic);
+		writer.U32(Version);
+		writer.U32(a_request.id);
+		writer.U32(a_request.flags);
+		writer.String(a_request.sourceName);
+		writer.String(a_request.entryPoint);
+		writer.String(a_request.profile);
+		writer.U32(static_cast<uint32_t>(a_request.defines.size()));
+		for (const auto& [name, value] : a_request.defines) {
+			writer.String(name);
+			writer.String(value);
+		}
+		writer.String(a_request.source);
+		return writer.Finish();
+	}
+
+	inline bool Deserialize(std::string_view a_payload, Request& a_request)
+	{
+		Reader reader(a_payload);
+		if (reader.U32() != Magic || reader.U32() != Version)
+			return false;
+		a_request.id = reader.U32();
+		a_request.flags = reader.U32();
+		a_request.sourceName = reader.String();
+		a_request.entryPoint = reader.String();
+		a_request.profile = reader.String();
+		const auto defineCount = reader.U32();
+		a_request.defines.clear();
+		for (uint32_t i = 0; i < defineCount && reader.IsValid(); i++) {
+			auto name = reader.String();
+			auto value = reader.String();
+			a_request.defines.emplace_back(std::move(name), std::move(value));
+		}
+		a_request.source = reader.String();
+		return reader.IsValid() && reader.AtEnd();
+	}
+
+	inline std::string Serialize(const Response& a_response)
+	{
+		Writer writer;
+		writer.U32(Magic);
+		writer.U32(Version);
+		writer.U32(a_response.id);
+		writer.U32(a_response.succeeded);
+		writer.String(a_response.blob);
+		writer.String(a_response.errors);
+		return writer.Finish();
+	}
+
+	inline bool Deserialize(std::string_view a_payload, Response& a_response)
+	{
+		Reader reader(a_payload);
+		if (reader.U32() != Magic || reader.U32() != Version)
+			return false;
+		a_response.id = reader.U32();
+		a_response.succeeded = reader.U32() != 0;
+		a_response.blob = reader.String();
+		a_response.errors = reader.String();
+		return reader.IsValid() && reader.AtEnd();
+	}
+}
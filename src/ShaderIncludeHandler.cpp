@@ -0,0 +1,196 @@
+#include "ShaderIncludeHandler.h"
+
+#include "ShaderCacheArchive.h"
+
+namespace SIE
+{
+	namespace SShaderIncludeHandler
+	{
+		struct CachedFile
+		{
+			std::filesystem::file_time_type writeTime;
+			std::shared_ptr<const std::string> contents;               // null if the file does not exist
+			uint64_t hash = 0;                                         // of the contents
+			std::shared_ptr<const std::vector<std::string>> includes;  // names of every #include directive, compiled or not
+			uint32_t generation = 0;                                   // fileCacheGeneration the file was last checked in
+		};
+
+		static std::mutex fileCacheMutex;
+		static std::unordered_map<std::wstring, CachedFile> fileCache;
+		static std::atomic<uint32_t> fileCacheGeneration = 0;  // files checked in an older generation are checked again
+
+		static std::vector<std::string> ScanIncludes(std::string_view a_contents)
+		{
+			std::vector<std::string> includes;
+			const auto skipSpace = [&](size_t a_pos) {
+				while (a_pos < a_contents.size() && (a_contents[a_pos] == ' ' || a_contents[a_pos] == '\t'))
+					a_pos++;
+				return a_pos;
+			};
+			for (size_t lineStart = 0; lineStart < a_contents.size();) {
+				size_t lineEnd = a_contents.find('\n', lineStart);
+				if (lineEnd == std::string_view::npos)
+					lineEnd = a_contents.size();
+				const auto line = a_contents.substr(0, lineEnd);
+
+				// # include "name" or <name>
+				size_t pos = skipSpace(lineStart);
+				if (pos < lineEnd && line[pos] == '#') {
+					pos = skipSpace(pos + 1);
+					if (line.substr(pos).starts_with("include")) {
+						pos = skipSpace(pos + 7);
+						if (pos < lineEnd && (line[pos] == '"' || line[pos] == '<')) {
+							const char close = line[pos] == '"' ? '"' : '>';
+							if (const auto end = line.find(close, pos + 1); end != std::string_view::npos)
+								includes.emplace_back(line.substr(pos + 1, end - pos - 1));
+						}
+					}
+				}
+				lineStart = lineEnd + 1;
+			}
+			return includes;
+		}
+
+		static std::optional<CachedFile> ReadCachedFile(const std::filesystem::path& a_path)
+		{
+			const auto key = a_path.lexically_normal().wstring();
+			const auto generation = fileCacheGeneration.load();
+			{
+				// checked this generation, so no file system access, which adds up over every include of every permutation
+				std::lock_guard lock(fileCacheMutex);
+				auto it = fileCache.find(key);
+				if (it != fileCache.end() && it->second.generation == generation)
+					return it->second.contents ? std::optional(it->second) : std::nullopt;
+			}
+
+			std::error_code ec;
+			const auto writeTime = std::filesystem::last_write_time(a_path, ec);
+			if (ec) {
+				std::lock_guard lock(fileCacheMutex);
+				fileCache.insert_or_assign(key, CachedFile{ .generation = generation });
+				return std::nullopt;
+			}
+			{
+				std::lock_guard lock(fileCacheMutex);
+				auto it = fileCache.find(key);
+				if (it != fileCache.end() && it->second.contents && it->second.writeTime == writeTime) {
+					it->second.generation = generation;
+					return it->second;
+				}
+			}
+
+			std::ifstream file(a_path, std::ios::binary);
+			if (!file.is_open())
+				return std::nullopt;
+			auto contents = std::make_shared<const std::string>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+			CachedFile cached{ writeTime, contents, ShaderCacheArchive::Hash(*contents), std::make_shared<const std::vector<std::string>>(ScanIncludes(*contents)), generation };
+
+			std::lock_guard lock(fileCacheMutex);
+			fileCache.insert_or_assign(key, cached);
+			return cached;
+		}
+	}
+
+	ShaderIncludeHandler::ShaderIncludeHandler(const std::filesystem::path& a_sourcePath) :
+		sourceDirectory(a_sourcePath.parent_path())
+	{}
+
+	HRESULT __stdcall ShaderIncludeHandler::Open(D3D_INCLUDE_TYPE, LPCSTR pFileName, LPCVOID pParentData, LPCVOID* ppData, UINT* pBytes)
+	{
+		const std::filesystem::path fileName{ pFileName };
+
+		// like the standard handler: relative to the including file, then the initial source, then the working directory
+		std::vector<std::filesystem::path> candidates;
+		if (auto it = openFiles.find(pParentData); it != openFiles.end())
+			candidates.push_back(it->second / fileName);
+		candidates.push_back(sourceDirectory / fileName);
+		candidates.push_back(fileName);
+
+		for (const auto& candidate : candidates) {
+			auto contents = ReadFile(candidate);
+			if (!contents)
+				continue;
+
+			auto path = candidate.lexically_normal();
+			openFiles.insert_or_assign(contents->data(), path.parent_path());
+			if (std::ranges::find(includes, path) == includes.end())
+				includes.push_back(path);
+			heldFiles.push_back(contents);
+
+			*ppData = contents->data();
+			*pBytes = static_cast<UINT>(contents->size());
+			return S_OK;
+		}
+
+		logger::debug("Failed to resolve shader include {}", pFileName);
+		return E_FAIL;
+	}
+
+	HRESULT __stdcall ShaderIncludeHandler::Close(LPCVOID)
+	{
+		// file data is shared with the cache and released with the handler
+		return S_OK;
+	}
+
+	std::shared_ptr<const std::string> ShaderIncludeHandler::ReadFile(const std::filesystem::path& a_path)
+	{
+		auto cached = SShaderIncludeHandler::ReadCachedFile(a_path);
+		return cached ? cached->contents : nullptr;
+	}
+
+	void ShaderIncludeHandler::InvalidateFileCache()
+	{
+		SShaderIncludeHandler::fileCacheGeneration++;
+	}
+
+	std::optional<ShaderIncludeHandler::SourceTree> ShaderIncludeHandler::ScanSourceTree(const std::filesystem::path& a_sourcePath)
+	{
+		auto source = SShaderIncludeHandler::ReadCachedFile(a_sourcePath);
+		if (!source)
+			return std::nullopt;
+
+		SourceTree tree;
+		tree.files.push_back(a_sourcePath.lexically_normal());
+		tree.hash = source->hash;
+		const auto combine = [&](uint64_t a_value) {
+			tree.hash = ShaderCacheArchive::Hash({ reinterpret_cast<const char*>(&a_value), sizeof(a_value) }, tree.hash);
+		};
+
+		// resolved like Open, depth first in directive order so the hash is stable
+		const auto sourceDirectory = a_sourcePath.parent_path();
+		std::vector<std::pair<std::shared_ptr<const std::vector<std::string>>, std::filesystem::path>> pending{ { source->includes, sourceDirectory } };
+		std::vector<size_t> nextInclude{ 0 };
+		while (!pending.empty()) {
+			const auto& [includes, directory] = pending.back();
+			size_t& next = nextInclude.back();
+			if (next == includes->size()) {
+				pending.pop_back();
+				nextInclude.pop_back();
+				continue;
+			}
+
+			const std::filesystem::path fileName{ (*includes)[next++] };
+			tree.hash = ShaderCacheArchive::Hash(fileName.string(), tree.hash);
+			std::optional<SShaderIncludeHandler::CachedFile> include;
+			std::filesystem::path path;
+			for (const auto& candidate : { directory / fileName, sourceDirectory / fileName, fileName }) {
+				if ((include = SShaderIncludeHandler::ReadCachedFile(candidate))) {
+					path = candidate.lexically_normal();
+					break;
+				}
+			}
+			if (!include) {
+				combine(0);  // a missing include changes the hash once it exists
+				continue;
+			}
+			combine(include->hash);
+			if (std::ranges::find(tree.files, path) != tree.files.end())
+				continue;  // include guards make later includes of the same file empty
+			tree.files.push_back(path);
+			auto parentDirectory = path.parent_path();
+			pending.emplace_back(include->includes, std::move(parentDirectory));
+			nextInclude.push_back(0);
+		}
+		return tree;
+	}
+}
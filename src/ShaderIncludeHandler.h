@@ -0,0 +1,69 @@
+#pragma once
+
+#include <d3dcommon.h>
+#include <filesystem>
+#include <unordered_map>
+
+namespace SIE
+{
+	/**
+	 * ID3DInclude resolving includes the same way as D3D_COMPILE_STANDARD_FILE_INCLUDE.
+	 *
+	 * File contents are served from a process-wide cache. Each file, or its absence, is checked
+	 * against the disk once, and again after InvalidateFileCache. Every file opened through a
+	 * handler is recorded.
+	 */
+	class ShaderIncludeHandler : public ID3DInclude
+	{
+	public:
+		explicit ShaderIncludeHandler(const std::filesystem::path& a_sourcePath);
+
+		HRESULT __stdcall Open(D3D_INCLUDE_TYPE IncludeType, LPCSTR pFileName, LPCVOID pParentData, LPCVOID* ppData, UINT* pBytes) override;
+		HRESULT __stdcall Close(LPCVOID pData) override;
+
+		/**
+		 * @brief Reads a file through the shared cache.
+		 *
+		 * @param a_path The file to read.
+		 * @return The file contents, or nullptr if the file does not exist.
+		 */
+		static std::shared_ptr<const std::string> ReadFile(const std::filesystem::path& a_path);
+
+		/**
+		 * @brief Checks every cached file against the disk again on its next read.
+		 *
+		 * Called when the file watcher reports changes and when the shader cache is cleared.
+		 */
+		static void InvalidateFileCache();
+
+		/**
+		 * A source file and every file it may include, found without preprocessing.
+		 */
+		struct SourceTree
+		{
+			uint64_t hash = 0;                         // contents of every file, and the names of includes which did not resolve
+			std::vector<std::filesystem::path> files;  // the source and its includes, in the order they were first found
+		};
+
+		/**
+		 * @brief Follows the #include directives of a source and its includes, whether or not the defines compile them.
+		 *
+		 * The result covers every file a preprocessed permutation can depend on, so it can key a cache
+		 * without running the preprocessor. File hashes and directives are cached with the contents.
+		 * @param a_sourcePath The source to scan.
+		 * @return The tree, or std::nullopt if the source does not exist.
+		 */
+		static std::optional<SourceTree> ScanSourceTree(const std::filesystem::path& a_sourcePath);
+
+		/**
+		 * @brief Gets every file included so far, in the order they were first opened.
+		 */
+		const std::vector<std::filesystem::path>& GetIncludes() const { return includes; }
+
+	private:
+		std::filesystem::path sourceDirectory;
+		std::unordered_map<LPCVOID, std::filesystem::path> openFiles;  // file data to directory, for resolving nested includes
+		std::vector<std::shared_ptr<const std::string>> heldFiles;     // keeps data handed to the compiler alive
+		std::vector<std::filesystem::path> includes;
+	};
+}
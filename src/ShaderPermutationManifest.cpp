@@ -0,0 +1,92 @@
+#include "ShaderPermutationManifest.h"
+
+#include <fstream>
+#include <nlohmann/json.hpp>
+
+namespace SIE
+{
+	void ShaderPermutationManifest::Add(ShaderPermutation a_permutation)
+	{
+		std::lock_guard lock(mutex);
+		const auto key = a_permutation.key;
+		permutations.insert_or_assign(key, std::move(a_permutation));
+	}
+
+	void ShaderPermutationManifest::Clear()
+	{
+		std::lock_guard lock(mutex);
+		permutations.clear();
+	}
+
+	std::vector<ShaderPermutation> ShaderPermutationManifest::GetPermutations() const
+	{
+		std::lock_guard lock(mutex);
+		std::vector<ShaderPermutation> result;
+		result.reserve(permutations.size());
+		for (const auto& [key, permutation] : permutations)
+			result.push_back(permutation);
+		return result;
+	}
+
+	bool ShaderPermutationManifest::Write(const std::filesystem::path& a_path) const
+	{
+		nlohmann::json manifest;
+		manifest["Version"] = Version;
+		manifest["Cache Version"] = cacheVersion;
+		manifest["Disk Cache Info"] = diskCacheInfo;
+		auto& list = manifest["Permutations"] = nlohmann::json::array();
+		for (const auto& permutation : GetPermutations()) {
+			nlohmann::json entry;
+			entry["Key"] = permutation.key;
+			entry["File"] = permutation.file;
+			entry["Type"] = permutation.type;
+			entry["Class"] = permutation.shaderClass;
+			entry["Descriptor"] = permutation.descriptor;
+			entry["Profile"] = permutation.profile;
+			entry["Flags"] = permutation.flags;
+			entry["Strip"] = permutation.strip;
+			entry["Defines"] = permutation.defines;
+			list.push_back(std::move(entry));
+		}
+
+		std::ofstream file(a_path, std::ios::trunc);
+		if (!file.is_open())
+			return false;
+		file << manifest.dump(1, '\t');
+		return file.good();
+	}
+
+	bool ShaderPermutationManifest::Read(const std::filesystem::path& a_path)
+	{
+		std::ifstream file(a_path);
+		if (!file.is_open())
+			return false;
+
+		try {
+			const auto manifest = nlohmann::json::parse(file);
+			if (manifest.value("Version", 0u) != Version)
+				return false;
+			cacheVersion = manifest.value("Cache Version", "");
+			diskCacheInfo = manifest.value("Disk Cache Info", "");
+
+			std::lock_guard lock(mutex);
+			permutations.clear();
+			for (const auto& entry : manifest.at("Permutations")) {
+				ShaderPermutation permutation;
+				permutation.key = entry.at("Key").get<uint64_t>();
+				permutation.file = entry.at("File").get<std::string>();
+				permutation.type = entry.value("Type", "");
+				permutation.shaderClass = entry.value("Class", "");
+				permutation.descriptor = entry.value("Descriptor", 0u);
+				permutation.profile = entry.at("Profile").get<std::string>();
+				permutation.flags = entry.value("Flags", 0u);
+				permutation.strip = entry.value("Strip", false);
+				permutation.defines = entry.at("Defines").get<std::vector<std::pair<std::string, std::string>>>();
+				permutations.insert_or_assign(permutation.key, std::move(permutation));
+			}
+		} catch (const nlohmann::json::exception&) {
+			return false;
+		}
+		return true;
+	}
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+// Shared with the offline cache prebuilder in tools/ShaderCachePrebuilder, so only the standard library and nlohmann json are used here.
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace SIE
+{
+	/**
+	 * Everything needed to compile one shader permutation outside of the game.
+	 *
+	 * Defines are recorded fully resolved, since part of the define rules (e.g. vanilla Lighting
+	 * defines) only exist inside the game executable.
+	 */
+	struct ShaderPermutation
+	{
+		uint64_t key = 0;         // disk cache key, see SShaderCache::GetDiskCacheKey
+		std::string file;         // source path relative to the game directory, e.g. Data/Shaders/Lighting.hlsl
+		std::string type;         // RE::BSShader::Type name, informational
+		std::string shaderClass;  // Vertex, Pixel or Compute, informational
+		uint32_t descriptor = 0;
+		std::string profile;  // e.g. ps_5_0
+		uint32_t flags = 0;   // D3DCOMPILE_* flags
+		bool strip = false;   // strip debug info after compiling
+		std::vector<std::pair<std::string, std::string>> defines;
+	};
+
+	/**
+	 * Set of shader permutations seen in a session, written as JSON next to the disk cache.
+	 */
+	class ShaderPermutationManifest
+	{
+	public:
+		static constexpr uint32_t Version = 1;
+
+		/**
+		 * @brief Adds a permutation, replacing any previous one with the same key.
+		 */
+		void Add(ShaderPermutation a_permutation);
+		void Clear();
+		std::vector<ShaderPermutation> GetPermutations() const;
+
+		bool Write(const std::filesystem::path& a_path) const;
+		bool Read(const std::filesystem::path& a_path);
+
+		std::string cacheVersion;   // SHADER_CACHE_VERSION the permutations were recorded with
+		std::string diskCacheInfo;  // contents of Info.ini, so a prebuilt cache passes ValidateDiskCache
+
+	private:
+		mutable std::mutex mutex;
+		std::unordered_map<uint64_t, ShaderPermutation> permutations;
+	};
+}
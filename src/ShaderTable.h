@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace SIE
+{
+	/**
+	 * Compiled shader table with a lock-free read path.
+	 *
+	 * Writers insert into the owning map under a mutex. Readers only search an immutable snapshot of the table and never lock,
+	 * so a shader is found once a snapshot containing it was published. Writers publish in batches: once enough inserts are
+	 * pending for the copy to be amortized, and on Flush, which the compile workers call when the queue runs dry or a draw
+	 * waits for the shader. FlushStale, called after every other compile, publishes once the oldest pending insert waited
+	 * PublishInterval. Removals publish immediately.
+	 * Replaced snapshots are freed once no reader is inside a lookup.
+	 *
+	 * Standalone of the game so tools/ShaderTableBenchmark can build it on the host with std containers.
+	 */
+	template <typename ShaderType,
+		typename SnapshotMap = std::unordered_map<uint32_t, ShaderType*>,
+		typename OwnerMap = std::unordered_map<uint32_t, std::unique_ptr<ShaderType>>>
+	class ShaderTable
+	{
+	public:
+		static constexpr size_t MinPublishBatch = 64;
+		static constexpr size_t PublishFraction = 8;  // a batch is at least 1 / PublishFraction of the table, so copies stay linear overall
+		static constexpr auto PublishInterval = std::chrono::milliseconds(100);
+
+		~ShaderTable()
+		{
+			delete snapshot.load();
+		}
+
+		ShaderType* Find(uint32_t descriptor) const
+		{
+			ShaderType* result = nullptr;
+			readers.fetch_add(1);
+			if (const auto current = snapshot.load()) {
+				auto it = current->find(descriptor);
+				if (it != current->end())
+					result = it->second;
+			}
+			readers.fetch_sub(1);
+			return result;
+		}
+
+		ShaderType* Insert(uint32_t descriptor, std::unique_ptr<ShaderType> shader)
+		{
+			std::lock_guard lockGuard(mutex);
+			auto [it, inserted] = shaders.insert_or_assign(descriptor, std::move(shader));
+			if (!pending++)
+				firstPending = std::chrono::steady_clock::now();
+			if (!inserted || pending >= std::max(MinPublishBatch, shaders.size() / PublishFraction) ||
+				std::chrono::steady_clock::now() - firstPending >= PublishInterval)
+				Publish();  // a replaced shader may still be referenced by the current snapshot, so that one is published at once
+			return it->second.get();
+		}
+
+		/** @brief Publishes pending inserts. */
+		void Flush()
+		{
+			if (!pending.load(std::memory_order_relaxed))
+				return;
+			std::lock_guard lockGuard(mutex);
+			Publish();
+		}
+
+		/** @brief Publishes pending inserts once the oldest of them waited PublishInterval. */
+		void FlushStale()
+		{
+			if (!pending.load(std::memory_order_relaxed))
+				return;
+			std::lock_guard lockGuard(mutex);
+			if (std::chrono::steady_clock::now() - firstPending >= PublishInterval)
+				Publish();
+		}
+
+		/**
+		 * @brief Removes shaders under one lock and publishes once.
+		 * @return The removed shaders, for the caller to release.
+		 */
+		std::vector<std::unique_ptr<ShaderType>> Erase(std::span<const uint32_t> descriptors)
+		{
+			std::lock_guard lockGuard(mutex);
+			std::vector<std::unique_ptr<ShaderType>> removed;
+			for (const auto descriptor : descriptors) {
+				auto it = shaders.find(descriptor);
+				if (it == shaders.end())
+					continue;
+				removed.push_back(std::move(it->second));
+				shaders.erase(it);
+				pending++;
+			}
+			Publish();
+			return removed;
+		}
+
+		/** @return The removed shaders, for the caller to release. */
+		std::vector<std::unique_ptr<ShaderType>> Clear()
+		{
+			std::lock_guard lockGuard(mutex);
+			std::vector<std::unique_ptr<ShaderType>> removed;
+			removed.reserve(shaders.size());
+			for (auto& [id, shader] : shaders)
+				removed.push_back(std::move(shader));
+			shaders.clear();
+			pending++;
+			Publish();
+			return removed;
+		}
+
+		uint64_t GetPublishCount() const { return publishCount.load(std::memory_order_relaxed); }
+
+	private:
+		// requires mutex
+		void Publish()
+		{
+			if (!pending)
+				return;
+			auto next = new SnapshotMap();
+			next->reserve(shaders.size());
+			for (auto& [id, shader] : shaders) {
+				next->emplace(id, shader.get());
+			}
+			pending = 0;
+			publishCount.fetch_add(1, std::memory_order_relaxed);
+			retired.emplace_back(snapshot.exchange(next));
+			if (readers.load() == 0)
+				retired.clear();
+		}
+
+		OwnerMap shaders;
+		std::atomic<SnapshotMap*> snapshot = nullptr;
+		std::atomic<size_t> pending = 0;  // inserts and removals since the last publish
+		std::chrono::steady_clock::time_point firstPending;
+		std::atomic<uint64_t> publishCount = 0;
+		mutable std::atomic<uint32_t> readers = 0;
+		std::vector<std::unique_ptr<SnapshotMap>> retired;  // replaced snapshots waiting for readers to leave
+		std::mutex mutex;
+	};
+}
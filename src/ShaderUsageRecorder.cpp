@@ -0,0 +1,203 @@
+#include "ShaderUsageRecorder.h"
+
+#include "ShaderCache.h"
+
+#include <fstream>
+
+namespace SIE
+{
+	namespace SShaderUsageRecorder
+	{
+		struct Header
+		{
+			uint32_t magic;
+			uint32_t version;
+			uint32_t count;
+		};
+
+		struct Record
+		{
+			uint8_t type;
+			uint8_t shaderClass;
+			uint16_t reserved;
+			uint32_t descriptor;
+			uint32_t hitCount;
+			uint32_t firstSeenFrame;
+		};
+		static_assert(sizeof(Record) == 16);
+
+		// Usage recorded by one thread since it last merged into the session
+		struct ThreadUsage
+		{
+			std::unordered_map<uint64_t, ShaderUsageRecorder::Usage> usage;
+			uint64_t lastKey = UINT64_MAX;  // techniques repeat back to back, so skip the lookup for those
+			ShaderUsageRecorder::Usage* lastUsage = nullptr;
+			uint32_t frame = 0;
+			uint32_t generation = 0;  // of the recorder when the buffer was started
+
+			void Reset(uint32_t a_frame, uint32_t a_generation)
+			{
+				usage.clear();
+				lastKey = UINT64_MAX;
+				lastUsage = nullptr;
+				frame = a_frame;
+				generation = a_generation;
+			}
+		};
+		static thread_local ThreadUsage threadUsage;
+	}
+
+	uint64_t ShaderUsageRecorder::GetKey(RE::BSShader::Type a_type, ShaderClass a_shaderClass, uint32_t a_descriptor)
+	{
+		return (static_cast<uint64_t>(a_type) << 40) | (static_cast<uint64_t>(a_shaderClass) << 32) | a_descriptor;
+	}
+
+	void ShaderUsageRecorder::Record(RE::BSShader::Type a_type, ShaderClass a_shaderClass, uint32_t a_descriptor)
+	{
+		const auto key = GetKey(a_type, a_shaderClass, a_descriptor);
+		const auto frame = RE::BSGraphics::State::GetSingleton()->frameCount;
+		auto& buffer = SShaderUsageRecorder::threadUsage;
+		if (frame != buffer.frame)
+			MergeThreadUsage();
+		if (key != buffer.lastKey) {
+			auto [it, inserted] = buffer.usage.try_emplace(key);
+			if (inserted)
+				it->second.firstSeenFrame = frame;
+			buffer.lastKey = key;
+			buffer.lastUsage = &it->second;
+		}
+		buffer.lastUsage->hitCount++;
+	}
+
+	void ShaderUsageRecorder::MergeThreadUsage() const
+	{
+		auto& buffer = SShaderUsageRecorder::threadUsage;
+		if (!buffer.usage.empty()) {
+			std::lock_guard lock(mutex);
+			if (buffer.generation == generation.load()) {
+				for (const auto& [key, usage] : buffer.usage) {
+					// an earlier merge already has the frame the permutation was first seen in
+					auto [it, inserted] = session.try_emplace(key, usage);
+					if (!inserted)
+						it->second.hitCount += usage.hitCount;
+				}
+			}
+		}
+		buffer.Reset(RE::BSGraphics::State::GetSingleton()->frameCount, generation.load());
+	}
+
+	void ShaderUsageRecorder::Clear()
+	{
+		std::lock_guard lock(mutex);
+		session.clear();
+		generation++;
+	}
+
+	std::vector<ShaderUsageRecorder::Entry> ShaderUsageRecorder::GetEntries() const
+	{
+		MergeThreadUsage();  // the save path usually runs on the recording thread, so nothing of the current frame is lost
+
+		std::vector<std::pair<uint64_t, Usage>> merged;
+		{
+			std::lock_guard lock(mutex);
+			merged.reserve(session.size() + history.size());
+			for (const auto& [key, usage] : session) {
+				auto total = usage;
+				if (auto it = history.find(key); it != history.end())
+					total.hitCount += it->second.hitCount;
+				merged.emplace_back(key, total);
+			}
+			for (const auto& [key, usage] : history) {
+				if (!session.contains(key))
+					merged.emplace_back(key, Usage{ UINT32_MAX, usage.hitCount });
+			}
+		}
+
+		// this session's permutations by first use, then the ones only seen before by popularity
+		std::ranges::sort(merged, [](const auto& a, const auto& b) {
+			return std::tie(a.second.firstSeenFrame, b.second.hitCount, a.first) < std::tie(b.second.firstSeenFrame, a.second.hitCount, b.first);
+		});
+
+		std::vector<Entry> entries;
+		entries.reserve(merged.size());
+		for (auto& [key, usage] : merged) {
+			if (usage.firstSeenFrame == UINT32_MAX)
+				usage.firstSeenFrame = 0;
+			entries.push_back({ static_cast<RE::BSShader::Type>(key >> 40), static_cast<ShaderClass>((key >> 32) & 0xFF),
+				static_cast<uint32_t>(key), usage });
+		}
+		return entries;
+	}
+
+	size_t ShaderUsageRecorder::GetSessionCount() const
+	{
+		MergeThreadUsage();
+		std::lock_guard lock(mutex);
+		return session.size();
+	}
+
+	bool ShaderUsageRecorder::IsKnownUnused(RE::BSShader::Type a_type, ShaderClass a_shaderClass, uint32_t a_descriptor) const
+	{
+		const auto key = GetKey(a_type, a_shaderClass, a_descriptor);
+		std::lock_guard lock(mutex);
+		return !history.empty() && !history.contains(key) && !session.contains(key);
+	}
+
+	bool ShaderUsageRecorder::Write() const
+	{
+		const auto entries = GetEntries();
+
+		std::ofstream binary(BinaryPath, std::ios::binary | std::ios::trunc);
+		if (!binary.is_open())
+			return false;
+		const SShaderUsageRecorder::Header header{ Magic, Version, static_cast<uint32_t>(entries.size()) };
+		binary.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		json list = json::array();
+		for (const auto& entry : entries) {
+			const SShaderUsageRecorder::Record record{ static_cast<uint8_t>(entry.type), static_cast<uint8_t>(entry.shaderClass), 0,
+				entry.descriptor, entry.usage.hitCount, entry.usage.firstSeenFrame };
+			binary.write(reinterpret_cast<const char*>(&record), sizeof(record));
+
+			list.push_back({
+				{ "Type", std::string(magic_enum::enum_name(entry.type)) },
+				{ "Class", std::string(magic_enum::enum_name(entry.shaderClass)) },
+				{ "Descriptor", entry.descriptor },
+				{ "First Seen Frame", entry.usage.firstSeenFrame },
+				{ "Hits", entry.usage.hitCount },
+			});
+		}
+		if (!binary.good())
+			return false;
+
+		std::ofstream file(JsonPath, std::ios::trunc);
+		json usage;
+		usage["Version"] = Version;
+		usage["Permutations"] = std::move(list);
+		file << usage.dump(1, '\t');
+		return file.good();
+	}
+
+	bool ShaderUsageRecorder::Read()
+	{
+		std::ifstream binary(BinaryPath, std::ios::binary);
+		if (!binary.is_open())
+			return false;
+
+		SShaderUsageRecorder::Header header{};
+		if (!binary.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != Magic || header.version != Version || header.count > MaxEntries)
+			return false;
+
+		std::vector<SShaderUsageRecorder::Record> records(header.count);
+		if (!binary.read(reinterpret_cast<char*>(records.data()), static_cast<std::streamsize>(records.size() * sizeof(SShaderUsageRecorder::Record))))
+			return false;
+
+		std::lock_guard lock(mutex);
+		history.clear();
+		history.reserve(records.size());
+		for (const auto& record : records)
+			history.insert_or_assign(GetKey(static_cast<RE::BSShader::Type>(record.type), static_cast<ShaderClass>(record.shaderClass), record.descriptor),
+				Usage{ record.firstSeenFrame, record.hitCount });
+		return true;
+	}
+}
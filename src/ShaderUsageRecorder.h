@@ -0,0 +1,85 @@
+#pragma once
+
+#include <RE/B/BSShader.h>
+
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace SIE
+{
+	enum class ShaderClass;
+
+	/**
+	 * Records which shader permutations are actually drawn, as seen by BSShader::BeginTechnique.
+	 *
+	 * Usage is saved as a compact binary file (read back on the next start) and as JSON for
+	 * inspection. Permutations recorded in an earlier session are precompiled ahead of the rest.
+	 * Each thread records into a buffer of its own, merged into the session once per frame, so
+	 * recording takes no lock.
+	 */
+	class ShaderUsageRecorder
+	{
+	public:
+		static constexpr uint32_t Magic = 0x55535343;  // CSSU
+		static constexpr uint32_t Version = 1;
+		static constexpr uint32_t MaxEntries = 1 << 20;  // far above the permutations of every shader type together
+		static constexpr auto BinaryPath = L"Data\\SKSE\\Plugins\\CommunityShadersUsage.bin";
+		static constexpr auto JsonPath = L"Data\\SKSE\\Plugins\\CommunityShadersUsage.json";
+
+		struct Usage
+		{
+			uint32_t firstSeenFrame = 0;  // frame of this session the permutation was first drawn in
+			uint32_t hitCount = 0;        // BeginTechnique calls, summed over every recorded session
+		};
+
+		struct Entry
+		{
+			RE::BSShader::Type type;
+			ShaderClass shaderClass;
+			uint32_t descriptor;  // modified descriptor, i.e. after State::ModifyShaderLookup
+			Usage usage;
+		};
+
+		bool IsEnabled() const { return enabled.load(std::memory_order_relaxed); }
+		void SetEnabled(bool a_enabled) { enabled.store(a_enabled, std::memory_order_relaxed); }
+
+		/**
+		 * @brief Counts a draw of the permutation. Called for every technique, so it only does a hash lookup in the
+		 * buffer of the calling thread, merged into the session when the thread records in a later frame.
+		 */
+		void Record(RE::BSShader::Type a_type, ShaderClass a_shaderClass, uint32_t a_descriptor);
+		void Clear();
+
+		/**
+		 * @brief Gets usage of this and previously recorded sessions, in the order permutations were first seen.
+		 *
+		 * Includes everything the calling thread recorded, and what other threads recorded before their current frame.
+		 */
+		std::vector<Entry> GetEntries() const;
+		size_t GetSessionCount() const;
+
+		/**
+		 * @brief Whether usage from an earlier session is known and does not include the permutation.
+		 *
+		 * Always false without a recording, so every permutation is treated as possibly used.
+		 */
+		bool IsKnownUnused(RE::BSShader::Type a_type, ShaderClass a_shaderClass, uint32_t a_descriptor) const;
+
+		bool Write() const;
+		bool Read();
+
+	private:
+		static uint64_t GetKey(RE::BSShader::Type a_type, ShaderClass a_shaderClass, uint32_t a_descriptor);
+		/** @brief Merges the buffer of the calling thread into the session. */
+		void MergeThreadUsage() const;
+
+		std::atomic<bool> enabled = false;
+		mutable std::mutex mutex;
+		mutable std::unordered_map<uint64_t, Usage> session;
+		std::unordered_map<uint64_t, Usage> history;  // read from BinaryPath
+		std::atomic<uint32_t> generation = 0;          // counts Clear calls, thread buffers filled before one are dropped
+	};
+}
@@ -70,16 +70,15 @@ void State::Draw()
 
 					currentExtraDescriptor = 0;
 
-					static Util::FrameChecker frameChecker;
-					if (frameChecker.isNewFrame()) {
-						ID3D11Buffer* buffers[3] = { permutationCB->CB(), sharedDataCB->CB(), featureDataCB->CB() };
-						context->PSSetConstantBuffers(4, 3, buffers);
-						context->CSSetConstantBuffers(5, 2, buffers + 1);
-					}
+					// Only bound by the first draw of a frame, the bind cache is invalidated on present
+					ID3D11Buffer* buffers[4] = { permutationCB->CB(), sharedDataCB->CB(), featureDataCB->CB(), sharedDataPerFrameCB->CB() };
+					bindCache.PSSetConstantBuffers(context, 4, 4, buffers);
+					bindCache.CSSetConstantBuffers(context, 5, 3, buffers + 1);
 
 					if (IsDeveloperMode()) {
-						BeginPerfEvent(std::format("Draw: CS {}::{:x}::{}", magic_enum::enum_name(currentShader->shaderType.get()), currentPixelDescriptor, currentShader->fxpFilename));
-						SetPerfMarker(std::format("Defines: {}", SIE::ShaderCache::GetDefinesString(*currentShader, currentPixelDescriptor)));
+						const auto& marker = GetDrawMarker(*currentShader, currentPixelDescriptor);
+						BeginPerfEvent(marker.event.c_str());
+						SetPerfMarker(marker.defines.c_str());
 						EndPerfEvent();
 					}
 				}
@@ -102,6 +101,7 @@ void State::Reset()
 	lastVertexDescriptor = 0;
 	initialized = false;
 	forceUpdatePermutationBuffer = true;
+	bindCache.NextFrame();
 }
 
 void State::Setup()
@@ -199,8 +199,13 @@ void State::Load(ConfigMode a_configMode, bool a_allowReload)
 				shaderCache.compilationThreadCount = std::clamp(advanced["Compiler Threads"].get<int32_t>(), 1, static_cast<int32_t>(std::thread::hardware_concurrency()));
 			if (advanced["Background Compiler Threads"].is_number_integer())
 				shaderCache.backgroundCompilationThreadCount = std::clamp(advanced["Background Compiler Threads"].get<int32_t>(), 1, static_cast<int32_t>(std::thread::hardware_concurrency()));
+			shaderCache.UpdateCompilationThreadCount();
 			if (advanced["Use FileWatcher"].is_boolean())
 				shaderCache.SetFileWatcher(advanced["Use FileWatcher"]);
+			if (advanced["Use Compiler Processes"].is_boolean())
+				shaderCache.SetCompilerProcesses(advanced["Use Compiler Processes"]);
+			if (advanced["Record Shader Usage"].is_boolean())
+				shaderCache.usageRecorder.SetEnabled(advanced["Record Shader Usage"]);
 			if (advanced["Extended Frame Annotations"].is_boolean())
 				extendedFrameAnnotations = advanced["Extended Frame Annotations"];
 		}
@@ -330,6 +335,8 @@ void State::Save(ConfigMode a_configMode)
 	advanced["Compiler Threads"] = shaderCache.compilationThreadCount;
 	advanced["Background Compiler Threads"] = shaderCache.backgroundCompilationThreadCount;
 	advanced["Use FileWatcher"] = shaderCache.UseFileWatcher();
+	advanced["Use Compiler Processes"] = shaderCache.UseCompilerProcesses();
+	advanced["Record Shader Usage"] = shaderCache.usageRecorder.IsEnabled();
 	advanced["Extended Frame Annotations"] = extendedFrameAnnotations;
 	settings["Advanced"] = advanced;
 
@@ -435,6 +442,7 @@ void State::SetDefines(std::string a_defines)
 	}
 	shaderDefinesString = shaderDefinesString.substr(0, shaderDefinesString.size() - 1);
 	logger::debug("Shader Defines set to {}", shaderDefinesString);
+	drawMarkers.clear();
 }
 
 std::vector<std::pair<std::string, std::string>>* State::GetDefines()
@@ -473,10 +481,9 @@ void State::SetupResources()
 
 	permutationCB = new ConstantBuffer(ConstantBufferDesc<PermutationCB>());
 	sharedDataCB = new ConstantBuffer(ConstantBufferDesc<SharedDataCB>());
+	sharedDataPerFrameCB = new ConstantBuffer(ConstantBufferDesc<SharedDataPerFrameCB>());
 
-	auto [data, size] = GetFeatureBufferData();
-	featureDataCB = new ConstantBuffer(ConstantBufferDesc((uint32_t)size));
-	delete[] data;
+	featureDataCB = new ConstantBuffer(ConstantBufferDesc((uint32_t)GetFeatureBufferSize()));
 
 	// Grab main texture to get resolution
 	// VR cannot use viewport->screenWidth/Height as it's the desktop preview window's resolution and not HMD
@@ -585,7 +592,12 @@ void State::ModifyShaderLookup(const RE::BSShader& a_shader, uint& a_vertexDescr
 
 void State::BeginPerfEvent(std::string_view title)
 {
-	pPerf->BeginEvent(std::wstring(title.begin(), title.end()).c_str());
+	pPerf->BeginEvent(Util::StringToWString(title).c_str());
+}
+
+void State::BeginPerfEvent(const wchar_t* title)
+{
+	pPerf->BeginEvent(title);
 }
 
 void State::EndPerfEvent()
@@ -595,7 +607,24 @@ void State::EndPerfEvent()
 
 void State::SetPerfMarker(std::string_view title)
 {
-	pPerf->SetMarker(std::wstring(title.begin(), title.end()).c_str());
+	pPerf->SetMarker(Util::StringToWString(title).c_str());
+}
+
+void State::SetPerfMarker(const wchar_t* title)
+{
+	pPerf->SetMarker(title);
+}
+
+const State::DrawMarker& State::GetDrawMarker(const RE::BSShader& a_shader, uint32_t a_pixelDescriptor)
+{
+	// The fxp file follows from the shader type, so type and descriptor identify the permutation
+	const auto type = a_shader.shaderType.get();
+	auto [it, inserted] = drawMarkers.try_emplace((static_cast<uint64_t>(type) << 32) | a_pixelDescriptor);
+	if (inserted) {
+		it->second.event = Util::StringToWString(std::format("Draw: CS {}::{:x}::{}", magic_enum::enum_name(type), a_pixelDescriptor, a_shader.fxpFilename));
+		it->second.defines = Util::StringToWString(std::format("Defines: {}", SIE::ShaderCache::GetDefinesString(a_shader, a_pixelDescriptor)));
+	}
+	return it->second;
 }
 
 void State::SetAdapterDescription(const std::wstring& description)
@@ -613,6 +642,34 @@ void State::UpdateSharedData()
 		const RE::NiTransform& dalcTransform = shaderManager.directionalAmbientTransform;
 		Util::StoreTransform3x4NoScale(data.DirectionalAmbient, dalcTransform);
 
+		data.CameraData = Util::GetCameraData();
+		data.BufferDim = { screenSize.x, screenSize.y, 1.0f / screenSize.x, 1.0f / screenSize.y };
+
+		UpdateWaterTiles(Util::GetEyePosition(0));
+		for (int waterTile = 0; waterTile < 25; waterTile++)
+			data.WaterData[waterTile] = Util::GetWaterData(waterTiles[waterTile]);
+
+		if (auto sky = RE::Sky::GetSingleton())
+			data.InInterior = sky->mode.get() != RE::Sky::Mode::kFull;
+		else
+			data.InInterior = true;
+
+		if (auto ui = RE::UI::GetSingleton())
+			data.InMapMenu = ui->IsMenuOpen(RE::MapMenu::MENU_NAME);
+		else
+			data.InMapMenu = true;
+
+		// Standing still or in menus leaves most of this unchanged
+		if (!sharedDataUploaded || std::memcmp(&data, &uploadedSharedData, sizeof(data)) != 0) {
+			sharedDataCB->Update(data);
+			uploadedSharedData = data;
+			sharedDataUploaded = true;
+		}
+	}
+
+	{
+		SharedDataPerFrameCB data{};
+
 		auto shadowSceneNode = RE::BSShaderManager::State::GetSingleton().shadowSceneNode[0];
 		auto dirLight = skyrim_cast<RE::NiDirectionalLight*>(shadowSceneNode->GetRuntimeData().sunLight->light.get());
 
@@ -625,8 +682,6 @@ void State::UpdateSharedData()
 		data.DirLightDirection = { -direction.x, -direction.y, -direction.z, 0.0f };
 		data.DirLightDirection.Normalize();
 
-		data.CameraData = Util::GetCameraData();
-		data.BufferDim = { screenSize.x, screenSize.y, 1.0f / screenSize.x, 1.0f / screenSize.y };
 		data.Timer = timer;
 
 		auto viewport = RE::BSGraphics::State::GetSingleton();
@@ -637,33 +692,11 @@ void State::UpdateSharedData()
 		data.FrameCount = viewport->frameCount * (bTAA || State::GetSingleton()->upscalerLoaded);
 		data.FrameCountAlwaysActive = viewport->frameCount;
 
-		for (int i = -2; i <= 2; i++) {
-			for (int k = -2; k <= 2; k++) {
-				int waterTile = (i + 2) + ((k + 2) * 5);
-				data.WaterData[waterTile] = Util::TryGetWaterData((float)i * 4096.0f, (float)k * 4096.0f);
-			}
-		}
-
-		if (auto sky = RE::Sky::GetSingleton())
-			data.InInterior = sky->mode.get() != RE::Sky::Mode::kFull;
-		else
-			data.InInterior = true;
-
-		if (auto ui = RE::UI::GetSingleton())
-			data.InMapMenu = ui->IsMenuOpen(RE::MapMenu::MENU_NAME);
-		else
-			data.InMapMenu = true;
-
-		sharedDataCB->Update(data);
+		sharedDataPerFrameCB->Update(data);
 	}
 
-	{
-		auto [data, size] = GetFeatureBufferData();
-
-		featureDataCB->Update(data, size);
-
-		delete[] data;
-	}
+	if (auto data = UpdateFeatureBufferData())
+		featureDataCB->Update(data, GetFeatureBufferSize());
 
 	const auto& depth = RE::BSGraphics::Renderer::GetSingleton()->GetDepthStencilData().depthStencils[RE::RENDER_TARGETS_DEPTHSTENCIL::kPOST_ZPREPASS_COPY];
 	auto terrainBlending = TerrainBlending::GetSingleton();
@@ -672,6 +705,29 @@ void State::UpdateSharedData()
 	context->PSSetShaderResources(20, 1, &srv);
 }
 
+void State::UpdateWaterTiles(const RE::NiPoint3& a_eyePosition)
+{
+	// Tiles are whole cells, so they stay the same until the camera enters another cell. Tiles of cells which were not loaded yet are retried.
+	const auto cellX = static_cast<int32_t>(std::floor(a_eyePosition.x / 4096.0f));
+	const auto cellY = static_cast<int32_t>(std::floor(a_eyePosition.y / 4096.0f));
+	RE::TESObjectCELL* cell = nullptr;
+	if (auto tes = RE::TES::GetSingleton())
+		cell = tes->GetCell(a_eyePosition);
+
+	const bool cellChanged = cell != waterTileCell || cellX != waterTileCellX || cellY != waterTileCellY;
+	waterTileCell = cell;
+	waterTileCellX = cellX;
+	waterTileCellY = cellY;
+
+	for (int i = -2; i <= 2; i++) {
+		for (int k = -2; k <= 2; k++) {
+			auto& tile = waterTiles[(i + 2) + ((k + 2) * 5)];
+			if (cellChanged || !tile.cell)
+				tile = Util::TryGetWaterTile({ a_eyePosition.x + (float)i * 4096.0f, a_eyePosition.y + (float)k * 4096.0f, a_eyePosition.z });
+		}
+	}
+}
+
 void State::ClearDisabledFeatures()
 {
 	disabledFeatures.clear();
@@ -3,11 +3,13 @@
 #include <Tracy/Tracy.hpp>
 #include <Tracy/TracyD3D11.hpp>
 
+#include <BindCache.h>
 #include <Buffer.h>
 #include <nlohmann/json.hpp>
 using json = nlohmann::json;
 
 #include <FeatureBuffer.h>
+#include <Utils/Game.h>
 
 class State
 {
@@ -99,8 +101,19 @@ public:
 	void ModifyShaderLookup(const RE::BSShader& a_shader, uint& a_vertexDescriptor, uint& a_pixelDescriptor, bool a_forceDeferred = false);
 
 	void BeginPerfEvent(std::string_view title);
+	void BeginPerfEvent(const wchar_t* title);
 	void EndPerfEvent();
 	void SetPerfMarker(std::string_view title);
+	void SetPerfMarker(const wchar_t* title);
+
+	// Perf marker strings of a shader permutation, only built the first time it is drawn in developer mode
+	struct DrawMarker
+	{
+		std::wstring event;
+		std::wstring defines;
+	};
+	std::unordered_map<uint64_t, DrawMarker> drawMarkers;  // by shader type and pixel descriptor
+	const DrawMarker& GetDrawMarker(const RE::BSShader& a_shader, uint32_t a_pixelDescriptor);
 
 	void SetAdapterDescription(const std::wstring& description);
 
@@ -134,25 +147,45 @@ public:
 
 	ConstantBuffer* permutationCB = nullptr;
 
+	// Only uploaded when it changed, see SharedDataPerFrameCB for what changes every frame
 	struct alignas(16) SharedDataCB
 	{
-		float4 WaterData[25];
+		float4 WaterData[25];  // water heights are absolute, the shaders subtract the camera height
 		DirectX::XMFLOAT3X4 DirectionalAmbient;
-		float4 DirLightDirection;
-		float4 DirLightColor;
 		float4 CameraData;
 		float4 BufferDim;
+		uint InInterior;
+		uint InMapMenu;
+		float2 pad0;
+	};
+	static_assert(sizeof(SharedDataCB) == 31 * 16);
+
+	struct alignas(16) SharedDataPerFrameCB
+	{
+		float4 DirLightDirection;  // follows the sun, which moves every frame in exteriors
+		float4 DirLightColor;
 		float Timer;
 		uint FrameCount;
 		uint FrameCountAlwaysActive;
-		uint InInterior;
-		uint InMapMenu;
-		float3 pad0;
+		uint pad0;
 	};
 
 	ConstantBuffer* sharedDataCB = nullptr;
+	ConstantBuffer* sharedDataPerFrameCB = nullptr;
+	SharedDataCB uploadedSharedData{};
+	bool sharedDataUploaded = false;
+
+	// Water of the 5x5 cells around the camera, only looked up again when the camera enters another cell
+	Util::WaterTile waterTiles[25];
+	RE::TESObjectCELL* waterTileCell = nullptr;
+	int32_t waterTileCellX = 0;
+	int32_t waterTileCellY = 0;
+	void UpdateWaterTiles(const RE::NiPoint3& a_eyePosition);
 	ConstantBuffer* featureDataCB = nullptr;
 
+	// Binds of the slots Community Shaders sets on every draw, skipping what is already bound
+	BindCache bindCache;
+
 	// Skyrim constants
 	bool isVR = false;
 	float2 screenSize = {};
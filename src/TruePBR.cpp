@@ -573,7 +573,7 @@ void TruePBR::GenerateShaderPermutations(RE::BSShader* shader)
 			auto vertexShaderDesriptor = descriptor;
 			auto pixelShaderDescriptor = descriptor;
 			State::GetSingleton()->ModifyShaderLookup(*shader, vertexShaderDesriptor, pixelShaderDescriptor);
-			std::ignore = shaderCache.GetVertexShader(*shader, vertexShaderDesriptor);
+			std::ignore = shaderCache.GetVertexShader(*shader, vertexShaderDesriptor, SIE::CompilationPriority::Speculative);
 		}
 
 		const auto pixelPermutations = Permutations::GeneratePBRLightingPixelPermutations();
@@ -581,7 +581,7 @@ void TruePBR::GenerateShaderPermutations(RE::BSShader* shader)
 			auto vertexShaderDesriptor = descriptor;
 			auto pixelShaderDescriptor = descriptor;
 			State::GetSingleton()->ModifyShaderLookup(*shader, vertexShaderDesriptor, pixelShaderDescriptor);
-			std::ignore = shaderCache.GetPixelShader(*shader, pixelShaderDescriptor);
+			std::ignore = shaderCache.GetPixelShader(*shader, pixelShaderDescriptor, SIE::CompilationPriority::Speculative);
 		}
 	} else if (shader->shaderType == RE::BSShader::Type::Grass) {
 		const auto vertexPermutations = Permutations::GeneratePBRGrassVertexPermutations();
@@ -589,7 +589,7 @@ void TruePBR::GenerateShaderPermutations(RE::BSShader* shader)
 			auto vertexShaderDesriptor = descriptor;
 			auto pixelShaderDescriptor = descriptor;
 			State::GetSingleton()->ModifyShaderLookup(*shader, vertexShaderDesriptor, pixelShaderDescriptor);
-			std::ignore = shaderCache.GetVertexShader(*shader, vertexShaderDesriptor);
+			std::ignore = shaderCache.GetVertexShader(*shader, vertexShaderDesriptor, SIE::CompilationPriority::Speculative);
 		}
 
 		const auto pixelPermutations = Permutations::GeneratePBRGrassPixelPermutations();
@@ -597,7 +597,7 @@ void TruePBR::GenerateShaderPermutations(RE::BSShader* shader)
 			auto vertexShaderDesriptor = descriptor;
 			auto pixelShaderDescriptor = descriptor;
 			State::GetSingleton()->ModifyShaderLookup(*shader, vertexShaderDesriptor, pixelShaderDescriptor);
-			std::ignore = shaderCache.GetPixelShader(*shader, pixelShaderDescriptor);
+			std::ignore = shaderCache.GetPixelShader(*shader, pixelShaderDescriptor, SIE::CompilationPriority::Speculative);
 		}
 	}
 }
@@ -1659,10 +1659,10 @@ void TruePBR::DataLoaded()
 
 void TruePBR::SetShaderResouces()
 {
-	auto context = State::GetSingleton()->context;
+	auto state = State::GetSingleton();
 	for (uint32_t textureIndex = 0; textureIndex < ExtendedRendererState::NumPSTextures; ++textureIndex) {
 		if (extendedRendererState.PSResourceModifiedBits & (1 << textureIndex)) {
-			context->PSSetShaderResources(ExtendedRendererState::FirstPSTexture + textureIndex, 1, &extendedRendererState.PSTexture[textureIndex]);
+			state->bindCache.PSSetShaderResource(state->context, ExtendedRendererState::FirstPSTexture + textureIndex, extendedRendererState.PSTexture[textureIndex]);
 		}
 	}
 	extendedRendererState.PSResourceModifiedBits = 0;
@@ -70,4 +70,9 @@ namespace Util
 		});
 		return result;
 	}
+
+	std::wstring StringToWString(std::string_view string)
+	{
+		return std::wstring(string.begin(), string.end());
+	}
 }  // namespace Util
@@ -22,4 +22,5 @@ namespace Util
 	 */
 	std::string FixFilePath(const std::string& a_path);
 	std::string WStringToString(const std::wstring& wideString);
+	std::wstring StringToWString(std::string_view string);
 }  // namespace Util
\ No newline at end of file
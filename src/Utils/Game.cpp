@@ -28,32 +28,25 @@ namespace Util
 		Dest.m[2][3] = Source.translate.z;
 	}
 
-	float4 TryGetWaterData(float offsetX, float offsetY)
+	WaterTile TryGetWaterTile(const RE::NiPoint3& a_position)
 	{
+		WaterTile tile;
 		if (RE::BSGraphics::RendererShadowState::GetSingleton()) {
 			if (auto tes = RE::TES::GetSingleton()) {
-				auto position = GetEyePosition(0);
-				position.x += offsetX;
-				position.y += offsetY;
-				if (auto cell = tes->GetCell(position)) {
-					float4 data = float4(1.0f, 1.0f, 1.0f, -FLT_MAX);
+				if (auto cell = tes->GetCell(a_position)) {
+					tile.cell = cell;
 
 					bool extraCellWater = false;
 
 					if (auto extraCellWaterType = cell->extraList.GetByType<RE::ExtraCellWaterType>()) {
 						if (auto water = extraCellWaterType->water) {
 							{
-								data = { float(water->data.deepWaterColor.red) + float(water->data.shallowWaterColor.red),
+								tile.color = { float(water->data.deepWaterColor.red) + float(water->data.shallowWaterColor.red),
 									float(water->data.deepWaterColor.green) + float(water->data.shallowWaterColor.green),
 									float(water->data.deepWaterColor.blue) + float(water->data.shallowWaterColor.blue) };
 
-								data.x /= 255.0f;
-								data.y /= 255.0f;
-								data.z /= 255.0f;
-
-								data.x *= 0.5;
-								data.y *= 0.5;
-								data.z *= 0.5;
+								tile.color /= 255.0f;
+								tile.color *= 0.5f;
 								extraCellWater = true;
 							}
 						}
@@ -62,35 +55,36 @@ namespace Util
 					if (!extraCellWater) {
 						if (auto worldSpace = tes->GetRuntimeData2().worldSpace) {
 							if (auto water = worldSpace->worldWater) {
-								data = { float(water->data.deepWaterColor.red) + float(water->data.shallowWaterColor.red),
+								tile.color = { float(water->data.deepWaterColor.red) + float(water->data.shallowWaterColor.red),
 									float(water->data.deepWaterColor.green) + float(water->data.shallowWaterColor.green),
 									float(water->data.deepWaterColor.blue) + float(water->data.shallowWaterColor.blue) };
 
-								data.x /= 255.0f;
-								data.y /= 255.0f;
-								data.z /= 255.0f;
-
-								data.x *= 0.5;
-								data.y *= 0.5;
-								data.z *= 0.5;
+								tile.color /= 255.0f;
+								tile.color *= 0.5f;
 							}
 						}
 					}
 
-					if (auto sky = RE::Sky::GetSingleton()) {
-						const auto& color = sky->skyColor[RE::TESWeather::ColorTypes::kWaterMultiplier];
-						data.x *= color.red;
-						data.y *= color.green;
-						data.z *= color.blue;
-					}
-
-					data.w = cell->GetExteriorWaterHeight() - position.z;
-
-					return data;
+					tile.height = cell->GetExteriorWaterHeight();
 				}
 			}
 		}
-		return float4(1.0f, 1.0f, 1.0f, -FLT_MAX);
+		return tile;
+	}
+
+	float4 GetWaterData(const WaterTile& a_tile)
+	{
+		if (!a_tile.cell)
+			return float4(1.0f, 1.0f, 1.0f, -FLT_MAX);
+
+		float4 data = { a_tile.color.x, a_tile.color.y, a_tile.color.z, a_tile.height };
+		if (auto sky = RE::Sky::GetSingleton()) {
+			const auto& color = sky->skyColor[RE::TESWeather::ColorTypes::kWaterMultiplier];
+			data.x *= color.red;
+			data.y *= color.green;
+			data.z *= color.blue;
+		}
+		return data;
 	}
 
 	RE::NiPoint3 GetAverageEyePosition()
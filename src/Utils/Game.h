@@ -19,7 +19,20 @@ namespace Util
 {
 	void StoreTransform3x4NoScale(DirectX::XMFLOAT3X4& Dest, const RE::NiTransform& Source);
 
-	float4 TryGetWaterData(float offsetX, float offsetY);
+	// Water of one cell, without what changes with the weather
+	struct WaterTile
+	{
+		RE::TESObjectCELL* cell = nullptr;  // nullptr if no cell is loaded at the position
+		float3 color = { 1.0f, 1.0f, 1.0f };
+		float height = -FLT_MAX;
+	};
+
+	WaterTile TryGetWaterTile(const RE::NiPoint3& a_position);
+	/**
+	 * @brief Finishes a water tile into an entry of WaterData in SharedData.hlsli, with the water multiplier of the current weather.
+	 * The height stays absolute, so it does not change with the camera.
+	 */
+	float4 GetWaterData(const WaterTile& a_tile);
 	float4 GetCameraData();
 	bool GetTemporal();
 	float GetVerticalFOVRad();
@@ -93,6 +93,8 @@ void MessageHandler(SKSE::MessagingInterface::Message* message)
 				auto& shaderCache = SIE::ShaderCache::Instance();
 
 				shaderCache.ValidateDiskCache();
+				if (shaderCache.usageRecorder.Read())
+					logger::info("Loaded shader usage; recorded permutations are precompiled first");
 
 				if (shaderCache.UseFileWatcher())
 					shaderCache.StartFileWatcher();
@@ -0,0 +1,299 @@
+// Benchmarks the shader compile queue (src/CompilationQueue.h) with a synthetic compile function.
+//
+// A producer thread requests tasks in per-frame bursts, like the render thread missing shaders, and
+// worker threads take and "compile" them by spinning for a random time. Reports tasks per second and
+// the latency from request to completion. Halfway through, the worker limit is halved and restored,
+// like background compilation toggling. Each run is repeated with a single queue behind one mutex,
+// the queue the cache used before the per-worker deques, for comparison.
+
+#include "CompilationQueue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	struct Task
+	{
+		uint32_t id = 0;
+
+		bool operator==(const Task& other) const { return id == other.id; }
+	};
+}
+
+template <>
+struct std::hash<Task>
+{
+	std::size_t operator()(const Task& task) const noexcept { return task.id; }
+};
+
+namespace
+{
+	struct Options
+	{
+		std::vector<uint32_t> workerCounts{ 2, 4, 8 };
+		std::vector<uint32_t> compileUs{ 20, 200, 2000 };  // mean synthetic compile time
+		uint32_t tasks = 4000;
+		uint32_t burst = 64;     // tasks requested per frame
+		uint32_t frameUs = 500;  // time between frames
+		bool resize = true;
+		uint32_t seed = 1;
+	};
+
+	struct Workload
+	{
+		std::vector<uint32_t> compileUs;  // per task
+		std::vector<Clock::time_point> requested;
+		std::vector<Clock::time_point> completed;
+	};
+
+	struct Result
+	{
+		double tasksPerSecond = 0.0;
+		double p50Ms = 0.0;
+		double p99Ms = 0.0;
+		double maxMs = 0.0;
+		double addP99Ns = 0.0;  // time the requesting thread spends in Add
+	};
+
+	void Spin(uint32_t a_us)
+	{
+		const auto end = Clock::now() + std::chrono::microseconds(a_us);
+		while (Clock::now() < end) {}
+	}
+
+	Workload MakeWorkload(const Options& a_options, uint32_t a_meanUs)
+	{
+		// compile times are skewed, most permutations are quick and a few take much longer
+		std::mt19937 random(a_options.seed);
+		const double sigma = 1.0;
+		std::lognormal_distribution<double> distribution(std::log(static_cast<double>(a_meanUs)) - sigma * sigma / 2, sigma);
+		Workload workload;
+		workload.compileUs.resize(a_options.tasks);
+		for (auto& us : workload.compileUs)
+			us = static_cast<uint32_t>(distribution(random));
+		workload.requested.resize(a_options.tasks);
+		workload.completed.resize(a_options.tasks);
+		return workload;
+	}
+
+	// The work-stealing queue the compile workers take from
+	class StealingQueue
+	{
+	public:
+		explicit StealingQueue(uint32_t a_workers) :
+			queue(a_workers) { queue.SetWorkerLimit(a_workers); }
+
+		void Add(uint32_t a_id) { queue.Add(Task{ a_id }, SIE::CompilationPriority::Draw, []() { return false; }); }
+		std::optional<uint32_t> Take(std::stop_token a_stoken, uint32_t a_worker)
+		{
+			auto task = queue.WaitTake(a_stoken, a_worker);
+			return task ? std::optional(task->id) : std::nullopt;
+		}
+		void Complete(uint32_t a_id) { queue.Complete(Task{ a_id }); }
+		void SetWorkerLimit(uint32_t a_limit) { queue.SetWorkerLimit(a_limit); }
+
+	private:
+		SIE::CompilationQueue<Task> queue;
+	};
+
+	// A single queue behind one mutex, the queue the cache used before, for comparison
+	class SharedQueue
+	{
+	public:
+		explicit SharedQueue(uint32_t a_workers) :
+			workerLimit(a_workers) {}
+
+		void Add(uint32_t a_id)
+		{
+			{
+				std::scoped_lock lock(mutex);
+				if (!known.insert(a_id).second)
+					return;
+				tasks.push_back(a_id);
+			}
+			condition.notify_one();
+		}
+
+		std::optional<uint32_t> Take(std::stop_token a_stoken, uint32_t a_worker)
+		{
+			std::unique_lock lock(mutex);
+			if (!condition.wait(lock, a_stoken, [&]() { return !tasks.empty() && a_worker < workerLimit; }))
+				return std::nullopt;
+			const auto id = tasks.front();
+			tasks.pop_front();
+			return id;
+		}
+
+		void Complete(uint32_t)
+		{
+			std::scoped_lock lock(mutex);
+		}
+
+		void SetWorkerLimit(uint32_t a_limit)
+		{
+			{
+				std::scoped_lock lock(mutex);
+				workerLimit = a_limit;
+			}
+			condition.notify_all();
+		}
+
+	private:
+		std::mutex mutex;
+		std::deque<uint32_t> tasks;
+		std::unordered_set<uint32_t> known;
+		uint32_t workerLimit;
+		std::condition_variable_any condition;
+	};
+
+	template <class Queue>
+	Result Run(const Options& a_options, uint32_t a_workers, uint32_t a_meanUs)
+	{
+		auto workload = MakeWorkload(a_options, a_meanUs);
+		Queue queue(a_workers);
+		std::atomic<uint32_t> completed = 0;
+
+		std::vector<std::jthread> workers;
+		for (uint32_t w = 0; w < a_workers; w++) {
+			workers.emplace_back([&, w](std::stop_token stoken) {
+				while (auto id = queue.Take(stoken, w)) {
+					Spin(workload.compileUs[*id]);
+					workload.completed[*id] = Clock::now();
+					queue.Complete(*id);
+					completed++;
+				}
+			});
+		}
+
+		const auto begin = Clock::now();
+		std::vector<double> addNs(a_options.tasks);
+		for (uint32_t id = 0; id < a_options.tasks;) {
+			const auto frameEnd = Clock::now() + std::chrono::microseconds(a_options.frameUs);
+			const uint32_t frameBegin = id;
+			for (uint32_t i = 0; i < a_options.burst && id < a_options.tasks; i++, id++) {
+				workload.requested[id] = Clock::now();
+				queue.Add(id);
+				addNs[id] = std::chrono::duration<double, std::nano>(Clock::now() - workload.requested[id]).count();
+			}
+			const auto crossed = [&](uint32_t a_task) { return a_options.resize && frameBegin < a_task && a_task <= id; };
+			if (crossed(a_options.tasks / 2))
+				queue.SetWorkerLimit(std::max(a_workers / 2, 1u));
+			if (crossed(a_options.tasks * 3 / 4))
+				queue.SetWorkerLimit(a_workers);
+			std::this_thread::sleep_until(frameEnd);
+		}
+		while (completed < a_options.tasks)
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		const auto end = Clock::now();
+		for (auto& worker : workers)
+			worker.request_stop();
+		workers.clear();
+
+		std::vector<double> latencies(a_options.tasks);
+		for (uint32_t id = 0; id < a_options.tasks; id++)
+			latencies[id] = std::chrono::duration<double, std::milli>(workload.completed[id] - workload.requested[id]).count();
+		std::sort(latencies.begin(), latencies.end());
+		const auto at = [&](double a_percentile) { return latencies[std::min(latencies.size() - 1, static_cast<size_t>(a_percentile * latencies.size()))]; };
+
+		Result result;
+		result.tasksPerSecond = a_options.tasks / std::chrono::duration<double>(end - begin).count();
+		result.p50Ms = at(0.50);
+		result.p99Ms = at(0.99);
+		result.maxMs = latencies.back();
+		std::sort(addNs.begin(), addNs.end());
+		result.addP99Ns = addNs[std::min(addNs.size() - 1, static_cast<size_t>(0.99 * addNs.size()))];
+		return result;
+	}
+
+	void Print(const char* a_queue, uint32_t a_workers, uint32_t a_meanUs, const Result& a_result)
+	{
+		std::printf("%-9s %7u %10u %10.0f %9.2f %9.2f %9.2f %11.0f\n",
+			a_queue, a_workers, a_meanUs, a_result.tasksPerSecond, a_result.p50Ms, a_result.p99Ms, a_result.maxMs, a_result.addP99Ns);
+	}
+
+	bool ParseList(char* a_list, std::vector<uint32_t>& a_values)
+	{
+		a_values.clear();
+		for (char* end = a_list; *a_list; a_list = end) {
+			const auto value = std::strtoul(a_list, &end, 10);
+			if (end == a_list || !value)
+				return false;
+			a_values.push_back(static_cast<uint32_t>(value));
+			if (*end == ',')
+				end++;
+		}
+		return !a_values.empty();
+	}
+
+	int Usage(const char* a_name)
+	{
+		std::fprintf(stderr,
+			"usage: %s [--workers 2,4,8] [--compile-us 20,200,2000] [--tasks 4000] [--burst 64] [--frame-us 500] [--no-resize] [--seed 1]\n"
+			"  --workers     worker thread counts to run, comma separated\n"
+			"  --compile-us  mean synthetic compile times to run, comma separated\n"
+			"  --tasks       tasks per run\n"
+			"  --burst       tasks requested per frame\n"
+			"  --frame-us    time between frames\n"
+			"  --no-resize   keep the worker limit, instead of halving it for a quarter of the run\n",
+			a_name);
+		return 1;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	for (int i = 1; i < argc; i++) {
+		const std::string_view arg = argv[i];
+		if (arg == "--no-resize") {
+			options.resize = false;
+			continue;
+		}
+		if (i + 1 >= argc)
+			return Usage(argv[0]);
+		if (arg == "--workers") {
+			if (!ParseList(argv[++i], options.workerCounts))
+				return Usage(argv[0]);
+		} else if (arg == "--compile-us") {
+			if (!ParseList(argv[++i], options.compileUs))
+				return Usage(argv[0]);
+		} else if (arg == "--tasks")
+			options.tasks = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+		else if (arg == "--burst")
+			options.burst = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+		else if (arg == "--frame-us")
+			options.frameUs = std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--seed")
+			options.seed = std::strtoul(argv[++i], nullptr, 10);
+		else
+			return Usage(argv[0]);
+	}
+
+	std::printf("%u tasks per run, %u per frame every %u us, %s\n", options.tasks, options.burst, options.frameUs,
+		options.resize ? "worker limit halved from 1/2 to 3/4 of the requests" : "fixed worker limit");
+	std::printf("%-9s %7s %10s %10s %9s %9s %9s %11s\n", "queue", "workers", "compile us", "tasks/s", "p50 ms", "p99 ms", "max ms", "add p99 ns");
+	for (const auto workers : options.workerCounts) {
+		for (const auto compileUs : options.compileUs) {
+			Print("shared", workers, compileUs, Run<SharedQueue>(options, workers, compileUs));
+			Print("stealing", workers, compileUs, Run<StealingQueue>(options, workers, compileUs));
+		}
+	}
+	return 0;
+}
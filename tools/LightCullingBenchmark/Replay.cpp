@@ -0,0 +1,180 @@
+// Replays a light capture written by Light Limit Fix (src/Features/LightLimitFIx/LightCapture.h).
+//
+// Every frame goes through the stages of LightLimitFix::UpdateLights that do not need the game:
+// merging particles into cells and turning cells into lights (gather), building the cluster grid
+// from the captured projection (build) and culling the lights into it (cull).
+
+#include "Replay.h"
+
+#include "LightCapture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+	using namespace LightCulling;
+
+	// LightLimitFix::ParticleCell
+	struct ParticleCell
+	{
+		float color[3]{};
+		float position[3]{};
+		float radius = 0.0f;
+		float weight = 0.0f;
+	};
+
+	// LightLimitFix::GetParticleCellKey
+	uint64_t GetParticleCellKey(const float (&a_position)[3], float a_cellSize)
+	{
+		const auto axis = [a_cellSize](float a_value) {
+			return static_cast<uint64_t>(static_cast<int64_t>(std::floor(a_value / a_cellSize))) & 0x1FFFFF;
+		};
+		return axis(a_position[0]) | (axis(a_position[1]) << 21) | (axis(a_position[2]) << 42);
+	}
+
+	// DirectX::SimpleMath::Vector3::Transform, for row vectors
+	void TransformPoint(const Matrix& a_matrix, const float* a_point, float* o_result)
+	{
+		for (int column = 0; column < 3; column++)
+			o_result[column] = a_point[0] * a_matrix.m[0][column] + a_point[1] * a_matrix.m[1][column] + a_point[2] * a_matrix.m[2][column] + a_matrix.m[3][column];
+	}
+
+	// LightLimitFix::AddCachedParticleLights, without the detection grid
+	void AddParticleLight(const FrameInfo& a_info, Light& a_light, std::vector<Light>& o_lights)
+	{
+		const float* position = a_light.positionWS[0];
+		const float distance = position[0] * position[0] + position[1] * position[1] + position[2] * position[2] - a_light.radius * a_light.radius;
+
+		float dimmer = 0.0f;
+		if (distance < a_info.lightFadeStart || a_info.lightFadeEnd == 0.0f)
+			dimmer = 1.0f;
+		else if (distance <= a_info.lightFadeEnd)
+			dimmer = 1.0f - ((distance - a_info.lightFadeStart) / (a_info.lightFadeEnd - a_info.lightFadeStart));
+
+		for (auto& channel : a_light.color)
+			channel *= dimmer;
+
+		if ((a_light.color[0] + a_light.color[1] + a_light.color[2]) > 1e-4 && a_light.radius > 1e-4) {
+			for (uint32_t eyeIndex = 0; eyeIndex < a_info.eyeCount; eyeIndex++)
+				TransformPoint(a_info.view[eyeIndex], a_light.positionWS[eyeIndex], a_light.positionVS[eyeIndex]);
+			o_lights.push_back(a_light);
+		}
+	}
+
+	void GatherLights(const CaptureFrame& a_frame, std::unordered_map<uint64_t, ParticleCell>& a_cells, std::vector<Light>& o_lights)
+	{
+		const auto& info = a_frame.info;
+		o_lights.assign(a_frame.lights.begin(), a_frame.lights.end());
+		if (!info.particleOptimization)
+			return;
+
+		a_cells.clear();
+		for (const auto& particle : a_frame.particles) {
+			const float luminance = particle.color[0] * 0.3f + particle.color[1] * 0.59f + particle.color[2] * 0.11f;
+			auto& cell = a_cells[GetParticleCellKey(particle.position, info.particleCellSize)];
+			for (int axis = 0; axis < 3; axis++) {
+				cell.color[axis] += particle.color[axis];
+				cell.position[axis] += (particle.position[axis] - info.eyePosition[0][axis]) * luminance;
+			}
+			cell.radius += particle.radius * luminance;
+			cell.weight += luminance;
+		}
+
+		for (const auto& [key, cell] : a_cells) {
+			Light light{};
+			std::copy_n(cell.color, 3, light.color);
+			light.radius = cell.radius / cell.weight;
+			for (int axis = 0; axis < 3; axis++) {
+				light.positionWS[0][axis] = cell.position[axis] / cell.weight;
+				light.positionWS[1][axis] = light.positionWS[0][axis];
+				if (info.eyeCount == 2)
+					light.positionWS[1][axis] += info.eyePosition[0][axis] - info.eyePosition[1][axis];
+			}
+			AddParticleLight(info, light, o_lights);
+		}
+	}
+
+	double Median(std::vector<double> a_values)
+	{
+		std::ranges::sort(a_values);
+		return a_values[a_values.size() / 2];
+	}
+}
+
+int Replay(const char* a_path, uint32_t a_iterations)
+{
+	CaptureReader reader;
+	if (!reader.Open(a_path)) {
+		std::fprintf(stderr, "%s could not be opened as a light capture of this version\n", a_path);
+		return 2;
+	}
+
+	std::vector<CaptureFrame> frames;
+	for (CaptureFrame frame; reader.Read(frame);)
+		frames.push_back(frame);
+	if (frames.empty()) {
+		std::fprintf(stderr, "%s holds no frames\n", a_path);
+		return 2;
+	}
+
+	std::printf("%zu frames, %ux%ux%u grid, %u eye(s)\n", frames.size(), frames[0].info.gridSize[0], frames[0].info.gridSize[1], frames[0].info.gridSize[2],
+		frames[0].info.eyeCount);
+	std::printf("%10s %8s %10s %8s %10s %10s %10s %10s %10s\n",
+		"frame", "lights", "particles", "rooms", "gather ms", "build ms", "cull ms", "saturated", "dropped");
+
+	using clock = std::chrono::steady_clock;
+	const auto elapsedMs = [](clock::time_point a_start) { return std::chrono::duration<double, std::milli>(clock::now() - a_start).count(); };
+
+	std::unordered_map<uint64_t, ParticleCell> cells;
+	std::vector<Light> lights;
+	ClusterCuller culler;
+	ClusterCuller reference;
+	std::vector<double> totalGatherMs, totalBuildMs, totalCullMs;
+	uint32_t mismatchedFrames = 0;
+	uint32_t mismatchedCounts = 0;
+
+	for (const auto& frame : frames) {
+		std::vector<double> gatherMs, buildMs, cullMs;
+		CullingStats stats;
+		for (uint32_t iteration = 0; iteration < a_iterations; iteration++) {
+			auto start = clock::now();
+			GatherLights(frame, cells, lights);
+			gatherMs.push_back(elapsedMs(start));
+
+			start = clock::now();
+			culler.BuildClusters(frame.GetGridDesc(), frame.info.invProjection);
+			buildMs.push_back(elapsedMs(start));
+
+			start = clock::now();
+			stats = culler.Cull(lights, true);
+			cullMs.push_back(elapsedMs(start));
+		}
+
+		reference.BuildClusters(frame.GetGridDesc(), frame.info.invProjection);
+		reference.Cull(lights, false);
+		const bool matches = reference.GetLightIndexList() == culler.GetLightIndexList();
+		mismatchedFrames += !matches;
+
+		// cells are summed in a different order than the plugin's jobs did, which can move a light across the visibility threshold
+		const bool countMatches = lights.size() == frame.info.gatheredLightCount;
+		mismatchedCounts += !countMatches;
+
+		totalGatherMs.push_back(Median(gatherMs));
+		totalBuildMs.push_back(Median(buildMs));
+		totalCullMs.push_back(Median(cullMs));
+
+		std::printf("%10u %8zu %10zu %8zu %10.3f %10.3f %10.3f %10u %10u%s%s\n",
+			frame.info.frameIndex, lights.size(), frame.particles.size(), frame.rooms.size(), totalGatherMs.back(), totalBuildMs.back(), totalCullMs.back(),
+			stats.saturatedClusters, stats.droppedLights, countMatches ? "" : "  LIGHT COUNT DIFFERS", matches ? "" : "  SIMD MISMATCH");
+	}
+
+	std::printf("median gather %.3f ms, build %.3f ms, cull %.3f ms over %zu frames\n", Median(totalGatherMs), Median(totalBuildMs), Median(totalCullMs), frames.size());
+	if (mismatchedCounts)
+		std::printf("%u frame(s) gathered a different number of lights than the plugin\n", mismatchedCounts);
+	return mismatchedFrames ? 1 : 0;
+}
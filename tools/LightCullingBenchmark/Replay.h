@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * @brief Replays a light capture, timing the gather, build and cull stages of every frame over a_iterations runs.
+ *
+ * @return 0, or 1 if SIMD culling disagreed with the scalar reference on any frame.
+ */
+int Replay(const char* a_path, uint32_t a_iterations);
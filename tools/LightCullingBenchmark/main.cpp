@@ -0,0 +1,210 @@
+// Benchmarks the CPU cluster culling of Light Limit Fix (src/Features/LightLimitFIx/ClusterCulling.h).
+//
+// Scatters random point lights through the view frustum of a synthetic camera, culls them with the
+// SIMD path and checks the result against the scalar reference, then reports timings and how far
+// the clusters saturate MAX_CLUSTER_LIGHTS. The grid defaults to the one used for a 1920x1080 screen.
+// With --replay, runs the frames of a light capture from the plugin instead, see Replay.cpp.
+
+#include "ClusterCulling.h"
+#include "Replay.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string_view>
+#include <vector>
+
+namespace
+{
+	struct Options
+	{
+		LightCulling::GridDesc grid{ { 30, 17, 32 }, 15.0f, 16384.0f, 128, 1 };
+		std::vector<uint32_t> lightCounts{ 1024, 2048, 4096, 8192, 16384 };
+		float fov = 90.0f;            // horizontal, in degrees
+		float aspect = 16.0f / 9.0f;  // width / height
+		float maxDistance = 4096.0f;  // lights are placed up to this view depth
+		float minRadius = 64.0f;
+		float maxRadius = 768.0f;
+		uint32_t iterations = 20;
+		uint32_t seed = 1;
+		const char* replay = nullptr;  // light capture to replay, ignores the scene options
+	};
+
+	// inverse of a left-handed D3D perspective projection, for row vectors
+	LightCulling::Matrix GetInverseProjection(const Options& a_options)
+	{
+		const float xScale = 1.0f / std::tan(a_options.fov * 0.5f * 3.14159265359f / 180.0f);
+		const float yScale = xScale * a_options.aspect;
+		const float n = a_options.grid.lightsNear;
+		const float f = a_options.grid.lightsFar;
+		const float a = f / (f - n);
+		const float b = -n * f / (f - n);
+
+		LightCulling::Matrix inverse{};
+		inverse.m[0][0] = 1.0f / xScale;
+		inverse.m[1][1] = 1.0f / yScale;
+		inverse.m[3][2] = 1.0f;
+		inverse.m[2][3] = 1.0f / b;
+		inverse.m[3][3] = -a / b;
+		return inverse;
+	}
+
+	std::vector<LightCulling::Light> GenerateLights(const Options& a_options, uint32_t a_count)
+	{
+		std::mt19937 random(a_options.seed);
+		std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+		std::uniform_real_distribution<float> depth(a_options.grid.lightsNear, a_options.maxDistance);
+		std::uniform_real_distribution<float> radius(a_options.minRadius, a_options.maxRadius);
+
+		const float tanHalfX = std::tan(a_options.fov * 0.5f * 3.14159265359f / 180.0f);
+		const float tanHalfY = tanHalfX / a_options.aspect;
+
+		std::vector<LightCulling::Light> lights(a_count);
+		for (auto& light : lights) {
+			const float z = depth(random);
+			const float position[3] = { unit(random) * z * tanHalfX, unit(random) * z * tanHalfY, z };
+			light.radius = radius(random);
+			for (int eyeIndex = 0; eyeIndex < 2; eyeIndex++)
+				std::memcpy(light.positionVS[eyeIndex], position, sizeof(position));
+		}
+		return lights;
+	}
+
+	bool Matches(const LightCulling::ClusterCuller& a_reference, const LightCulling::ClusterCuller& a_culler)
+	{
+		const auto& referenceGrid = a_reference.GetLightGrid();
+		const auto& grid = a_culler.GetLightGrid();
+		for (size_t i = 0; i < referenceGrid.size(); i++) {
+			if (referenceGrid[i].offset != grid[i].offset || referenceGrid[i].lightCount != grid[i].lightCount)
+				return false;
+		}
+		return a_reference.GetLightIndexList() == a_culler.GetLightIndexList();
+	}
+
+	double Median(std::vector<double> a_values)
+	{
+		std::ranges::sort(a_values);
+		return a_values[a_values.size() / 2];
+	}
+
+	int Usage(const char* a_name)
+	{
+		std::fprintf(stderr,
+			"usage: %s [--lights n[,n...]] [--grid x y z] [--max-cluster-lights n] [--near n] [--far n]\n"
+			"          [--slicing exponential|linear|hybrid] [--near-slice-end n] [--distance n] [--radius min max]\n"
+			"          [--iterations n] [--seed n] [--vr]\n"
+			"       %s --replay capture.bin [--iterations n]\n",
+			a_name, a_name);
+		return 2;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	for (int i = 1; i < argc; i++) {
+		const std::string_view arg = argv[i];
+		const auto next = [&]() { return std::strtod(argv[++i], nullptr); };
+		if (arg == "--lights" && i + 1 < argc) {
+			options.lightCounts.clear();
+			for (char* list = argv[++i]; *list;) {
+				options.lightCounts.push_back(static_cast<uint32_t>(std::strtoul(list, &list, 10)));
+				if (*list == ',')
+					list++;
+				else if (*list)
+					return Usage(argv[0]);
+			}
+		} else if (arg == "--grid" && i + 3 < argc) {
+			for (auto& size : options.grid.size)
+				size = std::max(static_cast<uint32_t>(next()), 1u);
+		} else if (arg == "--max-cluster-lights" && i + 1 < argc) {
+			options.grid.maxClusterLights = static_cast<uint32_t>(next());
+		} else if (arg == "--near" && i + 1 < argc) {
+			options.grid.lightsNear = static_cast<float>(next());
+		} else if (arg == "--far" && i + 1 < argc) {
+			options.grid.lightsFar = static_cast<float>(next());
+		} else if (arg == "--slicing" && i + 1 < argc) {
+			const std::string_view slicing = argv[++i];
+			if (slicing == "exponential")
+				options.grid.slicing = LightCulling::DepthSlicing::Exponential;
+			else if (slicing == "linear")
+				options.grid.slicing = LightCulling::DepthSlicing::Linear;
+			else if (slicing == "hybrid")
+				options.grid.slicing = LightCulling::DepthSlicing::Hybrid;
+			else
+				return Usage(argv[0]);
+		} else if (arg == "--near-slice-end" && i + 1 < argc) {
+			options.grid.nearSliceEnd = static_cast<float>(next());
+		} else if (arg == "--distance" && i + 1 < argc) {
+			options.maxDistance = static_cast<float>(next());
+		} else if (arg == "--radius" && i + 2 < argc) {
+			options.minRadius = static_cast<float>(next());
+			options.maxRadius = static_cast<float>(next());
+		} else if (arg == "--iterations" && i + 1 < argc) {
+			options.iterations = std::max(static_cast<uint32_t>(next()), 1u);
+		} else if (arg == "--seed" && i + 1 < argc) {
+			options.seed = static_cast<uint32_t>(next());
+		} else if (arg == "--replay" && i + 1 < argc) {
+			options.replay = argv[++i];
+		} else if (arg == "--vr") {
+			options.grid.eyeCount = 2;
+		} else {
+			return Usage(argv[0]);
+		}
+	}
+
+	if (options.replay)
+		return Replay(options.replay, options.iterations);
+
+	if (options.grid.slicing == LightCulling::DepthSlicing::Hybrid) {
+		if (options.grid.nearSliceEnd <= options.grid.lightsNear || options.grid.nearSliceEnd >= options.grid.lightsFar || options.grid.size[2] < 2) {
+			std::fprintf(stderr, "hybrid slicing needs --near-slice-end between --near and --far, and at least 2 depth slices\n");
+			return 2;
+		}
+	}
+
+	const auto inverseProjection = GetInverseProjection(options);
+	const LightCulling::Matrix inverseProjections[2] = { inverseProjection, inverseProjection };
+
+	LightCulling::ClusterCuller reference;
+	LightCulling::ClusterCuller culler;
+	reference.BuildClusters(options.grid, inverseProjections);
+	culler.BuildClusters(options.grid, inverseProjections);
+
+	constexpr const char* slicingNames[] = { "exponential", "linear", "hybrid" };
+	std::printf("grid %ux%ux%u (%u clusters) with %s depth slices, max %u lights per cluster, %u eye(s)\n",
+		options.grid.size[0], options.grid.size[1], options.grid.size[2], options.grid.GetClusterCount(), slicingNames[static_cast<uint32_t>(options.grid.slicing)],
+		options.grid.maxClusterLights, options.grid.eyeCount);
+	std::printf("%8s %12s %12s %8s %10s %10s %10s %10s %8s\n",
+		"lights", "scalar ms", "simd ms", "speedup", "indices", "saturated", "dropped", "peak", "empty");
+
+	bool failed = false;
+	for (const auto lightCount : options.lightCounts) {
+		const auto lights = GenerateLights(options, lightCount);
+
+		using clock = std::chrono::steady_clock;
+		auto start = clock::now();
+		const auto stats = reference.Cull(lights, false);
+		const double scalarMs = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+		std::vector<double> simdMs;
+		for (uint32_t iteration = 0; iteration < options.iterations; iteration++) {
+			start = clock::now();
+			culler.Cull(lights, true);
+			simdMs.push_back(std::chrono::duration<double, std::milli>(clock::now() - start).count());
+		}
+		const double medianMs = Median(simdMs);
+
+		const bool matches = Matches(reference, culler);
+		failed |= !matches;
+
+		std::printf("%8u %12.3f %12.3f %7.1fx %10u %10u %10u %10u %8u%s\n",
+			lightCount, scalarMs, medianMs, scalarMs / medianMs, stats.indexCount, stats.saturatedClusters, stats.droppedLights,
+			stats.peakClusterLights, stats.emptyClusters, matches ? "" : "  SIMD MISMATCH");
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+// Stands in for include/PCH.h so the plugin sources shared with the prebuilder build without CommonLibSSE.
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+
+#include <d3dcommon.h>
+#include <d3dcompiler.h>
+#include <winrt/base.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace logger
+{
+	inline bool verbose = false;
+
+	template <class... Args>
+	void debug(std::format_string<Args...> a_fmt, Args&&... a_args)
+	{
+		if (verbose)
+			std::fprintf(stderr, "%s\n", std::format(a_fmt, std::forward<Args>(a_args)...).c_str());
+	}
+
+	template <class... Args>
+	void info(std::format_string<Args...> a_fmt, Args&&... a_args)
+	{
+		std::fprintf(stderr, "%s\n", std::format(a_fmt, std::forward<Args>(a_args)...).c_str());
+	}
+
+	template <class... Args>
+	void warn(std::format_string<Args...> a_fmt, Args&&... a_args)
+	{
+		std::fprintf(stderr, "warning: %s\n", std::format(a_fmt, std::forward<Args>(a_args)...).c_str());
+	}
+
+	template <class... Args>
+	void error(std::format_string<Args...> a_fmt, Args&&... a_args)
+	{
+		std::fprintf(stderr, "error: %s\n", std::format(a_fmt, std::forward<Args>(a_args)...).c_str());
+	}
+}
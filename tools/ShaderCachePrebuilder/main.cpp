@@ -0,0 +1,154 @@
+// Builds Data/ShaderCache from a permutation manifest without launching the game.
+//
+// The manifest is written by the plugin (Data/ShaderCache/Permutations.json, or "Save Permutation
+// Manifest" in the menu) and holds the resolved defines of every permutation seen in a session.
+// Shaders are hashed and compiled exactly like SShaderCache::CompileShader does, so the plugin
+// accepts the resulting archive as its disk cache.
+
+#include "ShaderCacheArchive.h"
+#include "ShaderIncludeHandler.h"
+#include "ShaderPermutationManifest.h"
+
+#include <thread>
+
+namespace
+{
+	struct Options
+	{
+		std::filesystem::path gameDirectory;
+		std::filesystem::path manifest = "Data/ShaderCache/Permutations.json";
+		std::filesystem::path output = "Data/ShaderCache";
+		uint32_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+	};
+
+	enum class Result
+	{
+		Compiled,
+		UpToDate,
+		Failed,
+	};
+
+	Result Build(const SIE::ShaderPermutation& a_permutation, SIE::ShaderCacheArchive& a_archive)
+	{
+		const std::filesystem::path path = a_permutation.file;
+		const auto source = SIE::ShaderIncludeHandler::ReadFile(path);
+		const auto sourceTree = SIE::ShaderIncludeHandler::ScanSourceTree(path);
+		if (!source || !sourceTree) {
+			logger::error("{} does not exist", a_permutation.file);
+			return Result::Failed;
+		}
+
+		std::vector<D3D_SHADER_MACRO> defines;
+		for (const auto& [name, value] : a_permutation.defines)
+			defines.push_back({ name.c_str(), value.empty() ? nullptr : value.c_str() });
+		defines.push_back({ nullptr, nullptr });
+
+		const auto sourceHash = SIE::ShaderCacheArchive::HashCompileInputs(sourceTree->hash, defines, a_permutation.profile, a_permutation.flags);
+		if (auto [blob, timestamp] = a_archive.Find(a_permutation.key, sourceHash); blob) {
+			blob->Release();
+			return Result::UpToDate;
+		}
+
+		SIE::ShaderIncludeHandler includeHandler(path);
+		winrt::com_ptr<ID3DBlob> shaderBlob;
+		winrt::com_ptr<ID3DBlob> errors;
+		if (FAILED(D3DCompile(source->data(), source->size(), a_permutation.file.c_str(), defines.data(), &includeHandler, "main",
+				a_permutation.profile.c_str(), a_permutation.flags, 0, shaderBlob.put(), errors.put()))) {
+			logger::error("Failed to compile {} {}:{:X}:\n{}", a_permutation.type, a_permutation.shaderClass, a_permutation.descriptor,
+				errors ? static_cast<const char*>(errors->GetBufferPointer()) : "");
+			return Result::Failed;
+		}
+
+		if (a_permutation.strip) {
+			winrt::com_ptr<ID3DBlob> strippedBlob;
+			const uint32_t stripFlags = D3DCOMPILER_STRIP_DEBUG_INFO |
+			                            D3DCOMPILER_STRIP_TEST_BLOBS |
+			                            D3DCOMPILER_STRIP_PRIVATE_DATA;
+			if (SUCCEEDED(D3DStripShader(shaderBlob->GetBufferPointer(), shaderBlob->GetBufferSize(), stripFlags, strippedBlob.put())))
+				shaderBlob = strippedBlob;
+		}
+
+		a_archive.Add(a_permutation.key, sourceHash, shaderBlob.get());
+		logger::debug("Compiled {} {}:{:X}", a_permutation.type, a_permutation.shaderClass, a_permutation.descriptor);
+		return Result::Compiled;
+	}
+
+	int Usage(const char* a_name)
+	{
+		std::fprintf(stderr,
+			"usage: %s <game directory> [--manifest path] [--output directory] [--threads count] [--verbose]\n"
+			"  --manifest  permutation manifest, default Data/ShaderCache/Permutations.json\n"
+			"  --output    disk cache directory, default Data/ShaderCache\n"
+			"Relative paths are resolved against the game directory.\n",
+			a_name);
+		return 2;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	for (int i = 1; i < argc; i++) {
+		const std::string_view arg = argv[i];
+		if (arg == "--manifest" && i + 1 < argc) {
+			options.manifest = argv[++i];
+		} else if (arg == "--output" && i + 1 < argc) {
+			options.output = argv[++i];
+		} else if (arg == "--threads" && i + 1 < argc) {
+			options.threads = static_cast<uint32_t>(std::max(std::atoi(argv[++i]), 1));
+		} else if (arg == "--verbose") {
+			logger::verbose = true;
+		} else if (options.gameDirectory.empty() && !arg.starts_with("--")) {
+			options.gameDirectory = arg;
+		} else {
+			return Usage(argv[0]);
+		}
+	}
+	if (options.gameDirectory.empty())
+		return Usage(argv[0]);
+
+	// shader paths and includes are relative to the game directory, like in game
+	std::error_code ec;
+	std::filesystem::current_path(options.gameDirectory, ec);
+	if (ec) {
+		logger::error("Cannot open game directory {}: {}", options.gameDirectory.string(), ec.message());
+		return 1;
+	}
+
+	SIE::ShaderPermutationManifest manifest;
+	if (!manifest.Read(options.manifest)) {
+		logger::error("Failed to read permutation manifest {}", options.manifest.string());
+		return 1;
+	}
+	const auto permutations = manifest.GetPermutations();
+	logger::info("Building {} shader permutations recorded with cache version {} on {} threads", permutations.size(), manifest.cacheVersion, options.threads);
+
+	SIE::ShaderCacheArchive archive;
+	archive.Load(options.output);
+
+	const auto start = std::chrono::steady_clock::now();
+	std::atomic<size_t> next = 0;
+	std::atomic<size_t> counts[3] = {};
+	{
+		std::vector<std::jthread> workers;
+		for (uint32_t i = 0; i < options.threads; i++) {
+			workers.emplace_back([&]() {
+				for (size_t index = next++; index < permutations.size(); index = next++)
+					counts[static_cast<size_t>(Build(permutations[index], archive))]++;
+			});
+		}
+	}
+	archive.Close();
+	if (!archive.Compact()) {
+		logger::error("Failed to write shader cache archive to {}", options.output.string());
+		return 1;
+	}
+
+	std::ofstream info(options.output / "Info.ini", std::ios::trunc);
+	info << manifest.diskCacheInfo;
+
+	const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	logger::info("Compiled {}, up to date {}, failed {} in {:.1f}s",
+		counts[static_cast<size_t>(Result::Compiled)].load(), counts[static_cast<size_t>(Result::UpToDate)].load(), counts[static_cast<size_t>(Result::Failed)].load(), seconds);
+	return counts[static_cast<size_t>(Result::Failed)] ? 1 : 0;
+}
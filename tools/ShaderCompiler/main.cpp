@@ -0,0 +1,163 @@
+// Out-of-process shader compiler for Community Shaders.
+//
+// Reads framed requests (see src/ShaderCompilerProtocol.h) from stdin and writes one framed
+// response per request to stdout until stdin is closed.
+//
+// With --stand-in, or when built without d3dcompiler (e.g. on Linux), shaders are not compiled and
+// a synthetic blob derived from the request is returned instead. This exercises the protocol and
+// the plugin's process scheduling without D3D. --delay <ms>, --fail-on <text> and --crash-on <text>
+// simulate slow compiles, compile errors and compiler crashes for requests whose source contains <text>.
+
+#include "ShaderCompilerProtocol.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#	include <d3dcompiler.h>
+#	include <fcntl.h>
+#	include <io.h>
+#endif
+
+namespace Protocol = SIE::ShaderCompilerProtocol;
+
+namespace
+{
+	struct Options
+	{
+		bool standIn = false;
+		int delayMs = 0;
+		std::string failOn;
+		std::string crashOn;
+	};
+
+	bool ReadExact(char* a_data, size_t a_size)
+	{
+		return std::fread(a_data, 1, a_size, stdin) == a_size;
+	}
+
+	bool WriteMessage(const std::string& a_message)
+	{
+		return std::fwrite(a_message.data(), 1, a_message.size(), stdout) == a_message.size() && std::fflush(stdout) == 0;
+	}
+
+	Protocol::Response CompileStandIn(const Protocol::Request& a_request, const Options& a_options)
+	{
+		if (a_options.delayMs > 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(a_options.delayMs));
+		if (!a_options.crashOn.empty() && a_request.source.find(a_options.crashOn) != std::string::npos)
+			std::abort();
+
+		Protocol::Response response;
+		response.id = a_request.id;
+		if (!a_options.failOn.empty() && a_request.source.find(a_options.failOn) != std::string::npos) {
+			response.errors = a_request.sourceName + ": error: stand-in failure requested";
+			return response;
+		}
+
+		// FNV-1a over everything that would affect a real compile
+		uint64_t hash = 14695981039346656037ull;
+		auto mix = [&hash](std::string_view a_data) {
+			for (auto c : a_data) {
+				hash ^= static_cast<uint8_t>(c);
+				hash *= 1099511628211ull;
+			}
+		};
+		mix(a_request.profile);
+		mix(a_request.entryPoint);
+		for (const auto& [name, value] : a_request.defines) {
+			mix(name);
+			mix(value);
+		}
+		mix(a_request.source);
+
+		response.succeeded = true;
+		response.blob = "STANDIN";
+		response.blob.append(reinterpret_cast<const char*>(&hash), sizeof(hash));
+		return response;
+	}
+
+#ifdef _WIN32
+	Protocol::Response Compile(const Protocol::Request& a_request)
+	{
+		std::vector<D3D_SHADER_MACRO> defines;
+		for (const auto& [name, value] : a_request.defines)
+			defines.push_back({ name.c_str(), value.empty() ? nullptr : value.c_str() });
+		defines.push_back({ nullptr, nullptr });
+
+		ID3DBlob* shaderBlob = nullptr;
+		ID3DBlob* errorBlob = nullptr;
+		const HRESULT result = D3DCompile(a_request.source.data(), a_request.source.size(), a_request.sourceName.c_str(), defines.data(),
+			D3D_COMPILE_STANDARD_FILE_INCLUDE, a_request.entryPoint.c_str(), a_request.profile.c_str(), a_request.flags, 0, &shaderBlob, &errorBlob);
+
+		Protocol::Response response;
+		response.id = a_request.id;
+		response.succeeded = SUCCEEDED(result) && shaderBlob;
+		if (shaderBlob) {
+			response.blob.assign(static_cast<const char*>(shaderBlob->GetBufferPointer()), shaderBlob->GetBufferSize());
+			shaderBlob->Release();
+		}
+		if (errorBlob) {
+			response.errors.assign(static_cast<const char*>(errorBlob->GetBufferPointer()), errorBlob->GetBufferSize());
+			errorBlob->Release();
+		}
+		return response;
+	}
+#endif
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+#ifndef _WIN32
+	options.standIn = true;
+#endif
+	for (int i = 1; i < argc; i++) {
+		const std::string_view arg = argv[i];
+		if (arg == "--stand-in") {
+			options.standIn = true;
+		} else if (arg == "--delay" && i + 1 < argc) {
+			options.delayMs = std::atoi(argv[++i]);
+		} else if (arg == "--fail-on" && i + 1 < argc) {
+			options.failOn = argv[++i];
+		} else if (arg == "--crash-on" && i + 1 < argc) {
+			options.crashOn = argv[++i];
+		} else {
+			std::fprintf(stderr, "usage: %s [--stand-in] [--delay ms] [--fail-on text] [--crash-on text]\n", argv[0]);
+			return 2;
+		}
+	}
+
+#ifdef _WIN32
+	_setmode(_fileno(stdin), _O_BINARY);
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+	std::string payload;
+	while (true) {
+		char header[4];
+		if (!ReadExact(header, sizeof(header)))
+			return 0;  // the plugin closed the pipe
+		const auto size = Protocol::ReadLength(header);
+		if (size > Protocol::MaxMessageSize)
+			return 1;
+		payload.resize(size);
+		if (!ReadExact(payload.data(), size))
+			return 1;
+
+		Protocol::Request request;
+		if (!Protocol::Deserialize(payload, request))
+			return 1;
+
+#ifdef _WIN32
+		const auto response = options.standIn ? CompileStandIn(request, options) : Compile(request);
+#else
+		const auto response = CompileStandIn(request, options);
+#endif
+		if (!WriteMessage(Protocol::Serialize(response)))
+			return 1;
+	}
+}
@@ -0,0 +1,275 @@
+// Tests the plugin's compiler process pool (src/ShaderCompilerPool.h) against the stand-in compiler.
+//
+// The pool, the message framing and the protocol are the plugin's own; only the process is a POSIX
+// stand-in for the Windows pipes and process handles of src/ShaderCompilerProcess.cpp. The helper is
+// started with --delay, --fail-on and --crash-on to check that compile errors keep the process, that
+// crashes and hangs end it and a fresh one takes over, and that idle processes are reused.
+
+#include "ShaderCompilerPool.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <string>
+#include <string_view>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace Protocol = SIE::ShaderCompilerProtocol;
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+	using Protocol::ReadStatus;
+
+	struct Process
+	{
+		pid_t pid = -1;
+		int input = -1;   // write end of the helper's stdin
+		int output = -1;  // read end of the helper's stdout
+
+		~Process()
+		{
+			if (input >= 0)
+				close(input);
+			if (output >= 0)
+				close(output);
+			if (pid > 0) {
+				kill(pid, SIGKILL);
+				waitpid(pid, nullptr, 0);
+			}
+		}
+
+		bool Write(std::string_view a_data)
+		{
+			size_t offset = 0;
+			while (offset < a_data.size()) {
+				const auto written = write(input, a_data.data() + offset, a_data.size() - offset);
+				if (written < 0 && errno == EINTR)
+					continue;
+				if (written <= 0)
+					return false;
+				offset += static_cast<size_t>(written);
+			}
+			return true;
+		}
+
+		ReadStatus Read(char* a_data, size_t a_size, Clock::time_point a_deadline)
+		{
+			size_t offset = 0;
+			while (offset < a_size) {
+				const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(a_deadline - Clock::now()).count();
+				pollfd descriptor{ output, POLLIN, 0 };
+				const int ready = poll(&descriptor, 1, static_cast<int>(std::max<int64_t>(remaining, 0)));
+				if (ready < 0 && errno == EINTR)
+					continue;
+				if (ready == 0)
+					return ReadStatus::TimedOut;
+				const auto read = ready > 0 ? ::read(output, a_data + offset, a_size - offset) : -1;
+				if (read <= 0)
+					return ReadStatus::Closed;
+				offset += static_cast<size_t>(read);
+			}
+			return ReadStatus::Ok;
+		}
+
+		static std::unique_ptr<Process> Start(const std::vector<std::string>& a_args)
+		{
+			int toChild[2];
+			int fromChild[2];
+			// close on exec, so helpers started concurrently do not keep each other's pipes open
+			if (pipe2(toChild, O_CLOEXEC) != 0)
+				return nullptr;
+			if (pipe2(fromChild, O_CLOEXEC) != 0) {
+				close(toChild[0]);
+				close(toChild[1]);
+				return nullptr;
+			}
+
+			std::vector<char*> argv{ const_cast<char*>(COMPILER_PATH) };
+			for (const auto& arg : a_args)
+				argv.push_back(const_cast<char*>(arg.c_str()));
+			argv.push_back(nullptr);
+
+			const pid_t pid = fork();
+			if (pid == 0) {
+				dup2(toChild[0], STDIN_FILENO);
+				dup2(fromChild[1], STDOUT_FILENO);
+				execv(COMPILER_PATH, argv.data());
+				_exit(127);
+			}
+			close(toChild[0]);
+			close(fromChild[1]);
+
+			auto process = std::make_unique<Process>();
+			process->pid = pid;
+			process->input = toChild[1];
+			process->output = fromChild[0];
+			if (pid < 0)
+				return nullptr;
+			return process;
+		}
+	};
+
+	using Pool = SIE::ShaderCompilerPool<Process>;
+
+	constexpr auto Timeout = std::chrono::milliseconds(5000);
+
+	int failures = 0;
+
+	void Check(bool a_condition, const char* a_test, const char* a_what)
+	{
+		if (!a_condition) {
+			std::printf("FAIL %s: %s\n", a_test, a_what);
+			failures++;
+		}
+	}
+
+	Protocol::Request MakeRequest(std::string a_source)
+	{
+		Protocol::Request request;
+		request.sourceName = "test.hlsl";
+		request.profile = "ps_5_0";
+		request.defines = { { "TEST", "1" } };
+		request.source = std::move(a_source);
+		return request;
+	}
+
+	bool Succeeded(const Pool::Result& a_result)
+	{
+		return a_result.status == Pool::Status::Completed && a_result.response.succeeded && a_result.response.blob.starts_with("STANDIN");
+	}
+
+	// Every request gets its own response while threads share the processes
+	void TestConcurrentRequests()
+	{
+		constexpr const char* test = "concurrent requests";
+		constexpr int threadCount = 4;
+		constexpr int requestsPerThread = 25;
+		Pool pool([]() { return Process::Start({ "--stand-in", "--delay", "5" }); });
+
+		std::mutex mutex;
+		std::vector<std::string> blobs(requestsPerThread);
+		int succeeded = 0;
+		bool deterministic = true;
+		std::vector<std::jthread> threads;
+		for (int t = 0; t < threadCount; t++) {
+			threads.emplace_back([&]() {
+				for (int i = 0; i < requestsPerThread; i++) {
+					const auto result = pool.Compile(MakeRequest("shader " + std::to_string(i)), Timeout);
+					std::scoped_lock lock(mutex);
+					if (!Succeeded(result))
+						continue;
+					succeeded++;
+					// the same request compiles to the same blob, so a response never went to the wrong request
+					if (blobs[i].empty())
+						blobs[i] = result.response.blob;
+					else if (blobs[i] != result.response.blob)
+						deterministic = false;
+				}
+			});
+		}
+		threads.clear();
+
+		Check(succeeded == threadCount * requestsPerThread, test, "every request succeeds");
+		Check(deterministic, test, "responses match their requests");
+		Check(blobs[0] != blobs[1], test, "different requests get different blobs");
+		Check(pool.GetStartCount() <= threadCount, test, "at most one process per thread");
+	}
+
+	// A compile error is an answer, the process keeps serving requests
+	void TestCompileError()
+	{
+		constexpr const char* test = "compile error";
+		Pool pool([]() { return Process::Start({ "--stand-in", "--fail-on", "FAIL" }); });
+
+		const auto failed = pool.Compile(MakeRequest("FAIL"), Timeout);
+		Check(failed.status == Pool::Status::Completed, test, "the failure is a response");
+		Check(!failed.response.succeeded && !failed.response.errors.empty(), test, "the response carries the errors");
+		Check(!failed.process, test, "the process is kept");
+		Check(Succeeded(pool.Compile(MakeRequest("fine"), Timeout)), test, "the next request succeeds");
+		Check(pool.GetStartCount() == 1, test, "the process is reused");
+	}
+
+	// A crash fails only its request, the next one starts a fresh process
+	void TestCrash()
+	{
+		constexpr const char* test = "crash";
+		Pool pool([]() { return Process::Start({ "--stand-in", "--crash-on", "CRASH" }); });
+
+		auto crashed = pool.Compile(MakeRequest("CRASH"), Timeout);
+		Check(crashed.status == Pool::Status::Stopped, test, "the request fails as stopped");
+		Check(crashed.process != nullptr, test, "the process is handed back to be ended");
+		crashed.process.reset();
+		Check(Succeeded(pool.Compile(MakeRequest("fine"), Timeout)), test, "the next request succeeds");
+		Check(pool.GetStartCount() == 2, test, "a fresh process was started");
+	}
+
+	// A hung compiler fails its request at the deadline instead of blocking the worker
+	void TestTimeout()
+	{
+		constexpr const char* test = "timeout";
+		Pool pool([]() { return Process::Start({ "--stand-in", "--delay", "1000" }); });
+
+		const auto start = Clock::now();
+		auto timedOut = pool.Compile(MakeRequest("slow"), std::chrono::milliseconds(50));
+		const auto elapsed = Clock::now() - start;
+		Check(timedOut.status == Pool::Status::TimedOut, test, "the request times out");
+		Check(elapsed < std::chrono::milliseconds(500), test, "the request returns at the deadline");
+		Check(timedOut.process != nullptr, test, "the process is handed back to be ended");
+		timedOut.process.reset();
+		Check(Succeeded(pool.Compile(MakeRequest("slow"), Timeout)), test, "the next request succeeds");
+		Check(pool.GetStartCount() == 2, test, "a fresh process was started");
+	}
+
+	// An idle process that exited is replaced without failing the request
+	void TestIdleProcessExited()
+	{
+		constexpr const char* test = "idle process exited";
+		std::mutex mutex;
+		std::vector<pid_t> pids;
+		Pool pool([&]() {
+			auto process = Process::Start({ "--stand-in" });
+			std::scoped_lock lock(mutex);
+			if (process)
+				pids.push_back(process->pid);
+			return process;
+		});
+
+		Check(Succeeded(pool.Compile(MakeRequest("first"), Timeout)), test, "the first request succeeds");
+		kill(pids.front(), SIGKILL);
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		Check(Succeeded(pool.Compile(MakeRequest("second"), Timeout)), test, "the request is retried on a fresh process");
+		Check(pool.GetStartCount() == 2, test, "a fresh process was started");
+
+		pool.Shutdown();
+		Check(Succeeded(pool.Compile(MakeRequest("third"), Timeout)), test, "requests after a shutdown succeed");
+		Check(pool.GetStartCount() == 3, test, "shutdown ends idle processes");
+	}
+}
+
+int main()
+{
+	std::signal(SIGPIPE, SIG_IGN);  // writing to a crashed helper fails with EPIPE instead
+
+	TestConcurrentRequests();
+	TestCompileError();
+	TestCrash();
+	TestTimeout();
+	TestIdleProcessExited();
+
+	if (failures) {
+		std::printf("%d checks failed\n", failures);
+		return 1;
+	}
+	std::printf("all checks passed\n");
+	return 0;
+}
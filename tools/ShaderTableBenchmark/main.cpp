@@ -0,0 +1,252 @@
+// Benchmarks the compiled shader tables of the shader cache (src/ShaderTable.h).
+//
+// Reader threads look up random shaders, like the render thread on every draw, while writer threads
+// insert them, like the compile workers during a compile storm. Once every shader is inserted the
+// writers stop and the readers keep looking up for a while, like a frame after compilation finished.
+// Each run is repeated with a mutex around a single map, the table the cache used before, for comparison.
+
+#include "ShaderTable.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	struct Shader
+	{
+		uint32_t descriptor = 0;
+	};
+
+	// The table before SIE::ShaderTable, every lookup locks
+	class MutexTable
+	{
+	public:
+		Shader* Find(uint32_t descriptor)
+		{
+			std::lock_guard lockGuard(mutex);
+			auto it = shaders.find(descriptor);
+			return it != shaders.end() ? it->second.get() : nullptr;
+		}
+
+		Shader* Insert(uint32_t descriptor, std::unique_ptr<Shader> shader)
+		{
+			std::lock_guard lockGuard(mutex);
+			return shaders.insert_or_assign(descriptor, std::move(shader)).first->second.get();
+		}
+
+		void Flush() {}
+		uint64_t GetPublishCount() const { return 0; }
+
+	private:
+		std::unordered_map<uint32_t, std::unique_ptr<Shader>> shaders;
+		std::mutex mutex;
+	};
+
+	struct Options
+	{
+		std::vector<uint32_t> readerCounts{ 1, 2 };
+		std::vector<uint32_t> writerCounts{ 1, 4, 8 };
+		uint32_t shaders = 20000;     // inserted per run
+		uint32_t compileUs = 0;       // time a writer spends per shader before inserting it
+		uint32_t steadyMs = 200;      // lookups after the last insert
+		uint32_t sampleInterval = 8;  // every this many lookups is timed
+		uint32_t seed = 1;
+	};
+
+	struct Result
+	{
+		double stormLookupsPerSecond = 0.0;
+		double steadyLookupsPerSecond = 0.0;
+		double insertsPerSecond = 0.0;
+		double p50Ns = 0.0;
+		double p99Ns = 0.0;
+		double maxNs = 0.0;
+		uint64_t publishes = 0;
+		uint64_t missing = 0;  // shaders not found once the table was flushed, must be 0
+	};
+
+	void Spin(uint32_t a_us)
+	{
+		const auto end = Clock::now() + std::chrono::microseconds(a_us);
+		while (a_us && Clock::now() < end) {}
+	}
+
+	template <class Table>
+	Result Run(const Options& a_options, uint32_t a_readers, uint32_t a_writers)
+	{
+		Table table;
+		std::atomic<bool> writing = true;
+		std::atomic<bool> reading = true;
+		std::atomic<uint32_t> nextShader = 0;
+		std::atomic<uint64_t> stormLookups = 0;
+		std::atomic<uint64_t> steadyLookups = 0;
+		std::vector<std::vector<uint32_t>> samples(a_readers);
+
+		std::vector<std::thread> readers;
+		for (uint32_t r = 0; r < a_readers; r++) {
+			readers.emplace_back([&, r]() {
+				std::mt19937 random(a_options.seed + r);
+				std::uniform_int_distribution<uint32_t> descriptor(0, a_options.shaders - 1);
+				auto& latencies = samples[r];
+				uint64_t lookups = 0;
+				volatile Shader* sink = nullptr;
+				while (writing.load(std::memory_order_relaxed)) {
+					const auto id = descriptor(random);
+					if (lookups++ % a_options.sampleInterval == 0) {
+						const auto begin = Clock::now();
+						sink = table.Find(id);
+						latencies.push_back(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin).count()));
+					} else
+						sink = table.Find(id);
+				}
+				stormLookups += lookups;
+
+				lookups = 0;
+				while (reading.load(std::memory_order_relaxed)) {
+					sink = table.Find(descriptor(random));
+					lookups++;
+				}
+				steadyLookups += lookups;
+				(void)sink;
+			});
+		}
+
+		const auto stormBegin = Clock::now();
+		std::vector<std::thread> writers;
+		for (uint32_t w = 0; w < a_writers; w++) {
+			writers.emplace_back([&]() {
+				for (uint32_t id = nextShader++; id < a_options.shaders; id = nextShader++) {
+					Spin(a_options.compileUs);
+					table.Insert(id, std::make_unique<Shader>(Shader{ id }));
+				}
+			});
+		}
+		for (auto& writer : writers)
+			writer.join();
+		table.Flush();  // the compile workers flush once the queue runs dry
+		const auto stormEnd = Clock::now();
+		writing = false;
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(a_options.steadyMs));
+		reading = false;
+		const auto steadyEnd = Clock::now();
+		for (auto& reader : readers)
+			reader.join();
+
+		Result result;
+		const double stormSeconds = std::chrono::duration<double>(stormEnd - stormBegin).count();
+		const double steadySeconds = std::chrono::duration<double>(steadyEnd - stormEnd).count();
+		result.stormLookupsPerSecond = stormLookups / stormSeconds;
+		result.steadyLookupsPerSecond = steadyLookups / steadySeconds;
+		result.insertsPerSecond = a_options.shaders / stormSeconds;
+		result.publishes = table.GetPublishCount();
+
+		std::vector<uint32_t> latencies;
+		for (auto& readerSamples : samples)
+			latencies.insert(latencies.end(), readerSamples.begin(), readerSamples.end());
+		if (!latencies.empty()) {
+			std::sort(latencies.begin(), latencies.end());
+			const auto at = [&](double a_percentile) { return static_cast<double>(latencies[std::min(latencies.size() - 1, static_cast<size_t>(a_percentile * latencies.size()))]); };
+			result.p50Ns = at(0.50);
+			result.p99Ns = at(0.99);
+			result.maxNs = latencies.back();
+		}
+
+		for (uint32_t id = 0; id < a_options.shaders; id++) {
+			const auto shader = table.Find(id);
+			if (!shader || shader->descriptor != id)
+				result.missing++;
+		}
+		return result;
+	}
+
+	void Print(const char* a_table, uint32_t a_readers, uint32_t a_writers, const Result& a_result)
+	{
+		std::printf("%-9s %7u %7u %12.2f %9.0f %9.0f %9.0f %12.0f %9llu %12.2f%s\n",
+			a_table, a_readers, a_writers, a_result.stormLookupsPerSecond / 1e6, a_result.p50Ns, a_result.p99Ns, a_result.maxNs,
+			a_result.insertsPerSecond, static_cast<unsigned long long>(a_result.publishes), a_result.steadyLookupsPerSecond / 1e6,
+			a_result.missing ? "  MISSING SHADERS" : "");
+	}
+
+	bool ParseList(char* a_list, std::vector<uint32_t>& a_values)
+	{
+		a_values.clear();
+		for (char* end = a_list; *a_list; a_list = end) {
+			const auto value = std::strtoul(a_list, &end, 10);
+			if (end == a_list || !value)
+				return false;
+			a_values.push_back(static_cast<uint32_t>(value));
+			if (*end == ',')
+				end++;
+		}
+		return !a_values.empty();
+	}
+
+	int Usage(const char* a_name)
+	{
+		std::fprintf(stderr,
+			"usage: %s [--readers 1,2] [--writers 1,4,8] [--shaders 20000] [--compile-us 0] [--steady-ms 200] [--seed 1]\n"
+			"  --readers     reader thread counts to run, comma separated\n"
+			"  --writers     writer thread counts to run, comma separated\n"
+			"  --shaders     shaders inserted per run\n"
+			"  --compile-us  time a writer spends per shader before inserting it\n"
+			"  --steady-ms   time the readers keep looking up after the last insert\n",
+			a_name);
+		return 1;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	for (int i = 1; i < argc; i++) {
+		const std::string_view arg = argv[i];
+		if (i + 1 >= argc)
+			return Usage(argv[0]);
+		if (arg == "--readers") {
+			if (!ParseList(argv[++i], options.readerCounts))
+				return Usage(argv[0]);
+		} else if (arg == "--writers") {
+			if (!ParseList(argv[++i], options.writerCounts))
+				return Usage(argv[0]);
+		} else if (arg == "--shaders")
+			options.shaders = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+		else if (arg == "--compile-us")
+			options.compileUs = std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--steady-ms")
+			options.steadyMs = std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--seed")
+			options.seed = std::strtoul(argv[++i], nullptr, 10);
+		else
+			return Usage(argv[0]);
+	}
+
+	std::printf("%u shaders per run, %u us per compile, lookup latency of every %uth lookup during the storm\n",
+		options.shaders, options.compileUs, options.sampleInterval);
+	std::printf("%-9s %7s %7s %12s %9s %9s %9s %12s %9s %12s\n",
+		"table", "readers", "writers", "storm Mlk/s", "p50 ns", "p99 ns", "max ns", "inserts/s", "publishes", "steady Mlk/s");
+
+	bool missing = false;
+	for (const auto readers : options.readerCounts) {
+		for (const auto writers : options.writerCounts) {
+			const auto snapshot = Run<SIE::ShaderTable<Shader>>(options, readers, writers);
+			Print("snapshot", readers, writers, snapshot);
+			const auto mutex = Run<MutexTable>(options, readers, writers);
+			Print("mutex", readers, writers, mutex);
+			missing |= snapshot.missing || mutex.missing;
+		}
+	}
+	return missing ? 1 : 0;
+}